@@ -205,7 +205,7 @@ for my $mutrate (split /,/, $mutrates) {
 		    warn "Estimated error model:\n", $errmod if $verbose >= 2;
 		}
 
-		my @dist;
+		my (@pairs, @ldpcpairs);
 		for my $rep (1..$reps) {
 		    warn "Starting repetition $rep of $reps\n" if $verbose;
 		    my $bitseq = randseq ([0,1], $bitseqlen);
@@ -244,10 +244,15 @@ for my $mutrate (split /,/, $mutrates) {
 		    
 		    warn "Length(bitseq)=", length($bitseq), " Length(decseq)=", length($decseq), "\n" if $verbose;
 		    
-		    my $dist = editDistance ($bitseq, $decseq);
-		    warn "Edit distance: $dist", defined($ldpcdir) ? (" (pre-LDPC: ", editDistance($encseq,$recseq), ")") : (), "\n" if $verbose;
-		    push @dist, $dist/$bitseqlen;
+		    push @pairs, [$bitseq, $decseq];
+		    push @ldpcpairs, [$encseq, $recseq];
 		}
+		my @dist = editDistances (@pairs);
+		my @ldpcdist = defined($ldpcdir) ? editDistances (@ldpcpairs) : ();
+		for my $rep (1..$reps) {
+		    warn "Repetition $rep edit distance: ", $dist[$rep-1], defined($ldpcdir) ? (" (pre-LDPC: ", $ldpcdist[$rep-1], ")") : (), "\n" if $verbose;
+		}
+		@dist = map ($_/$bitseqlen, @dist);
 		@dist = sort { $a <=> $b } @dist;
 		my $distmean = sum(@dist) / @dist;
 		my $distsd = sqrt (sum(map($_*$_,@dist)) / @dist - $distmean**2);
@@ -366,9 +371,14 @@ sub syswarn {
     return `$syscmd`;
 }
 
-# Calculate Levenshtein edit distance
-# (reimplemented as separate C++ program for speed)
-sub editDistance {
-    my ($x, $y) = @_;
-    return `$editdist "$x" "$y"` + 0;
+# Calculate Levenshtein edit distances of a list of [x,y] pairs
+# (a separate C++ program for speed, run once for the whole batch)
+sub editDistances {
+    my @pairs = @_;
+    my $pairfh = tempfile (SUFFIX => '.tsv');
+    print $pairfh map ("$_->[0]\t$_->[1]\n", @pairs);
+    close $pairfh;
+    my @dist = map ($_ + 0, split (/\n/, `$editdist - <$pairfh`));
+    die "Expected ", scalar(@pairs), " edit distances, got ", scalar(@dist) unless @dist == @pairs;
+    return @dist;
 }
@@ -0,0 +1,192 @@
+#include <set>
+#include "anchor.h"
+#include "parallel.h"
+#include "logger.h"
+
+ControlWordAnchors::ControlWordAnchors (const Machine& machine)
+  : machine (machine),
+    seedLen (DefaultAnchorSeedLen),
+    maxEdits (DefaultAnchorMaxEdits),
+    minSegmentLen (DefaultAnchorMinSegmentLen)
+{
+  map<string,size_t> wordIndex;
+  for (State s = 0; s < machine.nStates(); ++s) {
+    const MachineState& ms = machine.state[s];
+    if (ms.name.find ("Control(") != string::npos && !ms.leftContext.empty()
+	&& ms.leftContext.find (MachineWildContext) == string::npos) {
+      if (!wordIndex.count (ms.leftContext)) {
+	wordIndex[ms.leftContext] = word.size();
+	word.push_back (ms.leftContext);
+	wordStates.push_back (vguard<State>());
+      }
+      wordStates[wordIndex.at(ms.leftContext)].push_back (s);
+    }
+  }
+  LogThisAt(3,"Found " << plural(word.size(),"control word") << " to anchor reads: " << join(word) << endl);
+}
+
+// Aligns the whole word to the read, with the word's first base near diag and the read's ends free
+bool ControlWordAnchors::verify (const TokSeq& read, size_t w, Pos diag, ControlWordAnchor& anchor) const {
+  const TokSeq wordTok = validTokenize (word[w], dnaAlphabetString);
+  const Pos wordLen = wordTok.size(), readLen = read.size();
+  const Pos winStart = max (0, diag - maxEdits), winEnd = min (readLen, diag + wordLen + maxEdits);
+  if (winEnd <= winStart)
+    return false;
+  const Pos winLen = winEnd - winStart;
+  // cost & start of the best alignment of the first i word bases ending at window position j
+  vguard<vguard<int> > cost (wordLen + 1, vguard<int> (winLen + 1, 0));
+  vguard<vguard<Pos> > start (wordLen + 1, vguard<Pos> (winLen + 1, 0));
+  for (Pos j = 0; j <= winLen; ++j)
+    start[0][j] = j;
+  for (Pos i = 1; i <= wordLen; ++i) {
+    cost[i][0] = i;
+    start[i][0] = 0;
+    for (Pos j = 1; j <= winLen; ++j) {
+      int c = cost[i-1][j-1] + (wordTok[i-1] == read[winStart+j-1] ? 0 : 1);
+      Pos st = start[i-1][j-1];
+      if (cost[i-1][j] + 1 < c) {
+	c = cost[i-1][j] + 1;
+	st = start[i-1][j];
+      }
+      if (cost[i][j-1] + 1 < c) {
+	c = cost[i][j-1] + 1;
+	st = start[i][j-1];
+      }
+      cost[i][j] = c;
+      start[i][j] = st;
+    }
+  }
+  int best = maxEdits + 1;
+  for (Pos j = 1; j <= winLen; ++j)
+    if (cost[wordLen][j] < best) {
+      best = cost[wordLen][j];
+      anchor.start = winStart + start[wordLen][j];
+      anchor.end = winStart + j;
+    }
+  anchor.word = w;
+  anchor.edits = best;
+  return best <= maxEdits;
+}
+
+vguard<ControlWordAnchor> ControlWordAnchors::findAnchors (const FastSeq& read) const {
+  vguard<ControlWordAnchor> anchors;
+  if (word.empty() || read.length() < (SeqIdx) seedLen)
+    return anchors;
+
+  const TokSeq readTok = read.tokens (dnaAlphabetString);
+  const KmerIndex index (read, dnaAlphabetString, seedLen);
+  set<pair<Pos,size_t> > candidates;  // (diagonal, word)
+  for (size_t w = 0; w < word.size(); ++w) {
+    const TokSeq wordTok = validTokenize (word[w], dnaAlphabetString);
+    for (Pos offset = 0; offset + seedLen <= (Pos) wordTok.size(); ++offset) {
+      const auto iter = index.kmerLocations.find (makeKmer (seedLen, wordTok.begin() + offset, dnaAlphabetString.size()));
+      if (iter != index.kmerLocations.end())
+	for (SeqIdx pos: iter->second)
+	  candidates.insert (make_pair ((Pos) pos - offset, w));
+    }
+  }
+
+  // verify, keeping the best match for each stretch of the read
+  vguard<ControlWordAnchor> matches;
+  for (const auto& cand: candidates) {
+    ControlWordAnchor anchor;
+    if (verify (readTok, cand.second, cand.first, anchor)) {
+      if (!matches.empty() && anchor.start < matches.back().end) {
+	ControlWordAnchor& prev = matches.back();
+	if (prev.word != anchor.word)
+	  prev.edits = maxEdits + 1;  // two different words: not confident
+	else if (anchor.edits < prev.edits)
+	  prev = anchor;
+      } else
+	matches.push_back (anchor);
+    }
+  }
+
+  Pos lastCut = 0;
+  for (const auto& anchor: matches)
+    if (anchor.edits <= maxEdits && anchor.end - lastCut >= minSegmentLen && anchor.end < (Pos) read.length()) {
+      anchors.push_back (anchor);
+      lastCut = anchor.end;
+    }
+  LogThisAt(4,"Read " << read.name << ": " << plural(matches.size(),"control word match","control word matches") << ", " << plural(anchors.size(),"anchor") << endl);
+  return anchors;
+}
+
+vguard<FastSeq> decodeFastSeqs (const char* filename, const ControlWordAnchors& anchors, const MutatorParams& mutatorParams, size_t nThreads) {
+  return decodeFastSeqs (readFastSeqs (filename), anchors, mutatorParams, nThreads);
+}
+
+vguard<FastSeq> decodeFastSeqs (const vguard<FastSeq>& outseqs, const ControlWordAnchors& anchors, const MutatorParams& mutatorParams, size_t nThreads) {
+  const Machine& machine = anchors.machine;
+  const InputModel inmod = viterbiInputModel (machine, mutatorParams);
+  MutatorParams segmentParams (mutatorParams);
+  segmentParams.local = false;  // segment ends are set explicitly
+
+  vguard<State> allStates;
+  for (State s = 0; s < machine.nStates(); ++s)
+    allStates.push_back (s);
+  const vguard<State> firstStates = mutatorParams.local ? allStates : vguard<State> (1, machine.startState());
+  const vguard<State> lastStates = mutatorParams.local ? allStates : vguard<State> (1, machine.nStates() - 1);
+
+  // segments of all reads
+  struct Segment {
+    size_t read;
+    FastSeq seq;
+    const vguard<State> *startStates, *endStates;
+    string trace;
+    bool ok;
+  };
+  vguard<Segment> segment;
+  vguard<size_t> readFirstSegment;
+  for (size_t r = 0; r < outseqs.size(); ++r) {
+    readFirstSegment.push_back (segment.size());
+    const FastSeq& outseq = outseqs[r];
+    const vguard<ControlWordAnchor> readAnchors = anchors.findAnchors (outseq);
+    Pos segStart = 0;
+    const vguard<State>* startStates = &firstStates;
+    for (size_t a = 0; a <= readAnchors.size(); ++a) {
+      const bool last = a == readAnchors.size();
+      const Pos segEnd = last ? outseq.length() : readAnchors[a].end;
+      Segment seg;
+      seg.read = r;
+      seg.seq.name = outseq.name + "/" + to_string(segStart+1) + "-" + to_string(segEnd);
+      seg.seq.seq = outseq.seq.substr (segStart, segEnd - segStart);
+      seg.startStates = startStates;
+      seg.endStates = last ? &lastStates : &anchors.wordStates[readAnchors[a].word];
+      seg.ok = false;
+      segment.push_back (seg);
+      startStates = seg.endStates;
+      segStart = segEnd;
+    }
+  }
+  readFirstSegment.push_back (segment.size());
+  LogThisAt(3,"Decoding " << plural(outseqs.size(),"read") << " in " << plural(segment.size(),"segment") << endl);
+
+  parallelFor (segment.size(), nThreads, [&] (size_t begin, size_t end) {
+      for (size_t n = begin; n < end; ++n) {
+	Segment& seg = segment[n];
+	ViterbiMatrix vit (machine, inmod, segmentParams, seg.seq, *seg.startStates, *seg.endStates);
+	seg.ok = vit.loglike() > -numeric_limits<double>::infinity();
+	if (seg.ok)
+	  seg.trace = vit.traceback();
+      }
+    }, 1);
+
+  vguard<FastSeq> inseqs;
+  for (size_t r = 0; r < outseqs.size(); ++r) {
+    FastSeq inseq;
+    inseq.name = outseqs[r].name;
+    bool ok = true;
+    for (size_t n = readFirstSegment[r]; n < readFirstSegment[r+1]; ++n) {
+      ok = ok && segment[n].ok;
+      inseq.seq += segment[n].trace;
+    }
+    if (!ok) {
+      LogThisAt(3,"Couldn't decode " << outseqs[r].name << " in segments; decoding it whole" << endl);
+      ViterbiMatrix vit (machine, inmod, mutatorParams, outseqs[r]);
+      inseq.seq = vit.traceback();
+    }
+    inseqs.push_back (inseq);
+  }
+  return inseqs;
+}
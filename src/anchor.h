@@ -0,0 +1,45 @@
+#ifndef ANCHOR_INCLUDED
+#define ANCHOR_INCLUDED
+
+#include "viterbi.h"
+
+#define DefaultAnchorSeedLen       8
+#define DefaultAnchorMaxEdits      1
+#define DefaultAnchorMinSegmentLen 64
+
+// A control word found in a read: bases [start,end) of the read align to control word #word with this many edits
+struct ControlWordAnchor {
+  Pos start, end;
+  size_t word;
+  int edits;
+};
+
+// Cuts reads at control words, so the pieces can be Viterbi-decoded independently.
+// The control words are the left contexts of the machine's Control(...) states, so composite machines work too
+// (every state built on a Control state is a possible anchor state). Words are located in a read by exact seeds of
+// seedLen bases, looked up in a KmerIndex of the read, and verified by edit distance within a band of maxEdits.
+// An anchor is kept if it has at most maxEdits edits, no different control word matches an overlapping stretch of
+// the read, and it leaves at least minSegmentLen bases since the previous cut.
+class ControlWordAnchors {
+public:
+  const Machine& machine;
+  vguard<string> word;
+  vguard<vguard<State> > wordStates;  // states whose left context is each word
+  Pos seedLen;
+  int maxEdits;
+  Pos minSegmentLen;
+
+  ControlWordAnchors (const Machine& machine);
+
+  vguard<ControlWordAnchor> findAnchors (const FastSeq& read) const;
+  bool verify (const TokSeq& read, size_t w, Pos diag, ControlWordAnchor& anchor) const;
+};
+
+// Viterbi-decode each sequence (in a FASTA file), decoding the segments between anchors in parallel.
+// The first and last segments start and end as a whole read would (according to mutatorParams.local);
+// a segment that ends at an anchor must end in one of its word's states, and the next segment starts in one of them.
+// If any segment has no valid path, the whole read is decoded in one piece.
+vguard<FastSeq> decodeFastSeqs (const char* filename, const ControlWordAnchors& anchors, const MutatorParams& mutatorParams, size_t nThreads);
+vguard<FastSeq> decodeFastSeqs (const vguard<FastSeq>& outseqs, const ControlWordAnchors& anchors, const MutatorParams& mutatorParams, size_t nThreads);
+
+#endif /* ANCHOR_INCLUDED */
@@ -0,0 +1,372 @@
+#include <limits>
+#include <numeric>
+#include "arithcode.h"
+#include "viterbi.h"
+#include "parallel.h"
+#include "logger.h"
+
+ArithmeticCode::ArithmeticCode (TransBuilder& builder)
+  : spectralRadius (0),
+    len (builder.len)
+{
+  Require (builder.nControlWords == 0, "Arithmetic code doesn't support control words");
+  builder.prepare();
+  findCodeKmers (builder);
+  findFrequencies (builder.nThreads);
+  LogThisAt(2,"Arithmetic code over " << codeKmer.size() << " " << len << "-mers starts at " << kmerString(startKmer(),len)
+	    << "; capacity " << capacity() << " bits/base" << endl);
+}
+
+// Starts from the builder's pruned graph, then repeatedly drops kmers that can't reach a branch
+// (a kmer with two or more out-edges), until every kmer can.
+void ArithmeticCode::findCodeKmers (const TransBuilder& builder) {
+  codeKmer = vguard<Kmer> (builder.kmers.begin(), builder.kmers.end());
+  codeOutFlags = vguard<EdgeFlags> (codeKmer.size());
+  for (size_t i = 0; i < codeKmer.size(); ++i)
+    codeOutFlags[i] = builder.kmerOutFlags[builder.candidateRank(codeKmer[i])];
+
+  const int shift = (len - 1) << 1;
+  while (true) {
+    const size_t n = codeKmer.size();
+    codeIndex = KmerBitmap (builder.maxKmer + 1);
+    for (Kmer kmer: codeKmer)
+      codeIndex.set (kmer);
+    codeIndex.indexRanks();
+
+    for (size_t i = 0; i < n; ++i) {
+      const Kmer prefix = (codeKmer[i] << 2) & builder.maxKmer;
+      for (Base b = 0; b < 4; ++b)
+	if (!isCodeKmer (prefix | b))
+	  codeOutFlags[i] &= ~(1 << b);
+    }
+
+    vguard<bool> live (n, false);
+    vguard<size_t> queue;
+    for (size_t i = 0; i < n; ++i)
+      if (builder.edgeFlagsToCount (codeOutFlags[i]) > 1) {
+	live[i] = true;
+	queue.push_back (i);
+      }
+    while (!queue.empty()) {
+      const Kmer kmer = codeKmer[queue.back()];
+      queue.pop_back();
+      const Kmer suffix = kmer >> 2;
+      const Base last = getBase (kmer, 1);
+      for (Base b = 0; b < 4; ++b) {
+	const Kmer src = suffix | (((Kmer) b) << shift);
+	if (isCodeKmer (src)) {
+	  const size_t si = kmerIndex (src);
+	  if (!live[si] && (codeOutFlags[si] & (1 << last))) {
+	    live[si] = true;
+	    queue.push_back (si);
+	  }
+	}
+      }
+    }
+
+    const size_t nLive = count (live.begin(), live.end(), true);
+    Require (nLive > 0, "Code graph has no branches, so can't encode anything");
+    if (nLive == n)
+      break;
+    LogThisAt(3,"Dropping " << plural(n - nLive,"kmer") << " that can't reach a branch" << endl);
+    size_t m = 0;
+    for (size_t i = 0; i < n; ++i)
+      if (live[i]) {
+	codeKmer[m] = codeKmer[i];
+	codeOutFlags[m] = codeOutFlags[i];
+	++m;
+      }
+    codeKmer.resize (m);
+    codeOutFlags.resize (m);
+  }
+}
+
+// Finds the Perron eigenvector by power iteration on the lazy matrix A+I (which also converges for periodic graphs),
+// then quantizes the max-entropic edge probabilities, giving every edge a frequency of at least 1.
+void ArithmeticCode::findFrequencies (size_t nThreads) {
+  const size_t n = codeKmer.size();
+  const size_t noIndex = numeric_limits<size_t>::max();
+  vguard<size_t> succ (4 * n, noIndex);
+  parallelFor (n, nThreads, [&] (size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+	const Kmer prefix = (codeKmer[i] << 2) & kmerMask(len);
+	for (Base b = 0; b < 4; ++b)
+	  if (codeOutFlags[i] & (1 << b))
+	    succ[4*i + b] = kmerIndex (prefix | b);
+      }
+    });
+
+  vguard<double> current (n, 1. / (double) n), next (n);
+  ProgressLog (plogEigen, 1);
+  plogEigen.initProgress ("Finding max-entropic edge probabilities");
+  size_t iter;
+  double delta = 1, total = 1;
+  for (iter = 0; iter < ArithEigenMaxIterations && delta > ArithEigenTolerance; ++iter) {
+    plogEigen.logProgress (min (1., log(delta) / log(ArithEigenTolerance)), "iteration %u, change %g", iter, delta);
+    parallelFor (n, nThreads, [&] (size_t begin, size_t end) {
+	for (size_t i = begin; i < end; ++i) {
+	  double x = current[i];
+	  for (size_t e = 4*i; e < 4*i + 4; ++e)
+	    if (succ[e] != noIndex)
+	      x += current[succ[e]];
+	  next[i] = x;
+	}
+      });
+    total = accumulate (next.begin(), next.end(), 0.);
+    delta = 0;
+    for (size_t i = 0; i < n; ++i) {
+      next[i] /= total;
+      delta += abs (next[i] - current[i]);
+    }
+    current.swap (next);
+  }
+  if (delta > ArithEigenTolerance)
+    Warn ("Perron eigenvector did not converge after %u iterations (change %g)", iter, delta);
+  else
+    LogThisAt(3,"Perron eigenvector converged after " << iter << " iterations" << endl);
+  spectralRadius = total - 1;  // the entries of current summed to 1 before the last iteration
+  Require (spectralRadius > 1, "Code graph has spectral radius %g, so can't encode anything", spectralRadius);
+
+  cumFreq = vguard<unsigned int> (5 * n, 0);
+  parallelFor (n, nThreads, [&] (size_t begin, size_t end) {
+      for (size_t i = begin; i < end; ++i) {
+	double norm = 0;
+	for (size_t e = 4*i; e < 4*i + 4; ++e)
+	  if (succ[e] != noIndex)
+	    norm += current[succ[e]];
+	unsigned int freq[4] = { 0, 0, 0, 0 };
+	unsigned int freqTot = 0;
+	Base maxBase = 0;
+	for (Base b = 0; b < 4; ++b) {
+	  const size_t j = succ[4*i + b];
+	  if (j != noIndex) {
+	    freq[b] = max (1U, (unsigned int) (current[j] / norm * ArithFreqTotal + .5));
+	    freqTot += freq[b];
+	    if (freq[b] > freq[maxBase])
+	      maxBase = b;
+	  }
+	}
+	freq[maxBase] += ArithFreqTotal - freqTot;  // small correction for rounding
+	unsigned int* cf = cumFreq.data() + 5 * i;
+	for (Base b = 0; b < 4; ++b)
+	  cf[b+1] = cf[b] + freq[b];
+      }
+    });
+}
+
+// The message bits, followed by 1000..., are the binary expansion of a point in [0,1); at each step the base is chosen whose
+// subinterval contains it. Padding with 1 puts the point in the middle of the message's dyadic interval, not at its edge,
+// so the interval is guaranteed to fit inside once it is narrow enough.
+string ArithmeticCode::encodeBits (const vguard<bool>& bits) const {
+  const size_t nBits = bits.size();
+  size_t nextBit = 0;
+  auto readBit = [&] () -> CodeValue {
+    const size_t n = nextBit++;
+    return n < nBits ? bits[n] : (n == nBits);
+  };
+  CodeValue low = 0, high = ArithCodeTop, value = 0;
+  for (int n = 0; n < ArithCodeBits; ++n)
+    value = (value << 1) | readBit();
+  size_t nDetermined = 0, nPending = 0;  // leading bits of the interval that are fixed; underflow bits waiting on the next fixed bit
+  string seq;
+  Kmer kmer = startKmer();
+  while (nDetermined < nBits) {
+    const unsigned int* cf = kmerCumFreq (kmerIndex (kmer));
+    const CodeValue range = high - low + 1;
+    const CodeValue target = ((value - low + 1) * ArithFreqTotal - 1) / range;
+    Base base = 0;
+    while (cf[base+1] <= target)
+      ++base;
+    high = low + (range * cf[base+1]) / ArithFreqTotal - 1;
+    low = low + (range * cf[base]) / ArithFreqTotal;
+    while (true) {
+      if (high < ArithCodeHalf) {
+	nDetermined += 1 + nPending;
+	nPending = 0;
+      } else if (low >= ArithCodeHalf) {
+	nDetermined += 1 + nPending;
+	nPending = 0;
+	low -= ArithCodeHalf;
+	high -= ArithCodeHalf;
+	value -= ArithCodeHalf;
+      } else if (low >= ArithCodeQuarter && high < ArithCodeHalf + ArithCodeQuarter) {
+	++nPending;
+	low -= ArithCodeQuarter;
+	high -= ArithCodeQuarter;
+	value -= ArithCodeQuarter;
+      } else
+	break;
+      low = low << 1;
+      high = (high << 1) | 1;
+      value = (value << 1) | readBit();
+    }
+    seq.push_back (baseToChar (base));
+    kmer = ((kmer << 2) | base) & kmerMask(len);
+  }
+  return seq;
+}
+
+vguard<bool> ArithmeticCode::decodeBits (const string& seq, size_t maxBits) const {
+  vguard<bool> bits;
+  size_t nPending = 0;
+  auto writeBit = [&] (bool bit) {
+    bits.push_back (bit);
+    for (; nPending > 0; --nPending)
+      bits.push_back (!bit);
+  };
+  CodeValue low = 0, high = ArithCodeTop;
+  Kmer kmer = startKmer();
+  for (size_t pos = 0; pos < seq.size() && bits.size() < maxBits; ++pos) {
+    const Base base = charToBase (seq[pos]);
+    const unsigned int* cf = kmerCumFreq (kmerIndex (kmer));
+    if (cf[base] == cf[base+1]) {
+      Warn ("Can't decode '%c' at position %u: %s has no such edge in the code graph", seq[pos], pos + 1, kmerString(kmer,len).c_str());
+      break;
+    }
+    const CodeValue range = high - low + 1;
+    high = low + (range * cf[base+1]) / ArithFreqTotal - 1;
+    low = low + (range * cf[base]) / ArithFreqTotal;
+    while (true) {
+      if (high < ArithCodeHalf)
+	writeBit (false);
+      else if (low >= ArithCodeHalf) {
+	writeBit (true);
+	low -= ArithCodeHalf;
+	high -= ArithCodeHalf;
+      } else if (low >= ArithCodeQuarter && high < ArithCodeHalf + ArithCodeQuarter) {
+	++nPending;
+	low -= ArithCodeQuarter;
+	high -= ArithCodeQuarter;
+      } else
+	break;
+      low = low << 1;
+      high = (high << 1) | 1;
+    }
+    kmer = ((kmer << 2) | base) & kmerMask(len);
+  }
+  if (bits.size() > maxBits)
+    bits.resize (maxBits);
+  return bits;
+}
+
+void ArithmeticCode::encodeLength (size_t nBytes, vguard<bool>& bits) {
+  const unsigned long long n = nBytes + 1;
+  const int nDigits = 64 - __builtin_clzll (n);
+  for (int d = 1; d < nDigits; ++d)
+    bits.push_back (false);
+  for (int d = nDigits - 1; d >= 0; --d)
+    bits.push_back ((n >> d) & 1);
+}
+
+bool ArithmeticCode::decodeLength (const vguard<bool>& bits, size_t& nBytes, size_t& headerBits) {
+  size_t nZeros = 0;
+  while (nZeros < bits.size() && !bits[nZeros])
+    ++nZeros;
+  if (nZeros >= 64 || 2 * nZeros + 1 > bits.size())
+    return false;
+  unsigned long long n = 0;
+  for (size_t d = nZeros; d <= 2 * nZeros; ++d)
+    n = (n << 1) | bits[d];
+  nBytes = n - 1;
+  headerBits = 2 * nZeros + 1;
+  return true;
+}
+
+string ArithmeticCode::encodeBytes (const string& bytes) const {
+  vguard<bool> bits;
+  encodeLength (bytes.size(), bits);
+  for (unsigned char c: bytes)
+    for (int n = 0; n <= 7; ++n)
+      bits.push_back ((c >> n) & 1);
+  const string seq = encodeBits (bits);
+  LogThisAt(1,"Encoded " << plural(bytes.size(),"byte") << " as " << plural(seq.size(),"base") << ": "
+	    << (seq.empty() ? 0. : (8. * bytes.size() / (double) seq.size())) << " bits/base achieved, "
+	    << capacity() << " bits/base capacity" << endl);
+  return seq;
+}
+
+string ArithmeticCode::decodeBytes (const string& seq, vguard<bool>* messageBits) const {
+  const vguard<bool> bits = decodeBits (seq, numeric_limits<size_t>::max());
+  size_t nBytes = 0, headerBits = 0;
+  if (!decodeLength (bits, nBytes, headerBits)) {
+    Warn ("Sequence too short to decode message length");
+    return string();
+  }
+  const size_t nMessageBits = min (8 * nBytes, bits.size() - headerBits);
+  if (nMessageBits < 8 * nBytes)
+    Warn ("Sequence too short: decoded %s of %s", plural(nMessageBits,"bit").c_str(), plural(8*nBytes,"message bit").c_str());
+  if (messageBits)
+    messageBits->assign (bits.begin() + headerBits, bits.begin() + headerBits + nMessageBits);
+  string bytes;
+  for (size_t b = 0; b + 8 <= nMessageBits; b += 8) {
+    unsigned char c = 0;
+    for (int n = 0; n <= 7; ++n)
+      if (bits[headerBits + b + n])
+	c = c | (1 << n);
+    bytes.push_back (c);
+  }
+  LogThisAt(2,"Decoded " << plural(seq.size(),"base") << " to " << plural(bytes.size(),"byte") << endl);
+  return bytes;
+}
+
+Machine ArithmeticCode::viterbiMachine() const {
+  const size_t n = codeKmer.size();
+  const State endState = n + 1;
+  Machine machine;
+  machine.state = vguard<MachineState> (n + 2);
+
+  MachineState& start = machine.state.front();
+  start.name = "Start#0";
+  start.leftContext = string (len, MachineWildContext);
+  start.trans.push_back (MachineTransition (MachineSOF, MachineNull, kmerIndex(startKmer()) + 1));
+
+  for (size_t i = 0; i < n; ++i) {
+    MachineState& ms = machine.state[i + 1];
+    ms.name = "Code#" + to_string (i + 1);
+    ms.leftContext = kmerString (codeKmer[i], len);
+    const Kmer prefix = (codeKmer[i] << 2) & kmerMask(len);
+    for (Base b = 0; b < 4; ++b)
+      if (codeOutFlags[i] & (1 << b))
+	ms.trans.push_back (MachineTransition (MachineStrictQuat0 + b, baseToChar(b), kmerIndex(prefix | b) + 1));
+    ms.trans.push_back (MachineTransition (MachineEOF, MachineNull, endState));
+  }
+
+  MachineState& end = machine.state.back();
+  end.name = "End#" + to_string (endState);
+  end.leftContext = string (len, MachineWildContext);
+
+  return machine;
+}
+
+string ArithmeticCode::viterbiTracebackBases (const string& trace) {
+  string seq;
+  for (char c: trace)
+    if (c >= MachineStrictQuat0 && c <= MachineStrictQuat3)
+      seq.push_back (baseToChar (c - MachineStrictQuat0));
+  return seq;
+}
+
+vguard<FastSeq> decodeFastSeqs (const char* filename, const ArithmeticCode& code, const MutatorParams& mutatorParams) {
+  return decodeFastSeqs (readFastSeqs (filename), code, mutatorParams);
+}
+
+vguard<FastSeq> decodeFastSeqs (const vguard<FastSeq>& outseqs, const ArithmeticCode& code, const MutatorParams& mutatorParams) {
+  vguard<FastSeq> inseqs;
+  MutatorParams globalParams (mutatorParams);
+  globalParams.local = false;  // the arithmetic decoder needs the whole path from the start kmer
+  const Machine machine = code.viterbiMachine();
+  // Under the max-entropic edge probabilities, all paths of the same length are (up to end effects) equally likely,
+  // so every base can be given the same weight
+  const string inAlph = string() + MachineSOF + MachineEOF + MachineStrictQuat0 + MachineStrictQuat1 + MachineStrictQuat2 + MachineStrictQuat3;
+  const InputModel inmod (inAlph);
+  for (auto& outseq: outseqs) {
+    ViterbiMatrix vit (machine, inmod, globalParams, outseq);
+    vguard<bool> bits;
+    code.decodeBytes (ArithmeticCode::viterbiTracebackBases (vit.traceback()), &bits);
+    FastSeq inseq;
+    inseq.name = outseq.name;
+    inseq.seq = to_string_join (bits, "");
+    inseqs.push_back (inseq);
+  }
+  return inseqs;
+}
@@ -0,0 +1,83 @@
+#ifndef ARITHCODE_INCLUDED
+#define ARITHCODE_INCLUDED
+
+#include <string>
+#include "vguard.h"
+#include "kmer.h"
+#include "trans.h"
+#include "builder.h"
+#include "mutator.h"
+#include "fastseq.h"
+
+using namespace std;
+
+// Edge frequencies are quantized to integers summing to ArithFreqTotal at every kmer
+#define ArithFreqBits  16
+#define ArithFreqTotal (1U << ArithFreqBits)
+
+// Coder interval registers (Witten-Neal-Cleary layout, with underflow bits held pending)
+#define ArithCodeBits     32
+#define ArithCodeTop      ((1ULL << ArithCodeBits) - 1)
+#define ArithCodeHalf     (1ULL << (ArithCodeBits - 1))
+#define ArithCodeQuarter  (1ULL << (ArithCodeBits - 2))
+
+// Convergence criteria for the Perron eigenvector (L1 change per iteration)
+#define ArithEigenTolerance     1e-12
+#define ArithEigenMaxIterations 1000000
+
+// Arithmetic code over the constrained de Bruijn graph built by TransBuilder.
+// Rather than assigning whole bits to branches, as TransBuilder::makeMachine does, the encoder runs an arithmetic
+// decoder over the message bits, choosing each base with the max-entropic (Parry) edge probabilities
+// P(i->j) = v_j / (lambda * v_i), where v is the right Perron eigenvector of the graph and lambda its spectral radius.
+// This approaches the graph's capacity of log2(lambda) bits per base.
+// The sequence starts (without emitting it) at the first code kmer, as the machine does when there is no start control word.
+// The message is the byte count (Elias gamma code of count+1) followed by the bytes, LSB first; the encoder stops as soon
+// as the bases emitted so far determine every message bit, and the decoder runs the matching arithmetic encoder.
+// Control words are not supported. Kmers from which the walk can't reach a branch are dropped,
+// so the walk never gets stuck in a forced cycle.
+class ArithmeticCode {
+private:
+  typedef unsigned long long CodeValue;
+
+  vguard<Kmer> codeKmer;  // kmers of the code, in ascending order
+  KmerBitmap codeIndex;  // ranks kmers in codeKmer
+  vguard<EdgeFlags> codeOutFlags;  // by index in codeKmer
+  vguard<unsigned int> cumFreq;  // 5 per kmer, by index in codeKmer: cumulative frequencies of out-edges, in base order
+  double spectralRadius;
+
+  void findCodeKmers (const TransBuilder& builder);
+  void findFrequencies (size_t nThreads);
+
+  inline size_t kmerIndex (Kmer kmer) const { return codeIndex.rank (kmer); }
+  inline bool isCodeKmer (Kmer kmer) const { return codeIndex[kmer]; }
+  inline const unsigned int* kmerCumFreq (size_t index) const { return cumFreq.data() + 5 * index; }
+
+  static void encodeLength (size_t nBytes, vguard<bool>& bits);
+  static bool decodeLength (const vguard<bool>& bits, size_t& nBytes, size_t& headerBits);
+
+public:
+  const Pos len;
+
+  ArithmeticCode (TransBuilder& builder);  // calls builder.prepare()
+
+  inline double capacity() const { return log2 (spectralRadius); }  // bits per base
+  inline Kmer startKmer() const { return codeKmer.front(); }
+  inline size_t nKmers() const { return codeKmer.size(); }
+
+  string encodeBits (const vguard<bool>& bits) const;
+  vguard<bool> decodeBits (const string& seq, size_t maxBits) const;  // stops once maxBits are determined
+
+  string encodeBytes (const string& bytes) const;
+  string decodeBytes (const string& seq, vguard<bool>* messageBits = NULL) const;
+
+  // Code graph as a machine for ViterbiMatrix: each kmer's out-edges are labeled with the strict quaternary input
+  // for the base emitted, so the traceback spells the clean sequence. Every kmer has an EOF transition to the End state.
+  Machine viterbiMachine() const;
+  static string viterbiTracebackBases (const string& trace);
+};
+
+// Viterbi-decode each sequence (in a FASTA file) to its message bits (always with a global alignment)
+vguard<FastSeq> decodeFastSeqs (const char* filename, const ArithmeticCode& code, const MutatorParams& mutatorParams);
+vguard<FastSeq> decodeFastSeqs (const vguard<FastSeq>& outseqs, const ArithmeticCode& code, const MutatorParams& mutatorParams);
+
+#endif /* ARITHCODE_INCLUDED */
@@ -0,0 +1,64 @@
+#include <sys/resource.h>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cmath>
+#include "benchmark.h"
+#include "jsonutil.h"
+
+// On Linux, the high-water mark is read from /proc (as it can be reset there); elsewhere it comes from getrusage
+size_t peakResidentBytes() {
+  ifstream status ("/proc/self/status");
+  string line;
+  while (getline (status, line))
+    if (line.compare (0, 6, "VmHWM:") == 0)
+      return stoull (line.substr (6)) * 1024;  // kilobytes
+  struct rusage usage;
+  if (getrusage (RUSAGE_SELF, &usage) != 0)
+    return 0;
+#ifdef __APPLE__
+  return usage.ru_maxrss;  // bytes
+#else
+  return usage.ru_maxrss * 1024;  // kilobytes
+#endif
+}
+
+bool resetPeakResidentBytes() {
+  ofstream clearRefs ("/proc/self/clear_refs");
+  clearRefs << "5" << flush;
+  return clearRefs.good();
+}
+
+BenchRecord& BenchRecord::set (const string& key, double value) {
+  ostringstream json;
+  if (isfinite (value) && value == floor (value) && fabs (value) < 1e15)
+    json << (long long) value;
+  else if (isfinite (value))
+    json << setprecision(6) << value;
+  else
+    json << "null";
+  field.push_back (make_pair (key, json.str()));
+  return *this;
+}
+
+BenchRecord& BenchRecord::set (const string& key, const string& value) {
+  field.push_back (make_pair (key, JsonUtil::quoteEscaped (value)));
+  return *this;
+}
+
+void BenchRecord::writeJSON (ostream& out) const {
+  out << "{";
+  for (size_t n = 0; n < field.size(); ++n)
+    out << (n ? ", " : "") << JsonUtil::quoteEscaped (field[n].first) << ": " << field[n].second;
+  out << "}";
+}
+
+void writeBenchJSON (ostream& out, const vguard<BenchRecord>& records) {
+  out << "[" << endl;
+  for (size_t n = 0; n < records.size(); ++n) {
+    out << " ";
+    records[n].writeJSON (out);
+    out << (n + 1 < records.size() ? "," : "") << endl;
+  }
+  out << "]" << endl;
+}
@@ -0,0 +1,51 @@
+#ifndef BENCHMARK_INCLUDED
+#define BENCHMARK_INCLUDED
+
+#include <chrono>
+#include <iostream>
+#include "vguard.h"
+
+using namespace std;
+
+// Wall-clock stopwatch, started on construction
+struct Stopwatch {
+  chrono::steady_clock::time_point start;
+
+  Stopwatch() : start (chrono::steady_clock::now()) { }
+  void reset() { start = chrono::steady_clock::now(); }
+  double seconds() const { return chrono::duration<double> (chrono::steady_clock::now() - start).count(); }
+};
+
+// Mean wall-clock seconds per repetition of a benchmark kernel.
+// op(reps) runs the kernel reps times; reps grows until one call of op takes at least minSeconds.
+template<class Op>
+double secondsPerRep (Op op, double minSeconds, size_t& reps) {
+  for (reps = 1; ; ) {
+    Stopwatch timer;
+    op (reps);
+    const double s = timer.seconds();
+    if (s >= minSeconds || reps >= (((size_t) 1) << 40))
+      return s / reps;
+    reps = s > 0 && s * 100 > minSeconds ? (size_t) (reps * 1.2 * minSeconds / s) + 1 : reps * 100;
+  }
+}
+
+// Peak resident set size of this process so far (or since the last reset), in bytes (0 if unknown)
+size_t peakResidentBytes();
+
+// Resets the peak to the current resident set size, where the OS allows it (Linux); returns false if it can't
+bool resetPeakResidentBytes();
+
+// One row of a benchmark table: a JSON object, with keys in the order they were set
+struct BenchRecord {
+  vguard<pair<string,string> > field;  // key, JSON-formatted value
+
+  BenchRecord& set (const string& key, double value);
+  BenchRecord& set (const string& key, const string& value);
+  void writeJSON (ostream& out) const;
+};
+
+// A JSON array of records, one per line
+void writeBenchJSON (ostream& out, const vguard<BenchRecord>& records);
+
+#endif /* BENCHMARK_INCLUDED */
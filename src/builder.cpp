@@ -1,5 +1,10 @@
 #include <iomanip>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
 #include "builder.h"
+#include "parallel.h"
+#include "metrics.h"
 
 vguard<int> TransBuilder::edgeFlagsToCountLookup ({ 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 });
 
@@ -14,173 +19,572 @@ TransBuilder::TransBuilder (Pos len)
     controlWordAtEnd (false),
     startAndEndUseSameControlWord (false),
     buildDelayedMachine (false),
-    kmerValid (maxKmer + 1)
+    nThreads (defaultThreads()),
+    nDroppedEdges (0),
+    reachTreeSeeded (false),
+    journalChanges (false)
 { }
 
+bool TransBuilder::isCandidate (Kmer kmer, Pos kmerLen) const {
+  return !endsWithMotif(kmer,kmerLen,excludedMotif,"excluded motif")
+    && !endsWithMotif(kmer,kmerLen,excludedMotifRevComp,"revcomp of excluded motif")
+    && !hasExactTandemRepeat(kmer,kmerLen,maxTandemRepeatLen)
+    && !hasExactLocalInvertedRepeat(kmer,kmerLen,2,maxTandemRepeatLen)
+    && !hasExactNonlocalInvertedRepeat(kmer,kmerLen,invertedRepeatLen,2);
+}
+
+bool TransBuilder::endsWithRepeat (Kmer kmer, Pos kmerLen) const {
+  return hasExactTandemRepeatAtEnd(kmer,kmerLen,maxTandemRepeatLen)
+    || hasExactLocalInvertedRepeatAtEnd(kmer,kmerLen,2,maxTandemRepeatLen)
+    || hasExactNonlocalInvertedRepeatAtEnd(kmer,kmerLen,invertedRepeatLen,2);
+}
+
+void TransBuilder::endsWithRepeat (const Kmer* kmer, Pos kmerLen, bool* result) const {
+  bool tandem[4], local[4], nonlocal[4];
+  hasExactTandemRepeatAtEnd<4> (kmer, kmerLen, maxTandemRepeatLen, tandem);
+  hasExactLocalInvertedRepeatAtEnd<4> (kmer, kmerLen, 2, maxTandemRepeatLen, local);
+  hasExactNonlocalInvertedRepeatAtEnd<4> (kmer, kmerLen, invertedRepeatLen, 2, nonlocal);
+  for (size_t n = 0; n < 4; ++n)
+    result[n] = tandem[n] || local[n] || nonlocal[n];
+}
+
+bool TransBuilder::endsWithExcludedMotif (Kmer kmer, Pos kmerLen) const {
+  return endsWithMotif(kmer,kmerLen,excludedMotif,"excluded motif")
+    || endsWithMotif(kmer,kmerLen,excludedMotifRevComp,"revcomp of excluded motif");
+}
+
 void TransBuilder::findCandidates() {
   ProgressLog (plogReps, 1);
   plogReps.initProgress ("Filtering %d-mer repeats", len);
+  const Pos prefixLen = min (len - 1, (Pos) CandidatePrefixLen);
+  vguard<Kmer> prefix;
+  if (prefixLen > 0)
+    extendCandidates (0, 0, prefixLen, prefix);
+  else
+    prefix.push_back (0);
+  vguard<vguard<Kmer> > found (prefix.size());
+  mutex plogMutex;
+  size_t nPrefixesDone = 0;
+  parallelFor (prefix.size(), nThreads, [&] (size_t begin, size_t end) {
+      for (size_t n = begin; n < end; ++n) {
+	extendCandidates (prefix[n], prefixLen, len, found[n]);
+	lock_guard<mutex> lock (plogMutex);
+	++nPrefixesDone;
+	plogReps.logProgress (nPrefixesDone / (double) prefix.size(), "prefix %llu/%llu", (unsigned long long) nPrefixesDone, (unsigned long long) prefix.size());
+      }
+    }, 1);
   kmers.clear();
-  for (Kmer kmer = 0; kmer <= maxKmer; ++kmer) {
-    plogReps.logProgress (kmer / (double) maxKmer, "sequence %llu/%llu", kmer, maxKmer);
-      
-    if (!endsWithMotif(kmer,len,excludedMotif,"excluded motif")
-	&& !endsWithMotif(kmer,len,excludedMotifRevComp,"revcomp of excluded motif")
-	&& !hasExactTandemRepeat(kmer,len,maxTandemRepeatLen)
-	&& !hasExactLocalInvertedRepeat(kmer,len,2,maxTandemRepeatLen)
-	&& !hasExactNonlocalInvertedRepeat(kmer,len,invertedRepeatLen,2)) {
-      LogThisAt(9,"Accepting " << kmerString(kmer,len) << endl);
-      kmerValid[kmer] = true;
+  for (const auto& f: found)
+    for (auto kmer: f) {
+      kmerValid.set (kmer);
       kmers.push_back (kmer);
     }
-  }
   const auto nKmersWithoutReps = kmers.size();
   LogThisAt(2,"Found " << nKmersWithoutReps << " candidate " << len << "-mers without repeats (" << setprecision(2) << 100*(double)nKmersWithoutReps/(1.+(double)maxKmer) << "%)" << endl);
 }
 
+// Depth-first extension of repeat-free prefixes, one base at a time, so only prefixes of candidates are visited.
+// Extensions of length extLen are appended to found, in ascending order.
+// Excluded motifs are only tested at full length, since (like the original scan) they only apply to the end of a kmer.
+// findCandidates() runs this on each prefix of length CandidatePrefixLen as a separate task, then concatenates the results.
+void TransBuilder::extendCandidates (Kmer prefix, Pos prefixLen, Pos extLen, vguard<Kmer>& found) const {
+  Kmer ext[4];
+  bool rejected[4];
+  for (Base b = 0; b < 4; ++b)
+    ext[b] = (prefix << 2) | b;
+  endsWithRepeat (ext, prefixLen + 1, rejected);
+  for (Base b = 0; b < 4; ++b) {
+    const Kmer seq = ext[b];
+    if (rejected[b]) {
+      if (LoggingAt(4))
+	endsWithRepeat (seq, prefixLen + 1);  // log the reason
+      continue;
+    }
+    if (prefixLen + 1 < extLen)
+      extendCandidates (seq, prefixLen + 1, extLen, found);
+    else if (extLen < len)
+      found.push_back (seq);
+    else if (!endsWithExcludedMotif (seq, len)) {
+      LogThisAt(9,"Accepting " << kmerString(seq,len) << endl);
+      found.push_back (seq);
+    }
+  }
+}
+
+// Sets up the rank index and per-kmer arrays over the candidates, and queues the candidates that are already dead ends.
+void TransBuilder::indexCandidates() {
+  candidateIndex = kmerValid;
+  candidateIndex.indexRanks();
+  candidateKmer = vguard<Kmer> (kmers.begin(), kmers.end());
+  const vguard<Kmer>& kmerVec = candidateKmer;
+  kmerDroppedFlags = vguard<EdgeFlags> (kmerVec.size(), 0);
+  kmerInDegree = vguard<unsigned char> (kmerVec.size());
+  kmerOutDegree = vguard<unsigned char> (kmerVec.size());
+  kmerParentBase = vguard<unsigned char> (kmerVec.size(), NoParentBase);
+  orphanMark = KmerBitmap (kmerVec.size());
+  parallelFor (kmerVec.size(), nThreads, [&] (size_t begin, size_t end) {
+      EdgeVector e;
+      for (size_t n = begin; n < end; ++n) {
+	kmerInDegree[n] = edgeFlagsToCount (incomingEdgeFlags (kmerVec[n], e));
+	kmerOutDegree[n] = edgeFlagsToCount (outgoingEdgeFlags (kmerVec[n], e));
+      }
+    });
+  deadEndQueue.clear();
+  for (size_t n = 0; n < kmerVec.size(); ++n)
+    if (kmerInDegree[n] == 0 || kmerOutDegree[n] == 0)
+      deadEndQueue.push_back (kmerVec[n]);
+  LogThisAt(3,"Indexed " << kmerVec.size() << " candidate " << len << "-mers in " << candidateIndex.bytes() << " bytes" << endl);
+}
+
+// The graph updates below maintain these invariants for every candidate kmer x (valid or not):
+//  kmerInDegree[x]  = number of valid kmers w with an undropped edge w->x
+//  kmerOutDegree[x] = number of valid non-source kmers y with an undropped edge x->y
+// A kmer whose count falls to zero is queued for pruneDeadEnds(),
+// and a kmer that loses its parent in the reachability tree is queued for pruneUnreachable().
+// Changes are journaled if journalChanges is set, and rollbackGraph() undoes them using the inverse operations
+// (validateKmer, restoreEdge, removeSourceKmer), which are not journaled.
+void TransBuilder::validateKmer (Kmer kmer) {
+  if (kmerValid[kmer])
+    return;
+  kmerValid.set (kmer);
+  EdgeVector in, out;
+  getOutgoing (kmer, out);
+  const EdgeFlags dropped = droppedEdgeFlags (kmer);
+  for (size_t n = 0; n < 4; ++n)
+    if (candidateIndex[out[n]] && !(dropped & (1 << n)))
+      ++kmerInDegree[candidateRank(out[n])];
+  if (!isSourceKmer (kmer)) {
+    getIncoming (kmer, in);
+    for (auto kmerIn: in)
+      if (candidateIndex[kmerIn] && !isDroppedEdge (kmerIn, kmer))
+	++kmerOutDegree[candidateRank(kmerIn)];
+  }
+}
+
+void TransBuilder::invalidateKmer (Kmer kmer) {
+  if (!kmerValid[kmer])
+    return;
+  recordChange (GraphInvalidateKmer, kmer);
+  EdgeVector in, out;
+  getOutgoing (kmer, out);
+  const EdgeFlags dropped = droppedEdgeFlags (kmer);
+  for (size_t n = 0; n < 4; ++n)
+    if (candidateIndex[out[n]] && !(dropped & (1 << n))) {
+      if (isTreeChild (kmer, out[n]))
+	orphanQueue.push_back (out[n]);
+      if (--kmerInDegree[candidateRank(out[n])] == 0)
+	deadEndQueue.push_back (out[n]);
+    }
+  kmerValid.reset (kmer);
+  if (!isSourceKmer (kmer)) {
+    getIncoming (kmer, in);
+    for (auto kmerIn: in)
+      if (candidateIndex[kmerIn] && !isDroppedEdge (kmerIn, kmer))
+	if (--kmerOutDegree[candidateRank(kmerIn)] == 0)
+	  deadEndQueue.push_back (kmerIn);
+  }
+}
+
+void TransBuilder::dropEdge (Kmer src, Kmer dest) {
+  if (isDroppedEdge (src, dest))
+    return;
+  recordChange (GraphDropEdge, src, dest);
+  if (kmerValid[src] && isTreeChild (src, dest))
+    orphanQueue.push_back (dest);
+  kmerDroppedFlags[candidateRank(src)] |= 1 << getBase(dest,1);
+  ++nDroppedEdges;
+  if (kmerValid[src] && candidateIndex[dest])
+    if (--kmerInDegree[candidateRank(dest)] == 0)
+      deadEndQueue.push_back (dest);
+  if (kmerValid[dest] && !isSourceKmer (dest))
+    if (--kmerOutDegree[candidateRank(src)] == 0)
+      deadEndQueue.push_back (src);
+}
+
+void TransBuilder::restoreEdge (Kmer src, Kmer dest) {
+  if (!isDroppedEdge (src, dest))
+    return;
+  kmerDroppedFlags[candidateRank(src)] &= ~(1 << getBase(dest,1));
+  --nDroppedEdges;
+  if (kmerValid[src] && candidateIndex[dest])
+    ++kmerInDegree[candidateRank(dest)];
+  if (kmerValid[dest] && !isSourceKmer (dest))
+    ++kmerOutDegree[candidateRank(src)];
+}
+
+// A source word becomes a root of the reachability tree, since edges into it are no longer followed.
+void TransBuilder::addSourceKmer (Kmer kmer) {
+  const bool wasSource = isSourceKmer (kmer);
+  if (!sourceMotif.insert (KmerLen (kmer, len)).second)
+    return;
+  recordChange (GraphAddSource, kmer);
+  if (kmerValid[kmer]) {
+    setParentBase (kmer, NoParentBase);
+    if (!wasSource) {
+      EdgeVector in;
+      getIncoming (kmer, in);
+      for (auto kmerIn: in)
+	if (candidateIndex[kmerIn] && !isDroppedEdge (kmerIn, kmer))
+	  if (--kmerOutDegree[candidateRank(kmerIn)] == 0)
+	    deadEndQueue.push_back (kmerIn);
+    }
+  }
+}
+
+void TransBuilder::removeSourceKmer (Kmer kmer) {
+  sourceMotif.erase (KmerLen (kmer, len));
+  if (kmerValid[kmer] && !isSourceKmer (kmer)) {
+    EdgeVector in;
+    getIncoming (kmer, in);
+    for (auto kmerIn: in)
+      if (candidateIndex[kmerIn] && !isDroppedEdge (kmerIn, kmer))
+	++kmerOutDegree[candidateRank(kmerIn)];
+  }
+}
+
+void TransBuilder::setParentBase (Kmer kmer, unsigned char base) {
+  unsigned char& parentBase = kmerParentBase[candidateRank(kmer)];
+  if (parentBase != base) {
+    recordChange (GraphSetParent, kmer, parentBase);
+    parentBase = base;
+  }
+}
+
+void TransBuilder::rollbackGraph (size_t journalSize) {
+  list<Kmer> restoredKmers;
+  while (graphJournal.size() > journalSize) {
+    const GraphChange change = graphJournal.back();
+    graphJournal.pop_back();
+    switch (change.type) {
+    case GraphInvalidateKmer:
+      validateKmer (change.kmer);
+      restoredKmers.push_back (change.kmer);
+      break;
+    case GraphDropEdge:
+      restoreEdge (change.kmer, change.other);
+      break;
+    case GraphAddSource:
+      removeSourceKmer (change.kmer);
+      break;
+    case GraphSetParent:
+      kmerParentBase[candidateRank(change.kmer)] = change.other;
+      break;
+    case GraphSeedTree:
+      reachTreeSeeded = change.other;
+      break;
+    default:
+      Abort ("Unknown graph change type %d", change.type);
+      break;
+    }
+  }
+  restoredKmers.sort();
+  kmers.merge (restoredKmers);
+  deadEndQueue.clear();
+  orphanQueue.clear();
+  LogThisAt(5,"Rolled back graph to " << kmers.size() << " " << len << "-mers" << endl);
+}
+
+void TransBuilder::removeInvalidKmers() {
+  kmers.remove_if ([&] (Kmer kmer) { return !kmerValid[kmer]; });
+}
+
+// Removes kmers that can't be reached from the source words (or, if there are none, from the first kmer).
+// The reachable kmers are found by breadth-first search, which also yields a spanning tree of them;
+// after that, as long as the tree's roots are the source words, only the subtrees that lose their parents are re-examined.
 void TransBuilder::pruneUnreachable() {
-  map<Kmer,Pos> dist;
+  vguard<Kmer> seeds;
   for (const auto& kl: sourceMotif)
-    if (kl.len == len)
-      doDFS (kl.kmer, dist);
-  if (kmers.size() && !dist.size())
-    doDFS (kmers.front(), dist);
+    if (kl.len == len && kmerValid[kl.kmer])
+      seeds.push_back (kl.kmer);
+  const bool seeded = !seeds.empty();
+  if (seeded && reachTreeSeeded) {
+    reattachOrphans();
+    return;
+  }
+  if (kmers.size() && !seeded)
+    seeds.push_back (kmers.front());
+  KmerBitmap reached (maxKmer + 1);
+  vguard<unsigned char> parentBase (candidateKmer.size(), NoParentBase);
+  const vguard<Kmer> reachedKmers = findReachable (seeds, reached, parentBase);
+  for (auto kmer: reachedKmers)
+    setParentBase (kmer, parentBase[candidateRank(kmer)]);
+  if (reachTreeSeeded != seeded) {
+    recordChange (GraphSeedTree, 0, reachTreeSeeded);
+    reachTreeSeeded = seeded;
+  }
   unsigned long long nDropped = 0;
   for (auto kmer: kmers)
-    if (!dist.count(kmer)) {
-      LogThisAt(6,"Dropping " << kmerString(kmer,len) << " as it was not seen in depth-first search" << endl);
-      kmerValid[kmer] = false;
+    if (!reached[kmer]) {
+      LogThisAt(6,"Dropping " << kmerString(kmer,len) << " as it was not seen in breadth-first search" << endl);
+      invalidateKmer (kmer);
       ++nDropped;
     }
+  orphanQueue.clear();
   if (nDropped) {
-    LogThisAt(4,"Dropped " << nDropped << " " << len << "-mers that were unreachable in depth-first search" << endl);
-    kmers.clear();
-    for (const auto& kd: dist)
-      kmers.push_back (kd.first);
+    LogThisAt(4,"Dropped " << nDropped << " " << len << "-mers that were unreachable in breadth-first search" << endl);
+    kmers.assign (reachedKmers.begin(), reachedKmers.end());
     pruneDeadEnds();
   } else
-    LogThisAt(5,"All " << kmers.size() << " " << len << "-mers were reached in depth-first search" << endl);
-}
-
-void TransBuilder::doDFS (Kmer kmer, map<Kmer,Pos>& distance) const {
-  EdgeVector nbr;
-  list<Kmer> kqueue;
-  list<Pos> kdist;
-  kqueue.push_back (kmer);
-  kdist.push_back (0);
-  while (!kqueue.empty()) {
-    kmer = kqueue.back();
-    const auto d = kdist.back();
-    LogThisAt(9,"Depth-first search: visiting " << kmerString(kmer,len) << endl);
-    kqueue.pop_back();
-    kdist.pop_back();
-    if (!distance.count(kmer)) {
-      distance[kmer] = d;
-      getOutgoing (kmer, nbr);
-      for (auto n: nbr)
-	if (kmerValid[n]
-	    && !endsWithMotif(n,len,sourceMotif)
-	    && !droppedEdge.count (pair<Kmer,Kmer> (kmer, n))
-	    && !distance.count(n)) {
-	  kqueue.push_back (n);
-	  kdist.push_back (d + 1);
+    LogThisAt(5,"All " << kmers.size() << " " << len << "-mers were reached in breadth-first search" << endl);
+}
+
+// Detaches the subtrees below the orphaned kmers, re-attaches as much of them as can be reached by an edge from
+// the rest of the tree, and removes the rest (along with any dead ends that leaves, which may orphan more kmers).
+void TransBuilder::reattachOrphans() {
+  unsigned long long nDropped = 0;
+  EdgeVector in, out;
+  while (!orphanQueue.empty()) {
+    vguard<Kmer> detached;
+    for (auto kmer: orphanQueue)
+      if (kmerValid[kmer] && !orphanMark[candidateRank(kmer)]) {
+	orphanMark.set (candidateRank(kmer));
+	detached.push_back (kmer);
+      }
+    orphanQueue.clear();
+    for (size_t n = 0; n < detached.size(); ++n) {
+      getOutgoing (detached[n], out);
+      for (auto kmerOut: out)
+	if (isTreeChild (detached[n], kmerOut) && !orphanMark[candidateRank(kmerOut)]) {
+	  orphanMark.set (candidateRank(kmerOut));
+	  detached.push_back (kmerOut);
 	}
     }
+    LogThisAt(6,"Re-attaching " << detached.size() << " detached " << len << "-mers to the reachability tree" << endl);
+
+    vguard<Kmer> frontier;
+    for (auto kmer: detached) {
+      getIncoming (kmer, in);
+      for (Base b = 0; b < 4; ++b)
+	if (candidateIndex[in[b]] && kmerValid[in[b]] && !orphanMark[candidateRank(in[b])] && !isDroppedEdge (in[b], kmer)) {
+	  orphanMark.reset (candidateRank(kmer));
+	  setParentBase (kmer, b);
+	  frontier.push_back (kmer);
+	  break;
+	}
+    }
+    while (!frontier.empty()) {
+      vguard<Kmer> next;
+      for (auto kmer: frontier) {
+	getOutgoing (kmer, out);
+	const EdgeFlags dropped = droppedEdgeFlags (kmer);
+	for (size_t b = 0; b < 4; ++b)
+	  if (candidateIndex[out[b]] && orphanMark[candidateRank(out[b])] && !(dropped & (1 << b))) {
+	    orphanMark.reset (candidateRank(out[b]));
+	    setParentBase (out[b], getBase(kmer,len));
+	    next.push_back (out[b]);
+	  }
+      }
+      frontier.swap (next);
+    }
+
+    unsigned long long nUnreached = 0;
+    for (auto kmer: detached)
+      if (orphanMark[candidateRank(kmer)]) {
+	orphanMark.reset (candidateRank(kmer));
+	LogThisAt(6,"Dropping " << kmerString(kmer,len) << " as it is no longer reachable" << endl);
+	invalidateKmer (kmer);
+	++nUnreached;
+      }
+    if (nUnreached) {
+      nDropped += nUnreached;
+      removeInvalidKmers();
+      pruneDeadEnds();
+    }
   }
+  if (nDropped)
+    LogThisAt(4,"Dropped " << nDropped << " " << len << "-mers that were no longer reachable" << endl);
+  else
+    LogThisAt(5,"All " << kmers.size() << " " << len << "-mers are still reachable" << endl);
 }
 
-set<Kmer> TransBuilder::kmersEndingWith (KmerLen motif) const {
-  set<Kmer> result;
-  for (auto kmer: kmers)
-    if (endsWithMotif(kmer,len,motif))
-      result.insert(kmer);
-  return result;
+// Level-synchronous breadth-first search from the seeds, following valid edges into non-source kmers.
+// Each frontier is expanded in parallel, and the next frontier is then collected serially.
+// Sets the reached kmers in the bitmap, and the first base of the kmer each was reached from in parentBase (by rank);
+// returns the reached kmers in ascending order (seeds included).
+vguard<Kmer> TransBuilder::findReachable (const vguard<Kmer>& seeds, KmerBitmap& reached, vguard<unsigned char>& parentBase) const {
+  vguard<Kmer> reachedKmers, frontier;
+  for (auto kmer: seeds)
+    if (!reached[kmer]) {
+      reached.set (kmer);
+      frontier.push_back (kmer);
+    }
+  while (!frontier.empty()) {
+    reachedKmers.insert (reachedKmers.end(), frontier.begin(), frontier.end());
+    vguard<EdgeFlags> newFlags (frontier.size());
+    parallelFor (frontier.size(), nThreads, [&] (size_t begin, size_t end) {
+	EdgeVector out;
+	for (size_t n = begin; n < end; ++n) {
+	  const EdgeFlags f = outgoingEdgeFlags (frontier[n], out);
+	  for (size_t b = 0; b < 4; ++b)
+	    if ((f & (1 << b)) && !reached[out[b]])
+	      newFlags[n] |= 1 << b;
+	}
+      });
+    vguard<Kmer> next;
+    EdgeVector out;
+    for (size_t n = 0; n < frontier.size(); ++n)
+      if (newFlags[n]) {
+	getOutgoing (frontier[n], out);
+	for (size_t b = 0; b < 4; ++b)
+	  if ((newFlags[n] & (1 << b)) && !reached[out[b]]) {
+	    reached.set (out[b]);
+	    parentBase[candidateRank(out[b])] = getBase (frontier[n], len);
+	    next.push_back (out[b]);
+	  }
+      }
+    frontier.swap (next);
+  }
+  sort (reachedKmers.begin(), reachedKmers.end());
+  return reachedKmers;
 }
 
+// Number of steps in which the motif can be reached from every kmer, by paths whose intermediate kmers
+// are neither source words nor end with the motif (or -1, if that takes maxSteps or more).
+// Works back from the motif one step at a time, keeping the set of kmers that can reach it as a bitmap over candidate ranks,
+// so each step is a parallel pass over the candidates.
 Pos TransBuilder::stepsToReach (KmerLen motif, int maxSteps) const {
-  set<Kmer> nbr = kmersEndingWith(motif);
-  EdgeVector in;
+  const size_t nWords = (candidateKmer.size() + 63) >> 6;
+  KmerBitmap nbr (candidateKmer.size()), passable (candidateKmer.size());
+  parallelFor (nWords, nThreads, [&] (size_t begin, size_t end) {
+      forRanksInWords (begin, end, [&] (size_t r) {
+	  const Kmer kmer = candidateKmer[r];
+	  if (kmerValid[kmer]) {
+	    if (endsWithMotif (kmer, len, motif))
+	      nbr.set (r);
+	    else if (!isSourceKmer (kmer))
+	      passable.set (r);
+	  }
+	});
+    });
   for (int steps = 0; steps < maxSteps; ++steps) {
-    if (nbr.size() == kmers.size())
+    if (nbr.count() == kmers.size())
       return steps;
-    set<Kmer> prev;
-    for (auto kmer: nbr)
-      if (!(endsWithMotif(kmer,len,sourceMotif) || endsWithMotif(kmer,len,motif))
-	  || steps == 0) {
-	getIncoming (kmer, in);
-	for (auto p: in)
-	  if (kmerValid[p])
-	    prev.insert (p);
-      }
-    nbr.swap (prev);
+    KmerBitmap prev (candidateKmer.size());
+    parallelFor (nWords, nThreads, [&] (size_t begin, size_t end) {
+	EdgeVector out;
+	forRanksInWords (begin, end, [&] (size_t r) {
+	    const Kmer kmer = candidateKmer[r];
+	    if (kmerValid[kmer]) {
+	      getOutgoing (kmer, out);
+	      for (auto kmerOut: out)
+		if (candidateIndex[kmerOut]) {
+		  const size_t rOut = candidateRank (kmerOut);
+		  if (nbr[rOut] && (steps == 0 || passable[rOut])) {
+		    prev.set (r);
+		    break;
+		  }
+		}
+	    }
+	  });
+      });
+    swap (nbr, prev);
   }
   return -1;
 }
 
-map<Kmer,list<Kmer> > TransBuilder::pathsTo (Kmer dest, int steps) const {
-  map<Kmer,list<Kmer> > pathFrom;
-  pathFrom[dest] = list<Kmer>();
-  EdgeVector in;
+// Kmers with paths of exactly the given number of steps to dest, following the same rules as stepsToReach().
+// Element [step] of the result is a bitmap (over candidate ranks) of the kmers that are (steps - step) steps from dest.
+vguard<KmerBitmap> TransBuilder::pathsTo (Kmer dest, int steps) const {
+  const size_t nWords = (candidateKmer.size() + 63) >> 6;
+  vguard<KmerBitmap> reaches (steps + 1, KmerBitmap (candidateKmer.size()));
+  reaches[steps].set (candidateRank (dest));
   for (int step = steps - 1; step >= 0; --step) {
-    map<Kmer,list<Kmer> > longerPathFrom;
-    for (auto interPath: pathFrom) {
-      const Kmer inter = interPath.first;
-      getIncoming (inter, in);
-      for (auto src: in)
-	if (kmerValid[src]
-	    && (!(endsWithMotif(src,len,sourceMotif) || src == dest)
-		|| step == 0))
-	  (longerPathFrom[src] = interPath.second).push_front (inter);
-    }
-    pathFrom.swap (longerPathFrom);
+    const KmerBitmap& next = reaches[step + 1];
+    KmerBitmap& current = reaches[step];
+    parallelFor (nWords, nThreads, [&] (size_t begin, size_t end) {
+	EdgeVector out;
+	forRanksInWords (begin, end, [&] (size_t r) {
+	    const Kmer kmer = candidateKmer[r];
+	    if (kmerValid[kmer] && (step == 0 || (kmer != dest && !isSourceKmer (kmer)))) {
+	      getOutgoing (kmer, out);
+	      for (auto kmerOut: out)
+		if (candidateIndex[kmerOut] && next[candidateRank(kmerOut)]) {
+		  current.set (r);
+		  break;
+		}
+	    }
+	  });
+      });
   }
-  return pathFrom;
+  return reaches;
+}
+
+// The next kmer on a path from pathsTo(). Where a path could go more than one way, it takes the kmer with the highest last base.
+Kmer TransBuilder::nextOnPath (Kmer kmer, const KmerBitmap& nextStep) const {
+  EdgeVector out;
+  getOutgoing (kmer, out);
+  for (int b = 3; b >= 0; --b)
+    if (candidateIndex[out[b]] && nextStep[candidateRank(out[b])])
+      return out[b];
+  Abort ("No path from %s", kmerString(kmer,len).c_str());
+  return 0;
 }
 
+// Removes queued kmers that have no incoming or no outgoing edges. Removing a kmer queues any neighbor it leaves
+// without edges, so this runs until there are no dead ends left, in time proportional to the number removed.
 void TransBuilder::pruneDeadEnds() {
-  ProgressLog (plogPrune, 3);
-  plogPrune.initProgress ("Pruning dead ends");
-  for (auto kmer: kmers)
-    pruneDeadEnds (kmer);
-  const unsigned long long nKmers = kmers.size();
-  unsigned long long nPruned = 0, nUnpruned = 0;
-  list<Kmer> unprunedKmers;
-  for (auto kmer: kmers) {
-    ++nPruned;
-    plogPrune.logProgress (nPruned / (double) nKmers, "sequence %llu/%llu", nPruned, nKmers);
-    if (kmerValid[kmer]) {
-      unprunedKmers.push_back (kmer);
-      ++nUnpruned;
+  unsigned long long nPruned = 0;
+  while (!deadEndQueue.empty()) {
+    const Kmer kmer = deadEndQueue.back();
+    deadEndQueue.pop_back();
+    if (isDeadEnd (kmer)) {
+      invalidateKmer (kmer);
+      ++nPruned;
     }
   }
-  LogThisAt(4,"Dead-end pruning removed " << (nPruned - nUnpruned) << " " << len << "-mers, leaving " << nUnpruned << endl);
-  kmers.swap (unprunedKmers);
+  if (nPruned)
+    removeInvalidKmers();
+  LogThisAt(4,"Dead-end pruning removed " << nPruned << " " << len << "-mers, leaving " << kmers.size() << endl);
 }
 
 void TransBuilder::assertKmersCorrect() const {
-  const set<Kmer> kmerSet (kmers.begin(), kmers.end());
-  for (Kmer kmer = 0; kmer <= maxKmer; ++kmer)
-    if (kmerValid[kmer])
-      Assert (kmerSet.count(kmer), "Missing kmer %s from kmer list", kmerString(kmer,len).c_str());
+  Assert (adjacent_find (kmers.begin(), kmers.end(), greater_equal<Kmer>()) == kmers.end(), "Kmer list is not in ascending order, or has duplicates");
   for (Kmer kmer: kmers)
     Assert (kmerValid[kmer], "Invalid kmer %s in kmer list", kmerString(kmer,len).c_str());
+  Assert (kmerValid.count() == kmers.size(), "Missing %llu kmers from kmer list", kmerValid.count() - kmers.size());
+  EdgeVector e;
+  for (Kmer kmer: kmers) {
+    Assert (countIncoming(kmer) == edgeFlagsToCount (incomingEdgeFlags (kmer, e)), "In-degree of %s is out of date", kmerString(kmer,len).c_str());
+    Assert (countOutgoing(kmer) == edgeFlagsToCount (outgoingEdgeFlags (kmer, e)), "Out-degree of %s is out of date", kmerString(kmer,len).c_str());
+    if (reachTreeSeeded) {
+      const unsigned char parentBase = kmerParentBase[candidateRank(kmer)];
+      if (parentBase == NoParentBase)
+	Assert (isSourceKmer(kmer), "Kmer %s has no parent in the reachability tree", kmerString(kmer,len).c_str());
+      else {
+	getIncoming (kmer, e);
+	Assert (kmerValid[e[parentBase]] && !isDroppedEdge (e[parentBase], kmer), "Kmer %s has a bad parent in the reachability tree", kmerString(kmer,len).c_str());
+      }
+    }
+  }
 }
 
 void TransBuilder::buildEdges() {
   LogThisAt(1,"Building edge graph for " << kmers.size() << " " << len << "-mers" << endl);
+  const vguard<Kmer> kmerVec (kmers.begin(), kmers.end());
+  vguard<EdgeFlags> kmerVecOutFlags (kmerVec.size());
+  parallelFor (kmerVec.size(), nThreads, [&] (size_t begin, size_t end) {
+      EdgeVector out;
+      for (size_t n = begin; n < end; ++n)
+	kmerVecOutFlags[n] = outgoingEdgeFlags (kmerVec[n], out);
+    });
+  // A kmer's outgoing flags depend only on edges dropped from that kmer, so they can all be computed up front;
+  // but each dropped edge changes the in-degrees that later choices depend on, so dropping is serial.
+  kmerOutFlags = vguard<EdgeFlags> (candidateKmer.size(), 0);
   EdgeVector out;
-  for (auto kmer: kmers) {
-    EdgeFlags outFlags = outgoingEdgeFlags(kmer,out);
+  for (size_t n = 0; n < kmerVec.size(); ++n) {
+    const Kmer kmer = kmerVec[n];
+    EdgeFlags outFlags = kmerVecOutFlags[n];
+    getOutgoing (kmer, out);
     if (edgeFlagsToCount(outFlags) > 2 && !keepDegenerates) {
       if ((outFlags & PurineFlags) == PurineFlags)
 	outFlags = dropWorseEdge (kmer, outFlags, out, AdenineBase, GuanineBase);
       if ((outFlags & PyrimidineFlags) == PyrimidineFlags)
 	outFlags = dropWorseEdge (kmer, outFlags, out, CytosineBase, ThymineBase);
     }
-    kmerOutFlags[kmer] = outFlags;
+    kmerOutFlags[candidateRank(kmer)] = outFlags;
   }
   if (!keepDegenerates)
-    LogThisAt(2,"Dropped " << droppedEdge.size() << " degenerate transitions" << endl);
+    LogThisAt(2,"Dropped " << nDroppedEdges << " degenerate transitions" << endl);
   pruneUnreachable();
 }
 
@@ -194,28 +598,39 @@ void TransBuilder::indexStates() {
     nStates++;
   if (isStartControlIndex(0) && isEndControlIndex(0))
     ++nStates;
+  // a state of zero (the start state) means none has been assigned yet
+  kmerState = vguard<State> (candidateKmer.size(), 0);
+  kmerStateZero = vguard<State> (candidateKmer.size(), 0);
+  kmerStateOne = vguard<State> (candidateKmer.size(), 0);
   for (auto kmer: controlWord)
-    kmerState[kmer] = nStates++;
+    kmerState[candidateRank(kmer)] = nStates++;
   for (auto kmer: kmers)
-    if (!kmerState.count(kmer) && endsWithMotif(kmer,len,sourceMotif))
-      kmerState[kmer] = nStates++;
+    if (!codeState(kmer) && endsWithMotif(kmer,len,sourceMotif))
+      kmerState[candidateRank(kmer)] = nStates++;
   firstNonControlState = nStates;
   for (auto kmer: kmers)
-    if (!kmerState.count(kmer))
-      kmerState[kmer] = nStates++;
-  for (auto kmer: kmers) {
-    const auto nOut = countOutgoing(kmer);
+    if (!codeState(kmer))
+      kmerState[candidateRank(kmer)] = nStates++;
+  const vguard<Kmer> kmerVec (kmers.begin(), kmers.end());
+  vguard<int> kmerVecOutCount (kmerVec.size());
+  parallelFor (kmerVec.size(), nThreads, [&] (size_t begin, size_t end) {
+      for (size_t n = begin; n < end; ++n)
+	kmerVecOutCount[n] = countOutgoing (kmerVec[n]);
+    });
+  for (size_t n = 0; n < kmerVec.size(); ++n) {
+    const auto nOut = kmerVecOutCount[n];
     if (nOut > 2)
-      kmerStateZero[kmer] = nStates++;
+      kmerStateZero[candidateRank(kmerVec[n])] = nStates++;
     if (nOut > 3)
-      kmerStateOne[kmer] = nStates++;
+      kmerStateOne[candidateRank(kmerVec[n])] = nStates++;
   }
   for (size_t c = 0; c < nControlWords; ++c) {
-    vguard<map<Kmer,State> > ckState (controlWordSteps[c]);
-    for (Pos step = 0; step < controlWordSteps[c] - 1; ++step)
-      for (auto kmer: controlWordIntermediates[c][step])
-	ckState[step][kmer] = nStates++;
-    controlKmerState.push_back (ckState);
+    vguard<State> firstState (controlWordSteps[c]);
+    for (Pos step = 0; step < controlWordSteps[c] - 1; ++step) {
+      firstState[step] = nStates;
+      nStates += controlWordIntermediates[c][step].size();
+    }
+    controlStepFirstState.push_back (firstState);
   }
 
   if (buildDelayedMachine)
@@ -224,16 +639,45 @@ void TransBuilder::indexStates() {
   endState = nStates++;
 }
 
+void TransBuilder::runStage (const char* stage, const function<void()>& f) {
+  if (stageStarting)
+    stageStarting();
+  MetricsSpan span (metrics.timerId (string("build.") + stage, "kmers"));
+  const auto start = chrono::steady_clock::now();
+  f();
+  span.items = kmers.size();
+  BuildStageStats stats;
+  stats.stage = stage;
+  stats.seconds = chrono::duration<double> (chrono::steady_clock::now() - start).count();
+  stats.peakResidentBytes = 0;
+  stats.kmers = kmers.size();
+  if (stageFinished)
+    stageFinished (stats);
+  stageStats.push_back (stats);
+  LogThisAt(2,"Stage " << stage << " took " << stats.seconds << " seconds, leaving " << plural(stats.kmers,"kmer") << endl);
+}
+
 void TransBuilder::prepare() {
-  findCandidates();
-  pruneDeadEnds();
-  pruneUnreachable();
-  getControlWords();
-  buildEdges();
-  indexStates();
+  stageStats.clear();
+  runStage ("findCandidates", [&] () {
+      kmerValid = KmerBitmap (maxKmer + 1);
+      MetricCount ("bytesAllocated.kmerBitmap", kmerValid.bytes());
+      findCandidates();
+    });
+  runStage ("indexCandidates", [&] () {
+      indexCandidates();
+      MetricCount ("bytesAllocated.kmerBitmap", candidateIndex.bytes() + orphanMark.bytes());
+    });
+  runStage ("prune", [&] () {
+      pruneDeadEnds();
+      pruneUnreachable();
+    });
+  runStage ("getControlWords", [&] () { getControlWords(); });
+  runStage ("buildEdges", [&] () { buildEdges(); });
+  runStage ("indexStates", [&] () { indexStates(); });
 }
 
-Machine TransBuilder::makeMachine() {
+void TransBuilder::prepareStates() {
   if (buildDelayedMachine) {
     Require (len % 2 == 0, "Delayed machine must have even number of bases per word");
     Require (controlWordAtStart && controlWordAtEnd && nControlWords > 0, "Delayed machine must generate control words at start & end of encoded sequence");
@@ -241,195 +685,289 @@ Machine TransBuilder::makeMachine() {
 
   prepare();
 
-  Machine machine;
-  machine.state = vguard<MachineState> (nStates);
-
+  stateOrigin = vguard<BuilderStateOrigin> (nStates);
   if (controlWordAtStart) {
     const Pos p0 = buildDelayedMachine ? len/2 : 0;
     for (Pos p = p0; p < len; ++p) {
-      const State s = p - p0;
-      MachineState& ms = machine.state[s];
-      ms.leftContext = string(len-p,MachineWildContext) + kmerSubstring(startControlWord(),len-p+1,p);
-      ms.name = (s == 0 ? "Start#" : "Load(Start)#") + to_string(s);
-      ms.trans.push_back (MachineTransition (MachineNull, baseToChar(getBase(startControlWord(),len-p)), s+1));
+      BuilderStateOrigin& origin = stateOrigin[p - p0];
+      origin.role = StartStateRole;
+      origin.index = p;
     }
-  } else {
-    MachineState& ms = machine.state.front();
-    ms.leftContext = string(len,MachineWildContext);
-    ms.name = "Start#1";
-    ms.trans.push_back (MachineTransition (MachineNull, MachineNull, firstNonControlState));
-  }
-  
-  EdgeVector out;
-  vguard<char> outChar;
-  vguard<State> outState;
+  } else
+    stateOrigin.front().role = StartStateRole;
 
-  int nOut2 = 0, nOut3 = 0, nOut4 = 0;
+  // the outgoing bases of a code state are rotated among its inputs, in turn for all code states with the same number of outgoing bases
+  int nOut[5] = { 0, 0, 0, 0, 0 };
   for (auto kmer: kmers) {
-    const State s = kmerState.at(kmer);
-    MachineState& ms = machine.state[s];
-    ms.leftContext = kmerString(kmer,len);
-    
-    getOutgoing (kmer, out);
-    const EdgeFlags outFlags = kmerOutFlags.at(kmer);
-    outChar.clear();
-    outState.clear();
-    for (size_t n = 0; n < 4; ++n)
-      if (outFlags & (1 << n)) {
-	outChar.push_back (baseToChar(n));
-	outState.push_back (kmerState.at(out[n]));
-      }
-
-    ms.name = "Code";
-    if (endsWithMotif(kmer,len,sourceMotif)) {
-      ms.name = "Source";
-      for (size_t c = 0; c < controlWord.size(); ++c)
-	if (kmer == controlWord[c]) {
-	  if (isEndControlIndex(c))
-	    ms.name = string("Control(End)");
-	  else if (isStartControlIndex(c))
-	    ms.name = string("Control(Start)");
-	  else
-	    ms.name = string("Control(") + controlChar(c) + ")";
-	}
+    const size_t rank = candidateRank(kmer);
+    const int nOutBases = edgeFlagsToCountLookup[kmerOutFlags[rank] & 15];
+    BuilderStateOrigin origin;
+    origin.kmer = kmer;
+    origin.rotate = nOutBases > 1 ? (++nOut[nOutBases] % nOutBases) : 0;
+    origin.role = CodeStateRole;
+    stateOrigin[kmerState[rank]] = origin;
+    if (nOutBases > 2) {
+      origin.role = SplitZeroStateRole;
+      stateOrigin[kmerStateZero[rank]] = origin;
     }
-    ms.name += "#" + to_string(s);
-
-    if (outChar.size() == 1)
-      ms.trans.push_back (MachineTransition (MachineNull, outChar[0], outState[0]));
-
-    else if (outChar.size() == 2) {
-      const int rotate2 = (++nOut2 % 2);
-      const size_t i2 = rotate2, j2 = (rotate2 + 1) % 2;
-      ms.trans.push_back (MachineTransition (MachineBit0, outChar[i2], outState[i2]));
-      ms.trans.push_back (MachineTransition (MachineBit1, outChar[j2], outState[j2]));
-
-      ms.trans.push_back (MachineTransition (MachineFlush, MachineNull, s));
-
-      ms.trans.push_back (MachineTransition (MachineStrictBit0, outChar[i2], outState[i2]));
-      ms.trans.push_back (MachineTransition (MachineStrictBit1, outChar[j2], outState[j2]));
-
-    } else if (outChar.size() == 3) {
-      const int rotate3 = (++nOut3 % 3);
-      const size_t i3 = rotate3, j3 = (rotate3 + 1) % 3, k3 = (rotate3 + 2) % 3;
-      const State s0 = kmerStateZero.at(kmer);
-      ms.trans.push_back (MachineTransition (MachineBit0, MachineNull, s0));
-      ms.trans.push_back (MachineTransition (MachineBit1, outChar[k3], outState[k3]));
-
-      machine.state[s0].leftContext = kmerString(kmer,len);
-      machine.state[s0].name = string("Split0#") + to_string(s0);
-      machine.state[s0].trans.push_back (MachineTransition (MachineBit0, outChar[i3], outState[i3]));
-      machine.state[s0].trans.push_back (MachineTransition (MachineBit1, outChar[j3], outState[j3]));
-
-      ms.trans.push_back (MachineTransition (MachineFlush, MachineNull, s));
-      machine.state[s0].trans.push_back (MachineTransition (MachineFlush, outChar[i3], outState[i3]));
-
-      ms.trans.push_back (MachineTransition (MachineStrictTrit0, outChar[i3], outState[i3]));
-      ms.trans.push_back (MachineTransition (MachineStrictTrit1, outChar[j3], outState[j3]));
-      ms.trans.push_back (MachineTransition (MachineStrictTrit2, outChar[k3], outState[k3]));
-
-    } else if (outChar.size() == 4) {
-      const int rotate4 = (++nOut4 % 4);
-      const size_t i4 = rotate4, j4 = (rotate4 + 1) % 4, k4 = (rotate4 + 2) % 4, l4 = (rotate4 + 3) % 4;
-      const State s0 = kmerStateZero.at(kmer);
-      const State s1 = kmerStateOne.at(kmer);
-      ms.trans.push_back (MachineTransition (MachineBit0, MachineNull, s0));
-      ms.trans.push_back (MachineTransition (MachineBit1, MachineNull, s1));
-
-      machine.state[s0].leftContext = kmerString(kmer,len);
-      machine.state[s0].name = string("Split0#") + to_string(s0);
-      machine.state[s0].trans.push_back (MachineTransition (MachineBit0, outChar[i4], outState[i4]));
-      machine.state[s0].trans.push_back (MachineTransition (MachineBit1, outChar[j4], outState[j4]));
-
-      machine.state[s1].leftContext = kmerString(kmer,len);
-      machine.state[s1].name = string("Split1#") + to_string(s1);
-      machine.state[s1].trans.push_back (MachineTransition (MachineBit0, outChar[k4], outState[k4]));
-      machine.state[s1].trans.push_back (MachineTransition (MachineBit1, outChar[l4], outState[l4]));
-
-      ms.trans.push_back (MachineTransition (MachineFlush, MachineNull, s));
-      machine.state[s0].trans.push_back (MachineTransition (MachineFlush, outChar[i4], outState[i4]));
-      machine.state[s1].trans.push_back (MachineTransition (MachineFlush, outChar[l4], outState[l4]));
-
-      ms.trans.push_back (MachineTransition (MachineStrictQuat0, outChar[i4], outState[i4]));
-      ms.trans.push_back (MachineTransition (MachineStrictQuat1, outChar[j4], outState[j4]));
-      ms.trans.push_back (MachineTransition (MachineStrictQuat2, outChar[k4], outState[k4]));
-      ms.trans.push_back (MachineTransition (MachineStrictQuat3, outChar[l4], outState[l4]));
+    if (nOutBases > 3) {
+      origin.role = SplitOneStateRole;
+      stateOrigin[kmerStateOne[rank]] = origin;
     }
-    
-    if (outChar.size() > 1) {
-      for (size_t c = 0; c < controlWord.size(); ++c) {
-	if (isSourceControlIndex(c))
-	  continue;
-	ms.trans.push_back (controlTrans (s, controlWordPath[c].at(kmer).front(), c, 0));
-      }
-      if (!controlWordAtEnd)
-	ms.trans.push_back (MachineTransition (MachineEOF, 0, endState));
-    }
-    if (controlWordAtEnd && kmer == endControlWord()) {
-
-      if (isStartControlIndex(0) && isEndControlIndex(0)) {
-	for (auto& t: ms.trans)
-	  if (t.dest == s)
-	    t.dest = s - 1;   // handle the self-looping MachineFlush transition
-	swap (ms.trans, machine.state[s-1].trans);  // give the Start copy all the outgoing transitions
-	machine.state[s-1].leftContext = ms.leftContext;
-	machine.state[s-1].name = string("Control(Start)") + "#" + to_string(s-1);
-      }
-
-      if (buildDelayedMachine)
-	ms.trans.push_back (MachineTransition (0, MachineWildContext, endState - len/2));
-      else
-	ms.trans.push_back (MachineTransition (0, 0, endState));
+    if (isStartEndControlCopy (kmer)) {
+      origin.role = StartCopyStateRole;
+      stateOrigin[kmerState[rank] - 1] = origin;
     }
   }
 
   for (size_t c = 0; c < controlWord.size(); ++c)
     for (int step = 0; step < controlWordSteps[c] - 1; ++step) {
-      const auto& ckState = controlKmerState[c][step];
-      for (const auto& ks: ckState) {
-	const Kmer srcKmer = ks.first;
-	const State srcState = ks.second;
-	const Kmer destKmer = nextIntermediateKmer (srcKmer, c, step + 1);
-	machine.state[srcState].leftContext = kmerString(srcKmer,len);
-	machine.state[srcState].name = (isEndControlIndex(c) ? string("Bridge(End)") : (string("Bridge(") + controlChar(c) + ")")) + "#" + to_string(srcState);
-	machine.state[srcState].trans.push_back (controlTrans (srcState, destKmer, c, step + 1));
+      const vguard<Kmer>& inter = controlWordIntermediates[c][step];
+      for (size_t n = 0; n < inter.size(); ++n) {
+	BuilderStateOrigin& origin = stateOrigin[controlStepFirstState[c][step] + n];
+	origin.role = BridgeStateRole;
+	origin.kmer = inter[n];
+	origin.control = c;
+	origin.index = step;
       }
     }
 
-  machine.state[endState].name = "End#" + to_string(endState);
-  machine.state[endState].leftContext = buildDelayedMachine
-    ? (kmerSubstring(endControlWord(),1,len/2) + string(len/2,MachineWildContext))
-    : (controlWordAtEnd ? kmerString(endControlWord(),len) : string(len,MachineWildContext));
-  
-  if (buildDelayedMachine) {
+  if (buildDelayedMachine)
     for (Pos pos = 1; pos <= len/2; ++pos) {
-      const State s = endState - 1 - len/2 + pos;
-      MachineState& ms = machine.state[s];
-      ms.name = string("Unload(End)#") + to_string(s);
-      ms.leftContext = kmerSubstring(endControlWord(),1,len-pos) + string(pos,MachineWildContext);
-      if (pos < len/2)
-	ms.trans.push_back (MachineTransition (0, MachineWildContext, s + 1));
-      else
-	ms.trans.push_back (MachineTransition (0, 0, endState));
+      BuilderStateOrigin& origin = stateOrigin[endState - 1 - len/2 + pos];
+      origin.role = UnloadStateRole;
+      origin.index = pos;
+    }
+
+  stateOrigin[endState].role = EndStateRole;
+}
+
+bool TransBuilder::isStartEndControlCopy (Kmer kmer) const {
+  return controlWordAtEnd && kmer == endControlWord() && isStartControlIndex(0) && isEndControlIndex(0);
+}
+
+string TransBuilder::stateLeftContext (State s) const {
+  const BuilderStateOrigin& origin = stateOrigin[s];
+  switch (origin.role) {
+  case StartStateRole:
+    return controlWordAtStart
+      ? (string(len-origin.index,MachineWildContext) + kmerSubstring(startControlWord(),len-origin.index+1,origin.index))
+      : string(len,MachineWildContext);
+  case UnloadStateRole:
+    return kmerSubstring(endControlWord(),1,len-origin.index) + string(origin.index,MachineWildContext);
+  case EndStateRole:
+    return buildDelayedMachine
+      ? (kmerSubstring(endControlWord(),1,len/2) + string(len/2,MachineWildContext))
+      : (controlWordAtEnd ? kmerString(endControlWord(),len) : string(len,MachineWildContext));
+  case NoStateRole:
+    return string();
+  default:
+    break;
+  }
+  return kmerString(origin.kmer,len);
+}
+
+void TransBuilder::makeCodeStates (Kmer kmer, int rotate, MachineState& ms, MachineState& ms0, MachineState& ms1) const {
+  const State s = codeState(kmer);
+  EdgeVector out;
+  getOutgoing (kmer, out);
+  const EdgeFlags outFlags = kmerOutFlags[candidateRank(kmer)];
+  vguard<char> outChar;
+  vguard<State> outState;
+  for (size_t n = 0; n < 4; ++n)
+    if (outFlags & (1 << n)) {
+      outChar.push_back (baseToChar(n));
+      outState.push_back (codeState(out[n]));
     }
 
-    for (auto& ms: machine.state) {
-      ms.rightContext = string (ms.leftContext.begin() + len/2, ms.leftContext.end());
-      ms.leftContext.erase (ms.leftContext.begin() + len/2, ms.leftContext.end());
+  ms.name = "Code";
+  if (endsWithMotif(kmer,len,sourceMotif)) {
+    ms.name = "Source";
+    for (size_t c = 0; c < controlWord.size(); ++c)
+      if (kmer == controlWord[c]) {
+	if (isEndControlIndex(c))
+	  ms.name = string("Control(End)");
+	else if (isStartControlIndex(c))
+	  ms.name = string("Control(Start)");
+	else
+	  ms.name = string("Control(") + controlChar(c) + ")";
+      }
+  }
+  ms.name += "#" + to_string(s);
+
+  if (outChar.size() == 1)
+    ms.trans.push_back (MachineTransition (MachineNull, outChar[0], outState[0]));
+
+  else if (outChar.size() == 2) {
+    const size_t i2 = rotate, j2 = (rotate + 1) % 2;
+    ms.trans.push_back (MachineTransition (MachineBit0, outChar[i2], outState[i2]));
+    ms.trans.push_back (MachineTransition (MachineBit1, outChar[j2], outState[j2]));
+
+    ms.trans.push_back (MachineTransition (MachineFlush, MachineNull, s));
+
+    ms.trans.push_back (MachineTransition (MachineStrictBit0, outChar[i2], outState[i2]));
+    ms.trans.push_back (MachineTransition (MachineStrictBit1, outChar[j2], outState[j2]));
+
+  } else if (outChar.size() == 3) {
+    const size_t i3 = rotate, j3 = (rotate + 1) % 3, k3 = (rotate + 2) % 3;
+    const State s0 = kmerStateZero[candidateRank(kmer)];
+    ms.trans.push_back (MachineTransition (MachineBit0, MachineNull, s0));
+    ms.trans.push_back (MachineTransition (MachineBit1, outChar[k3], outState[k3]));
+
+    ms0.name = string("Split0#") + to_string(s0);
+    ms0.trans.push_back (MachineTransition (MachineBit0, outChar[i3], outState[i3]));
+    ms0.trans.push_back (MachineTransition (MachineBit1, outChar[j3], outState[j3]));
+
+    ms.trans.push_back (MachineTransition (MachineFlush, MachineNull, s));
+    ms0.trans.push_back (MachineTransition (MachineFlush, outChar[i3], outState[i3]));
+
+    ms.trans.push_back (MachineTransition (MachineStrictTrit0, outChar[i3], outState[i3]));
+    ms.trans.push_back (MachineTransition (MachineStrictTrit1, outChar[j3], outState[j3]));
+    ms.trans.push_back (MachineTransition (MachineStrictTrit2, outChar[k3], outState[k3]));
+
+  } else if (outChar.size() == 4) {
+    const size_t i4 = rotate, j4 = (rotate + 1) % 4, k4 = (rotate + 2) % 4, l4 = (rotate + 3) % 4;
+    const State s0 = kmerStateZero[candidateRank(kmer)];
+    const State s1 = kmerStateOne[candidateRank(kmer)];
+    ms.trans.push_back (MachineTransition (MachineBit0, MachineNull, s0));
+    ms.trans.push_back (MachineTransition (MachineBit1, MachineNull, s1));
+
+    ms0.name = string("Split0#") + to_string(s0);
+    ms0.trans.push_back (MachineTransition (MachineBit0, outChar[i4], outState[i4]));
+    ms0.trans.push_back (MachineTransition (MachineBit1, outChar[j4], outState[j4]));
+
+    ms1.name = string("Split1#") + to_string(s1);
+    ms1.trans.push_back (MachineTransition (MachineBit0, outChar[k4], outState[k4]));
+    ms1.trans.push_back (MachineTransition (MachineBit1, outChar[l4], outState[l4]));
+
+    ms.trans.push_back (MachineTransition (MachineFlush, MachineNull, s));
+    ms0.trans.push_back (MachineTransition (MachineFlush, outChar[i4], outState[i4]));
+    ms1.trans.push_back (MachineTransition (MachineFlush, outChar[l4], outState[l4]));
+
+    ms.trans.push_back (MachineTransition (MachineStrictQuat0, outChar[i4], outState[i4]));
+    ms.trans.push_back (MachineTransition (MachineStrictQuat1, outChar[j4], outState[j4]));
+    ms.trans.push_back (MachineTransition (MachineStrictQuat2, outChar[k4], outState[k4]));
+    ms.trans.push_back (MachineTransition (MachineStrictQuat3, outChar[l4], outState[l4]));
+  }
+
+  if (outChar.size() > 1) {
+    for (size_t c = 0; c < controlWord.size(); ++c) {
+      if (isSourceControlIndex(c))
+	continue;
+      ms.trans.push_back (controlTrans (s, ((kmer << 2) | controlWordPathBase[c][candidateRank(kmer)]) & maxKmer, c, 0));
     }
+    if (!controlWordAtEnd)
+      ms.trans.push_back (MachineTransition (MachineEOF, 0, endState));
+  }
+}
 
-    for (auto& ms: machine.state)
-      for (auto& t: ms.trans)
-	if (t.out)
-	  t.out = machine.state[t.dest].leftContext.back();
+MachineState TransBuilder::makeState (State s) const {
+  const BuilderStateOrigin& origin = stateOrigin[s];
+  MachineState ms;
+  switch (origin.role) {
+  case StartStateRole:
+    if (controlWordAtStart) {
+      ms.name = (s == 0 ? "Start#" : "Load(Start)#") + to_string(s);
+      ms.trans.push_back (MachineTransition (MachineNull, baseToChar(getBase(startControlWord(),len-origin.index)), s+1));
+    } else {
+      ms.name = "Start#1";
+      ms.trans.push_back (MachineTransition (MachineNull, MachineNull, firstNonControlState));
+    }
+    break;
+
+  case CodeStateRole:
+  case SplitZeroStateRole:
+  case SplitOneStateRole:
+  case StartCopyStateRole:
+    {
+      MachineState code, split0, split1;
+      makeCodeStates (origin.kmer, origin.rotate, code, split0, split1);
+      if (origin.role == SplitZeroStateRole)
+	swap (ms, split0);
+      else if (origin.role == SplitOneStateRole)
+	swap (ms, split1);
+      else if (origin.role == StartCopyStateRole) {
+	// the Start copy of a control word used at both start & end gets all its outgoing transitions
+	const State codeS = s + 1;
+	for (auto& t: code.trans)
+	  if (t.dest == codeS)
+	    t.dest = s;   // handle the self-looping MachineFlush transition
+	swap (ms.trans, code.trans);
+	ms.name = string("Control(Start)") + "#" + to_string(s);
+      } else {
+	if (isStartEndControlCopy (origin.kmer))
+	  code.trans.clear();  // moved to the Start copy
+	swap (ms, code);
+	if (controlWordAtEnd && origin.kmer == endControlWord()) {
+	  if (buildDelayedMachine)
+	    ms.trans.push_back (MachineTransition (0, MachineWildContext, endState - len/2));
+	  else
+	    ms.trans.push_back (MachineTransition (0, 0, endState));
+	}
+      }
+    }
+    break;
+
+  case BridgeStateRole:
+    ms.name = (isEndControlIndex(origin.control) ? string("Bridge(End)") : (string("Bridge(") + controlChar(origin.control) + ")")) + "#" + to_string(s);
+    ms.trans.push_back (controlTrans (s, nextIntermediateKmer (origin.kmer, origin.control, origin.index + 1), origin.control, origin.index + 1));
+    break;
+
+  case UnloadStateRole:
+    ms.name = string("Unload(End)#") + to_string(s);
+    if (origin.index < (unsigned int) len/2)
+      ms.trans.push_back (MachineTransition (0, MachineWildContext, s + 1));
+    else
+      ms.trans.push_back (MachineTransition (0, 0, endState));
+    break;
+
+  case EndStateRole:
+    ms.name = "End#" + to_string(s);
+    break;
+
+  default:
+    break;
   }
+  ms.leftContext = stateLeftContext(s);
 
-  Assert (machine.state[0].trans.front().inputEmpty(), "First transition shouldn't have input");
-  machine.state[0].trans.front().in = MachineSOF;
-  
+  if (buildDelayedMachine) {
+    // the second half of each context is delayed to the right context, and each output is the last base of the destination's left context
+    ms.rightContext = string (ms.leftContext.begin() + len/2, ms.leftContext.end());
+    ms.leftContext.erase (ms.leftContext.begin() + len/2, ms.leftContext.end());
+    for (auto& t: ms.trans)
+      if (t.out)
+	t.out = stateLeftContext(t.dest)[len/2 - 1];
+  }
+
+  if (s == 0) {
+    Assert (ms.trans.front().inputEmpty(), "First transition shouldn't have input");
+    ms.trans.front().in = MachineSOF;
+  }
+
+  return ms;
+}
+
+Machine TransBuilder::makeMachine() {
+  prepareStates();
+  Machine machine;
+  machine.state.reserve (nStates);
+  for (State s = 0; s < nStates; ++s)
+    machine.state.push_back (makeState(s));
+  stateOrigin = vguard<BuilderStateOrigin>();
   return machine;
 }
 
+CompactMachine TransBuilder::makeCompactMachine() {
+  prepareStates();
+  CompactMachine compact;
+  compact.reserve (nStates, 0);
+  for (State s = 0; s < nStates; ++s)
+    compact.addState (makeState(s));
+  stateOrigin = vguard<BuilderStateOrigin>();
+  LogThisAt(3,"Built compact " << nStates << "-state machine in " << compact.bytes() << " bytes" << endl);
+  return compact;
+}
+
 bool TransBuilder::isSourceControlIndex (size_t c) const {
   return isStartControlIndex(c) && !isEndControlIndex(c);
 }
@@ -460,8 +998,8 @@ char TransBuilder::controlChar (size_t nControlWord) const {
 MachineTransition TransBuilder::controlTrans (State srcState, Kmer destKmer, size_t nControlWord, size_t step) const {
   const State destState =
     (step == controlWordSteps[nControlWord] - 1 && destKmer == controlWord[nControlWord])
-    ? kmerState.at(destKmer)
-    : controlKmerState[nControlWord][step].at(destKmer);
+    ? codeState(destKmer)
+    : controlKmerState (nControlWord, step, destKmer);
   return MachineTransition (step == 0
 			    ? (isEndControlIndex(nControlWord) ? MachineEOF : controlChar(nControlWord))
 			    : MachineNull, baseToChar(getBase(destKmer,1)), destState);
@@ -472,7 +1010,7 @@ Kmer TransBuilder::nextIntermediateKmer (Kmer srcKmer, size_t nControlWord, size
   getOutgoing (srcKmer, out);
   for (Kmer destKmer: out)
     if ((step == controlWordSteps[nControlWord] - 1 && destKmer == controlWord[nControlWord])
-	|| (step < controlWordSteps[nControlWord] - 1 && controlWordIntermediates[nControlWord][step].count(destKmer)))
+	|| (step < controlWordSteps[nControlWord] - 1 && binary_search (controlWordIntermediates[nControlWord][step].begin(), controlWordIntermediates[nControlWord][step].end(), destKmer)))
       return destKmer;
   Abort("Can't find intermediate kmer following %s at step %d to control word #%d (%s)", kmerString(srcKmer,len).c_str(), step, nControlWord, kmerString(controlWord[nControlWord],len).c_str());
   return 0;
@@ -488,11 +1026,13 @@ bool TransBuilder::getNextControlWord() {
 	    << endl);
   vguard<Kmer> cand (kmers.begin(), kmers.end());
   vguard<size_t> dist (cand.size(), len);
-  for (size_t k = 0; k < cand.size(); ++k)
-    if (kmerValid[cand[k]])
-      for (auto cw: controlWord)
-	dist[k] = min (dist[k], min (kmerHammingDistance (cand[k], cw, len),
-				     kmerHammingDistance (cand[k], kmerRevComp(cw,len), len)));
+  parallelFor (cand.size(), nThreads, [&] (size_t begin, size_t end) {
+      for (size_t k = begin; k < end; ++k)
+	if (kmerValid[cand[k]])
+	  for (auto cw: controlWord)
+	    dist[k] = min (dist[k], min (kmerHammingDistance (cand[k], cw, len),
+					 kmerHammingDistance (cand[k], kmerRevComp(cw,len), len)));
+    });
   auto indexByDistance = orderedIndices (dist);
   while (!indexByDistance.empty()) {
     const size_t bestIdx = indexByDistance.back();
@@ -526,13 +1066,10 @@ bool TransBuilder::getNextControlWord() {
 		       + "+ differences from (" + to_string_join(controlWordString) + ")"))
 	      << endl);
 
-    list<Kmer> savedKmers;
-    for (auto kmer: kmers)
-      if (kmerValid[kmer])
-	savedKmers.push_back (kmer);
-    
-    sourceMotif.insert (bestMotif);
-    kmerValid[bestRevComp] = false;
+    const size_t journalSize = graphJournal.size();
+    addSourceKmer (best);
+    invalidateKmer (bestRevComp);
+    removeInvalidKmers();
 
     pruneDeadEnds();
     pruneUnreachable();
@@ -567,9 +1104,7 @@ bool TransBuilder::getNextControlWord() {
 
     // flag this word as unusable and restore previous state
     dist[bestIdx] = 0;
-    sourceMotif.erase (bestMotif);
-    for (auto kmer: savedKmers)
-      kmerValid[kmer] = true;
+    rollbackGraph (journalSize);
 
     LogThisAt(3,"Trying next option for control word #" << (cCurrent + 1) << endl);
   }
@@ -595,7 +1130,10 @@ void TransBuilder::getControlWords() {
     startAndEndUseSameControlWord = true;
   }
   
+  journalChanges = true;
   Require (getNextControlWord(), "Ran out of control words");
+  journalChanges = false;
+  graphJournal.clear();
 
   if (controlWordAtEnd && (!startAndEndUseSameControlWord || !controlWordAtStart)) {
     const Kmer e = endControlWord();
@@ -603,7 +1141,7 @@ void TransBuilder::getControlWords() {
     getOutgoing (e, out);
     for (auto n: out)
       if (kmerValid[n])
-	droppedEdge.insert (pair<Kmer,Kmer> (e, n));
+	dropEdge (e, n);
   }
   
   pruneDeadEnds();
@@ -614,23 +1152,38 @@ void TransBuilder::getControlWords() {
     const Kmer controlKmer = controlWord[c];
     if (isSourceControlIndex(c)) {
       controlWordSteps.push_back (0);
-      controlWordPath.push_back (map<Kmer,list<Kmer> >());
-      controlWordIntermediates.push_back (vguard<set<Kmer> >());
+      controlWordPathBase.push_back (vguard<unsigned char>());
+      controlWordIntermediates.push_back (vguard<vguard<Kmer> >());
     } else {
       const Pos controlSteps = stepsToReach (KmerLen (controlWord[c], len));
-      Assert (controlSteps >= 0, "Control word #%d unreachable", c+1);
+      Assert (controlSteps > 0, "Control word #%d unreachable", c+1);
       controlWordSteps.push_back (controlSteps);
-      controlWordPath.push_back (pathsTo (controlKmer, controlSteps));
-      vguard<set<Kmer> > intermediates (controlSteps);
-      for (auto kmer: kmers)
+      const vguard<KmerBitmap> reaches = pathsTo (controlKmer, controlSteps);
+      // Follow the path from each kmer until it joins one that has already been followed, marking the kmers at each step
+      vguard<unsigned char> pathBase (candidateKmer.size(), 0);
+      vguard<KmerBitmap> onPath (controlSteps, KmerBitmap (candidateKmer.size()));
+      for (auto kmer: kmers) {
+	if (reaches[0][candidateRank(kmer)])
+	  pathBase[candidateRank(kmer)] = getBase (nextOnPath (kmer, reaches[1]), 1);
 	if (!controlWordAtEnd || kmer != endControlWord() || (startAndEndUseSameControlWord && controlWordAtStart)) {
-	  Pos step = 0;
-	  for (auto inter: controlWordPath[c].at(kmer)) {
+	  Assert (reaches[0][candidateRank(kmer)], "No path from %s to control word #%d", kmerString(kmer,len).c_str(), c+1);
+	  Kmer inter = kmer;
+	  for (Pos step = 0; step < controlSteps; ++step) {
+	    inter = nextOnPath (inter, reaches[step + 1]);
+	    const size_t r = candidateRank (inter);
+	    if (onPath[step][r])
+	      break;
 	    LogThisAt(9,"Adding " << kmerString(inter,len) << " at step " << step << " from " << kmerString(kmer,len) << " to control word #" << c << " (" << kmerString(controlWord[c],len) << ")" << endl);
-	    intermediates[step++].insert (inter);
+	    onPath[step].set (r);
 	  }
 	}
-      intermediates.pop_back();
+      }
+      controlWordPathBase.push_back (pathBase);
+      vguard<vguard<Kmer> > intermediates (controlSteps - 1);
+      for (Pos step = 0; step < controlSteps - 1; ++step)
+	for (size_t r = 0; r < candidateKmer.size(); ++r)
+	  if (onPath[step][r])
+	    intermediates[step].push_back (candidateKmer[r]);
       size_t nInter = 0;
       for (const auto& ks: intermediates)
 	nInter += ks.size();
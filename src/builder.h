@@ -2,11 +2,13 @@
 #define BUILDER_INCLUDED
 
 #include <string>
+#include <algorithm>
 #include "vguard.h"
 #include "util.h"
 #include "kmer.h"
 #include "pattern.h"
 #include "trans.h"
+#include "compact.h"
 
 using namespace std;
 
@@ -18,6 +20,44 @@ typedef unsigned char EdgeFlags;
 #define PurineFlags     (AdenineFlag | GuanineFlag)
 #define PyrimidineFlags (CytosineFlag | ThymineFlag)
 
+// Parent base of a kmer that is a root of the reachability tree
+#define NoParentBase 4
+
+// Types of graph change recorded in the journal, so that a tentative control word can be rolled back
+#define GraphInvalidateKmer 0
+#define GraphDropEdge       1
+#define GraphAddSource      2
+#define GraphSetParent      3
+#define GraphSeedTree       4
+
+struct GraphChange {
+  int type;
+  Kmer kmer, other;  // other is the dest kmer (GraphDropEdge) or the previous value (GraphSetParent, GraphSeedTree)
+  GraphChange (int type, Kmer kmer, Kmer other) : type(type), kmer(kmer), other(other) { }
+};
+
+// Cost of one stage of TransBuilder::prepare()
+struct BuildStageStats {
+  string stage;
+  double seconds;
+  size_t peakResidentBytes;  // set by TransBuilder::stageFinished, if any (otherwise 0)
+  size_t kmers;  // valid kmers left after the stage
+};
+
+// Where a state of the machine comes from, so that states can be made one at a time, in order (see TransBuilder::makeState)
+enum BuilderStateRole { NoStateRole, StartStateRole, CodeStateRole, SplitZeroStateRole, SplitOneStateRole, StartCopyStateRole, BridgeStateRole, UnloadStateRole, EndStateRole };
+
+struct BuilderStateOrigin {
+  Kmer kmer;  // code, split, start-copy & bridge states
+  unsigned int index;  // position in the control word (start & unload states), or step (bridge states)
+  unsigned short control;  // control word (bridge states)
+  unsigned char role, rotate;  // rotate: rotation of the code state's outgoing bases among its inputs
+  BuilderStateOrigin() : kmer(0), index(0), control(0), role(NoStateRole), rotate(0) { }
+};
+
+// Candidate kmers are found by extending each repeat-free prefix of this length on a separate task
+#define CandidatePrefixLen 6
+
 struct TransBuilder {
   static vguard<int> edgeFlagsToCountLookup;
 
@@ -33,38 +73,86 @@ struct TransBuilder {
   size_t nControlWords;
   bool controlWordAtStart, controlWordAtEnd, startAndEndUseSameControlWord;
   bool buildDelayedMachine;
+  size_t nThreads;  // worker threads for prepare(); the machine doesn't depend on this
   
   // work variables
-  vguard<bool> kmerValid;
+  KmerBitmap kmerValid;  // allocated by prepare()
+  KmerBitmap candidateIndex;  // kmers that passed the filters, ranked; the per-kmer arrays below are indexed by rank
+  vguard<Kmer> candidateKmer;  // kmers that passed the filters, by rank
+  vguard<unsigned char> kmerInDegree, kmerOutDegree;  // edge counts, kept up to date as kmers, edges & source motifs change
+  vguard<EdgeFlags> kmerDroppedFlags;  // outgoing edges that have been dropped
+  vguard<Kmer> deadEndQueue;  // kmers whose in- or out-degree has dropped to zero since the last pruneDeadEnds()
+  size_t nDroppedEdges;
+  vguard<unsigned char> kmerParentBase;  // reachability tree: first base of the in-neighbor each valid kmer was reached from
+  bool reachTreeSeeded;  // true if the tree is rooted at the source words, false if at the first kmer (there being no source words)
+  vguard<Kmer> orphanQueue;  // kmers cut off from their tree parent since the last pruneUnreachable()
+  KmerBitmap orphanMark;  // by rank, used by pruneUnreachable()
+  bool journalChanges;  // if true, graph changes are recorded in graphJournal
+  vguard<GraphChange> graphJournal;
   list<Kmer> kmers;
   vguard<Kmer> controlWord;
   vguard<string> controlWordString;
   vguard<Pos> controlWordSteps;
-  vguard<map<Kmer,list<Kmer> > > controlWordPath;
-  vguard<vguard<set<Kmer> > > controlWordIntermediates;
-  map<Kmer,EdgeFlags> kmerOutFlags;
-  set<pair<Kmer,Kmer> > droppedEdge;
+  vguard<vguard<unsigned char> > controlWordPathBase;  // per control word, by rank: last base of the next kmer on the path to it
+  vguard<vguard<vguard<Kmer> > > controlWordIntermediates;  // per control word and step, in ascending order
+  vguard<EdgeFlags> kmerOutFlags;  // by rank
 
   State nStates, firstNonControlState, endState;
-  map<Kmer,State> kmerState, kmerStateZero, kmerStateOne;
-  vguard<vguard<map<Kmer,State> > > controlKmerState;
+  vguard<State> kmerState, kmerStateZero, kmerStateOne;  // by rank
+  vguard<vguard<State> > controlStepFirstState;  // per control word and step: state of the first intermediate kmer
+
+  vguard<BuilderStateOrigin> stateOrigin;  // by state; filled by prepareStates(), freed once the states are made
+  vguard<BuildStageStats> stageStats;  // filled by prepare()
+  // optional hooks around each stage of prepare(), e.g. for benchmarks to measure the peak memory of each stage
+  function<void()> stageStarting;
+  function<void(BuildStageStats&)> stageFinished;
   
   TransBuilder (Pos len);
 
   void prepare();
+  void runStage (const char* stage, const function<void()>& f);  // runs one stage of prepare(), recording its stats
+  bool isCandidate (Kmer kmer, Pos kmerLen) const;  // true if kmer passes the repeat & motif filters
+  inline bool isCandidate (Kmer kmer) const { return isCandidate (kmer, len); }
+  bool endsWithRepeat (Kmer kmer, Pos kmerLen) const;  // true if kmer has a filtered repeat ending at its last base
+  void endsWithRepeat (const Kmer* kmer, Pos kmerLen, bool* result) const;  // batched form, for four kmers (doesn't log)
+  bool endsWithExcludedMotif (Kmer kmer, Pos kmerLen) const;
+  inline bool isCandidateExtension (Kmer kmer) const {  // same as isCandidate(kmer), if the first len-1 bases of kmer are known to be repeat-free
+    return !endsWithExcludedMotif (kmer, len) && !endsWithRepeat (kmer, len);
+  }
   void findCandidates();
+  void indexCandidates();
+  void extendCandidates (Kmer prefix, Pos prefixLen, Pos extLen, vguard<Kmer>& found) const;
   void pruneUnreachable();
   void pruneDeadEnds();
   void buildEdges();
+
+  // changes to the graph that keep the degree counts up to date
+  void validateKmer (Kmer kmer);
+  void invalidateKmer (Kmer kmer);
+  void dropEdge (Kmer src, Kmer dest);
+  void addSourceKmer (Kmer kmer);  // makes kmer a full-length source motif
+  void removeSourceKmer (Kmer kmer);
+  void restoreEdge (Kmer src, Kmer dest);
+  void setParentBase (Kmer kmer, unsigned char base);
+  void rollbackGraph (size_t journalSize);  // undoes changes until the journal is back to journalSize
+  void removeInvalidKmers();  // removes invalidated kmers from the kmer list
   void indexStates();
 
   Machine makeMachine();
+  CompactMachine makeCompactMachine();  // makes the states straight into the compact layout, without the full Machine
+
+  // states are made one at a time, in order, after prepareStates()
+  void prepareStates();
+  MachineState makeState (State s) const;
+  void makeCodeStates (Kmer kmer, int rotate, MachineState& ms, MachineState& ms0, MachineState& ms1) const;  // code state of kmer, and its split states
+  string stateLeftContext (State s) const;  // before the delayed machine splits it
+  bool isStartEndControlCopy (Kmer kmer) const;  // true if kmer is a control word used at start & end, whose code state has a Start copy
   
   void assertKmersCorrect() const;
   
-  void doDFS (Kmer kmer, map<Kmer,Pos>& distance) const;
+  vguard<Kmer> findReachable (const vguard<Kmer>& seeds, KmerBitmap& reached, vguard<unsigned char>& parentBase) const;
+  void reattachOrphans();
 
-  set<Kmer> kmersEndingWith (KmerLen motif) const;
   Pos stepsToReach (KmerLen motif, int maxSteps = 64) const;
 
   void getControlWords();
@@ -75,25 +163,64 @@ struct TransBuilder {
   Kmer startControlWord() const;
   Kmer endControlWord() const;
   
-  map<Kmer,list<Kmer> > pathsTo (Kmer dest, int steps) const;
+  vguard<KmerBitmap> pathsTo (Kmer dest, int steps) const;
+  Kmer nextOnPath (Kmer kmer, const KmerBitmap& nextStep) const;
   MachineTransition controlTrans (State srcState, Kmer destKmer, size_t nControlWord, size_t step) const;
   Kmer nextIntermediateKmer (Kmer srcKmer, size_t nControlWord, size_t step) const;
   char controlChar (size_t nControlWord) const;
   
-  inline void pruneDeadEnds (Kmer kmer) {
-    EdgeVector in, out;
-    if (kmerValid[kmer] && !endsWithMotif(kmer,len,sourceMotif)) {
-      const int inCount = countIncoming(kmer,in), outCount = countOutgoing(kmer,out);
+  inline size_t candidateRank (Kmer kmer) const {
+    return candidateIndex.rank (kmer);
+  }
+
+  inline void recordChange (int type, Kmer kmer, Kmer other = 0) {
+    if (journalChanges)
+      graphJournal.push_back (GraphChange (type, kmer, other));
+  }
+
+  inline bool isTreeChild (Kmer parent, Kmer kmer) const {
+    return candidateIndex[kmer] && kmerValid[kmer] && kmerParentBase[candidateRank(kmer)] == getBase(parent,len);
+  }
+
+  // calls f(r) for every candidate rank r in [begin*64,end*64), so that parallel calls over word ranges write to different words of a rank bitmap
+  template<class Func>
+  inline void forRanksInWords (size_t begin, size_t end, Func f) const {
+    const size_t rEnd = min (candidateKmer.size(), end << 6);
+    for (size_t r = begin << 6; r < rEnd; ++r)
+      f (r);
+  }
+
+  inline State codeState (Kmer kmer) const {
+    return kmerState[candidateRank(kmer)];
+  }
+
+  inline State controlKmerState (size_t nControlWord, size_t step, Kmer kmer) const {
+    const vguard<Kmer>& inter = controlWordIntermediates[nControlWord][step];
+    const auto iter = lower_bound (inter.begin(), inter.end(), kmer);
+    Assert (iter != inter.end() && *iter == kmer, "Kmer %s is not at step %d to control word #%d", kmerString(kmer,len).c_str(), step, nControlWord);
+    return controlStepFirstState[nControlWord][step] + (iter - inter.begin());
+  }
+
+  inline bool isSourceKmer (Kmer kmer) const {
+    return endsWithMotif (kmer, len, sourceMotif);
+  }
+
+  inline EdgeFlags droppedEdgeFlags (Kmer kmer) const {
+    return candidateIndex[kmer] ? kmerDroppedFlags[candidateRank(kmer)] : 0;
+  }
+
+  inline bool isDroppedEdge (Kmer src, Kmer dest) const {
+    return (droppedEdgeFlags(src) >> getBase(dest,1)) & 1;
+  }
+
+  inline bool isDeadEnd (Kmer kmer) const {
+    if (kmerValid[kmer] && !isSourceKmer(kmer)) {
+      const int inCount = countIncoming(kmer), outCount = countOutgoing(kmer);
       const bool prune = inCount == 0 || outCount == 0;
       LogThisAt(9,(prune ? "Pruning" : "Keeping") << " " << kmerString(kmer,len) << " with " << inCount << " incoming and " << outCount << " outgoing edges" << endl);
-      if (prune) {
-	kmerValid[kmer] = 0;
-	for (auto kmerIn: in)
-	  pruneDeadEnds (kmerIn);
-	for (auto kmerOut: out)
-	  pruneDeadEnds (kmerOut);
-      }
+      return prune;
     }
+    return false;
   }
  
   inline void getOutgoing (Kmer kmer, EdgeVector& outgoing) const {
@@ -110,47 +237,39 @@ struct TransBuilder {
       incoming[b] = prefix | (((Kmer) b) << shift);
   }
 
-  inline EdgeFlags outgoingEdgeFlags (Kmer kmer, EdgeVector& outgoing) {
+  inline EdgeFlags outgoingEdgeFlags (Kmer kmer, EdgeVector& outgoing) const {
     getOutgoing (kmer, outgoing);
+    const EdgeFlags dropped = droppedEdgeFlags (kmer);
     EdgeFlags f = 0;
     for (size_t n = 0; n < 4; ++n)
       if (kmerValid[outgoing[n]]
-	  && !endsWithMotif(outgoing[n],len,sourceMotif)
-	  && !droppedEdge.count (pair<Kmer,Kmer> (kmer, outgoing[n])))
+	  && !isSourceKmer(outgoing[n])
+	  && !(dropped & (1 << n)))
 	f = f | (1 << n);
     return f;
   }
 
-  inline EdgeFlags incomingEdgeFlags (Kmer kmer, EdgeVector& incoming) {
+  inline EdgeFlags incomingEdgeFlags (Kmer kmer, EdgeVector& incoming) const {
     getIncoming (kmer, incoming);
     EdgeFlags f = 0;
     for (size_t n = 0; n < 4; ++n)
       if (kmerValid[incoming[n]]
-	  && !droppedEdge.count (pair<Kmer,Kmer> (incoming[n], kmer)))
+	  && !isDroppedEdge (incoming[n], kmer))
 	f = f | (1 << n);
     return f;
   }
 
-  inline int edgeFlagsToCount (EdgeFlags flags) {
+  inline int edgeFlagsToCount (EdgeFlags flags) const {
     return edgeFlagsToCountLookup[flags & 0xf];
   }
 
-  inline int countOutgoing (Kmer kmer, EdgeVector& out) {
-    return edgeFlagsToCount (outgoingEdgeFlags (kmer, out));
-  }
-
-  inline int countIncoming (Kmer kmer, EdgeVector& in) {
-    return edgeFlagsToCount (incomingEdgeFlags (kmer, in));
-  }
-
-  inline int countIncoming (Kmer kmer) {
-    EdgeVector e;
-    return countIncoming (kmer, e);
+  // the degree counts are kept for every candidate kmer, valid or not
+  inline int countIncoming (Kmer kmer) const {
+    return kmerInDegree[candidateRank(kmer)];
   }
 
-  inline int countOutgoing (Kmer kmer) {
-    EdgeVector e;
-    return countOutgoing (kmer, e);
+  inline int countOutgoing (Kmer kmer) const {
+    return kmerOutDegree[candidateRank(kmer)];
   }
 
   inline bool betterDest (Kmer x, Kmer y) {  // true if x is preferred over y as destination state
@@ -170,7 +289,7 @@ struct TransBuilder {
 	      << "edge to " << kmerString(out[e],len)
 	      << " from " << kmerString(src,len)
 	      << endl);
-    droppedEdge.insert (pair<Kmer,Kmer> (src, out[e]));
+    dropEdge (src, out[e]);
     return flags & (0xf ^ (1 << e));
   }
 };
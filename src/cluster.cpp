@@ -0,0 +1,193 @@
+#include <algorithm>
+#include "cluster.h"
+#include "editdistance.h"
+#include "orient.h"
+#include "parallel.h"
+#include "logger.h"
+
+// splitmix64 finalizer
+static inline unsigned long long mixHash (unsigned long long x) {
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+ReadClusterer::ReadClusterer()
+  : kmerLen (DefaultClusterKmerLen),
+    sketchSize (DefaultClusterSketchSize),
+    nBands (DefaultClusterBands),
+    maxEditRate (DefaultClusterMaxEditRate),
+    seed (DefaultClusterSeed),
+    nThreads (1)
+{ }
+
+vguard<unsigned long long> ReadClusterer::sketch (const string& seq) const {
+  vguard<unsigned long long> mins (sketchSize, (unsigned long long) -1);
+  const Kmer mask = kmerLen < 32 ? (((Kmer) 1) << (2 * kmerLen)) - 1 : (Kmer) -1;
+  const int rcShift = 2 * (kmerLen - 1);
+  Kmer fwd = 0, rev = 0;
+  Pos validLen = 0;
+  for (char c: seq) {
+    const UnvalidatedAlphTok tok = tokenize (c, dnaAlphabetString);
+    if (tok < 0) {
+      validLen = 0;
+      continue;
+    }
+    fwd = ((fwd << 2) | (Kmer) tok) & mask;
+    rev = (rev >> 2) | (((Kmer) complementBase ((Base) tok)) << rcShift);
+    if (++validLen >= kmerLen) {
+      // one-permutation MinHash: the hash picks a bin, and each bin keeps its smallest hash
+      const unsigned long long h = mixHash (min (fwd, rev) ^ seed);
+      unsigned long long& m = mins[h % sketchSize];
+      m = min (m, h);
+    }
+  }
+  return mins;
+}
+
+vguard<ReadCluster> ReadClusterer::cluster (const vguard<FastSeq>& reads) const {
+  Require (kmerLen > 0 && kmerLen <= 32, "Cluster kmer length must be from 1 to 32");
+  Require (sketchSize > 0 && nBands > 0 && sketchSize % nBands == 0, "Sketch size must be a multiple of the number of bands");
+  const int rows = sketchSize / nBands;
+  const size_t n = reads.size();
+
+  // sketch, and hash each band
+  vguard<unsigned long long> bandKey (n * nBands);
+  parallelFor (n, nThreads, [&] (size_t begin, size_t end) {
+      for (size_t r = begin; r < end; ++r) {
+	const auto s = sketch (reads[r].seq);
+	for (int b = 0; b < nBands; ++b) {
+	  unsigned long long key = mixHash (seed + b);
+	  for (int i = 0; i < rows; ++i)
+	    key = mixHash (key ^ s[b*rows + i]);
+	  bandKey[r*nBands + b] = key;
+	}
+      }
+    });
+
+  // bucket by band key; pair each read with the first read in its bucket
+  vguard<pair<unsigned long long,size_t> > bucketed;
+  bucketed.reserve (n * nBands);
+  for (size_t r = 0; r < n; ++r)
+    for (int b = 0; b < nBands; ++b)
+      bucketed.push_back (make_pair (bandKey[r*nBands + b], r));
+  sort (bucketed.begin(), bucketed.end());
+  vguard<pair<size_t,size_t> > candidates;
+  for (size_t i = 0; i < bucketed.size(); ) {
+    size_t j = i + 1;
+    for (; j < bucketed.size() && bucketed[j].first == bucketed[i].first; ++j)
+      if (bucketed[j].second != bucketed[i].second)
+	candidates.push_back (make_pair (bucketed[i].second, bucketed[j].second));
+    i = j;
+  }
+  sort (candidates.begin(), candidates.end());
+  candidates.erase (unique (candidates.begin(), candidates.end()), candidates.end());
+  LogThisAt(3,"Sketched " << plural(n,"read") << "; verifying " << plural(candidates.size(),"candidate pair") << endl);
+
+  // verify by banded edit distance: first as they are, then (for pairs that fail) with the second read reverse-complemented
+  vguard<string> revcomp (n);
+  parallelFor (n, nThreads, [&] (size_t begin, size_t end) {
+      for (size_t r = begin; r < end; ++r)
+	revcomp[r] = revcompFastSeq(reads[r]).seq;
+    });
+  vguard<int> maxEdits (candidates.size());
+  vguard<size_t> verifying;
+  vguard<EditDistanceQuery> query;
+  for (size_t c = 0; c < candidates.size(); ++c) {
+    const string &x = reads[candidates[c].first].seq, &y = reads[candidates[c].second].seq;
+    maxEdits[c] = (int) (maxEditRate * max (x.size(), y.size()));
+    if (abs ((int) x.size() - (int) y.size()) <= maxEdits[c]) {
+      verifying.push_back (c);
+      query.push_back (EditDistanceQuery { &x, &y, 2 * maxEdits[c] });
+    }
+  }
+  // link: 0 = different strands, 1 = same orientation, 2 = opposite orientations
+  vguard<char> link (candidates.size(), 0);
+  const vguard<int> fwdDist = editDistances (query, nThreads);
+  vguard<size_t> revVerifying;
+  vguard<EditDistanceQuery> revQuery;
+  for (size_t v = 0; v < verifying.size(); ++v) {
+    const size_t c = verifying[v];
+    if (fwdDist[v] <= maxEdits[c])
+      link[c] = 1;
+    else {
+      revVerifying.push_back (c);
+      revQuery.push_back (EditDistanceQuery { query[v].x, &revcomp[candidates[c].second], query[v].band });
+    }
+  }
+  const vguard<int> revDist = editDistances (revQuery, nThreads);
+  for (size_t v = 0; v < revVerifying.size(); ++v)
+    if (revDist[v] <= maxEdits[revVerifying[v]])
+      link[revVerifying[v]] = 2;
+
+  // union-find, with the orientation of each read relative to its parent
+  vguard<size_t> parent (n);
+  vguard<bool> flip (n, false);
+  for (size_t r = 0; r < n; ++r)
+    parent[r] = r;
+  auto find = [&] (size_t r, bool& rootFlip) -> size_t {
+    bool f = false;
+    size_t root = r;
+    while (parent[root] != root) {
+      f = f != flip[root];
+      root = parent[root];
+    }
+    // path compression
+    bool g = f;
+    while (parent[r] != root) {
+      const size_t next = parent[r];
+      const bool nextFlip = g != flip[r];
+      parent[r] = root;
+      flip[r] = g;
+      r = next;
+      g = nextFlip;
+    }
+    rootFlip = f;
+    return root;
+  };
+  size_t nLinks = 0;
+  for (size_t c = 0; c < candidates.size(); ++c)
+    if (link[c]) {
+      ++nLinks;
+      bool fa, fb;
+      const size_t ra = find (candidates[c].first, fa), rb = find (candidates[c].second, fb);
+      if (ra != rb) {
+	parent[rb] = ra;
+	flip[rb] = (fa != fb) != (link[c] == 2);
+      }
+    }
+
+  map<size_t,ReadCluster> byRoot;
+  for (size_t r = 0; r < n; ++r) {
+    bool f;
+    const size_t root = find (r, f);
+    byRoot[root].push_back (ClusterMember { r, f });
+  }
+  vguard<ReadCluster> clusters;
+  for (auto& rc: byRoot) {
+    ReadCluster& c = rc.second;
+    // orient each cluster like most of its reads
+    const size_t nRev = count_if (c.begin(), c.end(), [] (const ClusterMember& m) { return m.reversed; });
+    if (2 * nRev > c.size())
+      for (auto& m: c)
+	m.reversed = !m.reversed;
+    clusters.push_back (c);
+  }
+  stable_sort (clusters.begin(), clusters.end(), [] (const ReadCluster& a, const ReadCluster& b) { return a.size() > b.size(); });
+  LogThisAt(2,"Found " << plural(clusters.size(),"cluster") << " of " << plural(n,"read") << " (" << plural(nLinks,"verified pair") << ")" << endl);
+  return clusters;
+}
+
+vguard<FastSeq> clusteredFastSeqs (const vguard<FastSeq>& reads, const vguard<ReadCluster>& clusters) {
+  vguard<FastSeq> out;
+  for (size_t c = 0; c < clusters.size(); ++c)
+    for (const auto& m: clusters[c]) {
+      FastSeq fs = m.reversed ? revcompFastSeq (reads[m.read]) : reads[m.read];
+      fs.comment = string("cluster=") + to_string(c+1) + (m.reversed ? " revcomp" : "");
+      out.push_back (fs);
+    }
+  return out;
+}
@@ -0,0 +1,46 @@
+#ifndef CLUSTER_INCLUDED
+#define CLUSTER_INCLUDED
+
+#include "fastseq.h"
+#include "kmer.h"
+
+#define DefaultClusterKmerLen       8
+#define DefaultClusterSketchSize    32
+#define DefaultClusterBands         32
+#define DefaultClusterMaxEditRate   .25
+#define DefaultClusterSeed          0x2545f491
+
+// A read's place in a cluster: reversed if it must be reverse-complemented to match the cluster's orientation
+struct ClusterMember {
+  size_t read;
+  bool reversed;
+};
+
+typedef vguard<ClusterMember> ReadCluster;
+
+// Groups reads by source strand, in either orientation.
+// Each read is sketched by one-permutation MinHash: each canonical kmerLen-mer is hashed once, the hash picks one of
+// sketchSize bins, and each bin keeps its smallest hash. The sketch is cut into nBands bands for locality-sensitive
+// hashing: reads sharing all the hashes of any band land in the same bucket. Each read in a bucket is verified
+// against the bucket's first read by banded edit distance (in both orientations), and linked to it if the distance
+// is at most maxEditRate per base.
+// Clusters are the connected components of the links.
+// Sketching and verification run on nThreads threads; the buckets are the only serial stage.
+struct ReadClusterer {
+  Pos kmerLen;
+  int sketchSize, nBands;
+  double maxEditRate;
+  unsigned long long seed;
+  size_t nThreads;
+
+  ReadClusterer();
+
+  vguard<ReadCluster> cluster (const vguard<FastSeq>& reads) const;  // largest clusters first
+
+  vguard<unsigned long long> sketch (const string& seq) const;
+};
+
+// Reads grouped for --joint decoding: each read oriented like its cluster, with comment "cluster=N"
+vguard<FastSeq> clusteredFastSeqs (const vguard<FastSeq>& reads, const vguard<ReadCluster>& clusters);
+
+#endif /* CLUSTER_INCLUDED */
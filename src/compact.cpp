@@ -0,0 +1,216 @@
+#include <fstream>
+#include "compact.h"
+#include "logger.h"
+
+PackedContext::PackedContext (const string& context)
+  : kmer(0), len(0), wildPrefix(0), wildSuffix(0)
+{
+  size_t b = 0, e = context.size();
+  while (b < e && context[b] == MachineWildContext)
+    ++b;
+  while (e > b && context[e-1] == MachineWildContext)
+    --e;
+  Require (e - b <= 32, "Context %s is too long to pack", context.c_str());
+  wildPrefix = b;
+  wildSuffix = context.size() - e;
+  len = e - b;
+  for (size_t i = b; i < e; ++i) {
+    Require (context[i] != MachineWildContext, "Can't pack context %s: wildcard in middle", context.c_str());
+    kmer = (kmer << 2) | charToBase (context[i]);
+  }
+}
+
+string PackedContext::toString() const {
+  return string (wildPrefix, MachineWildContext) + kmerString (kmer, len) + string (wildSuffix, MachineWildContext);
+}
+
+CompactMachine::CompactMachine()
+  : transOffset (1, 0)
+{ }
+
+CompactMachine::CompactMachine (const Machine& machine)
+  : transOffset (1, 0)
+{
+  size_t nTrans = 0;
+  for (const auto& ms: machine.state)
+    nTrans += ms.trans.size();
+  reserve (machine.nStates(), nTrans);
+  for (const auto& ms: machine.state)
+    addState (ms);
+  LogThisAt(3,"Compacted " << machine.nStates() << "-state machine into " << bytes() << " bytes (" << (nStates() ? bytes() / nStates() : 0) << " bytes/state, " << nameTable.size() << " distinct state names)" << endl);
+}
+
+void CompactMachine::clear() {
+  cstate.clear();
+  transOffset = vguard<size_t> (1, 0);
+  trans.clear();
+  nameTable.clear();
+  nameTableIndex.clear();
+}
+
+void CompactMachine::reserve (State nStates, size_t nTransitions) {
+  cstate.reserve (nStates);
+  transOffset.reserve (nStates + 1);
+  trans.reserve (nTransitions);
+}
+
+unsigned int CompactMachine::internName (const string& name) {
+  auto iter = nameTableIndex.find (name);
+  if (iter != nameTableIndex.end())
+    return iter->second;
+  const unsigned int idx = nameTable.size();
+  Assert (idx < CompactNameIndexFlag, "Too many distinct state names");
+  nameTable.push_back (name);
+  nameTableIndex[name] = idx;
+  return idx;
+}
+
+void CompactMachine::addState (const MachineState& ms) {
+  const State s = nStates();
+  CompactState cs;
+
+  const string suffix = Machine::stateIndex (s);
+  if (ms.name.size() > suffix.size() && ms.name.compare (ms.name.size() - suffix.size(), suffix.size(), suffix) == 0)
+    cs.nameIndex = internName (ms.name.substr (0, ms.name.size() - suffix.size())) | CompactNameIndexFlag;
+  else
+    cs.nameIndex = internName (ms.name);
+
+  const PackedContext left (ms.leftContext), right (ms.rightContext);
+  cs.leftKmer = left.kmer;
+  cs.leftLen = left.len;
+  cs.leftWildPrefix = left.wildPrefix;
+  cs.leftWildSuffix = left.wildSuffix;
+  cs.rightKmer = right.kmer;
+  cs.rightLen = right.len;
+  cs.rightWildPrefix = right.wildPrefix;
+  cs.rightWildSuffix = right.wildSuffix;
+
+  cstate.push_back (cs);
+  trans.insert (trans.end(), ms.trans.begin(), ms.trans.end());
+  transOffset.push_back (trans.size());
+}
+
+PackedContext CompactMachine::getLeft (const CompactState& cs) {
+  PackedContext pc;
+  pc.kmer = cs.leftKmer;
+  pc.len = cs.leftLen;
+  pc.wildPrefix = cs.leftWildPrefix;
+  pc.wildSuffix = cs.leftWildSuffix;
+  return pc;
+}
+
+PackedContext CompactMachine::getRight (const CompactState& cs) {
+  PackedContext pc;
+  pc.kmer = cs.rightKmer;
+  pc.len = cs.rightLen;
+  pc.wildPrefix = cs.rightWildPrefix;
+  pc.wildSuffix = cs.rightWildSuffix;
+  return pc;
+}
+
+State CompactMachine::startState() const {
+  Assert (nStates() > 0, "Machine has no states");
+  return 0;
+}
+
+string CompactMachine::stateName (State s) const {
+  const unsigned int idx = cstate[s].nameIndex;
+  const string& name = nameTable[idx & CompactNameIndexMask];
+  return (idx & CompactNameIndexFlag) ? (name + Machine::stateIndex(s)) : name;
+}
+
+const MachineTransition* CompactMachine::transFor (State s, InputSymbol in) const {
+  for (const auto& t: transitions(s))
+    if (t.in == in)
+      return &t;
+  return NULL;
+}
+
+bool CompactMachine::exitsWithInput (State s) const {
+  for (const auto& t: transitions(s))
+    if (t.in)
+      return true;
+  return false;
+}
+
+bool CompactMachine::exitsWithoutInput (State s) const {
+  for (const auto& t: transitions(s))
+    if (!t.in)
+      return true;
+  return false;
+}
+
+bool CompactMachine::emitsOutput (State s) const {
+  for (const auto& t: transitions(s))
+    if (t.out)
+      return true;
+  return false;
+}
+
+size_t CompactMachine::maxLeftContext() const {
+  size_t w = 0;
+  for (const auto& cs: cstate)
+    w = max (w, (size_t) (cs.leftLen + cs.leftWildPrefix + cs.leftWildSuffix));
+  return w;
+}
+
+size_t CompactMachine::maxRightContext() const {
+  size_t w = 0;
+  for (const auto& cs: cstate)
+    w = max (w, (size_t) (cs.rightLen + cs.rightWildPrefix + cs.rightWildSuffix));
+  return w;
+}
+
+size_t CompactMachine::bytes() const {
+  size_t b = cstate.capacity() * sizeof(CompactState)
+    + transOffset.capacity() * sizeof(size_t)
+    + trans.capacity() * sizeof(MachineTransition);
+  for (const auto& name: nameTable)
+    b += 2 * (sizeof(string) + name.capacity()) + sizeof(unsigned int);
+  return b;
+}
+
+Machine CompactMachine::expand() const {
+  Machine machine;
+  machine.state.reserve (nStates());
+  for (State s = 0; s < nStates(); ++s) {
+    MachineState ms;
+    ms.name = stateName(s);
+    ms.leftContext = leftContext(s);
+    ms.rightContext = rightContext(s);
+    const auto tr = transitions(s);
+    ms.trans.insert (ms.trans.end(), tr.begin(), tr.end());
+    machine.state.push_back (ms);
+  }
+  return machine;
+}
+
+void CompactMachine::writeJSON (ostream& out) const {
+  writeMachineJSON (*this, out);
+}
+
+void CompactMachine::readJSON (istream& in) {
+  clear();
+  Machine::readJSONStates (in, [&] (MachineState& ms) {
+      addState (ms);
+    });
+  for (State s = 0; s < nStates(); ++s) {
+    const PackedContext sr = rightPackedContext(s);
+    for (const auto& t: transitions(s))
+      if (t.out) {
+	if (sr.size())
+	  Assert (t.out == rightContext(s)[0], "In transition from %s to %s: emitted character (%c) does not match source's right context (%s)", stateName(s).c_str(), stateName(t.dest).c_str(), t.out, rightContext(s).c_str());
+	if (leftPackedContext(t.dest).size())
+	  Assert (t.out == leftContext(t.dest).back(), "In transition from %s to %s: emitted character (%c) does not match destination's left context (%s)", stateName(s).c_str(), stateName(t.dest).c_str(), t.out, leftContext(t.dest).c_str());
+      }
+  }
+}
+
+CompactMachine CompactMachine::fromFile (const char* filename) {
+  ifstream infile (filename);
+  if (!infile)
+    Fail ("File not found: %s", filename);
+  CompactMachine machine;
+  machine.readJSON (infile);
+  return machine;
+}
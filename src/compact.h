@@ -0,0 +1,101 @@
+#ifndef COMPACT_INCLUDED
+#define COMPACT_INCLUDED
+
+#include <string>
+#include <map>
+#include "vguard.h"
+#include "kmer.h"
+#include "trans.h"
+
+using namespace std;
+
+// Packed state context: a run of bases (2 bits each), optionally padded with wildcards on either side.
+// This covers every context the builder and composition code generate, e.g. "**ACG", "ACGT", "AC**".
+struct PackedContext {
+  Kmer kmer;
+  unsigned char len, wildPrefix, wildSuffix;
+  PackedContext() : kmer(0), len(0), wildPrefix(0), wildSuffix(0) { }
+  PackedContext (const string& context);
+  inline size_t size() const { return wildPrefix + len + wildSuffix; }
+  string toString() const;
+};
+
+// Compact state record. Names are interned; a name of the form "Type#n" where n is the state's own index
+// is stored as "Type" plus a flag, so all states of a given type share one table entry.
+struct CompactState {
+  Kmer leftKmer, rightKmer;
+  unsigned int nameIndex;
+  unsigned char leftLen, leftWildPrefix, leftWildSuffix;
+  unsigned char rightLen, rightWildPrefix, rightWildSuffix;
+};
+
+#define CompactNameIndexFlag 0x80000000
+#define CompactNameIndexMask 0x7fffffff
+
+struct CompactTransRange {
+  const MachineTransition *b, *e;
+  CompactTransRange (const MachineTransition* b, const MachineTransition* e) : b(b), e(e) { }
+  const MachineTransition* begin() const { return b; }
+  const MachineTransition* end() const { return e; }
+  size_t size() const { return e - b; }
+  bool empty() const { return b == e; }
+  const MachineTransition& front() const { return *b; }
+};
+
+// Alternative in-memory layout for Machine.
+// Provides the same per-state accessors as Machine (stateName, transitions, isEnd...),
+// so code templated on the machine type can use either.
+class CompactMachine {
+private:
+  vguard<CompactState> cstate;
+  vguard<size_t> transOffset;  // transitions for state s are trans[transOffset[s]] .. trans[transOffset[s+1]-1]
+  vguard<MachineTransition> trans;
+  vguard<string> nameTable;
+  map<string,unsigned int> nameTableIndex;
+
+  unsigned int internName (const string& name);
+  static PackedContext getLeft (const CompactState& cs);
+  static PackedContext getRight (const CompactState& cs);
+
+public:
+  CompactMachine();
+  CompactMachine (const Machine& machine);
+
+  void clear();
+  void reserve (State nStates, size_t nTransitions);
+  void addState (const MachineState& ms);  // appends next state
+
+  Machine expand() const;
+
+  State nStates() const { return cstate.size(); }
+  State startState() const;
+  size_t nTransitions() const { return trans.size(); }
+
+  // accessors
+  string stateName (State s) const;
+  string leftContext (State s) const { return getLeft(cstate[s]).toString(); }
+  string rightContext (State s) const { return getRight(cstate[s]).toString(); }
+  PackedContext leftPackedContext (State s) const { return getLeft(cstate[s]); }
+  PackedContext rightPackedContext (State s) const { return getRight(cstate[s]); }
+
+  inline CompactTransRange transitions (State s) const {
+    return CompactTransRange (trans.data() + transOffset[s], trans.data() + transOffset[s+1]);
+  }
+  const MachineTransition* transFor (State s, InputSymbol in) const;
+  inline bool acceptsInput (State s, InputSymbol in) const { return transFor(s,in) != NULL; }
+  inline bool isEnd (State s) const { return transOffset[s] == transOffset[s+1]; }
+  bool exitsWithInput (State s) const;
+  bool exitsWithoutInput (State s) const;
+  bool emitsOutput (State s) const;
+  bool isWait (State s) const { return exitsWithInput(s) && !exitsWithoutInput(s); }
+
+  size_t maxLeftContext() const;
+  size_t maxRightContext() const;
+  size_t bytes() const;  // approximate heap footprint
+
+  void writeJSON (ostream& out) const;
+  void readJSON (istream& in);
+  static CompactMachine fromFile (const char* filename);
+};
+
+#endif /* COMPACT_INCLUDED */
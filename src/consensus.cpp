@@ -0,0 +1,213 @@
+#include <algorithm>
+#include "consensus.h"
+#include "logger.h"
+#include "parallel.h"
+
+ReadToReference::ReadToReference (const TokSeq& read, const TokSeq& ref, Pos band)
+  : base (ref.size(), -1),
+    inserted (ref.size() + 1)
+{
+  const Pos n = read.size(), m = ref.size();
+  // band of diagonals d = j - i
+  const Pos dMin = min ((Pos) 0, m - n) - band, dMax = max ((Pos) 0, m - n) + band, width = dMax - dMin + 1;
+  const int inf = n + m + 1;
+  vguard<vguard<int> > cost (n + 1, vguard<int> (width, inf));
+  auto inBand = [&] (Pos i, Pos j) { return j >= 0 && j <= m && j - i >= dMin && j - i <= dMax; };
+  auto at = [&] (Pos i, Pos j) -> int& { return cost[i][j - i - dMin]; };
+  for (Pos i = 0; i <= n; ++i)
+    for (Pos j = max ((Pos) 0, i + dMin); j <= min (m, i + dMax); ++j) {
+      if (i == 0 || j == 0) {
+	at(i,j) = 0;  // free leading end gaps
+	continue;
+      }
+      int c = inf;
+      if (inBand(i-1,j-1))
+	c = min (c, at(i-1,j-1) + (read[i-1] == ref[j-1] ? 0 : 1));
+      if (inBand(i-1,j))
+	c = min (c, at(i-1,j) + 1);
+      if (inBand(i,j-1))
+	c = min (c, at(i,j-1) + 1);
+      at(i,j) = c;
+    }
+
+  // free trailing end gaps: finish anywhere on the last row or column
+  Pos bi = -1, bj = -1;
+  int best = inf;
+  for (Pos i = 0; i <= n; ++i)
+    if (inBand(i,m) && at(i,m) < best) {
+      best = at(i,m);
+      bi = i;
+      bj = m;
+    }
+  for (Pos j = 0; j <= m; ++j)
+    if (inBand(n,j) && at(n,j) < best) {
+      best = at(n,j);
+      bi = n;
+      bj = j;
+    }
+  Assert (bi >= 0, "Read and reference don't overlap in alignment band");
+
+  endCol = bj;
+  Pos i = bi, j = bj;
+  while (i > 0 && j > 0) {
+    const int c = at(i,j);
+    if (inBand(i-1,j-1) && c == at(i-1,j-1) + (read[i-1] == ref[j-1] ? 0 : 1)) {
+      base[j-1] = read[i-1];
+      --i;
+      --j;
+    } else if (inBand(i-1,j) && c == at(i-1,j) + 1) {
+      inserted[j].insert (inserted[j].begin(), dnaAlphabetString[read[i-1]]);
+      --i;
+    } else {
+      Assert (inBand(i,j-1) && c == at(i,j-1) + 1, "Alignment traceback failure");
+      --j;
+    }
+  }
+  firstCol = j;
+}
+
+JointDecoder::JointDecoder (const Machine& machine, const MutatorParams& mutatorParams)
+  : machine (machine),
+    mutatorParams (mutatorParams),
+    inputModel (viterbiInputModel (machine, mutatorParams)),
+    maxIterations (DefaultJointMaxIterations),
+    band (DefaultJointBand)
+{ }
+
+TokSeq JointDecoder::consensus (const vguard<TokSeq>& reads, const TokSeq& ref) const {
+  vguard<ReadToReference> align;
+  for (const auto& read: reads)
+    align.push_back (ReadToReference (read, ref, band));
+
+  TokSeq cons;
+  const Pos m = ref.size();
+  for (Pos col = 0; col <= m; ++col) {
+    // insertion between col-1 and col
+    if (col > 0 && col < m) {
+      map<string,int> insCount;
+      int nCovering = 0, nInserting = 0;
+      for (const auto& a: align)
+	if (a.firstCol < col && col < a.endCol) {
+	  ++nCovering;
+	  if (a.inserted[col].size()) {
+	    ++nInserting;
+	    ++insCount[a.inserted[col]];
+	  }
+	}
+      if (2 * nInserting > nCovering) {
+	const auto best = max_element (insCount.begin(), insCount.end(),
+				       [] (const pair<const string,int>& a, const pair<const string,int>& b) { return a.second < b.second; });
+	for (char c: best->first)
+	  cons.push_back (tokenize (c, dnaAlphabetString));
+      }
+    }
+    if (col == m)
+      break;
+    // the column itself
+    vguard<int> baseCount (4, 0);
+    int nBases = 0, nGaps = 0;
+    for (const auto& a: align)
+      if (a.firstCol <= col && col < a.endCol) {
+	if (a.base[col] < 0)
+	  ++nGaps;
+	else {
+	  ++nBases;
+	  ++baseCount[a.base[col]];
+	}
+      }
+    if (nBases >= nGaps) {
+      AlphTok best = ref[col];
+      for (AlphTok b = 0; b < 4; ++b)
+	if (baseCount[b] > baseCount[best])
+	  best = b;
+      cons.push_back (best);
+    }
+  }
+  return cons;
+}
+
+EmitProfile JointDecoder::profile (const vguard<TokSeq>& reads, const TokSeq& ref) const {
+  const MutatorScores scores (mutatorParams);
+  EmitProfile prof (4 * ref.size(), 0);
+  for (const auto& read: reads) {
+    const ReadToReference a (read, ref, band);
+    for (Pos col = a.firstCol; col < a.endCol; ++col)
+      if (a.base[col] >= 0)
+	for (Base b = 0; b < 4; ++b)
+	  prof[4*col + b] += scores.sub[b][a.base[col]];
+  }
+  return prof;
+}
+
+FastSeq JointDecoder::decode (const vguard<FastSeq>& reads) const {
+  Require (reads.size() > 0, "Can't decode an empty cluster");
+  vguard<TokSeq> tok;
+  vguard<size_t> byLength;
+  for (const auto& read: reads) {
+    byLength.push_back (tok.size());
+    tok.push_back (read.tokens (dnaAlphabetString));
+  }
+  sort (byLength.begin(), byLength.end(), [&] (size_t a, size_t b) { return tok[a].size() < tok[b].size(); });
+
+  TokSeq ref = tok[byLength[byLength.size() / 2]];
+  int iter = 0;
+  while (iter < maxIterations) {
+    ++iter;
+    const TokSeq next = consensus (tok, ref);
+    LogThisAt(4,"Consensus iteration " << iter << ": length " << next.size() << endl);
+    if (next == ref)
+      break;
+    ref = next;
+  }
+
+  FastSeq refSeq;
+  refSeq.name = reads.front().name + "/consensus";
+  refSeq.seq = detokenize (ref, dnaAlphabetString);
+  const ViterbiMatrix vit (machine, inputModel, mutatorParams, refSeq, profile (tok, ref));
+  LogThisAt(3,"Joint decoding of " << plural(reads.size(),"read") << ": consensus of length " << ref.size() << " after " << plural(iter,"iteration") << ", loglike " << vit.loglike() << endl);
+  FastSeq inseq;
+  inseq.name = reads.front().name;
+  inseq.seq = vit.traceback();
+  inseq.comment = string("reads=") + to_string(reads.size()) + " iterations=" + to_string(iter);
+  return inseq;
+}
+
+vguard<FastSeq> JointDecoder::decodeClusters (const vguard<FastSeq>& reads, size_t nThreads, const OrientationClassifier* classifier) const {
+  vguard<string> clusterName;
+  map<string,vguard<FastSeq> > clusterReads;
+  for (const auto& read: reads) {
+    string name;
+    for (const auto& word: split (read.comment))
+      if (word.find ("cluster=") == 0)
+	name = word.substr (8);
+    if (!clusterReads.count (name))
+      clusterName.push_back (name);
+    clusterReads[name].push_back (read);
+  }
+  LogThisAt(2,"Decoding " << plural(reads.size(),"read") << " in " << plural(clusterName.size(),"cluster") << endl);
+
+  vguard<FastSeq> decoded (clusterName.size());
+  parallelFor (clusterName.size(), nThreads, [&] (size_t begin, size_t end) {
+      for (size_t c = begin; c < end; ++c) {
+	const vguard<FastSeq>& cluster = clusterReads.at (clusterName[c]);
+	int forwardVotes = 0, reverseVotes = 0;
+	if (classifier)
+	  for (const auto& read: cluster) {
+	    const ReadOrientation orient = classifier->classify (read);
+	    forwardVotes += orient.forwardVotes;
+	    reverseVotes += orient.reverseVotes;
+	  }
+	if (reverseVotes > forwardVotes) {
+	  vguard<FastSeq> rc;
+	  for (const auto& read: cluster)
+	    rc.push_back (revcompFastSeq (read));
+	  decoded[c] = decode (rc);
+	  decoded[c].comment += " revcomp";
+	} else
+	  decoded[c] = decode (cluster);
+	if (clusterName[c].size())
+	  decoded[c].name = string("cluster") + clusterName[c];
+      }
+    }, 1);
+  return decoded;
+}
@@ -0,0 +1,50 @@
+#ifndef CONSENSUS_INCLUDED
+#define CONSENSUS_INCLUDED
+
+#include "viterbi.h"
+#include "orient.h"
+
+#define DefaultJointMaxIterations 4
+#define DefaultJointBand          32
+
+// A read aligned to a reference: base[col] is the read's token aligned to reference position col (-1 for a gap),
+// and inserted[col] is what the read has between reference positions col-1 and col.
+// Columns before the read's first aligned base, or after its last, are uncovered (end gaps are free).
+struct ReadToReference {
+  vguard<int> base;
+  vguard<string> inserted;
+  Pos firstCol, endCol;  // covered columns are [firstCol,endCol)
+
+  ReadToReference (const TokSeq& read, const TokSeq& ref, Pos band);
+};
+
+// Decodes a cluster of reads believed to come from the same strand to a single machine input, by progressive
+// profile refinement:
+//  - the reads are aligned to a reference (initially the median-length read), which is replaced by the majority
+//    consensus of the alignment: a column is kept if most reads covering it have a base there, and an insertion
+//    is made if most reads have one. This repeats until the consensus stops changing (or maxIterations);
+//  - the reads' bases at each consensus position are summed into a profile of substitution scores, and the
+//    profile is Viterbi-decoded as if it were one read, so the machine's constraints and the error model act on
+//    the evidence of every read at once.
+// Errors in a minority of reads are outvoted by the consensus; the Viterbi decoder deals with the rest.
+// Alignments are banded, with a band of at least band plus the difference in lengths, and free end gaps.
+struct JointDecoder {
+  const Machine& machine;
+  const MutatorParams& mutatorParams;
+  const InputModel inputModel;
+  int maxIterations;
+  Pos band;
+
+  JointDecoder (const Machine& machine, const MutatorParams& mutatorParams);
+
+  FastSeq decode (const vguard<FastSeq>& reads) const;
+  // reads are grouped by a "cluster=N" word in their comments (as written by clusteredFastSeqs), or else all decoded
+  // together; clusters are decoded in parallel. If classifier is non-null, the votes of all a cluster's reads decide
+  // its orientation, and a cluster voted reverse is reverse-complemented before decoding
+  vguard<FastSeq> decodeClusters (const vguard<FastSeq>& reads, size_t nThreads, const OrientationClassifier* classifier = NULL) const;
+
+  TokSeq consensus (const vguard<TokSeq>& reads, const TokSeq& ref) const;
+  EmitProfile profile (const vguard<TokSeq>& reads, const TokSeq& ref) const;
+};
+
+#endif /* CONSENSUS_INCLUDED */
@@ -0,0 +1,88 @@
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include "decodecache.h"
+#include "util.h"
+#include "logger.h"
+
+string fnv1aHash (const string& s) {
+  unsigned long long h = 0xcbf29ce484222325ULL;
+  for (unsigned char c: s) {
+    h ^= c;
+    h *= 0x100000001b3ULL;
+  }
+  ostringstream out;
+  out << hex << setw(16) << setfill('0') << h;
+  return out.str();
+}
+
+DecodeCache::DecodeCache (const string& machineDescription, const string& paramsDescription)
+  : machineHash (fnv1aHash (machineDescription)),
+    paramsHash (fnv1aHash (paramsDescription))
+{ }
+
+void DecodeCache::open (const char* cacheFilename) {
+  filename = cacheFilename;
+  ifstream infile (filename);
+  size_t nLines = 0;
+  string line;
+  while (getline (infile, line)) {
+    vguard<string> field;
+    istringstream linestream (line);
+    for (string f; getline (linestream, f, '\t'); )
+      field.push_back (f);
+    if (field.size() != 5) {
+      Warn ("Ignoring malformed line %u of decode cache %s", nLines + 1, filename.c_str());
+    } else if (field[0] == machineHash && field[1] == paramsHash) {
+      Result& r = result[field[2]];
+      r.comment = field[3];
+      r.seq = field[4];
+    }
+    ++nLines;
+  }
+  LogThisAt(3,"Loaded " << plural(result.size(),"decoded read") << " for this machine and parameters from " << filename << " (" << plural(nLines,"line") << ")" << endl);
+}
+
+vguard<FastSeq> DecodeCache::decode (const vguard<FastSeq>& reads, Decoder decoder) {
+  vguard<string> readHash;
+  vguard<FastSeq> todo;
+  set<string> todoHash;
+  for (const auto& read: reads) {
+    readHash.push_back (fnv1aHash (read.seq));
+    if (!result.count (readHash.back()) && !todoHash.count (readHash.back())) {
+      todoHash.insert (readHash.back());
+      todo.push_back (read);
+    }
+  }
+  LogThisAt(3,plural(reads.size(),"read") << ": " << plural(todo.size(),"new sequence") << " to decode, " << (reads.size() - todo.size()) << " duplicate or cached" << endl);
+
+  if (todo.size()) {
+    const vguard<FastSeq> decoded = decoder (todo);
+    Assert (decoded.size() == todo.size(), "Decoder returned %u sequences for %u reads", decoded.size(), todo.size());
+    ofstream outfile;
+    if (filename.size()) {
+      outfile.open (filename, ios::app);
+      if (!outfile)
+	Warn ("Can't write to decode cache %s", filename.c_str());
+    }
+    for (size_t n = 0; n < todo.size(); ++n) {
+      const string h = fnv1aHash (todo[n].seq);
+      Result& r = result[h];
+      r.comment = decoded[n].comment;
+      r.seq = decoded[n].seq;
+      if (outfile)
+	outfile << machineHash << '\t' << paramsHash << '\t' << h << '\t' << r.comment << '\t' << r.seq << endl;
+    }
+  }
+
+  vguard<FastSeq> inseqs;
+  for (size_t n = 0; n < reads.size(); ++n) {
+    const Result& r = result.at (readHash[n]);
+    FastSeq inseq;
+    inseq.name = reads[n].name;
+    inseq.comment = r.comment;
+    inseq.seq = r.seq;
+    inseqs.push_back (inseq);
+  }
+  return inseqs;
+}
@@ -0,0 +1,36 @@
+#ifndef DECODECACHE_INCLUDED
+#define DECODECACHE_INCLUDED
+
+#include <functional>
+#include <unordered_map>
+#include "fastseq.h"
+
+// 64-bit FNV-1a hash, as 16 hex digits. Unlike std::hash, it is the same on every platform, so it can key files.
+string fnv1aHash (const string& s);
+
+// Decodes each distinct read sequence once, copying the result to every read with that sequence.
+// Results can also be kept in a file, so that decoding a larger set of reads later only decodes the new ones.
+// Each line of the file is "machine-hash params-hash read-hash comment decoded-seq", tab-separated;
+// the machine and params hashes are of descriptions of everything (other than the read) that affects the result,
+// and lines for other machines or params are ignored (and kept).
+class DecodeCache {
+public:
+  typedef function<vguard<FastSeq> (const vguard<FastSeq>&)> Decoder;
+
+  const string machineHash, paramsHash;
+
+  DecodeCache (const string& machineDescription, const string& paramsDescription);
+
+  void open (const char* filename);  // load results from filename, if it exists, and append new ones to it
+
+  vguard<FastSeq> decode (const vguard<FastSeq>& reads, Decoder decoder);
+
+private:
+  struct Result {
+    string comment, seq;
+  };
+  string filename;
+  unordered_map<string,Result> result;  // by read hash
+};
+
+#endif /* DECODECACHE_INCLUDED */
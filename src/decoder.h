@@ -4,16 +4,16 @@
 #include "trans.h"
 #include "logger.h"
 
-template<class Writer>
+template<class Writer,class MachineType = Machine>
 struct Decoder {
   typedef map<State,deque<InputSymbol> > StateString;
   typedef typename StateString::iterator StateStringIter;
   
-  const Machine& machine;
+  const MachineType& machine;
   Writer& outs;
   StateString current;
 
-  Decoder (const Machine& machine, Writer& outs)
+  Decoder (const MachineType& machine, Writer& outs)
     : machine(machine),
       outs(outs)
   {
@@ -30,14 +30,14 @@ struct Decoder {
       expand();
       vguard<StateStringIter> ssIter;
       for (StateStringIter ss = current.begin(); ss != current.end(); ++ss)
-	if (machine.state[ss->first].isEnd())
+	if (machine.isEnd(ss->first))
 	  ssIter.push_back (ss);
       if (ssIter.size() == 1)
 	flush (ssIter.front());
       else if (ssIter.size() > 1) {
 	Warn ("Decoder unresolved: %u possible end states", ssIter.size());
 	for (auto ss: ssIter)
-	  Warn ("State %s: input queue %s", machine.state[ss->first].name.c_str(), ss->second.empty() ? "empty" : to_string_join(ss->second,"").c_str());
+	  Warn ("State %s: input queue %s", machine.stateName(ss->first).c_str(), ss->second.empty() ? "empty" : to_string_join(ss->second,"").c_str());
       } else if (current.size() > 1) {
 	Warn ("Decoder unresolved: %u possible states", current.size());
 	showQueue();
@@ -48,7 +48,7 @@ struct Decoder {
 
   void showQueue() const {
     for (const auto& ss: current)
-      Warn ("State %s: input queue %s", machine.state[ss.first].name.c_str(), ss.second.empty() ? "empty" : to_string_join(ss.second,"").c_str());
+      Warn ("State %s: input queue %s", machine.stateName(ss.first).c_str(), ss.second.empty() ? "empty" : to_string_join(ss.second,"").c_str());
   }
   
   void expand() {
@@ -60,16 +60,14 @@ struct Decoder {
 	seen.insert (ss);
 	const State state = ss.first;
 	const auto& str = ss.second;
-	const MachineState& ms = machine.state[state];
-	LogThisAt(10,"Input queue for " << ms.name << " is " << (str.empty() ? string("empty") : string(str.begin(),str.end())) << endl);
-	if (ms.isEnd() || ms.emitsOutput())
+	LogThisAt(10,"Input queue for " << machine.stateName(state) << " is " << (str.empty() ? string("empty") : string(str.begin(),str.end())) << endl);
+	if (machine.isEnd(state) || machine.emitsOutput(state))
 	  next[state] = str;
       }
       for (const auto& ss: current) {
 	const State state = ss.first;
 	const auto& str = ss.second;
-	const MachineState& ms = machine.state[state];
-	for (const auto& t: ms.trans)
+	for (const auto& t: machine.transitions(state))
 	  if (isUsable(t) && t.outputEmpty()) {
 	    auto nextStr = str;
 	    if (!t.inputEmpty())
@@ -77,13 +75,13 @@ struct Decoder {
 	    if (seen.count (t.dest))
 	      Assert (seen.at(t.dest) == nextStr,
 		      "Decoder error: state %s has two possible input queues (%s, %s)",
-		      machine.state[t.dest].name.c_str(),
+		      machine.stateName(t.dest).c_str(),
 		      to_string_join(seen.at(t.dest),"").c_str(),
 		      to_string_join(nextStr,"").c_str());
 	    else {
 	      next[t.dest] = nextStr;
-	      LogThisAt(9,"Transition " << ms.name
-			<< " -> " << machine.state[t.dest].name
+	      LogThisAt(9,"Transition " << machine.stateName(state)
+			<< " -> " << machine.stateName(t.dest)
 			<< (nextStr.empty() ? string() : (string(": input queue ") + to_string_join(nextStr,"")))
 			<< endl);
 	      foundNew = true;
@@ -126,7 +124,7 @@ struct Decoder {
     for (const auto& ss: current) {
       const State state = ss.first;
       const auto& str = ss.second;
-      for (const auto& t: machine.state[state].trans)
+      for (const auto& t: machine.transitions(state))
 	if (isUsable(t) && t.out == outSym) {
 	  const State nextState = t.dest;
 	  auto nextStr = str;
@@ -134,12 +132,12 @@ struct Decoder {
 	    nextStr.push_back (t.in);
 	  Assert (!next.count(nextState) || next.at(nextState) == nextStr,
 		  "Decoder error: state %s has two possible input queues (%s, %s)",
-		  machine.state[nextState].name.c_str(),
+		  machine.stateName(nextState).c_str(),
 		  to_string_join(next.at(nextState),"").c_str(),
 		  to_string_join(nextStr,"").c_str());
 	  next[nextState] = nextStr;
-	  LogThisAt(9,"Transition " << machine.state[state].name
-		    << " -> " << machine.state[nextState].name
+	  LogThisAt(9,"Transition " << machine.stateName(state)
+		    << " -> " << machine.stateName(nextState)
 		    << ": "
 		    << (nextStr.empty() ? string() : (string("input queue ") + to_string_join(nextStr,"") + ", "))
 		    << "output " << t.out
@@ -151,8 +149,7 @@ struct Decoder {
     expand();
     if (current.size() == 1) {
       auto iter = current.begin();
-      const MachineState& ms = machine.state[iter->first];
-      if (ms.exitsWithInput())
+      if (machine.exitsWithInput(iter->first))
 	flush (iter);
     } else
       shiftResolvedSymbols();
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <climits>
+#include "editdistance.h"
+#include "parallel.h"
+#include "util.h"
+
+typedef unsigned long long Word;
+#define WordBits 64
+
+// One column of the blocked bit-vector DP: blocks [firstBlock,lastBlock] of rows are computed.
+// Row 64*firstBlock (the row above the first computed block) has score top; rows above it are not computed.
+// Rows below the last computed block are taken to be reached by insertions from the last computed row.
+struct MyersColumn {
+  int firstBlock, lastBlock, top;
+  size_t offset;  // into the stored Pv & Mv vectors
+};
+
+// Runs the DP over the columns of y, calling record(j,column,Pv,Mv) after each column j>0, and returns the distance.
+// Pv & Mv are the vertical +1 and -1 delta bit-vectors, indexed by block.
+// The row band follows the banded DP that this replaces: for column j, rows i in [j-bmax,j+bmin] are needed.
+template<class Record>
+static int myersEditDistance (const string& x, const string& y, int band, Record record) {
+  const int xlen = x.length(), ylen = y.length();
+  if (xlen == 0 || ylen == 0)
+    return xlen + ylen;
+
+  if (band < 0)
+    band = max(xlen*2,ylen*2);
+  const int diff = ylen - xlen;
+  const int bmin = max (band/2, -diff);
+  const int bmax = max (band/2, diff);
+
+  const int nBlocks = (xlen + WordBits - 1) / WordBits;
+  vguard<Word> peq (256 * nBlocks, 0);  // peq[c*nBlocks+b] has bit k set if x[64*b+k] == c
+  for (int i = 0; i < xlen; ++i)
+    peq[((unsigned char) x[i]) * nBlocks + i / WordBits] |= ((Word) 1) << (i % WordBits);
+
+  auto lastRow = [&] (int b) { return min ((b + 1) * WordBits, xlen); };
+  auto firstBlock = [&] (int j) { return (max (1, j - bmax) - 1) / WordBits; };
+  auto lastBlock = [&] (int j) { return (min (xlen, j + bmin) - 1) / WordBits; };
+
+  // column 0: score of row i is i
+  vguard<Word> pv (nBlocks, ~(Word) 0), mv (nBlocks, 0);
+  vguard<int> score (nBlocks);  // score of each block's last row
+  for (int b = 0; b < nBlocks; ++b)
+    score[b] = lastRow(b);
+
+  MyersColumn col;
+  col.firstBlock = 0;
+  col.lastBlock = lastBlock(1);
+  col.top = 0;
+  col.offset = 0;
+  for (int j = 1; j <= ylen; ++j) {
+    const int fb = firstBlock(j), lb = lastBlock(j);
+    if (fb > col.firstBlock)
+      col.top = score[fb-1];  // blocks above fb are dropped; row 64*fb is now the top
+    // blocks entering the band start from column j-1 as insertions below the last computed row
+    for (int b = col.lastBlock + 1; b <= lb; ++b) {
+      pv[b] = ~(Word) 0;
+      mv[b] = 0;
+      score[b] = score[b-1] + lastRow(b) - b * WordBits;
+    }
+    col.firstBlock = fb;
+    col.lastBlock = lb;
+    // the top row is always reached by a deletion from the left, so its horizontal delta is +1
+    ++col.top;
+
+    const Word* eqBlock = &peq[((unsigned char) y[j-1]) * nBlocks];
+    int hin = 1;
+    for (int b = fb; b <= lb; ++b) {
+      const Word hinNeg = hin < 0 ? 1 : 0, hinPos = hin > 0 ? 1 : 0;
+      Word eq = eqBlock[b];
+      const Word Pv = pv[b], Mv = mv[b];
+      const Word xv = eq | Mv;
+      eq |= hinNeg;
+      const Word xh = (((eq & Pv) + Pv) ^ Pv) | eq;
+      Word ph = Mv | ~(xh | Pv);
+      Word mh = Pv & xh;
+      const int lastBit = lastRow(b) - 1 - b * WordBits;
+      const int hout = (int) ((ph >> lastBit) & 1) - (int) ((mh >> lastBit) & 1);
+      ph = (ph << 1) | hinPos;
+      mh = (mh << 1) | hinNeg;
+      pv[b] = mh | ~(xv | ph);
+      mv[b] = ph & xv;
+      score[b] += hout;
+      hin = hout;
+    }
+    record (j, col, pv, mv);
+  }
+  return score[nBlocks-1];
+}
+
+int editDistance (const string& x, const string& y, int band) {
+  return myersEditDistance (x, y, band, [] (int, const MyersColumn&, const vguard<Word>&, const vguard<Word>&) { });
+}
+
+EditAlignment::EditAlignment (const string& x, const string& y, int band) {
+  const int xlen = x.length(), ylen = y.length();
+  vguard<MyersColumn> column (ylen + 1);
+  vguard<Word> pvStore, mvStore;
+  distance = myersEditDistance (x, y, band, [&] (int j, const MyersColumn& col, const vguard<Word>& pv, const vguard<Word>& mv) {
+      column[j] = col;
+      column[j].offset = pvStore.size();
+      pvStore.insert (pvStore.end(), pv.begin() + col.firstBlock, pv.begin() + col.lastBlock + 1);
+      mvStore.insert (mvStore.end(), mv.begin() + col.firstBlock, mv.begin() + col.lastBlock + 1);
+    });
+
+  // score of cell (i,j), reconstructed from the column's top score and vertical deltas
+  const int inf = INT_MAX / 2;
+  auto cell = [&] (int i, int j) -> int {
+    if (j == 0 || xlen == 0)
+      return i;
+    const MyersColumn& col = column[j];
+    const int top = col.firstBlock * WordBits;
+    if (i < top)
+      return inf;
+    const int bottom = min ((col.lastBlock + 1) * WordBits, xlen);
+    const int extra = max (0, i - bottom);
+    i = min (i, bottom);
+    int s = col.top;
+    for (int b = col.firstBlock; b * WordBits < i; ++b) {
+      const int rows = min (WordBits, i - b * WordBits);
+      const Word mask = rows == WordBits ? ~(Word) 0 : (((Word) 1) << rows) - 1;
+      const size_t k = col.offset + b - col.firstBlock;
+      s += __builtin_popcountll (pvStore[k] & mask) - __builtin_popcountll (mvStore[k] & mask);
+    }
+    return s + extra;
+  };
+
+  int i = xlen, j = ylen;
+  while (i > 0 || j > 0) {
+    if (j == 0) {
+      ops.push_back ('I');
+      --i;
+    } else if (i == 0) {
+      ops.push_back ('D');
+      --j;
+    } else {
+      const int s = cell(i,j);
+      const bool match = x[i-1] == y[j-1];
+      if (cell(i-1,j-1) + (match ? 0 : 1) == s) {
+	ops.push_back (match ? '=' : 'X');
+	--i;
+	--j;
+      } else if (cell(i-1,j) + 1 == s) {
+	ops.push_back ('I');
+	--i;
+      } else {
+	Assert (cell(i,j-1) + 1 == s, "Edit alignment traceback failure");
+	ops.push_back ('D');
+	--j;
+      }
+    }
+  }
+  reverse (ops.begin(), ops.end());
+}
+
+vguard<int> editDistances (const vguard<EditDistanceQuery>& queries, size_t nThreads) {
+  vguard<int> dist (queries.size());
+  parallelFor (queries.size(), nThreads, [&] (size_t begin, size_t end) {
+      for (size_t n = begin; n < end; ++n)
+	dist[n] = editDistance (*queries[n].x, *queries[n].y, queries[n].band);
+    });
+  return dist;
+}
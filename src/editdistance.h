@@ -0,0 +1,35 @@
+#ifndef EDITDISTANCE_INCLUDED
+#define EDITDISTANCE_INCLUDED
+
+#include <string>
+#include "vguard.h"
+
+using namespace std;
+
+// Unit-cost edit distance between x and y, by Myers' bit-vector algorithm in Hyyrö's blocked form:
+// each column of the DP matrix (one character of y) is computed 64 rows (characters of x) per machine word.
+// If band is non-negative, only the blocks of rows that overlap a band of diagonals (band/2 either side of the main
+// diagonal, widened to reach the end of the longer string) are computed; the result is exact if it is at most band/2,
+// and otherwise is guaranteed to be more than band/2. If band is negative, the result is exact.
+int editDistance (const string& x, const string& y, int band = -1);
+
+// An optimal alignment of x to y, computed as editDistance (with the same band), by tracing back through the stored
+// bit-vectors of every column. Each character of ops is one column of the alignment:
+// '=' match, 'X' substitution, 'I' a character of x only, 'D' a character of y only.
+struct EditAlignment {
+  int distance;
+  string ops;
+
+  EditAlignment (const string& x, const string& y, int band = -1);
+};
+
+// A batch of comparisons: editDistance (*x, *y, band)
+struct EditDistanceQuery {
+  const string *x, *y;
+  int band;
+};
+
+// Edit distances of many pairs, computed on nThreads threads
+vguard<int> editDistances (const vguard<EditDistanceQuery>& queries, size_t nThreads);
+
+#endif /* EDITDISTANCE_INCLUDED */
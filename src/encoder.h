@@ -3,18 +3,18 @@
 
 #include "trans.h"
 
-template<class Writer>
+template<class Writer,class MachineType = Machine>
 struct Encoder {
   typedef map<State,deque<InputSymbol> > StateString;
   typedef typename StateString::iterator StateStringIter;
 
-  const Machine& machine;
+  const MachineType& machine;
   Writer& outs;
   StateString current;
   bool sentSOF, sentEOF;
   bool msb0;  // set this to encode MSB first, instead of LSB first
 
-  Encoder (const Machine& machine, Writer& outs)
+  Encoder (const MachineType& machine, Writer& outs)
     : machine(machine),
       outs(outs),
       msb0(false),
@@ -37,14 +37,14 @@ struct Encoder {
       expand();
       vguard<StateStringIter> ssIter;
       for (StateStringIter ss = current.begin(); ss != current.end(); ++ss)
-	if (machine.state[ss->first].isEnd())
+	if (machine.isEnd(ss->first))
 	  ssIter.push_back (ss);
       if (ssIter.size() == 1)
 	flush (ssIter.front());
       else if (ssIter.size() > 1) {
 	Warn ("Encoder unresolved: %u possible end states", ssIter.size());
 	for (auto ss: ssIter)
-	  Warn ("State %s: output queue %s", machine.state[ss->first].name.c_str(), ss->second.empty() ? "empty" : to_string_join(ss->second,"").c_str());
+	  Warn ("State %s: output queue %s", machine.stateName(ss->first).c_str(), ss->second.empty() ? "empty" : to_string_join(ss->second,"").c_str());
       } else if (current.size() > 1) {
 	Warn ("Encoder unresolved: %u possible states", current.size());
 	showQueue();
@@ -55,16 +55,16 @@ struct Encoder {
 
   void showQueue() const {
     for (const auto& ss: current)
-      Warn ("State %s: output queue %s", machine.state[ss.first].name.c_str(), ss.second.empty() ? "empty" : to_string_join(ss.second,"").c_str());
+      Warn ("State %s: output queue %s", machine.stateName(ss.first).c_str(), ss.second.empty() ? "empty" : to_string_join(ss.second,"").c_str());
   }
 
   bool atEnd() const {
-    return current.size() == 1 && machine.state[(*current.begin()).first].isEnd();
+    return current.size() == 1 && machine.isEnd((*current.begin()).first);
   }
 
   bool canEncodeSymbol (InputSymbol sym) const {
     for (const auto& ss: current)
-      if (machine.state[ss.first].transFor(sym) != NULL)
+      if (machine.acceptsInput(ss.first,sym))
 	return true;
     return false;
   }
@@ -78,16 +78,14 @@ struct Encoder {
 	seen.insert (ss);
 	const State state = ss.first;
 	const auto& str = ss.second;
-	const MachineState& ms = machine.state[state];
-	LogThisAt(10,"Output queue for " << ms.name << " is " << (str.empty() ? string("empty") : string(str.begin(),str.end())) << endl);
-	if (ms.isEnd() || ms.exitsWithInput())
+	LogThisAt(10,"Output queue for " << machine.stateName(state) << " is " << (str.empty() ? string("empty") : string(str.begin(),str.end())) << endl);
+	if (machine.isEnd(state) || machine.exitsWithInput(state))
 	  next[state] = str;
       }
       for (const auto& ss: current) {
 	const State state = ss.first;
 	const auto& str = ss.second;
-	const MachineState& ms = machine.state[state];
-	for (const auto& t: ms.trans)
+	for (const auto& t: machine.transitions(state))
 	  if (t.inputEmpty()) {
 	    auto nextStr = str;
 	    if (!t.outputEmpty())
@@ -95,13 +93,13 @@ struct Encoder {
 	    if (seen.count (t.dest))
 	      Assert (seen.at(t.dest) == nextStr,
 		      "Encoder error: state %s has two possible output queues (%s, %s)",
-		      machine.state[t.dest].name.c_str(),
+		      machine.stateName(t.dest).c_str(),
 		      to_string_join(seen.at(t.dest),"").c_str(),
 		      to_string_join(nextStr,"").c_str());
 	    else {
 	      next[t.dest] = nextStr;
-	      LogThisAt(9,"Transition " << ms.name
-			<< " -> " << machine.state[t.dest].name
+	      LogThisAt(9,"Transition " << machine.stateName(state)
+			<< " -> " << machine.stateName(t.dest)
 			<< (nextStr.empty() ? string() : (string(": output queue ") + to_string_join(nextStr,"")))
 			<< endl);
 	      foundNew = true;
@@ -150,7 +148,7 @@ struct Encoder {
     for (const auto& ss: current) {
       const State state = ss.first;
       const auto& str = ss.second;
-      for (const auto& t: machine.state[state].trans)
+      for (const auto& t: machine.transitions(state))
 	if (t.in == inSym) {
 	  const State nextState = t.dest;
 	  auto nextStr = str;
@@ -158,12 +156,12 @@ struct Encoder {
 	    nextStr.push_back (t.out);
 	  Assert (!next.count(nextState) || next.at(nextState) == nextStr,
 		  "Encoder error: state %s has two possible output queues (%s, %s)",
-		  machine.state[nextState].name.c_str(),
+		  machine.stateName(nextState).c_str(),
 		  to_string_join(next.at(nextState),"").c_str(),
 		  to_string_join(nextStr,"").c_str());
 	  next[nextState] = nextStr;
-	  LogThisAt(9,"Transition " << machine.state[state].name
-		    << " -> " << machine.state[nextState].name
+	  LogThisAt(9,"Transition " << machine.stateName(state)
+		    << " -> " << machine.stateName(nextState)
 		    << ": "
 		    << (nextStr.empty() ? string() : (string("output queue ") + to_string_join(nextStr,"") + ", "))
 		    << "input " << t.in
@@ -175,8 +173,7 @@ struct Encoder {
     expand();
     if (current.size() == 1) {
       auto iter = current.begin();
-      const MachineState& ms = machine.state[iter->first];
-      if (ms.emitsOutput())
+      if (machine.emitsOutput(iter->first))
 	flush (iter);
     } else
       shiftResolvedSymbols();
@@ -2,6 +2,7 @@
 #include "fwdback.h"
 #include "logsumexp.h"
 #include "logger.h"
+#include "metrics.h"
 
 #define FwdBackTolerance 1e-5
 #define BaumWelchMinFracInc .001
@@ -45,6 +46,11 @@ ForwardMatrix::ForwardMatrix (const MutatorParams& mutatorParams, const Stockhol
 {
   sCell(0,0) = 0;
 
+  vguard<LogProb> tanDupLenScore (maxDupLen), dupScore (maxDupLen);
+  for (Pos dupIdx = 0; dupIdx < (Pos) maxDupLen; ++dupIdx)
+    tanDupLenScore[dupIdx] = mutatorScores.tanDup + mutatorScores.len[dupIdx];
+
+  MetricPhase (span, "forward.fill", "cells");
   ProgressLog (plog, 3);
   plog.initProgress ("Forward matrix fill (%u*%u cells)", inLen, outLen);
 
@@ -52,6 +58,7 @@ ForwardMatrix::ForwardMatrix (const MutatorParams& mutatorParams, const Stockhol
     plog.logProgress (ip / (double) inLen, "row %u/%u", ip+1, inLen);
     for (SeqIdx op = 0; op <= outLen; ++op)
       if (env.inRange(ip,op)) {
+	++span.items;
 	Cell& cell = getCell(ip,op);
 	if (ip > 0 && op > 0) {
 	  if (env.inRange(ip-1,op-1))
@@ -69,11 +76,14 @@ ForwardMatrix::ForwardMatrix (const MutatorParams& mutatorParams, const Stockhol
 				del.d + mutatorScores.delExtend);
 	}
 	log_accum_exp (cell.s, cell.d + mutatorScores.delEnd);
-	for (Pos dupIdx = 0; dupIdx < maxDupLenAt(ip); ++dupIdx)
-	  log_accum_exp (cell.t[dupIdx], cell.s + mutatorScores.tanDup + mutatorScores.len[dupIdx]);
+	const Pos nDup = maxDupLenAt(ip);
+	for (Pos dupIdx = 0; dupIdx < nDup; ++dupIdx)
+	  dupScore[dupIdx] = cell.s + tanDupLenScore[dupIdx];
+	log_accum_exp (cell.t.data(), dupScore.data(), nDup);
       }
   }
   loglike = sCell(inLen,outLen);
+  MetricCount ("bytesAllocated.forward", span.items * (maxDupLen + 2) * sizeof(LogProb));
   LogThisAt(6,"Forward log-odds ratio: " << loglike << endl);
 }
 
@@ -83,6 +93,12 @@ BackwardMatrix::BackwardMatrix (const ForwardMatrix& fwd)
 {
   sCell(inLen,outLen) = 0;
 
+  // terms of the sum for cell.s: the match/insert term, the deletion term, and one per duplication length
+  vguard<LogProb> tanDupLenScore (maxDupLen), sTerm (maxDupLen + 2);
+  for (Pos dupIdx = 0; dupIdx < (Pos) maxDupLen; ++dupIdx)
+    tanDupLenScore[dupIdx] = mutatorScores.tanDup + mutatorScores.len[dupIdx];
+
+  MetricPhase (span, "backward.fill", "cells");
   ProgressLog (plog, 3);
   plog.initProgress ("Backward matrix fill (%u*%u cells)", inLen, outLen);
 
@@ -90,6 +106,7 @@ BackwardMatrix::BackwardMatrix (const ForwardMatrix& fwd)
     plog.logProgress ((inLen - ip) / (double) inLen, "row %u/%u", inLen-ip+1, inLen);
     for (int op = outLen; op >= 0; --op)
       if (env.inRange(ip,op)) {
+	++span.items;
 	Cell& cell = getCell(ip,op);
 	if (op < outLen) {
 	  if (ip < inLen && env.inRange(ip+1,op+1))
@@ -101,17 +118,21 @@ BackwardMatrix::BackwardMatrix (const ForwardMatrix& fwd)
 	    cell.t[0] = cellTanDupScore(ip,op+1,0) + ins.s;
 	  }
 	}
+	size_t nTerms = 0;
+	sTerm[nTerms++] = cell.s;
 	if (ip < inLen && env.inRange(ip+1,op)) {
 	  const Cell& del = getCell(ip+1,op);
-	  log_accum_exp (cell.s, mutatorScores.delOpen + del.d);
+	  sTerm[nTerms++] = mutatorScores.delOpen + del.d;
 	  cell.d = mutatorScores.delExtend + del.d;
 	}
 	for (Pos dupIdx = 0; dupIdx < maxDupLenAt(ip); ++dupIdx)
-	  log_accum_exp (cell.s, cell.t[dupIdx] + mutatorScores.tanDup + mutatorScores.len[dupIdx]);
+	  sTerm[nTerms++] = cell.t[dupIdx] + tanDupLenScore[dupIdx];
+	cell.s = log_sum_exp (sTerm.data(), nTerms);
 	log_accum_exp (cell.d, cell.s + mutatorScores.delEnd);
       }
   }
   loglike = sCell(0,0);
+  MetricCount ("bytesAllocated.backward", span.items * (maxDupLen + 2) * sizeof(LogProb));
   LogThisAt(6,"Backward log-odds ratio: " << loglike << endl);
 }
 
@@ -0,0 +1,217 @@
+#include <set>
+#include "implicit.h"
+#include "logger.h"
+
+ImplicitMachine::ImplicitMachine (const TransBuilder& builder)
+  : ImplicitMachine (builder, builder.len)
+{ }
+
+ImplicitMachine::ImplicitMachine (const TransBuilder& builder, Pos lookahead)
+  : filter (builder),
+    startKmer (0),
+    len (builder.len),
+    lookahead (lookahead)
+{
+  if (len <= ImplicitMaxBitmapLen) {
+    liveKnown = vguard<bool> (filter.maxKmer + 1);
+    liveBit = vguard<bool> (filter.maxKmer + 1);
+  }
+  Require (findStartKmer (0, 0, startKmer), "No %d-mers pass the filters", len);
+  LogThisAt(2,"Implicit " << len << "-mer machine starts at " << kmerString(startKmer,len) << endl);
+}
+
+bool ImplicitMachine::knownLive (Kmer kmer) const {
+  if (len <= ImplicitMaxBitmapLen)
+    return liveKnown[kmer] && liveBit[kmer];
+  const auto iter = liveCache.find (kmer);
+  return iter != liveCache.end() && iter->second;
+}
+
+bool ImplicitMachine::isLive (Kmer kmer, Pos depth) const {
+  if (!filter.isCandidateExtension (kmer))
+    return false;
+  if (depth == 0)
+    return true;
+  const Kmer prefix = (kmer << 2) & filter.maxKmer;
+  for (Base b = 0; b < 4; ++b)
+    if (knownLive (prefix | b) || isLive (prefix | b, depth - 1))
+      return true;
+  LogThisAt(6,"Rejecting " << kmerString(kmer,len) << " as it can't be extended by " << plural(depth,"base") << endl);
+  return false;
+}
+
+bool ImplicitMachine::isLive (Kmer kmer) const {
+  if (len <= ImplicitMaxBitmapLen) {
+    if (!liveKnown[kmer]) {
+      liveBit[kmer] = filter.isCandidate (kmer) && isLive (kmer, lookahead);
+      liveKnown[kmer] = true;
+    }
+    return liveBit[kmer];
+  }
+  const auto iter = liveCache.find (kmer);
+  if (iter != liveCache.end())
+    return iter->second;
+  if (liveCache.size() >= ImplicitMaxCacheEntries)
+    liveCache.clear();
+  return liveCache[kmer] = filter.isCandidate (kmer) && isLive (kmer, lookahead);
+}
+
+bool ImplicitMachine::findStartKmer (Kmer prefix, Pos prefixLen, Kmer& kmer) const {
+  if (prefixLen == len) {
+    if (!isLive (prefix))
+      return false;
+    kmer = prefix;
+    return true;
+  }
+  for (Base b = 0; b < 4; ++b) {
+    const Kmer next = (prefix << 2) | b;
+    if (!filter.endsWithRepeat (next, prefixLen + 1) && findStartKmer (next, prefixLen + 1, kmer))
+      return true;
+  }
+  return false;
+}
+
+void ImplicitMachine::getOutgoing (Kmer kmer, vguard<Kmer>& out) const {
+  out.clear();
+  const Kmer prefix = (kmer << 2) & filter.maxKmer;
+  for (Base b = 0; b < 4; ++b)
+    if (isLive (prefix | b))
+      out.push_back (prefix | b);
+}
+
+string ImplicitMachine::stateName (State s) const {
+  if (s == ImplicitStartState)
+    return string("Start");
+  if (s == ImplicitEndState)
+    return string("End");
+  const string kmer = kmerString (stateKmer(s), len);
+  switch (stateTag(s)) {
+  case ImplicitSplit0Tag: return string("Split0#") + kmer;
+  case ImplicitSplit1Tag: return string("Split1#") + kmer;
+  default: break;
+  }
+  return string("Code#") + kmer;
+}
+
+string ImplicitMachine::leftContext (State s) const {
+  return stateTag(s) == ImplicitSpecialTag
+    ? string (len, MachineWildContext)
+    : kmerString (stateKmer(s), len);
+}
+
+vguard<MachineTransition> ImplicitMachine::transitions (State s) const {
+  vguard<MachineTransition> trans;
+  const int tag = stateTag(s);
+  if (s == ImplicitStartState)
+    trans.push_back (MachineTransition (MachineSOF, MachineNull, makeState (ImplicitCodeTag, startKmer)));
+
+  else if (tag != ImplicitSpecialTag) {
+    const Kmer kmer = stateKmer(s);
+    vguard<Kmer> out;
+    getOutgoing (kmer, out);
+    const size_t n = out.size();
+    if (n == 0)
+      return trans;
+
+    const size_t r = kmer % n, i = r, j = (r + 1) % n, k = (r + 2) % n, l = (r + 3) % n;
+    auto outChar = [&] (size_t idx) { return baseToChar (getBase (out[idx], 1)); };
+    auto outState = [&] (size_t idx) { return makeState (ImplicitCodeTag, out[idx]); };
+    const State s0 = makeState (ImplicitSplit0Tag, kmer), s1 = makeState (ImplicitSplit1Tag, kmer);
+
+    if (tag == ImplicitCodeTag) {
+      if (n == 1)
+	trans.push_back (MachineTransition (MachineNull, outChar(0), outState(0)));
+
+      else if (n == 2) {
+	trans.push_back (MachineTransition (MachineBit0, outChar(i), outState(i)));
+	trans.push_back (MachineTransition (MachineBit1, outChar(j), outState(j)));
+	trans.push_back (MachineTransition (MachineFlush, MachineNull, s));
+	trans.push_back (MachineTransition (MachineStrictBit0, outChar(i), outState(i)));
+	trans.push_back (MachineTransition (MachineStrictBit1, outChar(j), outState(j)));
+
+      } else if (n == 3) {
+	trans.push_back (MachineTransition (MachineBit0, MachineNull, s0));
+	trans.push_back (MachineTransition (MachineBit1, outChar(k), outState(k)));
+	trans.push_back (MachineTransition (MachineFlush, MachineNull, s));
+	trans.push_back (MachineTransition (MachineStrictTrit0, outChar(i), outState(i)));
+	trans.push_back (MachineTransition (MachineStrictTrit1, outChar(j), outState(j)));
+	trans.push_back (MachineTransition (MachineStrictTrit2, outChar(k), outState(k)));
+
+      } else {
+	trans.push_back (MachineTransition (MachineBit0, MachineNull, s0));
+	trans.push_back (MachineTransition (MachineBit1, MachineNull, s1));
+	trans.push_back (MachineTransition (MachineFlush, MachineNull, s));
+	trans.push_back (MachineTransition (MachineStrictQuat0, outChar(i), outState(i)));
+	trans.push_back (MachineTransition (MachineStrictQuat1, outChar(j), outState(j)));
+	trans.push_back (MachineTransition (MachineStrictQuat2, outChar(k), outState(k)));
+	trans.push_back (MachineTransition (MachineStrictQuat3, outChar(l), outState(l)));
+      }
+
+      if (n > 1)
+	trans.push_back (MachineTransition (MachineEOF, MachineNull, ImplicitEndState));
+
+    } else if (tag == ImplicitSplit0Tag && n > 2) {
+      trans.push_back (MachineTransition (MachineBit0, outChar(i), outState(i)));
+      trans.push_back (MachineTransition (MachineBit1, outChar(j), outState(j)));
+      trans.push_back (MachineTransition (MachineFlush, outChar(i), outState(i)));
+
+    } else if (tag == ImplicitSplit1Tag && n > 3) {
+      trans.push_back (MachineTransition (MachineBit0, outChar(k), outState(k)));
+      trans.push_back (MachineTransition (MachineBit1, outChar(l), outState(l)));
+      trans.push_back (MachineTransition (MachineFlush, outChar(l), outState(l)));
+    }
+  }
+  return trans;
+}
+
+bool ImplicitMachine::acceptsInput (State s, InputSymbol in) const {
+  for (const auto& t: transitions(s))
+    if (t.in == in)
+      return true;
+  return false;
+}
+
+bool ImplicitMachine::isEnd (State s) const {
+  return transitions(s).empty();
+}
+
+bool ImplicitMachine::exitsWithInput (State s) const {
+  for (const auto& t: transitions(s))
+    if (t.in)
+      return true;
+  return false;
+}
+
+bool ImplicitMachine::emitsOutput (State s) const {
+  for (const auto& t: transitions(s))
+    if (t.out)
+      return true;
+  return false;
+}
+
+string ImplicitMachine::inputAlphabet (int inputFlags) const {
+  const string symbols = { MachineSOF, MachineEOF, MachineBit0, MachineBit1, MachineFlush,
+			   MachineStrictBit0, MachineStrictBit1,
+			   MachineStrictTrit0, MachineStrictTrit1, MachineStrictTrit2,
+			   MachineStrictQuat0, MachineStrictQuat1, MachineStrictQuat2, MachineStrictQuat3 };
+  set<char> alph;
+  for (char c: symbols)
+    if (((c == MachineSOF || c == MachineEOF) && (inputFlags & MachineSEOFInputFlag))
+	|| (c == MachineFlush && (inputFlags & MachineFlushInputFlag))
+	|| (Machine::isRelaxed(c) && (inputFlags & MachineRelaxedInputFlag))
+	|| (Machine::isStrict(c) && (inputFlags & MachineStrictInputFlag)))
+      alph.insert (c);
+  return string (alph.begin(), alph.end());
+}
+
+vguard<State> ImplicitMachine::localStartStates (const TokSeq& seq, Pos pos) const {
+  vguard<State> states;
+  if (pos >= len && pos < 2*len) {
+    Kmer kmer = 0;
+    for (Pos i = pos - len; i < pos; ++i)
+      kmer = (kmer << 2) | seq[i];
+    if (isLive (kmer))
+      states.push_back (makeState (ImplicitCodeTag, kmer));
+  }
+  return states;
+}
@@ -0,0 +1,85 @@
+#ifndef IMPLICIT_INCLUDED
+#define IMPLICIT_INCLUDED
+
+#include <string>
+#include <unordered_map>
+#include "vguard.h"
+#include "kmer.h"
+#include "trans.h"
+#include "builder.h"
+#include "fastseq.h"
+
+using namespace std;
+
+// State layout for ImplicitMachine: the low 2*len bits hold the kmer (the state's left context),
+// and the top two bits tag the state type, so every state is named by its packed kmer.
+#define ImplicitTagShift    62
+#define ImplicitCodeTag     0
+#define ImplicitSplit0Tag   1
+#define ImplicitSplit1Tag   2
+#define ImplicitSpecialTag  3
+#define ImplicitKmerMask    ((((State) 1) << ImplicitTagShift) - 1)
+#define ImplicitStartState  (((State) ImplicitSpecialTag) << ImplicitTagShift)
+#define ImplicitEndState    (ImplicitStartState | 1)
+
+// Above this length, liveness is memoized in a bounded hash table instead of a bitmap over all kmers
+#define ImplicitMaxBitmapLen    12
+#define ImplicitMaxCacheEntries (1 << 22)
+
+// De Bruijn code machine whose states are never materialized.
+// Transitions are computed on demand from the kmer bits, using the same filters and branch layout as
+// TransBuilder::makeMachine (split states for 3- and 4-way branches, strict and flush inputs, EOF from
+// every branching state). Differences from the explicit machine:
+//  - no control words (so no Bridge states), and no delayed variant;
+//  - a kmer is kept if it passes the filters and can be extended by at least `lookahead` further kmers
+//    that also pass, in place of the global dead-end and reachability pruning;
+//  - the assignment of input bits to branches is rotated by (kmer % outdegree), not by a running count;
+//  - the machine starts at the lexicographically first live kmer.
+// Provides the per-state accessors used by the Encoder and Decoder templates.
+class ImplicitMachine {
+private:
+  TransBuilder filter;  // supplies the kmer filters; its tables are never allocated
+  Kmer startKmer;
+
+  mutable vguard<bool> liveKnown, liveBit;  // memo, if len <= ImplicitMaxBitmapLen
+  mutable unordered_map<Kmer,bool> liveCache;  // memo, otherwise
+
+  bool isLive (Kmer kmer, Pos depth) const;  // assumes the first len-1 bases of kmer are repeat-free
+  bool knownLive (Kmer kmer) const;  // true if kmer is already memoized as live
+  bool findStartKmer (Kmer prefix, Pos prefixLen, Kmer& kmer) const;
+
+public:
+  const Pos len;
+  const Pos lookahead;
+
+  ImplicitMachine (const TransBuilder& builder);
+  ImplicitMachine (const TransBuilder& builder, Pos lookahead);
+
+  static inline int stateTag (State s) { return s >> ImplicitTagShift; }
+  static inline Kmer stateKmer (State s) { return s & ImplicitKmerMask; }
+  static inline State makeState (int tag, Kmer kmer) { return (((State) tag) << ImplicitTagShift) | kmer; }
+
+  bool isLive (Kmer kmer) const;  // true if kmer is a Code state of this machine
+  void getOutgoing (Kmer kmer, vguard<Kmer>& out) const;  // live successors, in base order
+
+  State startState() const { return ImplicitStartState; }
+  State endState() const { return ImplicitEndState; }
+
+  // accessors
+  string stateName (State s) const;
+  string leftContext (State s) const;
+  string rightContext (State s) const { return string(); }
+  vguard<MachineTransition> transitions (State s) const;
+  bool acceptsInput (State s, InputSymbol in) const;
+  bool isEnd (State s) const;
+  bool exitsWithInput (State s) const;
+  bool emitsOutput (State s) const;
+
+  string inputAlphabet (int inputFlags = MachineDefaultInputFlags) const;
+
+  // for the beam Viterbi decoder
+  size_t maxLeftContext() const { return len; }
+  vguard<State> localStartStates (const TokSeq& seq, Pos pos) const;  // live kmers read off the first few windows
+};
+
+#endif /* IMPLICIT_INCLUDED */
@@ -2,6 +2,7 @@
 #define KMER_INCLUDED
 
 #include <cmath>
+#include <cstring>
 #include <string>
 #include "vguard.h"
 #include "util.h"
@@ -130,7 +131,7 @@ inline size_t kmerHammingDistance (Kmer a, Kmer b, Pos len) {
   return d;
 }
 
-inline Kmer kmerMask (Pos len) {
+constexpr Kmer kmerMask (Pos len) {
   // 4^len - 1 = 2^(2*len) - 1 = (1 << (2*len)) - 1 = (1 << (len << 1)) - 1
   return (((Kmer) 1) << (len << 1)) - 1;
 }
@@ -155,15 +156,54 @@ inline string kmerSubAt (Kmer kmer, Pos start, Pos len, Pos kmerLen) {
   return kmerString (kmerSub (kmer, start, len), len) + kmerSubCoords(start,len,kmerLen);
 }
 
+// Complementing a base flips both its bits (complementBase(b) == 3-b), so the whole kmer is complemented at once;
+// the bases are then reversed by swapping neighboring bases, neighboring pairs, and (bswap) bytes.
 inline Kmer kmerRevComp (Kmer kmer, Pos len) {
-  Kmer rc = 0;
-  for (Pos i = 1; i <= len; ++i)
-    rc = (rc << 2) | complementBase (getBase(kmer,i));
-  return rc;
+  if (len <= 0)
+    return 0;
+  Kmer x = ~kmer;
+  x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+  x = ((x >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((x & 0x0f0f0f0f0f0f0f0fULL) << 4);
+  return __builtin_bswap64 (x) >> (64 - (len << 1));
 }
 
 struct EdgeVector : vguard<Kmer> {
   EdgeVector() : vguard<Kmer>(4) { }
 };
 
+// Set of kmers, bit-packed 64 to a word.
+// After indexRanks(), rank(kmer) gives the number of kmers in the set that are less than kmer,
+// so per-kmer data for the members can be kept in a dense array. The ranks are not updated by set() or reset().
+class KmerBitmap {
+private:
+  typedef unsigned long long Word;
+  vguard<Word> word;
+  vguard<unsigned int> wordRank;  // number of set bits in preceding words
+public:
+  KmerBitmap() { }
+  KmerBitmap (Kmer size) : word ((size + 63) >> 6, 0) { }
+  inline bool operator[] (Kmer kmer) const { return (word[kmer >> 6] >> (kmer & 63)) & 1; }
+  inline void set (Kmer kmer) { word[kmer >> 6] |= ((Word) 1) << (kmer & 63); }
+  inline void reset (Kmer kmer) { word[kmer >> 6] &= ~(((Word) 1) << (kmer & 63)); }
+  inline size_t bytes() const { return word.size() * sizeof(Word) + wordRank.size() * sizeof(unsigned int); }
+  Kmer count() const {
+    Kmer n = 0;
+    for (auto w: word)
+      n += __builtin_popcountll (w);
+    return n;
+  }
+  void indexRanks() {
+    wordRank = vguard<unsigned int> (word.size());
+    Kmer n = 0;
+    for (size_t w = 0; w < word.size(); ++w) {
+      wordRank[w] = n;
+      n += __builtin_popcountll (word[w]);
+    }
+    Require (n <= 0xffffffffULL, "Too many kmers to rank");
+  }
+  inline Kmer rank (Kmer kmer) const {
+    return wordRank[kmer >> 6] + __builtin_popcountll (word[kmer >> 6] & ((((Word) 1) << (kmer & 63)) - 1));
+  }
+};
+
 #endif /* KMER_INCLUDED */
@@ -16,9 +16,22 @@ string ansiEscape (int code) {
   return string("\x1b[") + to_string(code) + "m";
 }
 
+string getThreadIdString (thread::id id) {
+  ostringstream o;
+  o << "thread " << id;
+  return o.str();
+}
+
+// wait between checks of the queue, when the writer thread wasn't woken
+#define LogWriterPollMilliseconds 10
+
 Logger::Logger()
-  : verbosity(0), useAnsiColor(true)
+  : verbosity(0), useAnsiColor(true),
+    queueHead (new LogMessage()),
+    nQueued(0), nWritten(0),
+    writerRunning(false), stopWriter(false)
 {
+  queueTail = queueHead.load();
   for (int col : { 7, 2, 3, 5, 6, 1, 2, 3, 5, 6 })  // no blue, it's invisible
     logAnsiColor.push_back (ansiEscape(30 + col) + ansiEscape(40));
   threadAnsiColor = ansiEscape(37) + ansiEscape(41);  // white on red
@@ -27,6 +40,22 @@ Logger::Logger()
   setThreadName (this_thread::get_id(), "main thread");
 }
 
+Logger::~Logger() {
+  if (writerRunning) {
+    flush();
+    stopWriter = true;
+    wake.notify_one();
+    writer.join();
+    writerRunning = false;
+  }
+  // any messages logged after the writer stopped have been written directly
+  for (LogMessage* msg = queueTail; msg; ) {
+    LogMessage* next = msg->next.load();
+    delete msg;
+    msg = next;
+  }
+}
+
 void Logger::addTag (const char* tag) {
   addTag (string (tag));
 }
@@ -37,6 +66,8 @@ void Logger::addTag (const string& tag) {
 
 void Logger::setVerbose (int v) {
   verbosity = max (verbosity, v);
+  if (v > LOG_MAX_VERBOSITY)
+    Warn ("Verbosity %d requested, but messages above verbosity %d were compiled out", v, LOG_MAX_VERBOSITY);
 }
 
 void Logger::colorOff() {
@@ -53,45 +84,95 @@ void Logger::parseLogArgs (boost::program_options::variables_map& vm) {
     useAnsiColor = false;
 }
 
-void Logger::lock (int color, const char* file, int line, bool banner) {
-  thread::id myId = this_thread::get_id();
-  if (mx.try_lock_for (std::chrono::milliseconds(1000))) {
-    if (lastMxOwner != myId && banner && threadName.size() > 1)
+void Logger::print (const string& text, const char* file, int line, int v) {
+  if (stopWriter) {  // during shutdown
+    thread::id id = this_thread::get_id();
+    LogMessage msg;
+    msg.text = text;
+    msg.color = v;
+    msg.threadId = id;
+    write (msg, id);
+    return;
+  }
+  call_once (writerStarted, [this] () {
+      writer = thread (&Logger::writeLoop, this);
+      writerRunning = true;
+    });
+  LogMessage* msg = new LogMessage();
+  msg->text = text;
+  msg->color = v;
+  msg->threadId = this_thread::get_id();
+  ++nQueued;
+  LogMessage* prev = queueHead.exchange (msg, memory_order_acq_rel);
+  prev->next.store (msg, memory_order_release);
+  wake.notify_one();
+}
+
+void Logger::flush() {
+  const unsigned long long target = nQueued;
+  if (!writerRunning || nWritten >= target)
+    return;
+  wake.notify_one();
+  while (nWritten < target)
+    this_thread::yield();
+}
+
+void Logger::writeLoop() {
+  thread::id lastThreadId = this_thread::get_id();
+  while (true) {
+    if (writeQueued (lastThreadId))
+      continue;
+    if (stopWriter && nWritten == nQueued)
+      break;
+    unique_lock<mutex> lock (wakeMx);
+    wake.wait_for (lock, chrono::milliseconds (LogWriterPollMilliseconds));
+  }
+}
+
+bool Logger::writeQueued (thread::id& lastThreadId) {
+  bool wrote = false;
+  for (LogMessage* next = queueTail->next.load (memory_order_acquire); next; next = queueTail->next.load (memory_order_acquire)) {
+    write (*next, lastThreadId);
+    delete queueTail;
+    queueTail = next;
+    ++nWritten;
+    wrote = true;
+  }
+  if (wrote)
+    clog.flush();
+  return wrote;
+}
+
+void Logger::write (const LogMessage& msg, thread::id& lastThreadId) {
+  if (msg.threadId != lastThreadId) {
+    lock_guard<mutex> lock (threadNameMx);
+    if (threadName.size() > 1)
       clog << (useAnsiColor ? threadAnsiColor.c_str() : "")
-	   << '(' << getThreadName(myId) << ')'
+	   << '(' << (threadName.count(msg.threadId) ? threadName.at(msg.threadId) : getThreadIdString(msg.threadId)) << ')'
 	   << (useAnsiColor ? ansiColorOff.c_str() : "") << ' ';
-    lastMxOwner = myId;
-    mxOwnerFile = file;
-    mxOwnerLine = line;
-  } else if (banner)
-    clog << (useAnsiColor ? threadAnsiColor.c_str() : "")
-	 << '(' << getThreadName(myId) << ", ignoring lock by " << getThreadName(lastMxOwner) << " at " << mxOwnerFile << " line " << mxOwnerLine << ')'
-	 << (useAnsiColor ? ansiColorOff.c_str() : "") << ' ';
-  if (banner && useAnsiColor)
-    clog << (color < 0
+  }
+  lastThreadId = msg.threadId;
+  if (useAnsiColor)
+    clog << (msg.color < 0
 	     ? logAnsiColor.front()
-	     : (color >= (int) logAnsiColor.size()
+	     : (msg.color >= (int) logAnsiColor.size()
 		? logAnsiColor.back()
-		: logAnsiColor[color]));
-}
-
-void Logger::unlock (bool banner) {
-  if (banner && useAnsiColor)
+		: logAnsiColor[msg.color]));
+  clog << msg.text;
+  if (useAnsiColor)
     clog << ansiColorOff;
-  mx.unlock();
 }
 
 string Logger::getThreadName (thread::id id) {
+  lock_guard<mutex> lock (threadNameMx);
   const auto& iter = threadName.find(id);
-  if (iter == threadName.end()) {
-    ostringstream o;
-    o << "thread " << id;
-    return o.str();
-  }
+  if (iter == threadName.end())
+    return getThreadIdString (id);
   return iter->second;
 }
 
 void Logger::setThreadName (thread::id id, const string& name) {
+  lock_guard<mutex> lock (threadNameMx);
   threadName[id] = name;
 }
 
@@ -101,17 +182,38 @@ void Logger::nameLastThread (const list<thread>& threads, const char* prefix) {
 }
 
 void Logger::eraseThreadName (const thread& thr) {
+  lock_guard<mutex> lock (threadNameMx);
   threadName.erase (thr.get_id());
 }
 
+thread_local LogBuffer logBuffer;
+
+ostringstream& LogBuffer::push() {
+  if (depth == stream.size())
+    stream.emplace_back();
+  auto iter = stream.begin();
+  advance (iter, depth++);
+  ostringstream& out = *iter;
+  out.str (string());
+  out.clear();
+  out.flags (ios_base::skipws | ios_base::dec);
+  out.precision (6);
+  out.width (0);
+  out.fill (' ');
+  return out;
+}
+
 ProgressLogger::ProgressLogger (int verbosity, const char* function, const char* file, int line)
-  : msg(NULL), verbosity(verbosity), function(function), file(file), line(line)
+  : ticks(0), nextClockCheckTick(1), ticksPerClockCheck(1), active(false), msg(NULL), verbosity(verbosity), function(function), file(file), line(line)
 { }
 
 void ProgressLogger::initProgress (const char* desc, ...) {
-  startTime = std::chrono::system_clock::now();
+  startTime = lastClockCheck = std::chrono::steady_clock::now();
   lastElapsedSeconds = 0;
   reportInterval = 2;
+  ticks = 0;
+  nextClockCheckTick = ticksPerClockCheck = 1;
+  active = logger.testVerbosityOrLogTags (verbosity, function, file);
 
   time_t rawtime;
   struct tm * timeinfo;
@@ -124,7 +226,7 @@ void ProgressLogger::initProgress (const char* desc, ...) {
   vasprintf (&msg, desc, argptr);
   va_end (argptr);
 
-  if (logger.testVerbosityOrLogTags (verbosity, function, file)) {
+  if (active) {
     ostringstream l;
     l << msg << ": started at " << asctime(timeinfo);
     logger.print (l.str(), file, line, verbosity);
@@ -137,8 +239,17 @@ ProgressLogger::~ProgressLogger() {
 }
 
 void ProgressLogger::logProgress (double completedFraction, const char* desc, ...) {
+  if (!active || ++ticks < nextClockCheckTick)
+    return;
   va_list argptr;
-  const std::chrono::system_clock::time_point currentTime = std::chrono::system_clock::now();
+  const std::chrono::steady_clock::time_point currentTime = std::chrono::steady_clock::now();
+  const double secondsSinceCheck = std::chrono::duration<double> (currentTime - lastClockCheck).count();
+  if (secondsSinceCheck < ProgressClockCheckSeconds / 2 && ticksPerClockCheck < ProgressMaxTicksPerClockCheck)
+    ticksPerClockCheck *= 2;
+  else if (secondsSinceCheck > ProgressClockCheckSeconds * 2 && ticksPerClockCheck > 1)
+    ticksPerClockCheck /= 2;
+  nextClockCheckTick = ticks + ticksPerClockCheck;
+  lastClockCheck = currentTime;
   const auto elapsedSeconds = std::chrono::duration_cast<std::chrono::seconds> (currentTime - startTime).count();
   const double estimatedTotalSeconds = elapsedSeconds / completedFraction;
   if (elapsedSeconds > lastElapsedSeconds + reportInterval) {
@@ -147,7 +258,7 @@ void ProgressLogger::logProgress (double completedFraction, const char* desc, ..
     const double estimatedHoursLeft = estimatedMinutesLeft / 60;
     const double estimatedDaysLeft = estimatedHoursLeft / 24;
 
-    if (completedFraction > 0 && logger.testVerbosityOrLogTags (verbosity, function, file)) {
+    if (completedFraction > 0) {
       char *progMsg;
       va_start (argptr, desc);
       vasprintf (&progMsg, desc, argptr);
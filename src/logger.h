@@ -7,6 +7,8 @@
 #include <string>
 #include <deque>
 #include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include <thread>
 #include <ratio>
 #include <chrono>
@@ -18,6 +20,24 @@
 
 using namespace std;
 
+// Messages above this verbosity are compiled out, so their LogThisAt's cost nothing (e.g. make LOG_MAX_VERBOSITY=4)
+#ifndef LOG_MAX_VERBOSITY
+#define LOG_MAX_VERBOSITY 10
+#endif
+
+// A formatted message, queued for the writer thread
+struct LogMessage {
+  string text;
+  int color;
+  thread::id threadId;
+  atomic<LogMessage*> next;
+  LogMessage() : color(0), next(NULL) { }
+};
+
+// Messages are formatted by the logging thread, then passed to a single writer thread through a lock-free queue,
+// so worker threads never wait on each other to log.
+// The queue is an intrusive multi-producer single-consumer list (Vyukov): producers atomically swap their message in at the head,
+// and the writer follows next pointers from the tail, which is always a message that has already been written (or the initial stub).
 class Logger {
 private:
   int verbosity;
@@ -25,15 +45,29 @@ private:
   bool useAnsiColor;
   vguard<string> logAnsiColor;
   string threadAnsiColor, ansiColorOff;
-  
-  recursive_timed_mutex mx;
-  thread::id lastMxOwner;
-  const char* mxOwnerFile;
-  int mxOwnerLine;
+
+  mutex threadNameMx;
   map<thread::id,string> threadName;
 
+  atomic<LogMessage*> queueHead;
+  LogMessage* queueTail;  // only touched by the writer
+  atomic<unsigned long long> nQueued, nWritten;
+  once_flag writerStarted;
+  thread writer;
+  atomic<bool> writerRunning, stopWriter;
+  mutex wakeMx;
+  condition_variable wake;
+
+  void writeLoop();
+  bool writeQueued (thread::id& lastThreadId);  // writes every message in the queue; false if it was empty
+  void write (const LogMessage& msg, thread::id& lastThreadId);
+
+  Logger (const Logger&) = delete;
+  Logger& operator= (const Logger&) = delete;
+
 public:
   Logger();
+  ~Logger();
   // configuration
   void addTag (const char* tag);
   void addTag (const string& tag);
@@ -50,7 +84,7 @@ public:
   }
 
   inline bool testVerbosityOrLogTags (int v, const char* tag1, const char* tag2) {
-    return verbosity >= v || testLogTag(tag1) || testLogTag(tag2);
+    return verbosity >= v || (!logTags.empty() && (testLogTag(tag1) || testLogTag(tag2)));
   }
 
   string getThreadName (thread::id id);
@@ -58,26 +92,39 @@ public:
   void nameLastThread (const list<thread>& threads, const char* prefix);
   void eraseThreadName (const thread& thr);
 
-  void lock (int color = 0, const char* file = "", const int line = 0, bool banner = true);
-  void unlock (bool endBanner = true);
-  void lockSilently() { lock(0,"",0,false); }
-  void unlockSilently() { unlock(false); }
-
-  template<class T>
-  void print (const T& t, const char* file, int line, int v) {
-    lock(v,file,line,true);
-    clog << t;
-    unlock(true);
-  }
+  // queues a message (file & line are where it was logged from)
+  void print (const string& text, const char* file, int line, int v);
+  // waits until every message queued so far has been written
+  void flush();
 };
 
 extern Logger logger;
 
-#define LoggingAt(V)     (logger.testVerbosity(V))
-#define LoggingThisAt(V) (logger.testVerbosityOrLogTags(V,__func__,__FILE__))
+// Per-thread streams in which messages are formatted, reused from message to message.
+// A message can be logged while another is being formatted, so there's one stream per nesting depth.
+class LogBuffer {
+private:
+  list<ostringstream> stream;
+  size_t depth;
+public:
+  LogBuffer() : depth(0) { }
+  ostringstream& push();
+  void pop() { --depth; }
+};
+
+extern thread_local LogBuffer logBuffer;
+
+struct LogLine {
+  ostringstream& out;
+  LogLine() : out (logBuffer.push()) { }
+  ~LogLine() { logBuffer.pop(); }
+};
+
+#define LoggingAt(V)     ((V) <= LOG_MAX_VERBOSITY && logger.testVerbosity(V))
+#define LoggingThisAt(V) ((V) <= LOG_MAX_VERBOSITY && logger.testVerbosityOrLogTags(V,__func__,__FILE__))
 #define LoggingTag(T)    (logger.testLogTag(T))
 
-#define LogStream(V,S) do { ostringstream tmpLog; tmpLog << S; logger.print(tmpLog.str(),__FILE__,__LINE__,V); } while(0)
+#define LogStream(V,S) do { LogLine tmpLog; tmpLog.out << S; logger.print(tmpLog.out.str(),__FILE__,__LINE__,V); } while(0)
 
 #define LogAt(V,S)     do { if (LoggingAt(V)) LogStream(V,S); } while(0)
 #define LogThisAt(V,S) do { if (LoggingThisAt(V)) LogStream(V,S); } while(0)
@@ -85,10 +132,17 @@ extern Logger logger;
 
 
 /* progress logging */
+// logProgress() may be called in inner loops: it returns at once unless progress is being logged,
+// and then only looks at the clock every ticksPerClockCheck calls, adjusting that so the clock is read a few times a second.
+#define ProgressClockCheckSeconds .25
+#define ProgressMaxTicksPerClockCheck (1ULL << 20)
+
 class ProgressLogger {
 public:
-  std::chrono::system_clock::time_point startTime;
+  std::chrono::steady_clock::time_point startTime, lastClockCheck;
   double lastElapsedSeconds, reportInterval;
+  unsigned long long ticks, nextClockCheckTick, ticksPerClockCheck;
+  bool active;
   char* msg;
   int verbosity;
   const char *function, *file;
@@ -2,20 +2,70 @@
 #include "logsumexp.h"
 #include "util.h"
 
-LogSumExpLookupTable logSumExpLookupTable = LogSumExpLookupTable();
+LogSumExpLookupTable logSumExpLookupTable;
 
 LogSumExpLookupTable::LogSumExpLookupTable() {
-  lookup = new double [LOG_SUM_EXP_LOOKUP_ENTRIES];
-  int n;
-  double x;
-  for (n = 0; n < LOG_SUM_EXP_LOOKUP_ENTRIES; ++n) {
-    x = n * LOG_SUM_EXP_LOOKUP_PRECISION;
-    lookup[n] = log_sum_exp_unary_slow(x);
+  /* each step is the cubic Hermite interpolant of log(1+exp(-x)) between its ends, matching the value & slope at both */
+  const double h = 1. / LOG_SUM_EXP_LOOKUP_STEPS;
+  auto slope = [h] (double x) { return -h / (1. + exp(x)); };  /* d/dt of log(1+exp(-x)), for x = (n+t)*h */
+  for (int n = 0; n < LOG_SUM_EXP_LOOKUP_ENTRIES; ++n) {
+    const double x0 = n * h, x1 = (n + 1) * h;
+    const double f0 = log_sum_exp_unary_slow(x0), f1 = log_sum_exp_unary_slow(x1);
+    const double d0 = slope(x0), d1 = slope(x1);
+    double* c = lookup[n];
+    c[0] = f0;
+    c[1] = d0;
+    c[2] = 3*(f1 - f0) - 2*d0 - d1;
+    c[3] = 2*(f0 - f1) + d0 + d1;
   }
 }
 
-LogSumExpLookupTable::~LogSumExpLookupTable() {
-  delete[] lookup;
+// The vectorized sum keeps four independent lanes, like the batched pattern tests, so the compiler can vectorize it
+// without reassociating a single floating-point reduction (which it won't do without -ffast-math).
+#define LogSumExpLanes 4
+
+double log_sum_exp_vectorized (const double* x, size_t n) {
+  double laneMax[LogSumExpLanes], laneSum[LogSumExpLanes];
+  for (size_t l = 0; l < LogSumExpLanes; ++l)
+    laneMax[l] = -numeric_limits<double>::infinity();
+  size_t i = 0;
+  for (; i + LogSumExpLanes <= n; i += LogSumExpLanes)
+    for (size_t l = 0; l < LogSumExpLanes; ++l)
+      laneMax[l] = x[i+l] > laneMax[l] ? x[i+l] : laneMax[l];
+  double max = laneMax[0];
+  for (size_t l = 1; l < LogSumExpLanes; ++l)
+    max = laneMax[l] > max ? laneMax[l] : max;
+  for (size_t j = i; j < n; ++j)
+    max = x[j] > max ? x[j] : max;
+  if (std::isinf(max))  /* all -inf (or n is zero), or some +inf */
+    return max;
+  for (size_t l = 0; l < LogSumExpLanes; ++l)
+    laneSum[l] = 0;
+  for (i = 0; i + LogSumExpLanes <= n; i += LogSumExpLanes)
+    for (size_t l = 0; l < LogSumExpLanes; ++l)
+      laneSum[l] += exp_nonpositive (x[i+l] - max);
+  double sum = 0;
+  for (size_t j = i; j < n; ++j)
+    sum += exp_nonpositive (x[j] - max);
+  for (size_t l = 0; l < LogSumExpLanes; ++l)
+    sum += laneSum[l];
+  return max + log (sum);
+}
+
+#ifdef __AVX2__
+#define LogSumExpBatchKernel log_sum_exp_branchless
+#else /* __AVX2__ */
+#define LogSumExpBatchKernel log_sum_exp
+#endif /* __AVX2__ */
+
+void log_sum_exp (const double* a, const double* b, double* result, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    result[i] = LogSumExpBatchKernel (a[i], b[i]);
+}
+
+void log_accum_exp (double* acc, const double* x, size_t n) {
+  for (size_t i = 0; i < n; ++i)
+    acc[i] = LogSumExpBatchKernel (acc[i], x[i]);
 }
 
 double log_sum_exp_slow (double a, double b) {
@@ -3,6 +3,9 @@
 
 #include <vector>
 #include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <limits>
 
 using namespace std;
 
@@ -16,17 +19,19 @@ using namespace std;
 #define NAN_DEBUG
 */
 
-#define LOG_SUM_EXP_LOOKUP_MAX 10
-#define LOG_SUM_EXP_LOOKUP_PRECISION .0001
+/* log(1+exp(-x)) is a cubic spline with LOG_SUM_EXP_LOOKUP_STEPS knots per unit of x, up to LOG_SUM_EXP_LOOKUP_MAX,
+   and zero beyond (where it is below 1.2e-7). The table is 8 KB, so it stays in L1 cache during DP fills;
+   the spline's error is below 1e-8. */
+#define LOG_SUM_EXP_LOOKUP_MAX 16
+#define LOG_SUM_EXP_LOOKUP_STEPS 16
 
-#define LOG_SUM_EXP_LOOKUP_ENTRIES (((int) (LOG_SUM_EXP_LOOKUP_MAX / LOG_SUM_EXP_LOOKUP_PRECISION)) + 1)
+#define LOG_SUM_EXP_LOOKUP_ENTRIES (LOG_SUM_EXP_LOOKUP_MAX * LOG_SUM_EXP_LOOKUP_STEPS)
 
 double log_sum_exp_unary_slow (double x);  /* does not use lookup table */
 
 struct LogSumExpLookupTable {
-  double *lookup;
+  double lookup[LOG_SUM_EXP_LOOKUP_ENTRIES][4];  /* cubic coefficients for each step, in the offset from the step's start (0 to 1) */
   LogSumExpLookupTable();
-  ~LogSumExpLookupTable();
 };
 
 extern LogSumExpLookupTable logSumExpLookupTable;
@@ -36,23 +41,70 @@ inline double log_sum_exp_unary (double x) {
 #ifdef LOGSUMEXP_DEBUG
   return log_sum_exp_unary_slow(x);
 #else /* LOGSUMEXP_DEBUG */
-  int n;
-  double dx, f0, f1, df;
-  if (x >= LOG_SUM_EXP_LOOKUP_MAX || std::isnan(x) || std::isinf(x))
+  if (!(x < LOG_SUM_EXP_LOOKUP_MAX) || std::isinf(x))  /* also catches NaN */
     return 0;
   if (x < 0) {  /* really dumb approximation for x < 0. Should never be encountered, so issue a warning */
     cerr << "Called log_sum_exp_unary(x) for negative x = " << x << endl;
     return -x;
   }
-  n = (int) (x / LOG_SUM_EXP_LOOKUP_PRECISION);
-  dx = x - (n * LOG_SUM_EXP_LOOKUP_PRECISION);
-  f0 = logSumExpLookupTable.lookup[n];
-  f1 = logSumExpLookupTable.lookup[n+1];
-  df = f1 - f0;
-  return f0 + df * (dx / LOG_SUM_EXP_LOOKUP_PRECISION);
+  const double nx = x * LOG_SUM_EXP_LOOKUP_STEPS;
+  const int n = (int) nx;
+  const double t = nx - n;
+  const double* c = logSumExpLookupTable.lookup[n];
+  return c[0] + t * (c[1] + t * (c[2] + t * c[3]));
 #endif /* LOGSUMEXP_DEBUG */
 }
 
+/* Branch-free kernels for the batch functions below. These use only arithmetic and bit operations (no table lookups,
+   no library calls), so loops over them can be vectorized. */
+
+/* exp(x) for x <= 0, to a relative error of about 1e-12 (x below -708, or NaN, is treated as -708, giving about 3e-308).
+   x = k*log(2) + r, with |r| <= log(2)/2, and exp(r) is a near-minimax (Chebyshev) polynomial. */
+inline double exp_nonpositive (double x) {
+  x = x > -708. ? x : -708.;
+  const double shifter = 6755399441055744.;  /* 1.5*2^52: adding it rounds k into the low bits of the mantissa */
+  const double kd = x * 1.4426950408889634 + shifter;
+  uint64_t kbits;
+  memcpy (&kbits, &kd, sizeof(double));
+  const double k = kd - shifter;
+  const double r = (x - k * 6.93147180369123816490e-01) - k * 1.90821492927058770002e-10;
+  double p = 2.4876484278433792e-05;
+  p = p * r + 0.00019915872681309032;
+  p = p * r + 0.0013888820952554363;
+  p = p * r + 0.0083332660860249552;
+  p = p * r + 0.041666666895909664;
+  p = p * r + 0.16666666891117587;
+  p = p * r + 0.49999999999787809;
+  p = p * r + 0.99999999997977385;
+  p = p * r + 1.0000000000000004;
+  /* 2^k, by adding k to the exponent of 1.0 (the low bits of kbits are k, in two's complement) */
+  const uint64_t scaleBits = ((uint64_t) 0x3ff << 52) + (kbits << 52);
+  double scale;
+  memcpy (&scale, &scaleBits, sizeof(double));
+  return p * scale;
+}
+
+/* log(1+y) for 0 <= y <= 1, to an absolute error of about 2e-12, as 2*atanh(s) with s = y/(2+y),
+   using a near-minimax polynomial for atanh(s)/s in s^2 (which is at most 1/9) */
+inline double log1p_unit (double y) {
+  const double s = y / (2. + y), s2 = s * s;
+  double p = 0.1093028268533232;
+  p = p * s2 + 0.085612690942698633;
+  p = p * s2 + 0.11152563566958976;
+  p = p * s2 + 0.14284072887691968;
+  p = p * s2 + 0.20000030710351582;
+  p = p * s2 + 0.33333333118964897;
+  p = p * s2 + 1.0000000000024325;
+  return 2. * s * p;
+}
+
+/* log_sum_exp(a,b) without branches or table lookups.
+   If a and b are both infinite, min - max is NaN, which exp_nonpositive treats as -708, so the result is max (e.g. -inf). */
+inline double log_sum_exp_branchless (double a, double b) {
+  const double max = a > b ? a : b, min = a > b ? b : a;
+  return max + log1p_unit (exp_nonpositive (min - max));
+}
+
 inline double log_sum_exp (double a, double b) {
   /* returns log(exp(a) + exp(b)) */
   double max, diff, ret;
@@ -73,12 +125,37 @@ inline double log_sum_exp (double a, double b) {
   return ret;
 }
 
+/* n-ary log-sum-exp: log(exp(x[0]) + ... + exp(x[n-1])); -inf if n is zero.
+   Sums of LOG_SUM_EXP_MIN_VECTOR_TERMS or more terms are computed as max + log(sum(exp(x[i] - max))), with exp_nonpositive
+   in a vectorized loop and one call to log(). Shorter sums are folded pairwise through the lookup table, which is faster
+   for a handful of terms (such as the 3- to 5-argument forms below, or the per-cell sums of the Forward-Backward fills). */
+#define LOG_SUM_EXP_MIN_VECTOR_TERMS 8
+
+double log_sum_exp_vectorized (const double* x, size_t n);
+
+inline double log_sum_exp (const double* x, size_t n) {
+  if (n >= LOG_SUM_EXP_MIN_VECTOR_TERMS)
+    return log_sum_exp_vectorized (x, n);
+  if (n == 0)
+    return -numeric_limits<double>::infinity();
+  double sum = x[0];
+  for (size_t i = 1; i < n; ++i)
+    sum = log_sum_exp (sum, x[i]);
+  return sum;
+}
+
+inline double log_sum_exp (const vector<double>& x) {
+  return log_sum_exp (x.data(), x.size());
+}
+
 inline double log_sum_exp (double a, double b, double c) {
-    return log_sum_exp (log_sum_exp (a, b), c);
+  const double x[] = { a, b, c };
+  return log_sum_exp (x, 3);
 }
 
 inline double log_sum_exp (double a, double b, double c, double d) {
-    return log_sum_exp (log_sum_exp (log_sum_exp (a, b), c), d);
+  const double x[] = { a, b, c, d };
+  return log_sum_exp (x, 4);
 }
 
 inline void log_accum_exp (double& a, double b) {
@@ -86,9 +163,16 @@ inline void log_accum_exp (double& a, double b) {
 }  
 
 inline double log_sum_exp (double a, double b, double c, double d, double e) {
-    return log_sum_exp (log_sum_exp (log_sum_exp (log_sum_exp (a, b), c), d), e);
+  const double x[] = { a, b, c, d, e };
+  return log_sum_exp (x, 5);
 }
 
+/* Batch forms of log_sum_exp(a,b) & log_accum_exp(a,b), elementwise over arrays.
+   Where the target has AVX2, these use log_sum_exp_branchless, four pairs per vector; with narrower vectors,
+   the polynomial kernels cost more than table lookups, so these use the table. */
+void log_sum_exp (const double* a, const double* b, double* result, size_t n);  /* result[i] = log_sum_exp(a[i],b[i]) */
+void log_accum_exp (double* acc, const double* x, size_t n);  /* acc[i] = log_sum_exp(acc[i],x[i]) */
+
 double log_sum_exp_slow (double a, double b);  /* does not use lookup table */
 double log_sum_exp_slow (double a, double b, double c);
 double log_sum_exp_slow (double a, double b, double c, double d);
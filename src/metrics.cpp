@@ -0,0 +1,198 @@
+#include <fstream>
+#include <cmath>
+#include "metrics.h"
+#include "benchmark.h"
+#include "jsonutil.h"
+#include "util.h"
+
+Metrics metrics;
+thread_local MetricsShard* threadMetricsShard = NULL;
+
+void MetricsHistogram::add (double value) {
+  if (count == 0 || value < min)
+    min = value;
+  if (count == 0 || value > max)
+    max = value;
+  ++count;
+  sum += value;
+  const int b = value < 1 ? 0 : (int) log2 (value + 1);
+  ++bucket[b < MetricsHistogramBuckets ? b : MetricsHistogramBuckets - 1];
+}
+
+void MetricsHistogram::merge (const MetricsHistogram& other) {
+  if (other.count == 0)
+    return;
+  if (count == 0 || other.min < min)
+    min = other.min;
+  if (count == 0 || other.max > max)
+    max = other.max;
+  count += other.count;
+  sum += other.sum;
+  for (size_t b = 0; b < bucket.size(); ++b)
+    bucket[b] += other.bucket[b];
+}
+
+Metrics::Metrics()
+  : startTime (chrono::steady_clock::now()),
+    enabled (false)
+{ }
+
+void Metrics::enable() {
+  startTime = chrono::steady_clock::now();
+  enabled = true;
+}
+
+MetricsShard& Metrics::newShard() {
+  lock_guard<mutex> lock (mx);
+  shards.push_back (MetricsShard());
+  return shards.back();
+}
+
+size_t Metrics::findOrAdd (vguard<string>& names, const string& name) {
+  const auto iter = find (names.begin(), names.end(), name);
+  if (iter != names.end())
+    return iter - names.begin();
+  names.push_back (name);
+  return names.size() - 1;
+}
+
+size_t Metrics::counterId (const string& name) {
+  lock_guard<mutex> lock (mx);
+  return findOrAdd (counterName, name);
+}
+
+size_t Metrics::timerId (const string& name, const string& itemName) {
+  lock_guard<mutex> lock (mx);
+  const size_t id = findOrAdd (timerName, name);
+  if (id >= timerItemName.size())
+    timerItemName.resize (id + 1);
+  if (!itemName.empty())
+    timerItemName[id] = itemName;
+  return id;
+}
+
+size_t Metrics::histogramId (const string& name) {
+  lock_guard<mutex> lock (mx);
+  return findOrAdd (histogramName, name);
+}
+
+MetricsShard Metrics::merged() {
+  lock_guard<mutex> lock (mx);
+  MetricsShard total;
+  total.counter = vguard<unsigned long long> (counterName.size(), 0);
+  total.timer = vguard<MetricsTimer> (timerName.size());
+  total.histogram = vguard<MetricsHistogram> (histogramName.size());
+  for (const auto& shard: shards) {
+    for (size_t n = 0; n < shard.counter.size(); ++n)
+      total.counter[n] += shard.counter[n];
+    for (size_t n = 0; n < shard.timer.size(); ++n) {
+      total.timer[n].calls += shard.timer[n].calls;
+      total.timer[n].items += shard.timer[n].items;
+      total.timer[n].seconds += shard.timer[n].seconds;
+    }
+    for (size_t n = 0; n < shard.histogram.size(); ++n)
+      total.histogram[n].merge (shard.histogram[n]);
+  }
+  return total;
+}
+
+// Metrics are written as one JSON object, with each phase, counter & histogram on its own line, sorted by name.
+// Counters named "bytesAllocated.X" are also summed, as "bytesAllocated".
+void Metrics::writeJSON (ostream& out) {
+  const MetricsShard total = merged();
+  const double wallSeconds = chrono::duration<double> (chrono::steady_clock::now() - startTime).count();
+
+  auto sortedIndex = [] (const vguard<string>& names) {
+    map<string,size_t> index;
+    for (size_t n = 0; n < names.size(); ++n)
+      index[names[n]] = n;
+    return index;
+  };
+  auto writeSection = [&] (const char* section, const map<string,string>& entry, bool last) {
+    out << " " << JsonUtil::quoteEscaped (section) << ": {";
+    size_t n = 0;
+    for (const auto& e: entry)
+      out << (n++ ? "," : "") << endl << "  " << JsonUtil::quoteEscaped (e.first) << ": " << e.second;
+    out << (entry.empty() ? "" : "\n ") << "}" << (last ? "" : ",") << endl;
+  };
+
+  map<string,string> phases;
+  for (const auto& ni: sortedIndex (timerName)) {
+    const MetricsTimer& t = total.timer[ni.second];
+    BenchRecord rec;
+    rec.set ("calls", t.calls).set ("seconds", t.seconds);
+    const string& item = timerItemName[ni.second];
+    if (!item.empty())
+      rec.set (item, t.items).set (item + "PerSecond", t.seconds > 0 ? t.items / t.seconds : NAN);
+    ostringstream json;
+    rec.writeJSON (json);
+    phases[ni.first] = json.str();
+  }
+
+  map<string,string> counters;
+  const string bytesPrefix ("bytesAllocated.");
+  unsigned long long bytesAllocated = 0;
+  for (const auto& ni: sortedIndex (counterName)) {
+    counters[ni.first] = to_string (total.counter[ni.second]);
+    if (ni.first.compare (0, bytesPrefix.size(), bytesPrefix) == 0)
+      bytesAllocated += total.counter[ni.second];
+  }
+  counters["bytesAllocated"] = to_string (bytesAllocated);
+
+  map<string,string> histograms;
+  for (const auto& ni: sortedIndex (histogramName)) {
+    const MetricsHistogram& h = total.histogram[ni.second];
+    BenchRecord rec;
+    rec.set ("count", h.count).set ("mean", h.count ? h.sum / h.count : NAN).set ("min", h.min).set ("max", h.max);
+    ostringstream json;
+    rec.writeJSON (json);
+    string s = json.str();
+    size_t nBuckets = h.bucket.size();
+    while (nBuckets > 0 && h.bucket[nBuckets-1] == 0)
+      --nBuckets;
+    s.pop_back();  // closing brace
+    s += ", \"log2Buckets\": [";
+    for (size_t b = 0; b < nBuckets; ++b)
+      s += (b ? ", " : "") + to_string (h.bucket[b]);
+    s += "]}";
+    histograms[ni.first] = s;
+  }
+
+  BenchRecord run;
+  run.set ("wallSeconds", wallSeconds)
+    .set ("peakResidentBytes", peakResidentBytes())
+    .set ("threads", shards.size());
+  out << "{" << endl;
+  for (const auto& f: run.field)
+    out << " " << JsonUtil::quoteEscaped (f.first) << ": " << f.second << "," << endl;
+  writeSection ("phases", phases, false);
+  writeSection ("counters", counters, false);
+  writeSection ("histograms", histograms, true);
+  out << "}" << endl;
+}
+
+void Metrics::writeJSON (const string& filename) {
+  if (filename == "-")
+    writeJSON (cout);
+  else {
+    ofstream out (filename);
+    Require (out.good(), "Couldn't write metrics to %s", filename.c_str());
+    writeJSON (out);
+  }
+}
+
+MetricsWriter::MetricsWriter (const string& filename)
+  : filename (filename)
+{
+  if (!filename.empty())
+    metrics.enable();
+}
+
+MetricsWriter::~MetricsWriter() {
+  if (!filename.empty())
+    try {
+      metrics.writeJSON (filename);
+    } catch (const std::exception& e) {
+      cerr << e.what() << endl;
+    }
+}
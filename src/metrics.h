@@ -0,0 +1,135 @@
+#ifndef METRICS_INCLUDED
+#define METRICS_INCLUDED
+
+#include <string>
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <iostream>
+#include "vguard.h"
+
+using namespace std;
+
+// Counters, phase timers and histograms, for profiling runs without a profiler.
+// Each thread updates its own shard, without locking; the shards outlive their threads, and are merged when the metrics are written.
+// Metrics are named by string, but looked up once per call site (by the macros below), so the hot path is an index into a vector.
+// Nothing is recorded unless metrics are enabled, and a disabled call site costs one test of a global flag.
+
+#define MetricsHistogramBuckets 64  /* bucket b holds values v with floor(log2(v+1)) == b */
+
+struct MetricsTimer {
+  unsigned long long calls, items;
+  double seconds;
+  MetricsTimer() : calls(0), items(0), seconds(0) { }
+};
+
+struct MetricsHistogram {
+  unsigned long long count;
+  double sum, min, max;
+  vguard<unsigned long long> bucket;
+  MetricsHistogram() : count(0), sum(0), min(0), max(0), bucket (MetricsHistogramBuckets, 0) { }
+  void add (double value);
+  void merge (const MetricsHistogram& other);
+};
+
+struct MetricsShard {
+  vguard<unsigned long long> counter;
+  vguard<MetricsTimer> timer;
+  vguard<MetricsHistogram> histogram;
+};
+
+class Metrics {
+private:
+  mutex mx;
+  vguard<string> counterName, timerName, timerItemName, histogramName;
+  list<MetricsShard> shards;
+  chrono::steady_clock::time_point startTime;
+
+  MetricsShard& newShard();
+  static size_t findOrAdd (vguard<string>& names, const string& name);
+
+public:
+  bool enabled;
+
+  Metrics();
+  void enable();
+
+  // ids of named metrics (registered on first use)
+  size_t counterId (const string& name);
+  size_t timerId (const string& name, const string& itemName = string());
+  size_t histogramId (const string& name);
+
+  // this thread's shard
+  inline MetricsShard& shard();
+
+  inline void count (size_t id, unsigned long long n) {
+    vguard<unsigned long long>& c = shard().counter;
+    if (id >= c.size())
+      c.resize (id + 1, 0);
+    c[id] += n;
+  }
+  inline void time (size_t id, double seconds, unsigned long long items) {
+    vguard<MetricsTimer>& t = shard().timer;
+    if (id >= t.size())
+      t.resize (id + 1);
+    ++t[id].calls;
+    t[id].seconds += seconds;
+    t[id].items += items;
+  }
+  inline void sample (size_t id, double value) {
+    vguard<MetricsHistogram>& h = shard().histogram;
+    if (id >= h.size())
+      h.resize (id + 1);
+    h[id].add (value);
+  }
+
+  // merges the shards; call when no other thread is updating metrics
+  MetricsShard merged();
+  void writeJSON (ostream& out);
+  void writeJSON (const string& filename);  // "-" for standard output
+};
+
+extern Metrics metrics;
+extern thread_local MetricsShard* threadMetricsShard;
+
+inline MetricsShard& Metrics::shard() {
+  if (!threadMetricsShard)
+    threadMetricsShard = &newShard();
+  return *threadMetricsShard;
+}
+
+// Times a phase from construction to destruction. Items (cells, states...) done in the phase can be added, for a rate.
+class MetricsSpan {
+private:
+  size_t id;
+  bool active;
+  chrono::steady_clock::time_point start;
+public:
+  unsigned long long items;
+  MetricsSpan (size_t id, unsigned long long items = 0)
+    : id (id), active (metrics.enabled), items (items)
+  {
+    if (active)
+      start = chrono::steady_clock::now();
+  }
+  ~MetricsSpan() {
+    if (active)
+      metrics.time (id, chrono::duration<double> (chrono::steady_clock::now() - start).count(), items);
+  }
+  MetricsSpan (const MetricsSpan&) = delete;
+  MetricsSpan& operator= (const MetricsSpan&) = delete;
+};
+
+// Enables metrics (if given a filename), and writes them to the file when it goes out of scope, e.g. at the end of main()
+struct MetricsWriter {
+  string filename;
+  MetricsWriter (const string& filename);
+  ~MetricsWriter();
+};
+
+#define MetricCount(NAME,N) do { if (metrics.enabled) { static const size_t metricId = metrics.counterId(NAME); metrics.count (metricId, N); } } while(0)
+#define MetricSample(NAME,X) do { if (metrics.enabled) { static const size_t metricId = metrics.histogramId(NAME); metrics.sample (metricId, X); } } while(0)
+// declares a MetricsSpan called SPAN, timing the rest of the enclosing scope
+#define MetricPhase(SPAN,NAME,ITEMNAME) static const size_t SPAN##MetricId = metrics.timerId(NAME,ITEMNAME); MetricsSpan SPAN (SPAN##MetricId)
+
+#endif /* METRICS_INCLUDED */
@@ -0,0 +1,285 @@
+#include <cstring>
+#include <map>
+#include <set>
+#include <deque>
+#include <limits>
+#include <algorithm>
+#include "mixradar.h"
+#include "logger.h"
+
+// strict input symbols of the code machine, in the order mixradar.pl sorts their digit_radix labels
+#define MixRadarDigitOrder "ixpjyqzrs"
+
+#define NoMixRadarClass numeric_limits<size_t>::max()
+
+MixRadarBuilder::MixRadarBuilder (int blockLen)
+  : blockLen (blockLen),
+    eofProb (DefaultMixRadarEOFProb),
+    echo (DefaultMixRadarEcho)
+{ }
+
+MixRadarBuilder::Node::Node()
+  : p(0), A(0), B(0), D(0), E(1), m(0),
+    begin(false), start(false), end(false), prefix(false), input(false)
+{ }
+
+bool MixRadarBuilder::Trans::operator< (const Trans& t) const {
+  const char inKey = in ? in : 'e', tInKey = t.in ? t.in : 'e';  // 'e' is epsilon in mixradar.pl's labels
+  if (inKey != tInKey)
+    return inKey < tInKey;
+  return strchr (MixRadarDigitOrder, out) < strchr (MixRadarDigitOrder, t.out);
+}
+
+OutputSymbol MixRadarBuilder::digitSymbol (int digit, int radix) {
+  static const char* sym[] = { "ij", "xyz", "pqrs" };
+  return sym[radix-2][digit];
+}
+
+// Narrows the output interval [D,E) to the radix digit that contains m
+void MixRadarBuilder::findDigit (double D, double E, double m, int radix, int& digit, double& newD, double& newE) {
+  double d[5];
+  for (int k = 0; k <= radix; ++k)
+    d[k] = D + (E - D) * k / radix;
+  digit = -1;
+  for (int k = 0; k < radix; ++k)
+    if (d[k] <= m && d[k+1] > m) {
+      Assert (digit < 0, "Found two subintervals for radix %d", radix);
+      digit = k;
+    }
+  Assert (digit >= 0, "Couldn't find subinterval: (D,E)=(%g,%g) m=%g radix=%d", D, E, m, radix);
+  newD = d[digit];
+  newE = d[digit+1];
+}
+
+// Upper end of the output intervals at which the tree of digit choices for a block with interval [A,B) and midpoint m
+// stops (those inside [A,B)). The subtree below an output interval depends only on the interval, and many digit
+// sequences lead to the same one (e.g. two binary digits and one quaternary digit), so each is visited once.
+double MixRadarBuilder::finalEnd (double A, double B, double m) {
+  set<pair<double,double> > seen;
+  deque<pair<double,double> > queue (1, make_pair (0., 1.));
+  double maxE = 0;
+  while (!queue.empty()) {
+    const auto de = queue.front();
+    queue.pop_front();
+    for (int radix = 2; radix <= 4; ++radix) {
+      int digit;
+      double D, E;
+      findDigit (de.first, de.second, m, radix, digit, D, E);
+      if (D >= A && E <= B)
+	maxE = max (maxE, E);
+      else if (seen.insert (make_pair (D, E)).second)
+	queue.push_back (make_pair (D, E));
+    }
+  }
+  return maxE;
+}
+
+// Breadth-first tree of digit choices for one input block. At each node, every radix narrows [D,E) to the digit
+// containing the block's midpoint m. A branch stops once [D,E) is inside the block's interval [A,B), or once no other
+// block's tree has the same digit sequence (so the digits seen so far identify the block).
+// The other blocks that share a node's digit sequence are those whose midpoints are in [D,E), and whose trees
+// didn't stop at any of the node's ancestors.
+// A node's subtree depends only on [D,E) and the blocks sharing it, so nodes with the same ones are generated once,
+// making the tree a DAG. Since only a node's first occurrence in the tree has children that are new, states are created
+// in the same relative order as the full tree's.
+void MixRadarBuilder::generateTree (vguard<Node>& node, size_t root, const vguard<size_t>& wordNode) const {
+  vguard<size_t> rootShared;
+  for (size_t w: wordNode)
+    if (w != root)
+      rootShared.push_back (w);
+  map<pair<pair<double,double>,vguard<size_t> >,size_t> seen;
+  deque<pair<size_t,vguard<size_t> > > queue (1, make_pair (root, rootShared));
+  while (!queue.empty()) {
+    const size_t parent = queue.front().first;
+    vguard<size_t> shared;
+    shared.swap (queue.front().second);
+    queue.pop_front();
+    vguard<size_t> stillShared;  // blocks whose trees continue below this node
+    for (size_t w: shared)
+      if (!(node[parent].D >= node[w].A && node[parent].E <= node[w].B))
+	stillShared.push_back (w);
+    for (int radix = 2; radix <= 4; ++radix) {
+      const Node& output = node[parent];
+      Node child;
+      int digit;
+      findDigit (output.D, output.E, output.m, radix, digit, child.D, child.E);
+      child.A = output.A;
+      child.B = output.B;
+      child.m = output.m;
+      const OutputSymbol out = digitSymbol (digit, radix);
+      const bool isFinal = child.D >= child.A && child.E <= child.B;
+      vguard<size_t> childShared;
+      if (!isFinal)
+	for (size_t w: stillShared)
+	  if (child.D <= node[w].m && child.E > node[w].m)
+	    childShared.push_back (w);
+      auto key = make_pair (make_pair (child.D, child.E), childShared);
+      const auto iter = seen.find (key);
+      if (iter != seen.end())
+	node[parent].trans.push_back (Trans { MachineNull, out, iter->second });
+      else {
+	const size_t c = node.size();
+	seen[key] = c;
+	node[parent].trans.push_back (Trans { MachineNull, out, c });
+	node.push_back (child);
+	if (!childShared.empty())
+	  queue.push_back (make_pair (c, childShared));
+      }
+    }
+  }
+}
+
+// Equivalence class of the output subtree below node n, creating classes (and their representatives) as needed
+size_t MixRadarBuilder::treeClass (vguard<Node>& node, size_t n, vguard<size_t>& nodeClass, map<vguard<size_t>,size_t>& classIndex, vguard<size_t>& classRep) {
+  if (nodeClass[n] == NoMixRadarClass) {
+    sort (node[n].trans.begin(), node[n].trans.end());
+    vguard<size_t> key;
+    for (const auto& t: node[n].trans) {
+      key.push_back (t.in);
+      key.push_back (t.out);
+      key.push_back (treeClass (node, t.dest, nodeClass, classIndex, classRep));
+    }
+    const auto ci = classIndex.find (key);
+    if (ci == classIndex.end()) {
+      nodeClass[n] = classIndex[key] = classRep.size();
+      classRep.push_back (n);
+    } else {
+      nodeClass[n] = ci->second;
+      classRep[ci->second] = min (classRep[ci->second], n);
+    }
+  }
+  return nodeClass[n];
+}
+
+Machine MixRadarBuilder::makeMachine() const {
+  Require (blockLen > 0, "Mixed-radix block length must be positive");
+  const double pBit = (1 - eofProb) / 2;
+
+  // prefix tree of input blocks
+  vguard<Node> node (2);
+  const size_t beginNode = 0, startNode = 1;
+  node[beginNode].begin = true;
+  node[startNode].start = true;
+  node[startNode].p = 1;
+  deque<size_t> prefixQueue (1, startNode);
+  vguard<size_t> wordNode;
+  const string alph = string() + MachineBit0 + MachineBit1 + MachineFlush;
+  while (!prefixQueue.empty()) {
+    const size_t parent = prefixQueue.front();
+    prefixQueue.pop_front();
+    for (char c: alph) {
+      if (c == MachineFlush && node[parent].word.empty())  // no need to encode an empty block
+	continue;
+      Node child;
+      child.word = node[parent].word + c;
+      child.p = node[parent].p * (c == MachineFlush ? eofProb : pBit);
+      const size_t n = node.size();
+      node[parent].trans.push_back (Trans { c, MachineNull, n });
+      if (c == MachineFlush || (int) child.word.size() >= blockLen) {
+	child.input = true;
+	wordNode.push_back (n);
+      } else {
+	child.prefix = true;
+	prefixQueue.push_back (n);
+      }
+      node.push_back (child);
+    }
+  }
+  LogThisAt(3,"Mixed-radix code has " << plural(wordNode.size(),"input block") << endl);
+
+  // give blocks adjacent intervals in order of decreasing probability, and generate their output trees
+  sort (wordNode.begin(), wordNode.end(), [&] (size_t a, size_t b) {
+      return node[a].p > node[b].p || (node[a].p == node[b].p && node[a].word < node[b].word);
+    });
+  double norm = 0;
+  for (size_t w: wordNode)
+    norm += node[w].p;
+  for (size_t w: wordNode)
+    node[w].p /= norm;
+  double pMin = 0, scale = 1;
+  for (size_t w: wordNode) {
+    const double pMax = pMin + node[w].p * scale;
+    node[w].A = pMin;
+    node[w].B = pMax;
+    node[w].m = (pMin + pMax) / 2;
+    pMin = pMax;
+    // shrink the input interval to just enclose the output intervals used to encode it
+    const double newPMax = finalEnd (node[w].A, node[w].B, node[w].m);
+    if (newPMax < pMax) {
+      scale *= (1 - newPMax) / (1 - pMax);
+      pMin = newPMax;
+    }
+  }
+  vguard<size_t> validOut (wordNode);
+  for (size_t w: wordNode) {
+    const size_t firstNode = node.size();
+    generateTree (node, w, wordNode);
+    for (size_t n = firstNode; n < node.size(); ++n)
+      validOut.push_back (n);
+    LogThisAt(6,"Created " << plural(node.size() - firstNode,"state") << " to encode " << node[w].word << endl);
+  }
+
+  // merge equivalent output trees; leaves go back to the start state
+  vguard<size_t> equiv (node.size());
+  for (size_t n = 0; n < node.size(); ++n)
+    equiv[n] = n;
+  vguard<size_t> nodeClass (node.size(), NoMixRadarClass);
+  map<vguard<size_t>,size_t> classIndex;
+  vguard<size_t> classRep (1, startNode);
+  classIndex[vguard<size_t>()] = 0;
+  for (size_t n: validOut)
+    (void) treeClass (node, n, nodeClass, classIndex, classRep);
+  for (size_t n = 0; n < node.size(); ++n)
+    if (nodeClass[n] != NoMixRadarClass)
+      equiv[n] = classRep[nodeClass[n]];
+  for (auto& nd: node)
+    for (auto& t: nd.trans)
+      t.dest = equiv[t.dest];
+
+  // flush erases itself at the start state, control symbols are echoed, and EOF goes to the end state
+  Node& start = node[startNode];
+  start.trans.push_back (Trans { MachineFlush, MachineNull, startNode });
+  for (char c: echo)
+    start.trans.push_back (Trans { c, c, startNode });
+  const size_t endNode = node.size();
+  start.trans.push_back (Trans { MachineEOF, MachineEOF, endNode });
+  node[beginNode].trans.push_back (Trans { MachineSOF, MachineSOF, startNode });
+  node.push_back (Node());
+  node.back().end = true;
+  equiv.push_back (endNode);
+
+  // number the surviving states
+  vguard<State> nodeState (node.size(), 0);
+  vguard<size_t> stateNode;
+  for (size_t n = 0; n < node.size(); ++n)
+    if (equiv[n] == n) {
+      nodeState[n] = stateNode.size();
+      stateNode.push_back (n);
+    }
+
+  Machine machine;
+  machine.state = vguard<MachineState> (stateNode.size());
+  size_t nCodeStates = 0;
+  for (State s = 0; s < machine.nStates(); ++s) {
+    Node& nd = node[stateNode[s]];
+    MachineState& ms = machine.state[s];
+    if (nd.begin)
+      ms.name = "B";
+    else if (nd.start)
+      ms.name = "S";
+    else if (nd.end)
+      ms.name = "E";
+    else if (nd.prefix)
+      ms.name = "P" + nd.word;
+    else if (nd.input) {
+      ms.name = "W" + nd.word;
+      replace (ms.name.begin(), ms.name.end(), MachineFlush, 'x');
+    } else
+      ms.name = "C" + to_string (++nCodeStates);
+    sort (nd.trans.begin(), nd.trans.end());
+    for (const auto& t: nd.trans)
+      ms.trans.push_back (MachineTransition (t.in, t.out, nodeState[t.dest]));
+  }
+  LogThisAt(2,"Built " << blockLen << "-bit mixed-radix machine with " << plural(machine.nStates(),"state") << endl);
+  return machine;
+}
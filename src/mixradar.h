@@ -0,0 +1,54 @@
+#ifndef MIXRADAR_INCLUDED
+#define MIXRADAR_INCLUDED
+
+#include <string>
+#include <map>
+#include "vguard.h"
+#include "trans.h"
+
+using namespace std;
+
+#define DefaultMixRadarEOFProb .001
+#define DefaultMixRadarEcho    "ABCD"
+
+// Native generator for the mixed-radix block code of bin/mixradar.pl, in its flush & JSON mode
+// (mixradar.pl --flush --json <blockLen> <eofProb>), producing the same machine without the JSON round trip.
+// Input blocks of blockLen bits (or shorter blocks terminated by a flush) are ranked by probability and given
+// adjacent subintervals of [0,1); each block is then encoded as the shortest mixed sequence of binary, ternary and
+// quaternary digits (the strict inputs of the code machine) whose interval lies inside the block's subinterval.
+// Output trees that are equivalent are merged, and the input intervals shrink after each block to the space its
+// output trees actually used. The control symbols in echo pass straight through.
+// Unlike mixradar.pl, which builds every block's full tree before pruning it, branches are only grown while they
+// are needed, so longer blocks remain practical.
+struct MixRadarBuilder {
+  // config
+  int blockLen;
+  double eofProb;
+  string echo;
+
+  MixRadarBuilder (int blockLen);
+
+  Machine makeMachine() const;
+
+private:
+  struct Trans {
+    InputSymbol in;
+    OutputSymbol out;
+    size_t dest;
+    bool operator< (const Trans& t) const;  // same order as mixradar.pl's sorted transition labels
+  };
+  struct Node {
+    string word;
+    vguard<Trans> trans;
+    double p, A, B, D, E, m;
+    bool begin, start, end, prefix, input;
+    Node();
+  };
+  static OutputSymbol digitSymbol (int digit, int radix);
+  static void findDigit (double D, double E, double m, int radix, int& digit, double& newD, double& newE);
+  static double finalEnd (double A, double B, double m);
+  void generateTree (vguard<Node>& node, size_t root, const vguard<size_t>& wordNode) const;
+  static size_t treeClass (vguard<Node>& node, size_t n, vguard<size_t>& nodeClass, map<vguard<size_t>,size_t>& classIndex, vguard<size_t>& classRep);
+};
+
+#endif /* MIXRADAR_INCLUDED */
@@ -0,0 +1,114 @@
+#include <sstream>
+#include "orient.h"
+#include "logger.h"
+
+double ReadOrientation::confidence() const {
+  const int total = forwardVotes + reverseVotes;
+  return total ? (double) (reversed ? reverseVotes : forwardVotes) / (double) total : 0;
+}
+
+string ReadOrientation::toString() const {
+  ostringstream out;
+  out << "orientation=" << (reversed ? '-' : '+')
+      << " votes=" << forwardVotes << "/" << reverseVotes
+      << " confidence=" << confidence();
+  if (ambiguous)
+    out << " (decoded both ways)";
+  return out.str();
+}
+
+OrientationClassifier::OrientationClassifier (const Machine& machine)
+  : machine (machine),
+    wordLen (min ((Pos) machine.maxLeftContext() + 1, (Pos) (4 * sizeof(Kmer)))),
+    minVotes (DefaultOrientMinVotes)
+{
+  unordered_set<Kmer> word;
+  for (const auto& ms: machine.state)
+    if ((Pos) ms.leftContext.size() + 1 >= wordLen && ms.leftContext.find (MachineWildContext) == string::npos)
+      for (const auto& t: ms.trans)
+	if (t.out)
+	  word.insert (stringToKmer ((ms.leftContext + t.out).substr (ms.leftContext.size() + 1 - wordLen)));
+  for (Kmer w: word)
+    if (!word.count (kmerRevComp (w, wordLen)))
+      forwardWord.insert (w);
+  LogThisAt(3,"Orientation classifier uses " << plural(forwardWord.size(),"orientation-specific word") << " (of " << word.size() << " " << wordLen << "-mers)" << endl);
+}
+
+ReadOrientation OrientationClassifier::classify (const FastSeq& read) const {
+  ReadOrientation orient;
+  orient.forwardVotes = orient.reverseVotes = 0;
+  const Kmer mask = wordLen < (Pos) (4 * sizeof(Kmer)) ? (((Kmer) 1) << (2 * wordLen)) - 1 : (Kmer) -1;
+  Kmer kmer = 0;
+  Pos validLen = 0;
+  for (char c: read.seq) {
+    const UnvalidatedAlphTok tok = tokenize (c, dnaAlphabetString);
+    if (tok < 0) {
+      validLen = 0;
+      continue;
+    }
+    kmer = ((kmer << 2) | (Kmer) tok) & mask;
+    if (++validLen >= wordLen) {
+      if (forwardWord.count (kmer))
+	++orient.forwardVotes;
+      if (forwardWord.count (kmerRevComp (kmer, wordLen)))
+	++orient.reverseVotes;
+    }
+  }
+  orient.reversed = orient.reverseVotes > orient.forwardVotes;
+  orient.ambiguous = abs (orient.forwardVotes - orient.reverseVotes) < minVotes;
+  return orient;
+}
+
+FastSeq revcompFastSeq (const FastSeq& seq) {
+  FastSeq rc (seq);
+  reverse (rc.seq.begin(), rc.seq.end());
+  for (auto& c: rc.seq) {
+    const UnvalidatedAlphTok tok = tokenize (c, dnaAlphabetString);
+    if (tok >= 0)
+      c = baseToChar (complementBase ((Base) tok));
+  }
+  reverse (rc.qual.begin(), rc.qual.end());
+  return rc;
+}
+
+vguard<FastSeq> decodeFastSeqs (const vguard<FastSeq>& reads, const OrientationClassifier& classifier, const MutatorParams& mutatorParams, const ControlWordAnchors* anchors, size_t nThreads) {
+  const Machine& machine = classifier.machine;
+  vguard<ReadOrientation> orient;
+  vguard<FastSeq> oriented;
+  vguard<size_t> orientedIndex;
+  size_t nAmbiguous = 0;
+  for (size_t r = 0; r < reads.size(); ++r) {
+    orient.push_back (classifier.classify (reads[r]));
+    LogThisAt(4,"Read " << reads[r].name << ": " << orient.back().toString() << endl);
+    if (orient.back().ambiguous)
+      ++nAmbiguous;
+    else {
+      orientedIndex.push_back (r);
+      oriented.push_back (orient.back().reversed ? revcompFastSeq (reads[r]) : reads[r]);
+    }
+  }
+  LogThisAt(3,"Orientation of " << plural(reads.size() - nAmbiguous,"read") << " decided by voting; " << plural(nAmbiguous,"read") << " will be decoded both ways" << endl);
+
+  const vguard<FastSeq> decoded = anchors ? decodeFastSeqs (oriented, *anchors, mutatorParams, nThreads) : decodeFastSeqs (oriented, machine, mutatorParams);
+
+  vguard<FastSeq> inseqs (reads.size());
+  for (size_t n = 0; n < orientedIndex.size(); ++n)
+    inseqs[orientedIndex[n]] = decoded[n];
+
+  const InputModel inmod = viterbiInputModel (machine, mutatorParams);
+  for (size_t r = 0; r < reads.size(); ++r) {
+    ReadOrientation& ro = orient[r];
+    FastSeq& inseq = inseqs[r];
+    if (ro.ambiguous) {
+      const ViterbiMatrix fwd (machine, inmod, mutatorParams, reads[r]);
+      const FastSeq rc = revcompFastSeq (reads[r]);
+      const ViterbiMatrix rev (machine, inmod, mutatorParams, rc);
+      ro.reversed = rev.loglike() > fwd.loglike();
+      LogThisAt(4,"Read " << reads[r].name << ": forward loglike " << fwd.loglike() << ", reverse loglike " << rev.loglike() << endl);
+      inseq.name = reads[r].name;
+      inseq.seq = (ro.reversed ? rev : fwd).traceback();
+    }
+    inseq.comment = ro.toString();
+  }
+  return inseqs;
+}
@@ -0,0 +1,45 @@
+#ifndef ORIENT_INCLUDED
+#define ORIENT_INCLUDED
+
+#include <unordered_set>
+#include "viterbi.h"
+#include "anchor.h"
+
+#define DefaultOrientMinVotes 2
+
+// Result of voting on a read's orientation
+struct ReadOrientation {
+  int forwardVotes, reverseVotes;
+  bool reversed;   // read is the reverse complement of a coded sequence
+  bool ambiguous;  // too few votes, or too close, to decide without decoding both ways
+
+  double confidence() const;  // fraction of votes for the chosen orientation
+  string toString() const;
+};
+
+// Guesses a read's orientation without decoding it.
+// The machine's words are its (K+1)-mers: a full-length left context followed by a base the machine can emit from it.
+// Codes usually exclude the reverse complement of any motif they exclude, so most words are also words when reverse
+// complemented; the rest (typically those around control words, whose reverse complements are never emitted) are
+// orientation-specific. Each of these found in the read votes forward, and each found in its reverse complement votes
+// reverse. A read is classified if one orientation has at least minVotes more votes than the other.
+class OrientationClassifier {
+public:
+  const Machine& machine;
+  Pos wordLen;
+  unordered_set<Kmer> forwardWord;  // words whose reverse complement isn't a word
+  int minVotes;
+
+  OrientationClassifier (const Machine& machine);
+
+  ReadOrientation classify (const FastSeq& read) const;
+};
+
+FastSeq revcompFastSeq (const FastSeq& seq);
+
+// Viterbi-decode reads in either orientation. Classified reads are reverse-complemented if necessary, then decoded once
+// (in segments, if anchors is non-null); ambiguous reads are decoded both ways, keeping the better-scoring traceback.
+// Each decoded sequence's comment reports the orientation and the votes for it.
+vguard<FastSeq> decodeFastSeqs (const vguard<FastSeq>& reads, const OrientationClassifier& classifier, const MutatorParams& mutatorParams, const ControlWordAnchors* anchors, size_t nThreads);
+
+#endif /* ORIENT_INCLUDED */
@@ -0,0 +1,48 @@
+#ifndef PARALLEL_INCLUDED
+#define PARALLEL_INCLUDED
+
+#include <thread>
+#include <atomic>
+#include <list>
+#include <algorithm>
+
+using namespace std;
+
+// Number of worker threads to use by default: one per hardware thread (or 1, if that can't be determined)
+inline size_t defaultThreads() {
+  const size_t n = thread::hardware_concurrency();
+  return n ? n : 1;
+}
+
+// Call f(begin,end) on consecutive, non-overlapping ranges that together cover [0,n),
+// using up to nThreads threads (the calling thread included).
+// Ranges of `grain` indices are handed out on demand, so the order in which they run is not defined:
+// for deterministic results, f should write only to outputs indexed by position in [0,n),
+// leaving anything order-dependent to a serial pass over those outputs afterwards.
+// With one thread (or one range), f is called directly.
+template<class Func>
+void parallelFor (size_t n, size_t nThreads, Func f, size_t grain = 0) {
+  if (n == 0)
+    return;
+  if (grain == 0)
+    grain = max ((size_t) 1, n / (8 * max ((size_t) 1, nThreads)));
+  const size_t nRanges = (n + grain - 1) / grain;
+  nThreads = min (nThreads, nRanges);
+  if (nThreads <= 1) {
+    f ((size_t) 0, n);
+    return;
+  }
+  atomic<size_t> nextRange (0);
+  auto worker = [&] () {
+    for (size_t r = nextRange++; r < nRanges; r = nextRange++)
+      f (r * grain, min (n, (r + 1) * grain));
+  };
+  list<thread> threads;
+  for (size_t t = 1; t < nThreads; ++t)
+    threads.push_back (thread (worker));
+  worker();
+  for (auto& thr: threads)
+    thr.join();
+}
+
+#endif /* PARALLEL_INCLUDED */
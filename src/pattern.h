@@ -21,47 +21,189 @@ inline bool endsWithMotif (Kmer seq, Pos len, const set<KmerLen>& motif, const c
   return false;
 }
 
+// Word-level kernels.
+// A Kmer is treated as a vector of 2-bit lanes, lane p holding the base at position p, so that a repeat can be
+// looked for at every offset at once, by comparing the kmer with a shifted copy of itself.
+// A lane mask has the low bit of each selected lane set.
+#define KmerLaneLowBits 0x5555555555555555ULL
+
+// lanes for positions start..start+n-1
+constexpr Kmer lanesFrom (Pos start, Pos n) {
+  return n <= 0 ? 0 : ((kmerMask(n) & KmerLaneLowBits) << ((start - 1) << 1));
+}
+
+inline Kmer equalLanes (Kmer x, Kmer y) {
+  const Kmer d = x ^ y;
+  return ~(d | (d >> 1)) & KmerLaneLowBits;
+}
+
+inline Kmer complementaryLanes (Kmer x, Kmer y) {
+  return equalLanes (x, ~y);
+}
+
+inline Kmer broadcastBase (Base b) {
+  return KmerLaneLowBits * b;
+}
+
+// lanes p such that lanes p..p+n-1 are all set in mask
+inline Kmer laneRuns (Kmer mask, Pos n) {
+  Pos run = 1;
+  for (; 2*run <= n; run *= 2)
+    mask &= mask >> (run << 1);
+  if (run < n)
+    mask &= mask >> ((n - run) << 1);
+  return mask;
+}
+
+inline Pos highestLane (Kmer mask) {
+  return ((63 - __builtin_clzll (mask)) >> 1) + 1;
+}
+
+// lanes i such that positions i..i+repeatLen-1 equal positions i+repeatLen..i+2*repeatLen-1
+inline Kmer tandemRepeatLanes (Kmer seq, Pos len, Pos repeatLen) {
+  return laneRuns (equalLanes (seq, seq >> (repeatLen << 1)) & lanesFrom (1, len - repeatLen), repeatLen);
+}
+
+// lanes j such that positions j..j+repeatLen-1 are the reverse complement of positions j-gap-repeatLen..j-gap-1
+inline Kmer invertedRepeatLanes (Kmer seq, Pos len, Pos repeatLen, Pos gap) {
+  Kmer lanes = lanesFrom (repeatLen + gap + 1, len - 2*repeatLen - gap + 1);
+  for (Pos k = 0; k < repeatLen && lanes; ++k)
+    lanes &= complementaryLanes (seq >> (k << 1), seq << ((k + gap + 1) << 1));
+  return lanes;
+}
+
+// lanes j >= minPos such that positions j..j+motifLen-1 equal motif
+inline Kmer motifLanes (Kmer seq, Pos len, Kmer motif, Pos motifLen, Pos minPos) {
+  Kmer lanes = lanesFrom (minPos, len - motifLen - minPos + 2);
+  for (Pos k = 0; k < motifLen && lanes; ++k)
+    lanes &= equalLanes (seq >> (k << 1), broadcastBase (getBase (motif, k + 1)));
+  return lanes;
+}
+
 inline bool hasExactTandemRepeat (Kmer seq, Pos len, Pos maxRepeatLen) {
-  for (Pos repeatLen = 1; repeatLen <= maxRepeatLen; ++repeatLen)
-    for (Pos i = len - 2*repeatLen + 1; i >= 1; --i)
-      if (kmerSub (seq, i, repeatLen) == kmerSub (seq, i + repeatLen, repeatLen)) {
-	const int logLevel = max(5,8-repeatLen);
-	LogThisAt(logLevel,"Rejecting " << kmerString(seq,len) << " because " << kmerSubAt(seq,i+repeatLen,repeatLen,len) << " matches " << kmerSubAt(seq,i,repeatLen,len) << " (" << (repeatLen == 1 ? "repeated base" : "exact tandem repeat") << ")" << endl);
-	return true;
-      }
+  for (Pos repeatLen = 1; repeatLen <= maxRepeatLen && 2*repeatLen <= len; ++repeatLen) {
+    const Kmer lanes = tandemRepeatLanes (seq, len, repeatLen);
+    if (lanes) {
+      const Pos i = highestLane (lanes);
+      const int logLevel = max(5,8-repeatLen);
+      LogThisAt(logLevel,"Rejecting " << kmerString(seq,len) << " because " << kmerSubAt(seq,i+repeatLen,repeatLen,len) << " matches " << kmerSubAt(seq,i,repeatLen,len) << " (" << (repeatLen == 1 ? "repeated base" : "exact tandem repeat") << ")" << endl);
+      return true;
+    }
+  }
   return false;
 }
 
+// An inverted repeat contains shorter ones with the same center, so only the shortest length needs checking.
 inline bool hasExactLocalInvertedRepeat (Kmer seq, Pos len, Pos minRepeatLen, Pos maxRepeatLen) {
-  const Kmer rc = kmerRevComp (seq, len);
-  for (Pos repeatLen = minRepeatLen; repeatLen <= maxRepeatLen; ++repeatLen)
-    for (Pos i = len - 2*repeatLen + 1; i >= 1; --i) {
-      const Pos iRev = len - i - repeatLen + 2;
-      const Kmer invRep = kmerSub (rc, iRev, repeatLen);
-      if (invRep == kmerSub (seq, i + repeatLen, repeatLen)) {
-	const int logLevel = max(5,8-repeatLen);
-	LogThisAt(logLevel,"Rejecting " << kmerString(seq,len) << " because " << kmerSubAt(seq,i+repeatLen,repeatLen,len) << " matches " << kmerSubAt(seq,i,repeatLen,len) << " (palindrome)" << endl);
-	return true;
-      }
-    }
+  if (minRepeatLen > maxRepeatLen)
+    return false;
+  const Pos repeatLen = minRepeatLen;
+  const Kmer lanes = invertedRepeatLanes (seq, len, repeatLen, 0);
+  if (lanes) {
+    const Pos i = highestLane (lanes) - repeatLen;
+    const int logLevel = max(5,8-repeatLen);
+    LogThisAt(logLevel,"Rejecting " << kmerString(seq,len) << " because " << kmerSubAt(seq,i+repeatLen,repeatLen,len) << " matches " << kmerSubAt(seq,i,repeatLen,len) << " (palindrome)" << endl);
+    return true;
+  }
   return false;
 }
 
 inline bool hasExactNonlocalInvertedRepeat (Kmer seq, Pos len, Pos repeatLen, Pos minSeparation) {
   if (repeatLen <= 0)
     return false;
-  const Kmer rc = kmerRevComp (seq, len);
-  for (Pos i = len - 2*repeatLen - minSeparation + 1; i >= 1; --i) {
-    const Pos iRev = len - i - repeatLen + 2;
-    const Kmer invRep = kmerSub (rc, iRev, repeatLen);
-    const Pos jMin = i + repeatLen + minSeparation;
-    for (Pos j = len - repeatLen + 1; j >= jMin; --j)
-      if (invRep == kmerSub (seq, j, repeatLen)) {
-	LogThisAt(4,"Rejecting " << kmerString(seq,len) << "/" << kmerString(rc,len) << " because " << kmerSubAt(seq,j,repeatLen,len) << " matches " << kmerSubAt(seq,i,repeatLen,len) << "/" << kmerSubAt(rc,len-i-repeatLen+2,repeatLen,len) << " (exact inverted repeat)" << endl);
-	return true;
-      }
+  for (Pos gap = minSeparation; 2*repeatLen + gap <= len; ++gap) {
+    const Kmer lanes = invertedRepeatLanes (seq, len, repeatLen, gap);
+    if (lanes) {
+      const Pos j = highestLane (lanes), i = j - gap - repeatLen;
+      LogThisAt(4,"Rejecting " << kmerString(seq,len) << "/" << kmerString(kmerRevComp(seq,len),len) << " because " << kmerSubAt(seq,j,repeatLen,len) << " matches " << kmerSubAt(seq,i,repeatLen,len) << "/" << kmerSubAt(kmerRevComp(seq,len),len-i-repeatLen+2,repeatLen,len) << " (exact inverted repeat)" << endl);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Variants of the above that only look for repeats whose rightmost copy includes the last base (position 1).
+// A sequence has a repeat iff one of its prefixes ends with one, so these can be used to check a sequence
+// incrementally as it is extended one base at a time.
+inline bool hasExactTandemRepeatAtEnd (Kmer seq, Pos len, Pos maxRepeatLen) {
+  for (Pos repeatLen = 1; repeatLen <= maxRepeatLen && 2*repeatLen <= len; ++repeatLen)
+    if (((seq ^ (seq >> (repeatLen << 1))) & kmerMask (repeatLen)) == 0) {
+      const int logLevel = max(5,8-repeatLen);
+      LogThisAt(logLevel,"Rejecting " << kmerString(seq,len) << " because " << kmerSubAt(seq,1+repeatLen,repeatLen,len) << " matches " << kmerSubAt(seq,1,repeatLen,len) << " (" << (repeatLen == 1 ? "repeated base" : "exact tandem repeat") << ")" << endl);
+      return true;
+    }
+  return false;
+}
+
+// Positions 1..2*repeatLen form a palindrome iff they equal the same positions of their reverse complement,
+// so reverse-complementing the whole word once gives every length to compare against.
+inline bool hasExactLocalInvertedRepeatAtEnd (Kmer seq, Pos len, Pos minRepeatLen, Pos maxRepeatLen) {
+  const Kmer rc = kmerRevComp (seq, 32);
+  for (Pos repeatLen = minRepeatLen; repeatLen <= maxRepeatLen && 2*repeatLen <= len; ++repeatLen)
+    if (repeatLen <= 0 || ((seq ^ (rc >> (64 - (repeatLen << 2)))) & kmerMask (repeatLen << 1)) == 0) {
+      const int logLevel = max(5,8-repeatLen);
+      LogThisAt(logLevel,"Rejecting " << kmerString(seq,len) << " because " << kmerSubAt(seq,1+repeatLen,repeatLen,len) << " matches " << kmerSubAt(seq,1,repeatLen,len) << " (palindrome)" << endl);
+      return true;
+    }
+  return false;
+}
+
+inline bool hasExactNonlocalInvertedRepeatAtEnd (Kmer seq, Pos len, Pos repeatLen, Pos minSeparation) {
+  if (repeatLen <= 0 || len < 2*repeatLen + minSeparation)
+    return false;
+  const Kmer lanes = motifLanes (seq, len, kmerRevComp (seq, repeatLen), repeatLen, 1 + repeatLen + minSeparation);
+  if (lanes) {
+    const Pos j = highestLane (lanes);
+    LogThisAt(4,"Rejecting " << kmerString(seq,len) << " because " << kmerSubAt(seq,j,repeatLen,len) << " matches revcomp of " << kmerSubAt(seq,1,repeatLen,len) << " (exact inverted repeat)" << endl);
+    return true;
   }
   return false;
 }
 
+// Batched forms of the end tests, for N sequences of the same length (such as the four one-base extensions of a prefix).
+// result[n] is set if seq[n] has a repeat. The loops over the batch have no early exits, so the compiler can
+// vectorize them (four or eight 64-bit kmers per vector, where the target has AVX2 or AVX-512). These don't log.
+template<size_t N>
+inline void hasExactTandemRepeatAtEnd (const Kmer* seq, Pos len, Pos maxRepeatLen, bool* result) {
+  for (size_t n = 0; n < N; ++n)
+    result[n] = false;
+  for (Pos repeatLen = 1; repeatLen <= maxRepeatLen && 2*repeatLen <= len; ++repeatLen) {
+    const int shift = repeatLen << 1;
+    const Kmer mask = kmerMask (repeatLen);
+    for (size_t n = 0; n < N; ++n)
+      result[n] |= ((seq[n] ^ (seq[n] >> shift)) & mask) == 0;
+  }
+}
+
+template<size_t N>
+inline void hasExactLocalInvertedRepeatAtEnd (const Kmer* seq, Pos len, Pos minRepeatLen, Pos maxRepeatLen, bool* result) {
+  Kmer rc[N];
+  for (size_t n = 0; n < N; ++n) {
+    rc[n] = kmerRevComp (seq[n], 32);
+    result[n] = minRepeatLen <= 0 && minRepeatLen <= maxRepeatLen;
+  }
+  for (Pos repeatLen = max (minRepeatLen, 1); repeatLen <= maxRepeatLen && 2*repeatLen <= len; ++repeatLen) {
+    const int shift = 64 - (repeatLen << 2);
+    const Kmer mask = kmerMask (repeatLen << 1);
+    for (size_t n = 0; n < N; ++n)
+      result[n] |= ((seq[n] ^ (rc[n] >> shift)) & mask) == 0;
+  }
+}
+
+template<size_t N>
+inline void hasExactNonlocalInvertedRepeatAtEnd (const Kmer* seq, Pos len, Pos repeatLen, Pos minSeparation, bool* result) {
+  for (size_t n = 0; n < N; ++n)
+    result[n] = false;
+  if (repeatLen <= 0 || len < 2*repeatLen + minSeparation)
+    return;
+  const Kmer range = lanesFrom (1 + repeatLen + minSeparation, len - 2*repeatLen - minSeparation + 1);
+  for (size_t n = 0; n < N; ++n) {
+    const Kmer invRep = kmerRevComp (seq[n], repeatLen);
+    Kmer lanes = range;
+    for (Pos k = 0; k < repeatLen; ++k)
+      lanes &= equalLanes (seq[n] >> (k << 1), broadcastBase (getBase (invRep, k + 1)));
+    result[n] = lanes != 0;
+  }
+}
+
 #endif /* PATTERN_INCLUDED */
@@ -0,0 +1,159 @@
+#include <random>
+#include <algorithm>
+#include "periodic.h"
+#include "logger.h"
+
+PeriodicBuilder::PeriodicBuilder (int period, bool watermark)
+  : period (period),
+    watermark (watermark),
+    subperiod (0),
+    subControl (false),
+    copies (1),
+    mixWater (true),
+    eofOK (false),
+    seed (DefaultWatermarkSeed)
+{ }
+
+Machine PeriodicBuilder::makeMachine() const {
+  Require (period > 0, "Period must be positive");
+  Require (copies > 0, "Number of control word copies must be positive");
+  Require (subperiod >= 0, "Subperiod can't be negative");
+  Require (watermark || (subperiod == 0 && copies == 1), "Subperiods and multiple control words are for watermarks only");
+  Require (subperiod > 0 || !subControl, "Sub-period control words need a subperiod");
+
+  // states: B, S1..Sn, C1..Ccopies, E
+  const int sub = subperiod > 0 ? subperiod : period + 1;
+  const int nS = watermark ? period + period / sub : period;
+  const int nC = watermark ? copies : 1;
+  const State endState = nS + nC + 1;
+  Machine machine;
+  machine.state = vguard<MachineState> (endState + 1);
+  machine.state[0].name = "B";
+  machine.state[0].trans.push_back (MachineTransition (MachineSOF, MachineSOF, 1));
+
+  mt19937 gen (seed);
+  auto randomPerm = [&] (const string& digits) -> string {
+    string perm = digits;
+    if (mixWater) {
+      int nPerms = 1;
+      for (int k = 2; k <= (int) digits.size(); ++k)
+	nPerms *= k;
+      const int nNext = (int) (gen() / 4294967296. * nPerms);
+      for (int k = 0; k < nNext; ++k)
+	next_permutation (perm.begin(), perm.end());
+    }
+    return perm;
+  };
+
+  for (int n = 1; n <= nS; ++n) {
+    MachineState& ms = machine.state[n];
+    ms.name = string("S") + to_string(n);
+    if (watermark) {
+      const string perm2 = randomPerm ("ij"), perm3 = randomPerm ("xyz"), perm4 = randomPerm ("pqrs");
+      if ((n - 1) % (sub + 1) == sub) {
+	if (subControl)
+	  ms.trans.push_back (MachineTransition (MachineNull, MachineControlFirst + 1, n + 1));
+	else
+	  for (const string* perm: { &perm2, &perm3, &perm4 })
+	    ms.trans.push_back (MachineTransition (MachineNull, perm->front(), n + 1));
+      } else {
+	for (const string* perm: { &perm2, &perm3, &perm4 }) {
+	  ms.trans.push_back (MachineTransition (MachineBit0, (*perm)[0], n + 1));
+	  ms.trans.push_back (MachineTransition (MachineBit1, (*perm)[1], n + 1));
+	}
+	if (eofOK || n == 1)
+	  ms.trans.push_back (MachineTransition (MachineEOF, MachineEOF, endState));
+      }
+    } else {
+      ms.trans.push_back (MachineTransition (MachineBit0, MachineBit0, n + 1));
+      ms.trans.push_back (MachineTransition (MachineBit1, MachineBit1, n + 1));
+      ms.trans.push_back (MachineTransition (MachineEOF, MachineEOF, endState));
+    }
+  }
+
+  for (int c = 1; c <= nC; ++c) {
+    MachineState& ms = machine.state[nS + c];
+    ms.name = string("C") + (c < nC || nC > 1 ? to_string(c) : string());
+    ms.trans.push_back (MachineTransition (MachineNull, MachineControlFirst, c < nC ? nS + c + 1 : 1));
+  }
+  machine.state[endState].name = "E";
+
+  LogThisAt(2,"Built " << (watermark ? "watermark" : "sync") << " machine with period " << period << " (" << plural(machine.nStates(),"state") << ")" << endl);
+  return machine;
+}
+
+PeriodicMachine::PeriodicMachine (const Machine& outer, const Machine& inner)
+  : outer (outer),
+    inner (inner.isWaitingMachine() ? inner : inner.waitingMachine())
+{
+  Assert (this->inner.isWaitingMachine(), "Attempt to compose transducers A*B where B is not a waiting machine");
+  Assert (this->outer.state.back().isEnd(), "Last state must be end state");
+  Assert (this->inner.state.back().isEnd(), "Last state must be end state");
+  const size_t len = this->inner.maxLeftContext();
+  for (State i = 0; i < this->inner.nStates(); ++i) {
+    const string& lc = this->inner.state[i].leftContext;
+    if (lc.size() == len && lc.find (MachineWildContext) == string::npos)
+      innerByContext[lc].push_back (i);
+  }
+  LogThisAt(3,"Periodic machine has " << plural(this->outer.nStates(),"outer state") << " and " << plural(this->inner.nStates(),"inner state") << "; " << (this->outer.nStates() * this->inner.nStates()) << " states are generated on demand" << endl);
+}
+
+string PeriodicMachine::stateName (State s) const {
+  return string("(") + outer.state[outerState(s)].name + "," + inner.state[innerState(s)].name + ")";
+}
+
+vguard<MachineTransition> PeriodicMachine::transitions (State s) const {
+  const State o = outerState(s), i = innerState(s);
+  const MachineState& msi = outer.state[o];
+  const MachineState& msj = inner.state[i];
+  vguard<MachineTransition> trans;
+  if (msj.isWait() || msj.isEnd()) {
+    for (const auto& it: msi.trans)
+      if (it.out == MachineNull)
+	trans.push_back (MachineTransition (it.in, MachineNull, pairState(it.dest,i)));
+      else
+	for (const auto& jt: msj.trans)
+	  if (it.out == jt.in)
+	    trans.push_back (MachineTransition (it.in, jt.out, pairState(it.dest,jt.dest)));
+  } else
+    for (const auto& jt: msj.trans)
+      trans.push_back (MachineTransition (MachineNull, jt.out, pairState(o,jt.dest)));
+  return trans;
+}
+
+bool PeriodicMachine::acceptsInput (State s, InputSymbol in) const {
+  for (const auto& t: transitions(s))
+    if (t.in == in)
+      return true;
+  return false;
+}
+
+bool PeriodicMachine::exitsWithInput (State s) const {
+  for (const auto& t: transitions(s))
+    if (t.in)
+      return true;
+  return false;
+}
+
+bool PeriodicMachine::emitsOutput (State s) const {
+  for (const auto& t: transitions(s))
+    if (t.out)
+      return true;
+  return false;
+}
+
+vguard<State> PeriodicMachine::localStartStates (const TokSeq& seq, Pos pos) const {
+  vguard<State> states;
+  const Pos len = maxLeftContext();
+  if (len > 0 && pos >= len && pos < 2*len) {
+    string lc;
+    for (Pos i = pos - len; i < pos; ++i)
+      lc.push_back (dnaAlphabetString[seq[i]]);
+    const auto iter = innerByContext.find (lc);
+    if (iter != innerByContext.end())
+      for (State o = 1; o + 1 < outer.nStates(); ++o)  // anywhere in the period, but not at the outer Begin or End
+	for (State i: iter->second)
+	  states.push_back (pairState (o, i));
+  }
+  return states;
+}
@@ -0,0 +1,78 @@
+#ifndef PERIODIC_INCLUDED
+#define PERIODIC_INCLUDED
+
+#include <string>
+#include <unordered_map>
+#include "vguard.h"
+#include "kmer.h"
+#include "trans.h"
+#include "fastseq.h"
+
+using namespace std;
+
+// watmark.pl hashes its seed string; this is the first 32 bits of the MD5 of its default, "THEKID"
+#define DefaultWatermarkSeed 0x5dd4fe05
+
+// Native generator for the synchronization codes of bin/syncer.pl and the watermark codes of bin/watmark.pl.
+// Both are a single period of states (S1..Sn) followed by control-word states (C) that return to S1:
+//  - sync: each S state passes one bit through, and may end the message;
+//  - watermark: each S state encodes one bit as a binary, ternary or quaternary digit, using a random permutation
+//    of the digits (unless mixWater is false), so a decoder can tell the states apart. If subperiod is nonzero,
+//    a watermark digit (or, with subControl, control word B) is sent after every subperiod bits.
+// The sync code is identical to syncer.pl's. The watermark permutations come from a Mersenne Twister seeded with
+// seed, but aren't those of watmark.pl, which depend on the Perl modules it uses.
+struct PeriodicBuilder {
+  // config
+  int period;
+  bool watermark;
+  int subperiod;
+  bool subControl;
+  int copies;
+  bool mixWater;
+  bool eofOK;
+  unsigned int seed;
+
+  PeriodicBuilder (int period, bool watermark = false);
+
+  Machine makeMachine() const;
+};
+
+// Composition of a periodic outer machine (one period of a sync or watermark code) with an inner code machine,
+// generated on demand rather than stored: a state is a (period position, code state) pair, packed as
+// outerState * innerStates + innerState, as in Machine::compose. Transitions are those Machine::compose would
+// build, without its pruning of dead ends and null chains; dead ends simply have no transitions.
+// Provides the per-state accessors used by the Encoder and Decoder templates and the beam Viterbi decoder.
+class PeriodicMachine {
+private:
+  unordered_map<string,vguard<State> > innerByContext;  // inner states with full-length left contexts
+
+  inline State outerState (State s) const { return s / inner.nStates(); }
+  inline State innerState (State s) const { return s % inner.nStates(); }
+  inline State pairState (State o, State i) const { return o * inner.nStates() + i; }
+
+public:
+  const Machine outer, inner;
+
+  PeriodicMachine (const Machine& outer, const Machine& inner);
+
+  State startState() const { return pairState (outer.startState(), inner.startState()); }
+  State endState() const { return pairState (outer.nStates() - 1, inner.nStates() - 1); }
+
+  // accessors
+  string stateName (State s) const;
+  string leftContext (State s) const { return inner.state[innerState(s)].leftContext; }
+  string rightContext (State s) const { return inner.state[innerState(s)].rightContext; }
+  vguard<MachineTransition> transitions (State s) const;
+  bool acceptsInput (State s, InputSymbol in) const;
+  bool isEnd (State s) const { return s == endState(); }
+  bool exitsWithInput (State s) const;
+  bool emitsOutput (State s) const;
+
+  string inputAlphabet (int inputFlags = MachineDefaultInputFlags) const { return outer.inputAlphabet (inputFlags); }
+
+  // for the beam Viterbi decoder
+  size_t maxLeftContext() const { return inner.maxLeftContext(); }
+  vguard<State> localStartStates (const TokSeq& seq, Pos pos) const;  // states a local read may begin in, after pos bases
+};
+
+#endif /* PERIODIC_INCLUDED */
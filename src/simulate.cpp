@@ -0,0 +1,80 @@
+#include "simulate.h"
+#include "parallel.h"
+#include "logger.h"
+
+Stockholm SimulatedRead::alignment() const {
+  vguard<FastSeq> rows;
+  rows.push_back (origRow);
+  rows.push_back (readRow);
+  return Stockholm (rows);
+}
+
+ReadSimulator::ReadSimulator (const MutatorParams& params)
+  : params (params),
+    seed (DefaultSimulateSeed),
+    nThreads (1)
+{ }
+
+SimulatedRead ReadSimulator::simulate (const FastSeq& orig, const string& readName, mt19937_64& gen) const {
+  const TokSeq in = orig.tokens (dnaAlphabetString);
+  const Pos inLen = in.size(), maxDupLen = params.maxDupLen();
+
+  vguard<vguard<double> > pSub (4, vguard<double> (4));
+  for (Base x = 0; x < 4; ++x)
+    for (Base y = 0; y < 4; ++y)
+      pSub[x][y] = params.pSub (x, y);
+
+  SimulatedRead sim;
+  sim.read.name = sim.readRow.name = readName;
+  sim.origRow.name = orig.name;
+  string &read = sim.read.seq, &origRow = sim.origRow.seq, &readRow = sim.readRow.seq;
+  auto emit = [&] (Base x) {
+    read.push_back (dnaAlphabetString[random_index (pSub[x], gen)]);
+    readRow.push_back (read.back());
+  };
+
+  // event weights from the match state: no gap, deletion, then a duplication of each length
+  vguard<double> event (3 + maxDupLen, 0);
+  for (Pos ip = 0; ; ) {
+    event[0] = ip < inLen ? params.pNoGap() : 0;
+    event[1] = ip < inLen ? params.pDelOpen : 0;
+    event[2] = ip < inLen ? 0 : 1;  // end of read
+    for (Pos len = 1; len <= maxDupLen; ++len)
+      event[2 + len] = len <= ip ? params.pTanDup * params.pLen[len-1] : 0;
+    const size_t e = random_index (event, gen);
+    if (e == 0) {
+      origRow.push_back (dnaAlphabetString[in[ip]]);
+      emit (in[ip++]);
+    } else if (e == 1) {
+      do {
+	origRow.push_back (dnaAlphabetString[in[ip++]]);
+	readRow.push_back (Alignment::gapChar);
+      } while (ip < inLen && random_double(gen) < params.pDelExtend);
+    } else if (e == 2)
+      break;
+    else {
+      const Pos len = e - 2;
+      for (Pos k = ip - len; k < ip; ++k) {
+	origRow.push_back (Alignment::gapChar);
+	emit (in[k]);
+      }
+    }
+  }
+  return sim;
+}
+
+vguard<SimulatedRead> ReadSimulator::simulate (const vguard<FastSeq>& origs, int copies) const {
+  Require (copies > 0, "Number of simulated reads per sequence must be positive");
+  Require (params.pNoGap() >= 0 && params.pMatch() >= 0 && params.pDelExtend < 1, "Error model probabilities out of range");
+  const size_t nReads = origs.size() * copies;
+  vguard<SimulatedRead> sims (nReads);
+  parallelFor (nReads, nThreads, [&] (size_t begin, size_t end) {
+      for (size_t n = begin; n < end; ++n) {
+	mt19937_64 gen (seed ^ (n * 0x9e3779b97f4a7c15ULL));
+	const FastSeq& orig = origs[n / copies];
+	sims[n] = simulate (orig, orig.name + "." + to_string (n % copies + 1), gen);
+      }
+    });
+  LogThisAt(2,"Simulated " << plural(nReads,"read") << " from " << plural(origs.size(),"sequence") << endl);
+  return sims;
+}
@@ -0,0 +1,40 @@
+#ifndef SIMULATE_INCLUDED
+#define SIMULATE_INCLUDED
+
+#include <random>
+#include "mutator.h"
+#include "stockholm.h"
+
+#define DefaultSimulateSeed   0x6d2b79f5
+#define DefaultSimulateCopies 1
+
+// A read simulated from an original sequence, with the true alignment: origRow and readRow are its gapped rows
+struct SimulatedRead {
+  FastSeq read, origRow, readRow;
+
+  Stockholm alignment() const;
+};
+
+// Draws reads from the error channel of MutatorParams, event by event, as the pair HMM of fwdback scores them.
+// From the match state, before each base of the original, one of:
+//  - no gap (pNoGap): the base is read, substituted with probability pTransition or pTransversion;
+//  - deletion (pDelOpen): the base is skipped, as are the following bases with probability pDelExtend each;
+//  - tandem duplication (pTanDup): a length L is drawn from pLen, and the previous L bases are read again, each
+//    substituted independently, before returning to the match state.
+// Duplication lengths longer than the sequence so far are excluded, and the rest renormalized; at the end of the
+// original, the read either ends or (with relative weight pTanDup) gets one more duplication.
+// Each read has its own random number generator, seeded from seed and the read's index, so the reads don't depend
+// on the number of threads.
+struct ReadSimulator {
+  const MutatorParams& params;
+  unsigned long long seed;
+  size_t nThreads;
+
+  ReadSimulator (const MutatorParams& params);
+
+  SimulatedRead simulate (const FastSeq& orig, const string& readName, mt19937_64& gen) const;
+  // copies reads of each original, named <original>.<n>
+  vguard<SimulatedRead> simulate (const vguard<FastSeq>& origs, int copies) const;
+};
+
+#endif /* SIMULATE_INCLUDED */
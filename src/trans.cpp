@@ -1,8 +1,12 @@
 #include <iomanip>
 #include <fstream>
+#include <limits>
+#include <cmath>
+#include <unordered_map>
 #include "trans.h"
 #include "logger.h"
 #include "jsonutil.h"
+#include "parallel.h"
 
 struct MachineTokenLookup {
   map<InputSymbol,InputToken> sym2tok;
@@ -304,140 +308,141 @@ string Machine::inputDescriptionTable() const {
   return machineTokenLookup.tokenDescriptionTable (inputAlphabet (MachineAllInputFlags));
 }
 
-map<InputSymbol,double> Machine::expectedBasesPerInputSymbol (const char* symbols) const {
-  const size_t len = maxLeftContext() + maxRightContext();
-  const size_t burnInSteps = len*4, simSteps = len*4;
-  map<State,double> current;
-  size_t nSources = 0;
+// The chain is over the states that accept any of the symbols. At each step one of the accepted symbols is chosen uniformly
+// (EOF and control symbols have their bases counted, but are never chosen), and then any non-input transitions are followed
+// up to the next input state. Its stationary distribution is found by power iteration on the lazy chain (P+I)/2,
+// which has the same stationary distribution but also converges when the chain is periodic.
+map<InputSymbol,double> Machine::expectedBasesPerInputSymbol (const char* symbols, size_t nThreads) const {
+  const string alph (symbols);
+  const size_t nSymbols = alph.size();
+  const size_t noIndex = numeric_limits<size_t>::max();
+  vguard<State> chainState;
+  vguard<size_t> chainIndex (nStates(), noIndex);
   for (State s = 0; s < nStates(); ++s)
     if (state[s].exitsWithInput (symbols)) {
-      current[s] = 1;
-      ++nSources;
-    }
-  Assert (nSources > 0, "Couldn't find any input states");
-  for (auto& ps: current)
-    ps.second /= (double) nSources;
-  const string alph (symbols);
-  map<char,vguard<double> > eb;
-
-  auto logCurrent = [&](int logLevel) -> void {
-    double pTot = 0;
-    for (auto& ps: current) {
-      LogThisAt(logLevel,"P(" << state[ps.first].name << ") = " << ps.second << endl);
-      pTot += ps.second;
+      chainIndex[s] = chainState.size();
+      chainState.push_back (s);
     }
-    LogThisAt(logLevel+1,"Total probability is " << pTot << endl);
-  };
-  
-  auto evolve = [&]() -> void {
-    logCurrent(5);
-    map<State,double> next;
-    map<char,double> bases;
-    for (const auto& ps: current) {
-      const MachineState& ms = state[ps.first];
-      const double p = ps.second;
-
-      map<char,const MachineTransition*> transFor;
-      double nt = 0;
-      for (char c: alph) {
-	auto t = ms.transFor(c);
-	if (t) {
-	  transFor[c] = t;
-	  if (c != MachineEOF)
+  const size_t n = chainState.size();
+  Assert (n > 0, "Couldn't find any input states");
+
+  // bases output, and index of the next input state (if the symbol moves the chain), for each input state & symbol
+  vguard<double> symBases (n * nSymbols, 0);
+  vguard<size_t> symDest (n * nSymbols, noIndex);
+  vguard<double> moveProb (n, 0);
+  parallelFor (n, nThreads, [&] (size_t begin, size_t end) {
+      set<State> seen;
+      for (size_t i = begin; i < end; ++i) {
+	const MachineState& ms = state[chainState[i]];
+	size_t nt = 0;
+	for (size_t k = 0; k < nSymbols; ++k) {
+	  const char c = alph[k];
+	  auto t = ms.transFor(c);
+	  if (!t)
+	    continue;
+	  seen.clear();
+	  State s;
+	  while (true) {
+	    if (t->out)
+	      ++symBases[i*nSymbols + k];
+	    s = t->dest;
+	    if (seen.count(s))  // guard against infinite loops
+	      break;
+	    seen.insert(s);
+	    if (state[s].exitsWithInput() || state[s].isEnd())
+	      break;
+	    Assert (state[s].isDeterministic(), "Non-deterministic state without inputs: %s", state[s].name.c_str());
+	    t = &state[s].next();
+	  }
+	  if (c != MachineEOF && !isControl(c)) {
+	    symDest[i*nSymbols + k] = chainIndex[s];  // if s isn't an input state, the chain stops here
 	    ++nt;
+	  }
 	}
+	if (nt)
+	  moveProb[i] = 1. / (double) nt;
       }
-
-      double ptot = 0;
-      for (const auto& ct: transFor) {
-	const char c = ct.first;
-	auto t = ct.second;
-	set<State> seen;
-	State s;
-	while (true) {
-	  if (t->out)
-	    bases[c] += p;
-	  s = t->dest;
-	  if (seen.count(s))  // guard against infinite loops
-	    break;
-	  seen.insert(s);
-	  if (state[s].exitsWithInput() || state[s].isEnd())
-	    break;
-	  Assert (state[s].isDeterministic(), "Non-deterministic state without inputs: %s", state[s].name.c_str());
-	  t = &state[s].next();
-	}
-	if (c != MachineEOF) {
-	  LogThisAt(7,"P(" << ms.name << "->" << state[s].name << ")=" << (p/nt) << endl);
-	  next[s] += p / nt;
-	  ptot += p / nt;
-	}
-      }
-      LogThisAt(8,"Total outgoing transition probability from state " << ms.name << " is " << ptot << "; state probability is " << p << endl);
+    });
+
+  // transpose into compressed sparse rows by destination, so each thread of the iteration sums into its own states
+  vguard<size_t> inStart (n + 1, 0), inSrc;
+  for (auto d: symDest)
+    if (d != noIndex)
+      ++inStart[d + 1];
+  partial_sum (inStart.begin(), inStart.end(), inStart.begin());
+  inSrc.resize (inStart.back());
+  vguard<size_t> inNext (inStart.begin(), inStart.end() - 1);
+  for (size_t i = 0; i < n; ++i)
+    for (size_t k = 0; k < nSymbols; ++k) {
+      const size_t d = symDest[i*nSymbols + k];
+      if (d != noIndex)
+	inSrc[inNext[d]++] = i;
     }
-    for (char c: alph)
-      eb[c].push_back (bases[c]);
-    current.swap (next);
-  };
 
+  vguard<double> current (n, 1. / (double) n), next (n);
   ProgressLog (plogSim, 1);
   plogSim.initProgress ("Estimating compression rate");
-  for (size_t step = 0; step < burnInSteps; ++step) {
-    plogSim.logProgress (step / (double) (burnInSteps + simSteps), "burn-in step %u/%u", step, simSteps + burnInSteps);
-    evolve();
+  size_t iter;
+  double delta = 1;
+  for (iter = 0; iter < MachineRateMaxIterations && delta > MachineRateTolerance; ++iter) {
+    plogSim.logProgress (min (1., log(delta) / log(MachineRateTolerance)), "iteration %u, change %g", iter, delta);
+    parallelFor (n, nThreads, [&] (size_t begin, size_t end) {
+	for (size_t d = begin; d < end; ++d) {
+	  double pIn = 0;
+	  for (size_t e = inStart[d]; e < inStart[d+1]; ++e)
+	    pIn += current[inSrc[e]] * moveProb[inSrc[e]];
+	  next[d] = (current[d] + pIn) / 2;
+	}
+      });
+    // renormalize, in case probability leaks out of the chain
+    const double pTot = accumulate (next.begin(), next.end(), 0.);
+    Assert (pTot > 0, "Input states are not recurrent");
+    delta = 0;
+    for (size_t i = 0; i < n; ++i) {
+      next[i] /= pTot;
+      delta += abs (next[i] - current[i]);
+    }
+    current.swap (next);
   }
-  eb.clear();
-  for (size_t step = 0; step < simSteps; ++step) {
-    plogSim.logProgress ((step + burnInSteps) / (double) (burnInSteps + simSteps), "step %u/%u", step + burnInSteps, simSteps + burnInSteps);
-    evolve();
+  if (delta > MachineRateTolerance)
+    Warn ("Stationary distribution did not converge after %u iterations (change %g)", iter, delta);
+  else
+    LogThisAt(3,"Stationary distribution converged after " << iter << " iterations" << endl);
+  for (size_t i = 0; i < n; ++i)
+    LogThisAt(5,"P(" << state[chainState[i]].name << ") = " << current[i] << endl);
+
+  map<InputSymbol,double> bps;
+  for (size_t k = 0; k < nSymbols; ++k) {
+    double b = 0;
+    for (size_t i = 0; i < n; ++i)
+      b += current[i] * symBases[i*nSymbols + k];
+    bps[alph[k]] = b;
   }
-
-  logCurrent(3);
-
-  map<char,double> bps;
-  for (char c: alph)
-    bps[c] = accumulate (eb[c].begin(), eb[c].end(), 0.) / (double) eb[c].size();
   return bps;
 }
 
 void Machine::writeJSON (ostream& out) const {
-  out << "{\"state\": [" << endl;
-  for (State s = 0; s < nStates(); ++s) {
-    const MachineState& ms = state[s];
-    out << " {\"n\":" << s << ",";
-    if (ms.name.size())
-	out << "\"id\":\"" << ms.name << "\",";
-    if (ms.leftContext.size())
-      out << "\"l\":\"" << ms.leftContext << "\",";
-    if (ms.rightContext.size())
-      out << "\"r\":\"" << ms.rightContext << "\",";
-    out << "\"trans\":[";
-    for (size_t nt = 0; nt < ms.trans.size(); ++nt) {
-      const MachineTransition& t = ms.trans[nt];
-      if (nt > 0) out << ",";
-      out << "{";
-      if (t.in) out << "\"in\":\"" << t.in << "\",";
-      if (t.out) out << "\"out\":\"" << t.out << "\",";
-      out << "\"to\":" << t.dest
-	  << "}";
-    }
-    out << "]}";
-    if (s < nStates() - 1)
-      out << ",";
-    out << endl;
-  }
-  out << "]}" << endl;
+  writeMachineJSON (*this, out);
 }
 
 void Machine::readJSON (istream& in) {
   state.clear();
+  readJSONStates (in, [&] (MachineState& ms) {
+      state.push_back (ms);
+    });
+  verifyContexts();
+}
+
+void Machine::readJSONStates (istream& in, const function<void(MachineState&)>& addState) {
   ParsedJson pj (in);
   JsonValue jstate = pj.getType ("state", JSON_ARRAY);
+  size_t nStates = 0;
   for (JsonIterator iter = begin(jstate); iter != end(jstate); ++iter) {
     const JsonMap jsmap (iter->value);
     MachineState ms;
     if (jsmap.contains("n")) {
       const size_t n = jsmap.getNumber("n");
-      Require (state.size() == n, "State n=%u out of sequence", n);
+      Require (nStates == n, "State n=%u out of sequence", n);
     }
     if (jsmap.contains("id"))
       ms.name = jsmap.getString("id");
@@ -463,9 +468,9 @@ void Machine::readJSON (istream& in) {
       }
       ms.trans.push_back (t);
     }
-    state.push_back (ms);
+    addState (ms);
+    ++nStates;
   }
-  verifyContexts();
 }
 
 Machine Machine::fromJSON (istream& in) {
@@ -508,59 +513,68 @@ Machine Machine::compose (const Machine& first, const Machine& origSecond) {
   Assert (second.isWaitingMachine(), "Attempt to compose transducers A*B where B is not a waiting machine");
   Assert (first.state.back().isEnd(), "Last state must be end state");
   Assert (second.state.back().isEnd(), "Last state must be end state");
-  vguard<MachineState> comp (first.nStates() * second.nStates());
+  // product states are only created once reachable from the start state, but are indexed as in the full product
+  const State nProduct = first.nStates() * second.nStates();
   auto compState = [&](State i,State j) -> State {
     return i * second.nStates() + j;
   };
   auto compStateName = [&](State i,State j) -> string {
     return string("(") + first.state[i].name + "," + second.state[j].name + ")";
   };
-  for (State i = 0; i < first.nStates(); ++i)
-    for (State j = 0; j < second.nStates(); ++j) {
-      MachineState& ms = comp[compState(i,j)];
-      const MachineState& msi = first.state[i];
-      const MachineState& msj = second.state[j];
-      ms.name = compStateName(i,j);
-      ms.leftContext = msj.leftContext;
-      ms.rightContext = msj.rightContext;
-      if (msj.isWait() || msj.isEnd()) {
-	for (const auto& it: msi.trans)
-	  if (it.out == MachineNull) {
-	    ms.trans.push_back (MachineTransition (it.in, MachineNull, compState(it.dest,j)));
-	    LogThisAt(6,"Adding transition from " << ms.name << " to " << compStateName(it.dest,j) << endl);
-	  } else
-	    for (const auto& jt: msj.trans)
-	      if (it.out == jt.in) {
-		ms.trans.push_back (MachineTransition (it.in, jt.out, compState(it.dest,jt.dest)));
-		LogThisAt(6,"Adding transition from " << ms.name << " to " << compStateName(it.dest,jt.dest) << endl);
-	      }
-      } else
-	for (const auto& jt: msj.trans) {
-	  ms.trans.push_back (MachineTransition (MachineNull, jt.out, compState(i,jt.dest)));
-	  LogThisAt(6,"Adding transition from " << ms.name << " to " << compStateName(i,jt.dest) << endl);
-	}
-    }
-  vguard<bool> reachableFromStart (comp.size(), false);
+  vguard<MachineState> comp;  // transition destinations are product indices
+  vguard<State> compIndex;
+  unordered_map<State,State> compPos;
   deque<State> queue;
-  queue.push_back (compState(first.startState(),second.startState()));
-  reachableFromStart[queue.front()] = true;
+  auto addState = [&](State c) {
+    if (!compPos.count(c)) {
+      compPos[c] = comp.size();
+      compIndex.push_back (c);
+      comp.push_back (MachineState());
+      queue.push_back (c);
+    }
+  };
+  addState (compState(first.startState(),second.startState()));
   while (queue.size()) {
     const State c = queue.front();
     queue.pop_front();
-    for (const auto& t: comp[c].trans)
-      if (!reachableFromStart[t.dest]) {
-	reachableFromStart[t.dest] = true;
-	queue.push_back (t.dest);
+    const State i = c / second.nStates(), j = c % second.nStates();
+    MachineState ms;
+    const MachineState& msi = first.state[i];
+    const MachineState& msj = second.state[j];
+    ms.name = compStateName(i,j);
+    ms.leftContext = msj.leftContext;
+    ms.rightContext = msj.rightContext;
+    if (msj.isWait() || msj.isEnd()) {
+      for (const auto& it: msi.trans)
+	if (it.out == MachineNull) {
+	  ms.trans.push_back (MachineTransition (it.in, MachineNull, compState(it.dest,j)));
+	  LogThisAt(6,"Adding transition from " << ms.name << " to " << compStateName(it.dest,j) << endl);
+	} else
+	  for (const auto& jt: msj.trans)
+	    if (it.out == jt.in) {
+	      ms.trans.push_back (MachineTransition (it.in, jt.out, compState(it.dest,jt.dest)));
+	      LogThisAt(6,"Adding transition from " << ms.name << " to " << compStateName(it.dest,jt.dest) << endl);
+	    }
+    } else
+      for (const auto& jt: msj.trans) {
+	ms.trans.push_back (MachineTransition (MachineNull, jt.out, compState(i,jt.dest)));
+	LogThisAt(6,"Adding transition from " << ms.name << " to " << compStateName(i,jt.dest) << endl);
       }
+    for (const auto& t: ms.trans)
+      addState (t.dest);
+    comp[compPos.at(c)] = ms;
   }
 
   vguard<bool> endReachableFrom (comp.size(), false);
   vguard<vguard<State> > sources (comp.size());
   for (State s = 0; s < comp.size(); ++s)
     for (const auto& t: comp[s].trans)
-      sources[t.dest].push_back (s);
-  queue.push_back (compState(first.nStates()-1,second.nStates()-1));
-  endReachableFrom[queue.front()] = true;
+      sources[compPos.at(t.dest)].push_back (s);
+  const auto endIter = compPos.find (compState(first.nStates()-1,second.nStates()-1));
+  if (endIter != compPos.end()) {
+    queue.push_back (endIter->second);
+    endReachableFrom[queue.front()] = true;
+  }
   while (queue.size()) {
     const State c = queue.front();
     queue.pop_front();
@@ -571,33 +585,48 @@ Machine Machine::compose (const Machine& first, const Machine& origSecond) {
       }
   }
 
-  map<State,State> nullEquiv;
+  // keep the states in product order
+  vguard<State> keep;
   for (State s = 0; s < comp.size(); ++s)
-    if (reachableFromStart[s] && endReachableFrom[s]) {
-      State d = s;
-      while (comp[d].trans.size() == 1 && comp[d].trans.front().isNull())
-	d = comp[d].trans.front().dest;
-      if (d != s)
-	nullEquiv[s] = d;
-    }
+    if (endReachableFrom[s])
+      keep.push_back (s);
+  sort (keep.begin(), keep.end(), [&] (State a, State b) { return compIndex[a] < compIndex[b]; });
+
+  // drop transitions into dead ends, and switch destinations to positions in comp
+  for (State s: keep) {
+    vguard<MachineTransition> trans;
+    for (const auto& t: comp[s].trans)
+      if (endReachableFrom[compPos.at(t.dest)])
+	trans.push_back (MachineTransition (t.in, t.out, compPos.at(t.dest)));
+    comp[s].trans.swap (trans);
+  }
+
+  map<State,State> nullEquiv;
+  for (State s: keep) {
+    State d = s;
+    while (comp[d].trans.size() == 1 && comp[d].trans.front().isNull())
+      d = comp[d].trans.front().dest;
+    if (d != s)
+      nullEquiv[s] = d;
+  }
   vguard<State> old2new (comp.size());
   State nStates = 0;
-  for (State oldIdx = 0; oldIdx < comp.size(); ++oldIdx)
-    if (reachableFromStart[oldIdx] && endReachableFrom[oldIdx] && !nullEquiv.count(oldIdx))
-      old2new[oldIdx] = nStates++;
-  for (State oldIdx = 0; oldIdx < comp.size(); ++oldIdx)
-    if (reachableFromStart[oldIdx] && endReachableFrom[oldIdx] && nullEquiv.count(oldIdx))
-      old2new[oldIdx] = old2new[nullEquiv.at(oldIdx)];
-  for (State oldIdx = 0; oldIdx < comp.size(); ++oldIdx)
-    if (reachableFromStart[oldIdx] && endReachableFrom[oldIdx])
-      for (auto& t: comp[oldIdx].trans)
-	t.dest = old2new[t.dest];
-  LogThisAt(3,"Transducer composition yielded " << nStates << "-state machine; " << plural (comp.size() - nStates, "more state was", "more states were") << " unreachable" << endl);
+  for (State s: keep)
+    if (!nullEquiv.count(s))
+      old2new[s] = nStates++;
+  for (State s: keep)
+    if (nullEquiv.count(s))
+      old2new[s] = old2new[nullEquiv.at(s)];
+  for (State s: keep)
+    for (auto& t: comp[s].trans)
+      t.dest = old2new[t.dest];
+  LogThisAt(3,"Transducer composition yielded " << nStates << "-state machine; " << plural (nProduct - nStates, "more state was", "more states were") << " unreachable" << endl);
+
   Machine compMachine;
   compMachine.state.reserve (nStates);
-  for (State oldIdx = 0; oldIdx < comp.size(); ++oldIdx)
-    if (reachableFromStart[oldIdx] && endReachableFrom[oldIdx] && !nullEquiv.count(oldIdx))
-      compMachine.state.push_back (comp[oldIdx]);
+  for (State s: keep)
+    if (!nullEquiv.count(s))
+      compMachine.state.push_back (comp[s]);
   return compMachine;
 }
 
@@ -3,6 +3,8 @@
 
 #include <string>
 #include <map>
+#include <iostream>
+#include <functional>
 #include "vguard.h"
 
 using namespace std;
@@ -38,6 +40,10 @@ typedef int ControlIndex;
 
 #define MachineWildContext  '*'
 
+// Convergence criteria for the stationary distribution in expectedBasesPerInputSymbol (L1 change per iteration)
+#define MachineRateTolerance     1e-12
+#define MachineRateMaxIterations 1000000
+
 #define MachineStrictInputFlag   1
 #define MachineRelaxedInputFlag  2
 #define MachineFlushInputFlag    4
@@ -85,6 +91,17 @@ struct Machine {
   Machine();
   State nStates() const;
   State startState() const;
+
+  // per-state accessors, also implemented by CompactMachine and ImplicitMachine
+  inline const string& stateName (State s) const { return state[s].name; }
+  inline const string& leftContext (State s) const { return state[s].leftContext; }
+  inline const string& rightContext (State s) const { return state[s].rightContext; }
+  inline const vguard<MachineTransition>& transitions (State s) const { return state[s].trans; }
+  inline const MachineTransition* transFor (State s, InputSymbol in) const { return state[s].transFor(in); }
+  inline bool acceptsInput (State s, InputSymbol in) const { return state[s].transFor(in) != NULL; }
+  inline bool isEnd (State s) const { return state[s].isEnd(); }
+  inline bool exitsWithInput (State s) const { return state[s].exitsWithInput(); }
+  inline bool emitsOutput (State s) const { return state[s].emitsOutput(); }
   
   void verifyContexts() const;
   bool isWaitingMachine() const;
@@ -95,6 +112,7 @@ struct Machine {
   void writeDot (ostream& out) const;
   void writeJSON (ostream& out) const;
   void readJSON (istream& in);
+  static void readJSONStates (istream& in, const function<void(MachineState&)>& addState);
   static Machine fromJSON (istream& in);
   static Machine fromFile (const char* filename);
   
@@ -119,10 +137,42 @@ struct Machine {
   string outputAlphabet() const;
   string inputDescriptionTable() const;
 
-  map<InputSymbol,double> expectedBasesPerInputSymbol (const char* symbols = "01") const;
+  // expected bases output per input symbol, in the stationary distribution of a random walk over the states that accept the symbols
+  map<InputSymbol,double> expectedBasesPerInputSymbol (const char* symbols = "01", size_t nThreads = 1) const;
 
   Machine waitingMachine() const;  // convert to waiting machine
   vguard<State> decoderToposort (const string& inputAlphabet) const;  // topological sort by non-output transitions
 };
 
+// JSON serialization via the per-state accessors, shared by Machine and CompactMachine
+template<class MachineType>
+void writeMachineJSON (const MachineType& machine, ostream& out) {
+  out << "{\"state\": [" << endl;
+  for (State s = 0; s < machine.nStates(); ++s) {
+    const string name = machine.stateName(s), lc = machine.leftContext(s), rc = machine.rightContext(s);
+    out << " {\"n\":" << s << ",";
+    if (name.size())
+	out << "\"id\":\"" << name << "\",";
+    if (lc.size())
+      out << "\"l\":\"" << lc << "\",";
+    if (rc.size())
+      out << "\"r\":\"" << rc << "\",";
+    out << "\"trans\":[";
+    size_t nt = 0;
+    for (const auto& t: machine.transitions(s)) {
+      if (nt++ > 0) out << ",";
+      out << "{";
+      if (t.in) out << "\"in\":\"" << t.in << "\",";
+      if (t.out) out << "\"out\":\"" << t.out << "\",";
+      out << "\"to\":" << t.dest
+	  << "}";
+    }
+    out << "]}";
+    if (s < machine.nStates() - 1)
+      out << ",";
+    out << endl;
+  }
+  out << "]}" << endl;
+}
+
 #endif /* TRANSDUCER_INCLUDED */
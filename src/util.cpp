@@ -25,6 +25,7 @@
 
 // function defs
 void Warn(const char* warning, ...) {
+  logger.flush();  // so the message follows any logging that preceded it
   va_list argptr;
   fprintf(stderr,"Warning: ");
   va_start (argptr, warning);
@@ -34,6 +35,7 @@ void Warn(const char* warning, ...) {
 }
 
 void Abort(const char* error, ...) {
+  logger.flush();
   va_list argptr;
   va_start (argptr, error);
   fprintf(stderr,"Abort: ");
@@ -45,6 +47,7 @@ void Abort(const char* error, ...) {
 }
 
 void Fail(const char* error, ...) {
+  logger.flush();
   va_list argptr;
   va_start (argptr, error);
   vfprintf(stderr,error,argptr);
@@ -1,7 +1,10 @@
 #include <list>
+#include <set>
+#include <algorithm>
 #include <iomanip>
 #include "viterbi.h"
 #include "logger.h"
+#include "metrics.h"
 
 InputModel::InputModel (const string& inAlph, double symWeight, double controlWeight)
   : inputAlphabet(inAlph)
@@ -23,6 +26,8 @@ string InputModel::toString() const {
 MachineScores::MachineScores (const Machine& machine, const InputModel& inputModel)
   : stateScores (machine.nStates())
 {
+  MetricPhase (span, "viterbi.scores", "states");
+  span.items = machine.nStates();
   machine.verifyContexts();
   for (char c: machine.outputAlphabet())
     Assert (isValidToken(c,dnaAlphabetString), "Not a DNA-outputting machine");
@@ -64,6 +69,8 @@ ViterbiMatrix::ViterbiMatrix (const Machine& machine, const InputModel& inputMod
     nStates (machine.nStates()),
     seqLen (fastSeq.length()),
     cell (nCells (machine, mutatorParams, fastSeq), -numeric_limits<double>::infinity()),
+    isStartState (machine.nStates(), mutatorParams.local),
+    bestEndState (machine.nStates() - 1),
     machine (machine),
     inputModel (inputModel),
     mutatorParams (mutatorParams),
@@ -72,14 +79,84 @@ ViterbiMatrix::ViterbiMatrix (const Machine& machine, const InputModel& inputMod
     machineScores (machine, inputModel),
     mutatorScores (mutatorParams)
 {
+  isStartState[0] = true;
   if (mutatorParams.local)
     for (State state = 0; state < machine.nStates(); ++state)
-      sCell(state,0) = 0;
+      endStates.push_back (state);
   else
-    sCell(0,0) = 0;
+    endStates.push_back (machine.nStates() - 1);
+  initEmitScores();
+  fill();
+}
+
+ViterbiMatrix::ViterbiMatrix (const Machine& machine, const InputModel& inputModel, const MutatorParams& mutatorParams, const FastSeq& fastSeq, const vguard<State>& startStates, const vguard<State>& endStates)
+  : maxDupLen (min (machine.maxLeftContext(), mutatorParams.maxDupLen())),
+    nStates (machine.nStates()),
+    seqLen (fastSeq.length()),
+    cell (nCells (machine, mutatorParams, fastSeq), -numeric_limits<double>::infinity()),
+    isStartState (machine.nStates(), false),
+    endStates (endStates),
+    bestEndState (endStates.empty() ? machine.nStates() - 1 : endStates.front()),
+    machine (machine),
+    inputModel (inputModel),
+    mutatorParams (mutatorParams),
+    fastSeq (fastSeq),
+    seq (fastSeq.tokens (dnaAlphabetString)),
+    machineScores (machine, inputModel),
+    mutatorScores (mutatorParams)
+{
+  for (State state: startStates)
+    isStartState[state] = true;
+  initEmitScores();
+  fill();
+}
+
+ViterbiMatrix::ViterbiMatrix (const Machine& machine, const InputModel& inputModel, const MutatorParams& mutatorParams, const FastSeq& fastSeq, const EmitProfile& profile)
+  : maxDupLen (min (machine.maxLeftContext(), mutatorParams.maxDupLen())),
+    nStates (machine.nStates()),
+    seqLen (fastSeq.length()),
+    cell (nCells (machine, mutatorParams, fastSeq), -numeric_limits<double>::infinity()),
+    isStartState (machine.nStates(), mutatorParams.local),
+    bestEndState (machine.nStates() - 1),
+    emitScore (profile),
+    machine (machine),
+    inputModel (inputModel),
+    mutatorParams (mutatorParams),
+    fastSeq (fastSeq),
+    seq (fastSeq.tokens (dnaAlphabetString)),
+    machineScores (machine, inputModel),
+    mutatorScores (mutatorParams)
+{
+  Assert (emitScore.size() == 4 * (size_t) seqLen, "Profile length doesn't match sequence length");
+  isStartState[0] = true;
+  if (mutatorParams.local)
+    for (State state = 0; state < machine.nStates(); ++state)
+      endStates.push_back (state);
+  else
+    endStates.push_back (machine.nStates() - 1);
+  fill();
+}
+
+void ViterbiMatrix::initEmitScores() {
+  emitScore.resize (4 * seqLen);
+  for (Pos pos = 0; pos < seqLen; ++pos)
+    for (Base base = 0; base < 4; ++base)
+      emitScore[4*pos + base] = mutatorScores.sub[base][seq[pos]];
+}
+
+void ViterbiMatrix::fill() {
+  for (State state = 0; state < machine.nStates(); ++state)
+    if (isStartState[state])
+      sCell(state,0) = 0;
 
   const auto stateOrder = machine.decoderToposort (inputModel.inputAlphabet);
 
+  MetricPhase (span, "viterbi.fill", "cells");
+  span.items = cell.size();
+  MetricCount ("viterbi.statesTouched", (seqLen + 1) * nStates);
+  MetricCount ("bytesAllocated.viterbi", cell.size() * sizeof(LogProb));
+  MetricSample ("viterbi.readLength", seqLen);
+
   ProgressLog (plog, 2);
   plog.initProgress ("Filling Viterbi matrix (%d*%d cells)", seqLen, machine.nStates());
 
@@ -92,7 +169,7 @@ ViterbiMatrix::ViterbiMatrix (const Machine& machine, const InputModel& inputMod
       if (pos > 0)
 	for (const auto& its: ss.incomingEmit)
 	  sCell(state,pos) = max (sCell(state,pos),
-				  sCell(its.src,pos-1) + its.score + mutatorScores.noGap + mutatorScores.sub[its.base][seq[pos-1]]);
+				  sCell(its.src,pos-1) + its.score + mutatorScores.noGap + emit(its.base,pos-1));
 
       for (const auto& its: ss.incomingNull)
 	sCell(state,pos) = max (sCell(state,pos),
@@ -100,10 +177,10 @@ ViterbiMatrix::ViterbiMatrix (const Machine& machine, const InputModel& inputMod
 
       if (mdl > 0 && pos > 0) {
 	sCell(state,pos) = max (sCell(state,pos),
-				tCell(state,pos-1,0) + mutatorScores.sub[tanDupBase(ss,0)][seq[pos-1]]);
+				tCell(state,pos-1,0) + emit(tanDupBase(ss,0),pos-1));
 
 	for (Pos dupIdx = 0; dupIdx < mdl - 1; ++dupIdx)
-	  tCell(state,pos,dupIdx) = tCell(state,pos-1,dupIdx+1) + mutatorScores.sub[tanDupBase(ss,dupIdx+1)][seq[pos-1]];
+	  tCell(state,pos,dupIdx) = tCell(state,pos-1,dupIdx+1) + emit(tanDupBase(ss,dupIdx+1),pos-1);
       }
     }
 
@@ -168,9 +245,9 @@ ViterbiMatrix::ViterbiMatrix (const Machine& machine, const InputModel& inputMod
       }
   }
 
-  if (mutatorParams.local)
-    for (State state = 0; state < machine.nStates(); ++state)
-      loglike() = max (loglike(), sCell(state,seqLen));
+  for (State state: endStates)
+    if (sCell(state,seqLen) > sCell(bestEndState,seqLen))
+      bestEndState = state;
 
   LogThisAt(10,"Viterbi matrix:\n" << toString());
 }
@@ -193,6 +270,8 @@ string ViterbiMatrix::toString() const {
 }
 
 string ViterbiMatrix::traceback() const {
+  MetricPhase (span, "viterbi.traceback", "bases");
+  span.items = seqLen;
   list<char> trace;
 
   if (!(loglike() > -numeric_limits<double>::infinity())) {
@@ -200,7 +279,7 @@ string ViterbiMatrix::traceback() const {
     return "";
   }
   
-  State state = machine.nStates() - 1, bestState;
+  State state = bestEndState, bestState;
   Pos pos = seqLen, bestPos;
   MutStateIndex mutState = 0, bestMutState;
   LogProb best;
@@ -237,14 +316,11 @@ string ViterbiMatrix::traceback() const {
   };
 
   initBest();
-  if (mutatorParams.local)
-    for (State s = 0; s < machine.nStates(); ++s)
-      updateBest (s, seqLen, sMutStateIndex(), 0, NULL);
-  else
-    updateBest (machine.nStates() - 1, seqLen, sMutStateIndex(), 0, NULL);
+  for (State s: endStates)
+    updateBest (s, seqLen, sMutStateIndex(), 0, NULL);
   checkBest();
 
-  while (pos >= 0 && state > 0) {
+  while (pos >= 0 && state > 0 && !(pos == 0 && mutState == sMutStateIndex() && isStartState[state] && getCell(state,pos,mutState) == 0 && !mutatorParams.local)) {
     const StateScores& ss = machineScores.stateScores[state];
     const auto mdl = maxDupLenAt(ss);
     initBest();
@@ -252,13 +328,13 @@ string ViterbiMatrix::traceback() const {
 
       if (pos > 0)
 	for (const auto& its: ss.incomingEmit)
-	  updateBest (its.src, pos-1, sMutStateIndex(), its.score + mutatorScores.noGap + mutatorScores.sub[its.base][seq[pos-1]], &its);
+	  updateBest (its.src, pos-1, sMutStateIndex(), its.score + mutatorScores.noGap + emit(its.base,pos-1), &its);
       for (const auto& its: ss.incomingNull)
 	updateBest (its.src, pos, sMutStateIndex(), its.score, &its);
       updateBest (state, pos, dMutStateIndex(), mutatorScores.delEnd, NULL);
 
       if (mdl > 0 && pos > 0)
-	updateBest (state, pos-1, tMutStateIndex(0), mutatorScores.sub[tanDupBase(ss,0)][seq[pos-1]], NULL);
+	updateBest (state, pos-1, tMutStateIndex(0), emit(tanDupBase(ss,0),pos-1), NULL);
 
       if (pos == 0 && mutatorParams.local)
 	updateBest (0, 0, sMutStateIndex(), 0, NULL);
@@ -282,7 +358,7 @@ string ViterbiMatrix::traceback() const {
 
       const Pos dupIdx = tMutStateDupIdx (mutState);
       if (dupIdx < mdl - 1)
-	updateBest (state, pos-1, tMutStateIndex(dupIdx+1), mutatorScores.sub[tanDupBase(ss,dupIdx+1)][seq[pos-1]], NULL);
+	updateBest (state, pos-1, tMutStateIndex(dupIdx+1), emit(tanDupBase(ss,dupIdx+1),pos-1), NULL);
       updateBest (state, pos, sMutStateIndex(), mutatorScores.tanDup + mutatorScores.len[dupIdx], NULL);
 
       if (bestMutState == sMutStateIndex()) {
@@ -303,12 +379,20 @@ string ViterbiMatrix::traceback() const {
   return string (trace.begin(), trace.end());
 }
 
-vguard<FastSeq> decodeFastSeqs (const char* filename, const Machine& machine, const MutatorParams& mutatorParams) {
-  const vguard<FastSeq> outseqs = readFastSeqs (filename);
-  vguard<FastSeq> inseqs;
+InputModel viterbiInputModel (const Machine& machine, const MutatorParams& mutatorParams) {
   const string inAlph = machine.inputAlphabet (MachineRelaxedInputFlag | MachineControlInputFlag | MachineSEOFInputFlag);
   const InputModel inmod (inAlph, 1., pow(4.,-(double)(4*mutatorParams.maxDupLen())));  // somewhat arbitrary penalty for control characters. Rationale: maxDupLen is typically half of codeword length; paths to control chars are typically <1.5*codeword length
   LogThisAt(6,"Input model for Viterbi decoding:" << endl << inmod.toString());
+  return inmod;
+}
+
+vguard<FastSeq> decodeFastSeqs (const char* filename, const Machine& machine, const MutatorParams& mutatorParams) {
+  return decodeFastSeqs (readFastSeqs (filename), machine, mutatorParams);
+}
+
+vguard<FastSeq> decodeFastSeqs (const vguard<FastSeq>& outseqs, const Machine& machine, const MutatorParams& mutatorParams) {
+  vguard<FastSeq> inseqs;
+  const InputModel inmod = viterbiInputModel (machine, mutatorParams);
   for (auto& outseq: outseqs) {
     ViterbiMatrix vit (machine, inmod, mutatorParams, outseq);
     FastSeq inseq;
@@ -318,3 +402,270 @@ vguard<FastSeq> decodeFastSeqs (const char* filename, const Machine& machine, co
   }
   return inseqs;
 }
+
+template<class MachineType>
+ImplicitViterbiMatrix<MachineType>::ImplicitViterbiMatrix (const MachineType& machine, const InputModel& inputModel, const MutatorParams& mutatorParams, const FastSeq& fastSeq, size_t beamWidth)
+  : maxDupLen (min ((size_t) machine.maxLeftContext(), mutatorParams.maxDupLen())),
+    seqLen (fastSeq.length()),
+    row (fastSeq.length() + 1),
+    bestEndState (machine.endState()),
+    best (-numeric_limits<double>::infinity()),
+    machine (machine),
+    inputModel (inputModel),
+    mutatorParams (mutatorParams),
+    fastSeq (fastSeq),
+    seq (fastSeq.tokens (dnaAlphabetString)),
+    mutatorScores (mutatorParams),
+    beamWidth (beamWidth)
+{
+  const Source start = { 0, noMutStateIndex(), false, MachineNull };
+  update (row[0], machine.startState(), sMutStateIndex(), 0, start);
+
+  MetricPhase (span, "beamViterbi.fill", "cells");
+  ProgressLog (plog, 2);
+  plog.initProgress ("Filling beam Viterbi matrix (%d rows, beam width %u)", seqLen, beamWidth);
+
+  size_t nCells = 0;
+  for (Pos pos = 0; pos <= seqLen; ++pos) {
+    plog.logProgress (pos / (double) seqLen, "row %d/%d", pos, seqLen);
+    fillRow (pos);
+    pruneRow (pos);
+    nCells += row[pos].cell.size();
+    MetricSample ("beamViterbi.rowCells", row[pos].cell.size());
+  }
+  span.items = nCells;
+  MetricCount ("beamViterbi.statesTouched", stateScoresCache.size());
+
+  if (mutatorParams.local) {
+    for (const auto& sc: row[seqLen].cell)
+      if (sc.second.score[sMutStateIndex()] > best || (sc.second.score[sMutStateIndex()] == best && sc.first < bestEndState)) {
+	best = sc.second.score[sMutStateIndex()];
+	bestEndState = sc.first;
+      }
+  } else
+    best = cellScore (row[seqLen], bestEndState, sMutStateIndex());
+
+  LogThisAt(4,"Beam Viterbi matrix visited " << nCells << " cells (" << stateScoresCache.size() << " distinct states); log-likelihood " << best << endl);
+}
+
+template<class MachineType>
+const typename ImplicitViterbiMatrix<MachineType>::StateScores& ImplicitViterbiMatrix<MachineType>::stateScores (State state) const {
+  const auto iter = stateScoresCache.find (state);
+  if (iter != stateScoresCache.end())
+    return iter->second;
+  StateScores& ss = stateScoresCache[state];
+  for (char lc: machine.leftContext(state))
+    if (lc != MachineWildContext)
+      ss.leftContext.push_back (charToBase (lc));
+  for (const auto& t: machine.transitions(state))
+    if (t.inputEmpty() || t.isEOF() || inputModel.symProb.count(t.in)) {
+      TransScore ts;
+      ts.dest = t.dest;
+      ts.score = inputModel.symProb.count(t.in) ? log(inputModel.symProb.at(t.in)) : 0;
+      ts.in = t.in;
+      ts.emit = !t.outputEmpty();
+      ts.base = ts.emit ? charToBase (t.out) : 0;
+      ss.outgoing.push_back (ts);
+    }
+  return ss;
+}
+
+template<class MachineType>
+bool ImplicitViterbiMatrix<MachineType>::update (Row& r, State state, MutStateIndex mutState, LogProb score, const Source& src) {
+  if (!(score > -numeric_limits<double>::infinity()))
+    return false;
+  Cell& c = r.cell[state];
+  if (c.score.empty()) {
+    const Source none = { 0, noMutStateIndex(), false, MachineNull };
+    c.score = vguard<LogProb> (maxDupLen + 2, -numeric_limits<double>::infinity());
+    c.src = vguard<Source> (maxDupLen + 2, none);
+  }
+  if (score > c.score[mutState]) {
+    c.score[mutState] = score;
+    c.src[mutState] = src;
+    return true;
+  }
+  return false;
+}
+
+template<class MachineType>
+void ImplicitViterbiMatrix<MachineType>::fillRow (Pos pos) {
+  Row& r = row[pos];
+  const Source none = { 0, noMutStateIndex(), false, MachineNull };
+
+  if (pos > 0) {
+    const Row& prev = row[pos-1];
+    const AlphTok obs = seq[pos-1];
+    for (State state: prev.beam) {
+      const Cell& pc = prev.cell.at (state);
+      const StateScores& ss = stateScores (state);
+      const LogProb ssrc = pc.score[sMutStateIndex()];
+      if (ssrc > -numeric_limits<double>::infinity())
+	for (const auto& ts: ss.outgoing)
+	  if (ts.emit) {
+	    const Source src = { state, sMutStateIndex(), true, ts.in };
+	    update (r, ts.dest, sMutStateIndex(), ssrc + ts.score + mutatorScores.noGap + mutatorScores.sub[ts.base][obs], src);
+	  }
+
+      const auto mdl = maxDupLenAt (ss);
+      if (mdl > 0) {
+	const Source src = { state, tMutStateIndex(0), true, MachineNull };
+	update (r, state, sMutStateIndex(), pc.score[tMutStateIndex(0)] + mutatorScores.sub[ss.tanDupBase(0)][obs], src);
+	for (Pos dupIdx = 0; dupIdx < mdl - 1; ++dupIdx) {
+	  const Source tsrc = { state, tMutStateIndex(dupIdx+1), true, MachineNull };
+	  update (r, state, tMutStateIndex(dupIdx), pc.score[tMutStateIndex(dupIdx+1)] + mutatorScores.sub[ss.tanDupBase(dupIdx+1)][obs], tsrc);
+	}
+      }
+    }
+  }
+
+  // local reads may also start part-way through the machine, at states matching the first few windows
+  if (mutatorParams.local)
+    for (State state: machine.localStartStates (seq, pos))
+      update (r, state, sMutStateIndex(), pos * log(.25), none);
+
+  // deletions & null transitions
+  LogProb rowBest = -numeric_limits<double>::infinity();
+  vguard<State> pushStates;
+  for (const auto& sc: r.cell) {
+    pushStates.push_back (sc.first);
+    rowBest = max (rowBest, max (sc.second.score[sMutStateIndex()], sc.second.score[dMutStateIndex()]));
+  }
+  sort (pushStates.begin(), pushStates.end(), greater<State>());
+  set<State> onStack (pushStates.begin(), pushStates.end());
+
+  auto relax = [&] (State dest, MutStateIndex mutState, LogProb score, const Source& src) -> bool {
+    if (score < rowBest - ImplicitViterbiBeamDelta || !update (r, dest, mutState, score, src))
+      return false;
+    rowBest = max (rowBest, score);
+    return true;
+  };
+
+  while (!pushStates.empty()) {
+    const State state = pushStates.back();
+    pushStates.pop_back();
+    onStack.erase (state);
+    const StateScores& ss = stateScores (state);
+
+    const LogProb dsrc = cellScore (r, state, dMutStateIndex());
+    LogProb ssrc = cellScore (r, state, sMutStateIndex());
+    if (dsrc + mutatorScores.delEnd > ssrc) {
+      const Source src = { state, dMutStateIndex(), false, MachineNull };
+      update (r, state, sMutStateIndex(), dsrc + mutatorScores.delEnd, src);
+      ssrc = dsrc + mutatorScores.delEnd;
+    }
+
+    for (const auto& ts: ss.outgoing) {
+      bool push = false;
+      if (ts.emit) {
+	const LogProb dext = dsrc + mutatorScores.delExtend, dopen = ssrc + mutatorScores.delOpen;
+	const bool fromD = dext > dopen;
+	const Source src = { state, fromD ? dMutStateIndex() : sMutStateIndex(), false, ts.in };
+	push = relax (ts.dest, dMutStateIndex(), (fromD ? dext : dopen) + ts.score, src);
+      } else {
+	const Source dsrcPtr = { state, dMutStateIndex(), false, ts.in };
+	const Source ssrcPtr = { state, sMutStateIndex(), false, ts.in };
+	push = relax (ts.dest, dMutStateIndex(), dsrc + ts.score, dsrcPtr);
+	push = relax (ts.dest, sMutStateIndex(), ssrc + ts.score, ssrcPtr) || push;
+      }
+      if (push && !onStack.count (ts.dest)) {
+	pushStates.push_back (ts.dest);
+	onStack.insert (ts.dest);
+      }
+    }
+  }
+
+  // tandem duplications
+  if (pos > 0)
+    for (auto& sc: r.cell) {
+      const StateScores& ss = stateScores (sc.first);
+      const auto mdl = maxDupLenAt (ss);
+      const Source src = { sc.first, sMutStateIndex(), false, MachineNull };
+      for (Pos dupIdx = 0; dupIdx < mdl; ++dupIdx)
+	update (r, sc.first, tMutStateIndex(dupIdx), sc.second.score[sMutStateIndex()] + mutatorScores.tanDup + mutatorScores.len[dupIdx], src);
+    }
+}
+
+template<class MachineType>
+void ImplicitViterbiMatrix<MachineType>::pruneRow (Pos pos) {
+  Row& r = row[pos];
+  vguard<pair<LogProb,State> > ranked;
+  LogProb rowBest = -numeric_limits<double>::infinity();
+  for (const auto& sc: r.cell) {
+    const LogProb cs = *max_element (sc.second.score.begin(), sc.second.score.end());
+    ranked.push_back (pair<LogProb,State> (cs, sc.first));
+    rowBest = max (rowBest, cs);
+  }
+  sort (ranked.begin(), ranked.end(), [] (const pair<LogProb,State>& a, const pair<LogProb,State>& b) {
+      return a.first > b.first || (a.first == b.first && a.second < b.second);
+    });
+  for (const auto& cs: ranked) {
+    if (r.beam.size() >= beamWidth || !(cs.first > -numeric_limits<double>::infinity()) || cs.first < rowBest - ImplicitViterbiBeamDelta)
+      break;
+    r.beam.push_back (cs.second);
+  }
+  LogThisAt(8,"Row " << pos << ": " << r.cell.size() << " cells, " << r.beam.size() << " in beam, best " << rowBest << endl);
+}
+
+template<class MachineType>
+string ImplicitViterbiMatrix<MachineType>::traceback() const {
+  MetricPhase (span, "beamViterbi.traceback", "bases");
+  span.items = seqLen;
+  if (!(loglike() > -numeric_limits<double>::infinity())) {
+    Warn ("No valid Viterbi decoding found");
+    return "";
+  }
+
+  list<char> trace;
+  State state = bestEndState;
+  Pos pos = seqLen;
+  MutStateIndex mutState = sMutStateIndex();
+  while (true) {
+    const Source& src = row[pos].cell.at(state).src[mutState];
+    if (src.mutState == noMutStateIndex())
+      break;
+    LogThisAt(9,"Traceback at (" << machine.stateName(state) << "," << pos << "," << mutState << ")" << endl);
+    if (src.in)
+      trace.push_front (src.in);
+    state = src.state;
+    mutState = src.mutState;
+    if (src.prevRow)
+      --pos;
+  }
+  return string (trace.begin(), trace.end());
+}
+
+template<class MachineType>
+vguard<FastSeq> decodeFastSeqsBeam (const vguard<FastSeq>& outseqs, const MachineType& machine, const MutatorParams& mutatorParams, size_t beamWidth) {
+  vguard<FastSeq> inseqs;
+  const string inAlph = machine.inputAlphabet (MachineRelaxedInputFlag | MachineControlInputFlag | MachineSEOFInputFlag);
+  const InputModel inmod (inAlph, 1., pow(4.,-(double)(4*mutatorParams.maxDupLen())));
+  LogThisAt(6,"Input model for beam Viterbi decoding:" << endl << inmod.toString());
+  for (auto& outseq: outseqs) {
+    ImplicitViterbiMatrix<MachineType> vit (machine, inmod, mutatorParams, outseq, beamWidth);
+    FastSeq inseq;
+    inseq.name = outseq.name;
+    inseq.seq = vit.traceback();
+    inseqs.push_back (inseq);
+  }
+  return inseqs;
+}
+
+vguard<FastSeq> decodeFastSeqs (const vguard<FastSeq>& outseqs, const ImplicitMachine& machine, const MutatorParams& mutatorParams, size_t beamWidth) {
+  return decodeFastSeqsBeam (outseqs, machine, mutatorParams, beamWidth);
+}
+
+vguard<FastSeq> decodeFastSeqs (const vguard<FastSeq>& outseqs, const PeriodicMachine& machine, const MutatorParams& mutatorParams, size_t beamWidth) {
+  return decodeFastSeqsBeam (outseqs, machine, mutatorParams, beamWidth);
+}
+
+vguard<FastSeq> decodeFastSeqs (const char* filename, const ImplicitMachine& machine, const MutatorParams& mutatorParams, size_t beamWidth) {
+  return decodeFastSeqsBeam (readFastSeqs (filename), machine, mutatorParams, beamWidth);
+}
+
+vguard<FastSeq> decodeFastSeqs (const char* filename, const PeriodicMachine& machine, const MutatorParams& mutatorParams, size_t beamWidth) {
+  return decodeFastSeqsBeam (readFastSeqs (filename), machine, mutatorParams, beamWidth);
+}
+
+template class ImplicitViterbiMatrix<ImplicitMachine>;
+template class ImplicitViterbiMatrix<PeriodicMachine>;
@@ -1,8 +1,11 @@
 #ifndef VITERBI_INCLUDED
 #define VITERBI_INCLUDED
 
+#include <unordered_map>
 #include "mutator.h"
 #include "fastseq.h"
+#include "implicit.h"
+#include "periodic.h"
 
 // default probabilistic weighting for control chars means that a 14-base sequence is less probable than the control character that generates it
 // i.e. it's optimized for ~14-base codewords
@@ -34,6 +37,10 @@ struct StateScores {
   inline Base base() const { return leftContext.back(); }
 };
 
+// Emission scores for decoding a profile of several aligned reads instead of one read:
+// profile[4*pos+base] is the log-likelihood of the reads' bases at position pos, if the machine emitted base there
+typedef vguard<LogProb> EmitProfile;
+
 struct MachineScores {
   vguard<StateScores> stateScores;
   MachineScores (const Machine& machine, const InputModel& inputModel);
@@ -80,7 +87,15 @@ private:
   inline LogProb& tCell (State state, Pos pos, Pos idx) { return cell[tCellIndex(state,pos,idx)]; }
 
   inline LogProb getCell (State state, Pos pos, MutStateIndex mutState) const { return cell[cellIndex(state,pos,mutState)]; }
-  inline LogProb& loglike() { return sCell (machine.nStates() - 1, seqLen); }
+
+  vguard<bool> isStartState;
+  vguard<State> endStates;
+  State bestEndState;
+  EmitProfile emitScore;  // by position & base; for a single read, from mutatorScores.sub
+  void initEmitScores();
+  void fill();
+
+  inline LogProb emit (Base base, Pos pos) const { return emitScore[4*pos + base]; }
   
 public:
   const Machine& machine;
@@ -92,6 +107,10 @@ public:
   const MutatorScores mutatorScores;
 
   ViterbiMatrix (const Machine& machine, const InputModel& inputModel, const MutatorParams& mutatorParams, const FastSeq& fastSeq);
+  // alignment from any of startStates at the start of the sequence, to any of endStates at the end (ignores mutatorParams.local)
+  ViterbiMatrix (const Machine& machine, const InputModel& inputModel, const MutatorParams& mutatorParams, const FastSeq& fastSeq, const vguard<State>& startStates, const vguard<State>& endStates);
+  // alignment to a profile; fastSeq is its consensus, which is only used for logging
+  ViterbiMatrix (const Machine& machine, const InputModel& inputModel, const MutatorParams& mutatorParams, const FastSeq& fastSeq, const EmitProfile& profile);
   string toString() const;
   string traceback() const;
 
@@ -99,12 +118,96 @@ public:
   inline LogProb dCell (State state, Pos pos) const { return cell[dCellIndex(state,pos)]; }
   inline LogProb tCell (State state, Pos pos, Pos dupIdx) const { return cell[tCellIndex(state,pos,dupIdx)]; }
 
-  inline LogProb loglike() const { return sCell (machine.nStates() - 1, seqLen); }
+  inline LogProb loglike() const { return sCell (bestEndState, seqLen); }
   
   inline Pos maxDupLenAt (const StateScores& ss) const { return min ((Pos) maxDupLen, (Pos) ss.leftContext.size()); }
   inline Base tanDupBase (const StateScores& ss, Pos dupIdx) const { return ss.leftContext[ss.leftContext.size() - 1 - dupIdx]; }
 };
 
+// Beam-search Viterbi for machines whose states are generated on demand (ImplicitMachine, PeriodicMachine).
+// Uses the same error model and recursions as ViterbiMatrix, but each row only holds the states reached
+// from the previous row's beam, and stores traceback pointers instead of rescanning incoming transitions.
+// In local mode, reads may begin at the Start state, or at any live kmer matching the read within the
+// first few windows (the bases before the window are scored under a uniform background model).
+// Besides the Encoder/Decoder accessors, MachineType provides maxLeftContext() and localStartStates().
+#define DefaultImplicitViterbiBeamWidth 1000
+#define ImplicitViterbiBeamDelta        30  /* log-likelihood below row best at which cells are dropped */
+
+template<class MachineType>
+class ImplicitViterbiMatrix {
+private:
+  typedef size_t MutStateIndex;
+  struct TransScore {
+    State dest;
+    LogProb score;
+    InputSymbol in;
+    bool emit;
+    Base base;
+  };
+  struct StateScores {
+    vguard<Base> leftContext;
+    vguard<TransScore> outgoing;
+    inline Base tanDupBase (Pos dupIdx) const { return leftContext[leftContext.size() - 1 - dupIdx]; }
+  };
+  struct Source {
+    State state;
+    MutStateIndex mutState;
+    bool prevRow;
+    InputSymbol in;
+  };
+  struct Cell {
+    vguard<LogProb> score;
+    vguard<Source> src;
+  };
+  struct Row {
+    unordered_map<State,Cell> cell;
+    vguard<State> beam;
+  };
+
+  size_t maxDupLen, seqLen;
+  vguard<Row> row;
+  mutable unordered_map<State,StateScores> stateScoresCache;
+  State bestEndState;
+  LogProb best;
+
+  inline MutStateIndex sMutStateIndex() const { return 0; }
+  inline MutStateIndex dMutStateIndex() const { return 1; }
+  inline MutStateIndex tMutStateIndex (Pos dupIdx) const { return 2 + dupIdx; }
+  inline MutStateIndex noMutStateIndex() const { return maxDupLen + 2; }
+
+  const StateScores& stateScores (State state) const;
+  inline Pos maxDupLenAt (const StateScores& ss) const { return min ((Pos) maxDupLen, (Pos) ss.leftContext.size()); }
+
+  static inline LogProb cellScore (const Row& r, State state, MutStateIndex mutState) {
+    const auto iter = r.cell.find (state);
+    return iter == r.cell.end() ? -numeric_limits<double>::infinity() : iter->second.score[mutState];
+  }
+  bool update (Row& r, State state, MutStateIndex mutState, LogProb score, const Source& src);
+  void fillRow (Pos pos);
+  void pruneRow (Pos pos);
+
+public:
+  const MachineType& machine;
+  const InputModel& inputModel;
+  const MutatorParams& mutatorParams;
+  const FastSeq& fastSeq;
+  const TokSeq seq;
+  const MutatorScores mutatorScores;
+  const size_t beamWidth;
+
+  ImplicitViterbiMatrix (const MachineType& machine, const InputModel& inputModel, const MutatorParams& mutatorParams, const FastSeq& fastSeq, size_t beamWidth = DefaultImplicitViterbiBeamWidth);
+
+  inline LogProb loglike() const { return best; }
+  string traceback() const;
+};
+
+InputModel viterbiInputModel (const Machine& machine, const MutatorParams& mutatorParams);  // the input model used to decode reads
+
+vguard<FastSeq> decodeFastSeqs (const vguard<FastSeq>& outseqs, const Machine& machine, const MutatorParams& mutatorParams);
 vguard<FastSeq> decodeFastSeqs (const char* filename, const Machine& machine, const MutatorParams& mutatorParams);
+vguard<FastSeq> decodeFastSeqs (const char* filename, const ImplicitMachine& machine, const MutatorParams& mutatorParams, size_t beamWidth = DefaultImplicitViterbiBeamWidth);
+vguard<FastSeq> decodeFastSeqs (const char* filename, const PeriodicMachine& machine, const MutatorParams& mutatorParams, size_t beamWidth = DefaultImplicitViterbiBeamWidth);
+vguard<FastSeq> decodeFastSeqs (const vguard<FastSeq>& outseqs, const ImplicitMachine& machine, const MutatorParams& mutatorParams, size_t beamWidth = DefaultImplicitViterbiBeamWidth);
+vguard<FastSeq> decodeFastSeqs (const vguard<FastSeq>& outseqs, const PeriodicMachine& machine, const MutatorParams& mutatorParams, size_t beamWidth = DefaultImplicitViterbiBeamWidth);
 
 #endif /* VITERBI_INCLUDED */
@@ -0,0 +1,323 @@
+#include <iostream>
+#include <sstream>
+#include <random>
+#include <boost/program_options.hpp>
+#include "../src/vguard.h"
+#include "../src/logger.h"
+#include "../src/encoder.h"
+#include "../src/decoder.h"
+#include "../src/viterbi.h"
+#include "../src/fwdback.h"
+#include "../src/pattern.h"
+#include "../src/logsumexp.h"
+#include "../src/benchmark.h"
+
+using namespace std;
+
+namespace po = boost::program_options;
+
+// results of each kernel are folded into these, so the compiler can't drop the work
+volatile Kmer kmerSink;
+volatile double doubleSink;
+volatile size_t sizeSink;
+
+// Times each kernel and collects one record per kernel.
+// An "op" is the unit the kernel's time is divided by (one call, one row, one byte...);
+// an "item" is the unit of work its throughput is quoted in (kmers, cells, bases...).
+struct MicroBench {
+  double minSeconds;
+  string only;
+  vguard<BenchRecord> records;
+
+  MicroBench (double minSeconds, const string& only)
+    : minSeconds (minSeconds),
+      only (only)
+  { }
+
+  // op(reps) runs the kernel reps times; each run is opsPerRep ops of itemsPerOp items
+  template<class Op>
+  void run (const string& name, const string& opName, double opsPerRep, const string& itemName, double itemsPerOp, Op op) {
+    if (!only.empty() && name.find (only) == string::npos)
+      return;
+    size_t reps;
+    const double secondsPerOp = secondsPerRep (op, minSeconds, reps) / opsPerRep;
+    BenchRecord rec;
+    rec.set ("benchmark", name)
+      .set ("op", opName)
+      .set ("ops", reps * opsPerRep)
+      .set ("nsPerOp", secondsPerOp * 1e9)
+      .set ("opsPerSecond", 1 / secondsPerOp)
+      .set ("item", itemName)
+      .set ("itemsPerOp", itemsPerOp)
+      .set ("itemsPerSecond", itemsPerOp / secondsPerOp);
+    records.push_back (rec);
+    LogThisAt(2,name << ": " << secondsPerOp * 1e9 << " ns per " << opName << endl);
+  }
+};
+
+// error model for the Viterbi & Forward benchmarks; the same defaults as dnastore
+MutatorParams benchErrorModel (size_t maxDupLen) {
+  MutatorParams mut;
+  mut.initMaxDupLen (max ((size_t) 1, maxDupLen));
+  mut.pTanDup = .001;
+  mut.pDelOpen = .001;
+  mut.pDelExtend = .01;
+  mut.pTransition = .01 * 10 / 11;
+  mut.pTransversion = .01 / 11;
+  mut.local = false;
+  return mut;
+}
+
+int main (int argc, char** argv) {
+
+#ifndef DEBUG
+  try {
+#endif /* DEBUG */
+
+    po::options_description desc("Allowed options");
+    desc.add_options()
+      ("help,h", "display this help message")
+      ("machine", po::value<vector<string> >(), "machine JSON file(s) for the machine-level benchmarks")
+      ("stockholm", po::value<string>()->default_value("data/test.stk"), "Stockholm database for the Forward benchmark")
+      ("only", po::value<string>()->default_value(""), "only run benchmarks whose name contains this string")
+      ("min-time", po::value<double>()->default_value(.2), "minimum time (seconds) to spend timing each benchmark")
+      ("payload-bits", po::value<int>()->default_value(1024), "length of the random payload to encode, decode & Viterbi-decode")
+      ("seed", po::value<unsigned long long>()->default_value(1), "random number seed")
+      ("verbose,v", po::value<int>()->default_value(1), "verbosity level")
+      ("log", po::value<vector<string> >(), "log everything in this function")
+      ("nocolor", "log in monochrome")
+      ;
+    po::positional_options_description pos;
+    pos.add ("machine", -1);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc,argv).options(desc).positional(pos).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      cout << "Usage: " << argv[0] << " [options] [<machine.json>...]" << endl;
+      cout << "Times the core kernels and prints a JSON table of ns per op & items per second" << endl;
+      cout << desc << endl;
+      return 1;
+    }
+
+    logger.parseLogArgs (vm);
+
+    const double minSeconds = vm.at("min-time").as<double>();
+    const int payloadLen = vm.at("payload-bits").as<int>();
+    Require (minSeconds > 0 && payloadLen > 0, "--min-time and --payload-bits must be positive");
+    mt19937_64 gen (vm.at("seed").as<unsigned long long>());
+    MicroBench bench (minSeconds, vm.at("only").as<string>());
+
+    // kmer & pattern kernels, on random kmers
+    const Pos len = 16;
+    const size_t nKmers = 1024;  // power of 2
+    vguard<Kmer> kmers (nKmers);
+    for (auto& kmer: kmers)
+      kmer = gen() & kmerMask(len);
+
+    bench.run ("kmerRevComp", "call", 1, "kmer", 1, [&] (size_t reps) {
+	Kmer x = 0;
+	for (size_t n = 0; n < reps; ++n)
+	  x ^= kmerRevComp (kmers[n & (nKmers-1)], len);
+	kmerSink = x;
+      });
+    bench.run ("kmerSub", "call", 1, "kmer", 1, [&] (size_t reps) {
+	Kmer x = 0;
+	for (size_t n = 0; n < reps; ++n)
+	  x ^= kmerSub (kmers[n & (nKmers-1)], 1 + (n & 7), 1 + ((n >> 3) & 7));
+	kmerSink = x;
+      });
+
+    auto patternBench = [&] (const string& name, const function<bool(Kmer)>& test) {
+      bench.run (string("pattern/") + name, "call", nKmers, "kmer", 1, [&] (size_t reps) {
+	  size_t hits = 0;
+	  for (size_t r = 0; r < reps; ++r)
+	    for (Kmer kmer: kmers)
+	      hits += test (kmer);
+	  sizeSink = hits;
+	});
+    };
+    patternBench ("hasExactTandemRepeat", [&] (Kmer k) { return hasExactTandemRepeat (k, len, 4); });
+    patternBench ("hasExactLocalInvertedRepeat", [&] (Kmer k) { return hasExactLocalInvertedRepeat (k, len, 3, 8); });
+    patternBench ("hasExactNonlocalInvertedRepeat", [&] (Kmer k) { return hasExactNonlocalInvertedRepeat (k, len, 4, 2); });
+    patternBench ("hasExactTandemRepeatAtEnd", [&] (Kmer k) { return hasExactTandemRepeatAtEnd (k, len, 4); });
+    patternBench ("hasExactLocalInvertedRepeatAtEnd", [&] (Kmer k) { return hasExactLocalInvertedRepeatAtEnd (k, len, 3, 8); });
+    patternBench ("hasExactNonlocalInvertedRepeatAtEnd", [&] (Kmer k) { return hasExactNonlocalInvertedRepeatAtEnd (k, len, 4, 2); });
+
+    auto batchBench = [&] (const string& name, const function<void(const Kmer*,bool*)>& test) {
+      bench.run (string("pattern/") + name + "<4>", "call", nKmers / 4, "kmer", 4, [&] (size_t reps) {
+	  size_t hits = 0;
+	  bool result[4];
+	  for (size_t r = 0; r < reps; ++r)
+	    for (size_t n = 0; n < nKmers; n += 4) {
+	      test (&kmers[n], result);
+	      hits += result[0] + result[1] + result[2] + result[3];
+	    }
+	  sizeSink = hits;
+	});
+    };
+    batchBench ("hasExactTandemRepeatAtEnd", [&] (const Kmer* k, bool* r) { hasExactTandemRepeatAtEnd<4> (k, len, 4, r); });
+    batchBench ("hasExactLocalInvertedRepeatAtEnd", [&] (const Kmer* k, bool* r) { hasExactLocalInvertedRepeatAtEnd<4> (k, len, 3, 8, r); });
+    batchBench ("hasExactNonlocalInvertedRepeatAtEnd", [&] (const Kmer* k, bool* r) { hasExactNonlocalInvertedRepeatAtEnd<4> (k, len, 4, 2, r); });
+
+    // log-sum-exp, with & without the lookup table
+    const size_t nLogProbs = 1024;  // power of 2
+    vguard<double> logProb (nLogProbs);
+    for (auto& lp: logProb)
+      lp = -20 * random_double (gen);
+    bench.run ("log_sum_exp", "call", 1, "pair", 1, [&] (size_t reps) {
+	double x = 0;
+	for (size_t n = 0; n < reps; ++n)
+	  x += log_sum_exp (logProb[n & (nLogProbs-1)], logProb[(n + 1) & (nLogProbs-1)]);
+	doubleSink = x;
+      });
+    bench.run ("log_sum_exp_slow", "call", 1, "pair", 1, [&] (size_t reps) {
+	double x = 0;
+	for (size_t n = 0; n < reps; ++n)
+	  x += log_sum_exp_slow (logProb[n & (nLogProbs-1)], logProb[(n + 1) & (nLogProbs-1)]);
+	doubleSink = x;
+      });
+    bench.run ("log_sum_exp_unary", "call", 1, "value", 1, [&] (size_t reps) {
+	double x = 0;
+	for (size_t n = 0; n < reps; ++n)
+	  x += log_sum_exp_unary (-logProb[n & (nLogProbs-1)]);
+	doubleSink = x;
+      });
+    bench.run ("log_sum_exp_unary_slow", "call", 1, "value", 1, [&] (size_t reps) {
+	double x = 0;
+	for (size_t n = 0; n < reps; ++n)
+	  x += log_sum_exp_unary_slow (-logProb[n & (nLogProbs-1)]);
+	doubleSink = x;
+      });
+    bench.run ("log_sum_exp_branchless", "call", 1, "pair", 1, [&] (size_t reps) {
+	double x = 0;
+	for (size_t n = 0; n < reps; ++n)
+	  x += log_sum_exp_branchless (logProb[n & (nLogProbs-1)], logProb[(n + 1) & (nLogProbs-1)]);
+	doubleSink = x;
+      });
+    // n-ary sums (short ones fold through the table, long ones are vectorized), and the batch form over the whole array
+    vguard<double> logProbSum (nLogProbs);
+    for (size_t nArgs: { 5, 64 }) {
+      const string name = "log_sum_exp_nary/" + to_string(nArgs);
+      bench.run (name, "call", 1, "value", nArgs, [&] (size_t reps) {
+	  double x = 0;
+	  for (size_t n = 0; n < reps; ++n)
+	    x += log_sum_exp (logProb.data() + (n * nArgs) % (nLogProbs - nArgs), nArgs);
+	  doubleSink = x;
+	});
+    }
+    bench.run ("log_sum_exp_batch", "call", 1, "pair", nLogProbs - 1, [&] (size_t reps) {
+	for (size_t n = 0; n < reps; ++n)
+	  log_sum_exp (logProb.data(), logProb.data() + 1, logProbSum.data(), nLogProbs - 1);
+	doubleSink = logProbSum[0];
+      });
+
+    // Forward algorithm on a Stockholm database
+    const string stockFile = vm.at("stockholm").as<string>();
+    if (!stockFile.empty()) {
+      const list<Stockholm> db = readStockholmDatabase (stockFile.c_str());
+      const MutatorParams mut = benchErrorModel (4);
+      size_t nCols = 0;
+      for (const auto& stock: db)
+	nCols += stock.columns();
+      bench.run ("ForwardMatrix/" + stockFile, "alignment", db.size(), "column", nCols / (double) db.size(), [&] (size_t reps) {
+	  double x = 0;
+	  for (size_t r = 0; r < reps; ++r)
+	    for (const auto& stock: db)
+	      x += ForwardMatrix (mut, stock, false).loglike;
+	  doubleSink = x;
+	});
+    }
+
+    // machine-level benchmarks
+    string payload;
+    for (int n = 0; n < payloadLen; ++n)
+      payload.push_back (gen() & 1 ? MachineBit1 : MachineBit0);
+    string payloadBytes;
+    for (int n = 0; n < (payloadLen + 7) / 8; ++n)
+      payloadBytes.push_back ((char) gen());
+
+    const vector<string> machineFiles = vm.count("machine") ? vm.at("machine").as<vector<string> >() : vector<string>();
+    for (const auto& machineFile: machineFiles) {
+      const Machine machine = Machine::fromFile (machineFile.c_str());
+      bench.run ("Machine::readJSON/" + machineFile, "load", 1, "state", machine.nStates(), [&] (size_t reps) {
+	  size_t n = 0;
+	  for (size_t r = 0; r < reps; ++r)
+	    n += Machine::fromFile (machineFile.c_str()).nStates();
+	  sizeSink = n;
+	});
+
+      ostringstream dna;
+      {
+	istringstream in (payloadBytes);
+	Encoder<ostringstream> encoder (machine, dna);
+	encoder.encodeStream (in);
+      }
+      const size_t nBases = dna.str().size();
+      bench.run ("Encoder::encodeStream/" + machineFile, "byte", payloadBytes.size(), "base", nBases / (double) payloadBytes.size(), [&] (size_t reps) {
+	  size_t n = 0;
+	  for (size_t r = 0; r < reps; ++r) {
+	    istringstream in (payloadBytes);
+	    ostringstream out;
+	    {
+	      Encoder<ostringstream> encoder (machine, out);
+	      encoder.encodeStream (in);
+	    }
+	    n += out.tellp();
+	  }
+	  sizeSink = n;
+	});
+      bench.run ("Decoder::decodeString/" + machineFile, "base", nBases, "base", 1, [&] (size_t reps) {
+	  size_t n = 0;
+	  for (size_t r = 0; r < reps; ++r) {
+	    ostringstream out;
+	    {
+	      Decoder<ostringstream> decoder (machine, out);
+	      decoder.decodeString (dna.str());
+	    }
+	    n += out.tellp();
+	  }
+	  sizeSink = n;
+	});
+
+      // Viterbi decoding of an error-free read of the payload bits.
+      // The recursion fills the matrix a row (read position) at a time, so its time is quoted per row;
+      // the per-state scores are precomputed once per matrix, and timed separately.
+      FastSeq read;
+      read.name = "read";
+      {
+	ostringstream out;
+	{
+	  Encoder<ostringstream> encoder (machine, out);
+	  encoder.encodeSymbolString (payload);
+	}
+	read.seq = out.str();
+      }
+      const MutatorParams mut = benchErrorModel (machine.maxLeftContext() / 2);
+      const InputModel inputModel = viterbiInputModel (machine, mut);
+      bench.run ("MachineScores/" + machineFile, "machine", 1, "state", machine.nStates(), [&] (size_t reps) {
+	  size_t n = 0;
+	  for (size_t r = 0; r < reps; ++r)
+	    n += MachineScores (machine, inputModel).stateScores.size();
+	  sizeSink = n;
+	});
+      const size_t nRows = read.seq.size() + 1;
+      bench.run ("ViterbiMatrix/" + machineFile, "row", nRows, "cell", machine.nStates() * (mut.maxDupLen() + 2), [&] (size_t reps) {
+	  double x = 0;
+	  for (size_t r = 0; r < reps; ++r)
+	    x += ViterbiMatrix (machine, inputModel, mut, read).loglike();
+	  doubleSink = x;
+	});
+    }
+
+    writeBenchJSON (cout, bench.records);
+
+#ifndef DEBUG
+  } catch (const std::exception& e) {
+    cerr << e.what() << endl;
+  }
+#endif /* DEBUG */
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,127 @@
+#include <iostream>
+#include <sstream>
+#include <boost/program_options.hpp>
+#include "../src/vguard.h"
+#include "../src/logger.h"
+#include "../src/builder.h"
+#include "../src/benchmark.h"
+
+using namespace std;
+
+namespace po = boost::program_options;
+
+int main (int argc, char** argv) {
+
+#ifndef DEBUG
+  try {
+#endif /* DEBUG */
+
+    po::options_description desc("Allowed options");
+    desc.add_options()
+      ("help,h", "display this help message")
+      ("length,l", po::value<vector<int> >()->multitoken()->default_value(vector<int> {8, 10, 12}, "8 10 12"), "lengths of k-mers in de Bruijn graph")
+      ("tandem,t", po::value<vector<int> >()->multitoken(), "lengths of local tandem duplications & inverted repeats to reject (default: half the k-mer length)")
+      ("invrep,i", po::value<vector<int> >()->multitoken()->default_value(vector<int> {4}, "4"), "lengths of nonlocal inverted repeats to reject")
+      ("controls,c", po::value<vector<int> >()->multitoken()->default_value(vector<int> {4}, "4"), "numbers of control words")
+      ("threads", po::value<int>(), "number of threads for the builder (default: one per CPU)")
+      ("verbose,v", po::value<int>()->default_value(1), "verbosity level")
+      ("log", po::value<vector<string> >(), "log everything in this function")
+      ("nocolor", "log in monochrome")
+      ;
+
+    po::variables_map vm;
+    po::store(po::parse_command_line(argc,argv,desc), vm);
+    po::notify(vm);
+
+    if (vm.count("help")) {
+      cout << "Usage: " << argv[0] << " [options]" << endl;
+      cout << "Builds a code machine for every combination of the settings, and prints a JSON table of the time, peak memory" << endl
+	   << "and output size of each stage of the builder (the machine is written to memory, not saved)" << endl;
+      cout << desc << endl;
+      return 1;
+    }
+
+    logger.parseLogArgs (vm);
+
+    const vector<int> tandemLens = vm.count("tandem") ? vm.at("tandem").as<vector<int> >() : vector<int> (1, -1);
+    const bool canResetPeak = resetPeakResidentBytes();
+    if (!canResetPeak)
+      Warn ("Can't reset peak memory usage on this system, so peakResidentBytes is the high-water mark of the whole run so far");
+
+    vguard<BenchRecord> records;
+    for (int len: vm.at("length").as<vector<int> >())
+      for (int tandem: tandemLens)
+	for (int invrep: vm.at("invrep").as<vector<int> >())
+	  for (int controls: vm.at("controls").as<vector<int> >()) {
+	    Require (len > 0 && len <= 31, "Maximum context is 31 bases");
+	    TransBuilder builder (len);
+	    if (tandem >= 0)
+	      builder.maxTandemRepeatLen = tandem;
+	    builder.invertedRepeatLen = invrep;
+	    builder.nControlWords = controls;
+	    builder.controlWordAtStart = builder.controlWordAtEnd = controls > 0;
+	    // only the benchmark resets the peak: it also lowers the peak the OS reports for the whole process
+	    builder.stageStarting = [] () { resetPeakResidentBytes(); };
+	    builder.stageFinished = [] (BuildStageStats& stats) { stats.peakResidentBytes = peakResidentBytes(); };
+	    if (vm.count("threads")) {
+	      Require (vm.at("threads").as<int>() > 0, "--threads must be at least 1");
+	      builder.nThreads = vm.at("threads").as<int>();
+	    }
+
+	    LogThisAt(1,"Building machine with length " << len << ", tandem " << builder.maxTandemRepeatLen << ", invrep " << invrep << ", " << plural(controls,"control word") << endl);
+	    Stopwatch buildTimer;
+	    const Machine machine = builder.makeMachine();
+	    const double buildSeconds = buildTimer.seconds();
+	    const size_t buildPeak = peakResidentBytes();  // since the start of indexStates
+
+	    ostringstream json;
+	    machine.writeJSON (json);
+	    size_t nTransitions = 0;
+	    for (const auto& ms: machine.state)
+	      nTransitions += ms.trans.size();
+
+	    auto record = [&] (const string& stage) -> BenchRecord& {
+	      records.push_back (BenchRecord());
+	      return records.back()
+		.set ("length", len)
+		.set ("tandem", builder.maxTandemRepeatLen)
+		.set ("invrep", invrep)
+		.set ("controls", controls)
+		.set ("threads", builder.nThreads)
+		.set ("stage", stage);
+	    };
+	    double prepareSeconds = 0;
+	    size_t maxPeak = buildPeak;
+	    for (const auto& stats: builder.stageStats) {
+	      record (stats.stage)
+		.set ("seconds", stats.seconds)
+		.set ("peakResidentBytes", stats.peakResidentBytes)
+		.set ("kmers", stats.kmers);
+	      prepareSeconds += stats.seconds;
+	      maxPeak = max (maxPeak, stats.peakResidentBytes);
+	    }
+	    // the rest of makeMachine() turns the graph into machine states
+	    record ("makeStates")
+	      .set ("seconds", buildSeconds - prepareSeconds)
+	      .set ("peakResidentBytes", buildPeak)
+	      .set ("kmers", builder.kmers.size());
+	    record ("total")
+	      .set ("seconds", buildSeconds)
+	      .set ("peakResidentBytes", maxPeak)
+	      .set ("kmers", builder.kmers.size())
+	      .set ("states", machine.nStates())
+	      .set ("transitions", nTransitions)
+	      .set ("jsonBytes", json.str().size());
+	    LogThisAt(1,"Built " << plural(machine.nStates(),"state") << " in " << buildSeconds << " seconds" << endl);
+	  }
+
+    writeBenchJSON (cout, records);
+
+#ifndef DEBUG
+  } catch (const std::exception& e) {
+    cerr << e.what() << endl;
+  }
+#endif /* DEBUG */
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,193 @@
+#include <iostream>
+#include <sstream>
+#include <random>
+#include <boost/program_options.hpp>
+#include "../src/vguard.h"
+#include "../src/logger.h"
+#include "../src/encoder.h"
+#include "../src/decoder.h"
+#include "../src/viterbi.h"
+#include "../src/simulate.h"
+#include "../src/editdistance.h"
+#include "../src/parallel.h"
+#include "../src/benchmark.h"
+
+using namespace std;
+
+namespace po = boost::program_options;
+
+// payload bits, with start & end of file symbols removed
+string payloadBits (const string& decoded) {
+  string bits;
+  for (char c: decoded)
+    if (c != MachineSOF && c != MachineEOF)
+      bits.push_back (c);
+  return bits;
+}
+
+int main (int argc, char** argv) {
+
+#ifndef DEBUG
+  try {
+#endif /* DEBUG */
+
+    po::options_description desc("Allowed options");
+    desc.add_options()
+      ("help,h", "display this help message")
+      ("machine", po::value<vector<string> >(), "machine JSON file(s) to benchmark")
+      ("payload-bits", po::value<int>()->default_value(1024), "length of each random payload")
+      ("payloads", po::value<int>()->default_value(4), "number of random payloads per machine")
+      ("copies", po::value<int>()->default_value(1), "number of simulated reads per payload, for each error setting")
+      ("seed", po::value<unsigned long long>()->default_value(DefaultSimulateSeed), "random number seed for payloads & reads")
+      ("threads", po::value<int>(), "number of threads for simulating & Viterbi-decoding reads (default: one per CPU)")
+      ("error-sub-prob", po::value<vector<double> >()->multitoken()->default_value(vector<double> {0, .01}, "0 .01"), "substitution probabilities")
+      ("error-dup-prob", po::value<vector<double> >()->multitoken()->default_value(vector<double> {.001}, ".001"), "tandem duplication probabilities")
+      ("error-del-open", po::value<vector<double> >()->multitoken()->default_value(vector<double> {.001}, ".001"), "deletion opening probabilities")
+      ("error-del-ext", po::value<double>()->default_value(.01), "deletion extension probability")
+      ("error-iv-ratio", po::value<double>()->default_value(10), "transition/transversion ratio")
+      ("error-local", "decode reads as partial sequences (local alignment)")
+      ("verbose,v", po::value<int>()->default_value(1), "verbosity level")
+      ("log", po::value<vector<string> >(), "log everything in this function")
+      ("nocolor", "log in monochrome")
+      ;
+    po::positional_options_description pos;
+    pos.add ("machine", -1);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(argc,argv).options(desc).positional(pos).run(), vm);
+    po::notify(vm);
+
+    if (vm.count("help") || !vm.count("machine")) {
+      cout << "Usage: " << argv[0] << " [options] <machine.json> [<machine.json>...]" << endl;
+      cout << "Encodes random payloads, simulates reads with errors (every combination of the error settings),"
+	   << " decodes them, and prints a JSON table of rates, speeds & bit error rates" << endl
+	   << "(peakResidentBytes is the high-water mark of the whole run so far, so benchmark the largest machine last)" << endl;
+      cout << desc << endl;
+      return 1;
+    }
+
+    logger.parseLogArgs (vm);
+
+    const int payloadLen = vm.at("payload-bits").as<int>(), nPayloads = vm.at("payloads").as<int>(), copies = vm.at("copies").as<int>();
+    Require (payloadLen > 0 && nPayloads > 0 && copies > 0, "--payload-bits, --payloads and --copies must be positive");
+    const unsigned long long seed = vm.at("seed").as<unsigned long long>();
+    const size_t nThreads = vm.count("threads") ? vm.at("threads").as<int>() : defaultThreads();
+    Require (nThreads > 0, "--threads must be at least 1");
+
+    mt19937_64 gen (seed);
+    vguard<string> payload (nPayloads);
+    for (auto& bits: payload)
+      for (int n = 0; n < payloadLen; ++n)
+	bits.push_back (gen() & 1 ? MachineBit1 : MachineBit0);
+
+    vguard<BenchRecord> records;
+    for (const auto& machineFile: vm.at("machine").as<vector<string> >()) {
+      Stopwatch loadTimer;
+      const Machine machine = Machine::fromFile (machineFile.c_str());
+      const double loadSeconds = loadTimer.seconds();
+
+      // encode
+      vguard<FastSeq> encoded (nPayloads);
+      size_t nBases = 0;
+      Stopwatch encodeTimer;
+      for (int p = 0; p < nPayloads; ++p) {
+	ostringstream dna;
+	{
+	  Encoder<ostringstream> encoder (machine, dna);
+	  encoder.encodeSymbolString (payload[p]);
+	}
+	encoded[p].name = string("payload") + to_string(p+1);
+	encoded[p].seq = dna.str();
+	nBases += encoded[p].seq.size();
+      }
+      const double encodeSeconds = encodeTimer.seconds();
+
+      // exact decoding of the error-free sequences
+      int exactFailures = 0;
+      Stopwatch exactTimer;
+      for (int p = 0; p < nPayloads; ++p) {
+	ostringstream bits;
+	{
+	  Decoder<ostringstream> decoder (machine, bits);
+	  decoder.decodeString (encoded[p].seq);
+	}
+	if (payloadBits (bits.str()) != payload[p])
+	  ++exactFailures;
+      }
+      const double exactSeconds = exactTimer.seconds();
+      LogThisAt(2,machineFile << ": encoded " << plural(nPayloads,"payload") << " of " << plural(payloadLen,"bit") << " as " << plural(nBases,"base") << endl);
+
+      for (double subProb: vm.at("error-sub-prob").as<vector<double> >())
+	for (double dupProb: vm.at("error-dup-prob").as<vector<double> >())
+	  for (double delOpen: vm.at("error-del-open").as<vector<double> >()) {
+	    MutatorParams mut;
+	    mut.initMaxDupLen (max ((size_t) 1, machine.maxLeftContext() / 2));
+	    mut.pTanDup = dupProb;
+	    mut.pDelOpen = delOpen;
+	    mut.pDelExtend = vm.at("error-del-ext").as<double>();
+	    const double ivRatio = vm.at("error-iv-ratio").as<double>();
+	    mut.pTransition = subProb * ivRatio / (1 + ivRatio);
+	    mut.pTransversion = subProb / (1 + ivRatio);
+	    mut.local = vm.count("error-local");
+
+	    ReadSimulator simulator (mut);
+	    simulator.seed = seed;
+	    simulator.nThreads = nThreads;
+	    const vguard<SimulatedRead> sims = simulator.simulate (encoded, copies);
+
+	    // Viterbi-decode the reads
+	    const InputModel inputModel = viterbiInputModel (machine, mut);
+	    vguard<string> decoded (sims.size());
+	    size_t nReadBases = 0;
+	    for (const auto& sim: sims)
+	      nReadBases += sim.read.seq.size();
+	    Stopwatch viterbiTimer;
+	    parallelFor (sims.size(), nThreads, [&] (size_t begin, size_t end) {
+		for (size_t n = begin; n < end; ++n) {
+		  const ViterbiMatrix vit (machine, inputModel, mut, sims[n].read);
+		  decoded[n] = payloadBits (vit.traceback());
+		}
+	      }, 1);
+	    const double viterbiSeconds = viterbiTimer.seconds();
+
+	    vguard<EditDistanceQuery> query;
+	    for (size_t n = 0; n < sims.size(); ++n)
+	      query.push_back (EditDistanceQuery { &payload[n / copies], &decoded[n], -1 });
+	    size_t nBitErrors = 0;
+	    for (int d: editDistances (query, nThreads))
+	      nBitErrors += d;
+
+	    BenchRecord rec;
+	    rec.set ("machine", machineFile)
+	      .set ("states", machine.nStates())
+	      .set ("loadSeconds", loadSeconds)
+	      .set ("payloadBits", payloadLen)
+	      .set ("payloads", nPayloads)
+	      .set ("bitsPerBase", payloadLen * nPayloads / (double) nBases)
+	      .set ("encodeBasesPerSecond", nBases / encodeSeconds)
+	      .set ("exactDecodeBasesPerSecond", nBases / exactSeconds)
+	      .set ("exactDecodeFailures", exactFailures)
+	      .set ("subProb", subProb)
+	      .set ("dupProb", dupProb)
+	      .set ("delOpenProb", delOpen)
+	      .set ("delExtendProb", mut.pDelExtend)
+	      .set ("reads", sims.size())
+	      .set ("threads", nThreads)
+	      .set ("viterbiReadsPerSecond", sims.size() / viterbiSeconds)
+	      .set ("viterbiBasesPerSecond", nReadBases / viterbiSeconds)
+	      .set ("bitErrorRate", nBitErrors / (double) (payloadLen * sims.size()))
+	      .set ("peakResidentBytes", peakResidentBytes());
+	    records.push_back (rec);
+	    LogThisAt(2,machineFile << ", sub=" << subProb << " dup=" << dupProb << " del=" << delOpen << ": " << plural(nBitErrors,"bit error") << " in " << plural(sims.size(),"read") << endl);
+	  }
+    }
+    writeBenchJSON (cout, records);
+
+#ifndef DEBUG
+  } catch (const std::exception& e) {
+    cerr << e.what() << endl;
+  }
+#endif /* DEBUG */
+
+  return EXIT_SUCCESS;
+}
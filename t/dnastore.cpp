@@ -1,6 +1,7 @@
 #include <cstdlib>
 #include <stdexcept>
 #include <fstream>
+#include <sstream>
 #include <iomanip>
 #include <random>
 #include <boost/program_options.hpp>
@@ -16,6 +17,18 @@
 #include "../src/mutator.h"
 #include "../src/fwdback.h"
 #include "../src/viterbi.h"
+#include "../src/compact.h"
+#include "../src/implicit.h"
+#include "../src/arithcode.h"
+#include "../src/mixradar.h"
+#include "../src/periodic.h"
+#include "../src/anchor.h"
+#include "../src/orient.h"
+#include "../src/decodecache.h"
+#include "../src/consensus.h"
+#include "../src/cluster.h"
+#include "../src/simulate.h"
+#include "../src/metrics.h"
 
 using namespace std;
 
@@ -31,6 +44,91 @@ void getMotifs (po::variables_map& vm, const char* arg, set<KmerLen>& motifs, se
     }
 }
 
+// Viterbi-decode the reads in the --decode-viterbi file (each distinct sequence once) and print the results.
+// With --decode-cache, results are also kept in a file, keyed by hashes of the machine and params descriptions.
+void runViterbi (po::variables_map& vm, bool rawSeqOutput, const string& machineDescription, const string& paramsDescription, DecodeCache::Decoder decoder) {
+  const vguard<FastSeq> reads = readFastSeqs (vm.at("decode-viterbi").as<string>().c_str());
+  DecodeCache cache (machineDescription, paramsDescription);
+  if (vm.count("decode-cache")) {
+    Require (machineDescription.size(), "--decode-cache isn't supported for this type of machine");
+    cache.open (vm.at("decode-cache").as<string>().c_str());
+  }
+  const vguard<FastSeq> decoded = cache.decode (reads, decoder);
+  if (rawSeqOutput)
+    for (const auto& fs: decoded)
+      cout << fs.seq << endl;
+  else
+    writeFastaSeqs (cout, decoded);
+}
+
+string machineDescription (const Machine& machine) {
+  ostringstream out;
+  machine.writeJSON (out);
+  return out.str();
+}
+
+// encoding & decoding actions that work with either machine layout; returns false if none was requested
+template<class MachineType>
+bool runCodec (const MachineType& machine, po::variables_map& vm, bool rawSeqOutput) {
+  if (vm.count("encode-file")) {
+    const string filename = vm.at("encode-file").as<string>();
+    ifstream infile (filename, std::ios::binary);
+    if (!infile)
+      throw runtime_error ("Binary file not found");
+    FastaWriter writer (cout, rawSeqOutput ? NULL : filename.c_str());
+    Encoder<FastaWriter,MachineType> encoder (machine, writer);
+    encoder.encodeStream (infile);
+
+  } else if (vm.count("decode-file")) {
+    const vguard<FastSeq> fastSeqs = readFastSeqs (vm.at("decode-file").as<string>().c_str());
+    BinaryWriter writer (cout);
+    Decoder<BinaryWriter,MachineType> decoder (machine, writer);
+    for (auto& fs: fastSeqs)
+      decoder.decodeString (fs.seq);
+
+  } else if (vm.count("encode-string")) {
+    FastaWriter writer (cout, rawSeqOutput ? NULL : "ASCII_string");
+    Encoder<FastaWriter,MachineType> encoder (machine, writer);
+    encoder.encodeString (vm.at("encode-string").as<string>());
+      
+  } else if (vm.count("decode-string")) {
+    BinaryWriter writer (cout);
+    Decoder<BinaryWriter,MachineType> decoder (machine, writer);
+    decoder.decodeString (vm.at("decode-string").as<string>());
+
+  } else if (vm.count("encode-bits")) {
+    FastaWriter writer (cout, rawSeqOutput ? NULL : "bit_string");
+    Encoder<FastaWriter,MachineType> encoder (machine, writer);
+    encoder.encodeSymbolString (vm.at("encode-bits").as<string>());
+      
+  } else if (vm.count("decode-bits")) {
+    Decoder<ostream,MachineType> decoder (machine, cout);
+    decoder.decodeString (vm.at("decode-bits").as<string>());
+    decoder.close();
+
+    cout << endl;
+
+  } else
+    return false;
+
+  return true;
+}
+
+// sync or watermark code requested by --sync or --watermark
+PeriodicBuilder periodicBuilder (po::variables_map& vm) {
+  const bool watermark = vm.count("watermark");
+  Require (watermark != (bool) vm.count("sync"), "Specify one of --sync or --watermark");
+  PeriodicBuilder builder (vm.at(watermark ? "watermark" : "sync").as<int>(), watermark);
+  if (vm.count("watermark-sub"))
+    builder.subperiod = vm.at("watermark-sub").as<int>();
+  builder.subControl = vm.count("watermark-word");
+  builder.copies = vm.at("watermark-copies").as<int>();
+  builder.mixWater = !vm.count("watermark-nomix");
+  builder.eofOK = vm.count("watermark-eof");
+  builder.seed = vm.at("watermark-seed").as<unsigned int>();
+  return builder;
+}
+
 int main (int argc, char** argv) {
 
 #ifndef DEBUG
@@ -52,12 +150,30 @@ int main (int argc, char** argv) {
       ("no-start", "do not use a control word at start of encoded sequence")
       ("no-end", "do not use a control word at end of encoded sequence")
       ("delay,y", "build delayed machine")
+      ("threads", po::value<int>(), "number of threads used to build the machine, estimate its rate, and decode anchored segments (default: one per CPU)")
       ("rate,R", "calculate compression rate")
       ("dot", "print in Graphviz format")
       ("token-info", "print descriptions of input tokens")
       ("load-machine,L", po::value<string>(), "load machine from JSON file")
       ("save-machine,S", po::value<string>(), "save machine to JSON file")
       ("compose-machine,C", po::value<vector<string> >(), "load machine from JSON file and compose in front of primary machine")
+      ("mixradar,M", po::value<int>(), "build mixed-radix block code with blocks of this many bits, and compose in front of primary machine")
+      ("mixradar-eof-prob", po::value<double>()->default_value(DefaultMixRadarEOFProb), "probability of a short (flushed) block, for --mixradar")
+      ("print-mixradar", "print the --mixradar machine in JSON format, without building the primary machine")
+      ("sync", po::value<int>(), "build sync code with this period (as bin/syncer.pl), and compose in front of all other machines")
+      ("watermark", po::value<int>(), "build watermark code with this period (cf. bin/watmark.pl), and compose in front of all other machines")
+      ("watermark-sub", po::value<int>(), "send a watermark digit after every this many bits")
+      ("watermark-word", "send control word B after each watermark sub-period, instead of a watermark digit")
+      ("watermark-copies", po::value<int>()->default_value(1), "number of copies of control word A after each watermark period")
+      ("watermark-nomix", "don't permute watermark digits")
+      ("watermark-eof", "allow premature EOF, so message length needn't be a multiple of the watermark period")
+      ("watermark-seed", po::value<unsigned int>()->default_value(DefaultWatermarkSeed), "random number seed for watermark digit permutations")
+      ("print-periodic", "print the --sync or --watermark machine in JSON format, without building the primary machine")
+      ("periodic", "generate the composition with the --sync or --watermark machine on demand, instead of building it (encoding & decoding only)")
+      ("compact", "hold machine in compact in-memory layout for saving, encoding & exact decoding")
+      ("implicit", "generate code machine states on demand, without building the machine (allows long k-mers; no control words)")
+      ("arithmetic", "arithmetic-code bits onto the constrained de Bruijn graph at max-entropic edge probabilities (no control words)")
+      ("beam-width", po::value<int>()->default_value(DefaultImplicitViterbiBeamWidth), "max states per position for Viterbi decoding with --implicit or --periodic")
       ("encode-file,e", po::value<string>(), "encode binary file to FASTA on stdout")
       ("decode-file,d", po::value<string>(), "decode FASTA file to binary on stdout")
       ("encode-string,E", po::value<string>(), "encode ASCII string to FASTA on stdout")
@@ -65,6 +181,21 @@ int main (int argc, char** argv) {
       ("encode-bits,b", po::value<string>(), "encode string of bits and control symbols to FASTA on stdout")
       ("decode-bits,B", po::value<string>(), "decode DNA sequence to string of bits and control symbols on stdout")
       ("decode-viterbi,V", po::value<string>(), "decode FASTA file using Viterbi algorithm")
+      ("cluster-reads", po::value<string>(), "group reads in FASTA file by source strand, orient them alike, and print them with cluster=N comments")
+      ("cluster-kmer", po::value<int>()->default_value(DefaultClusterKmerLen), "kmer length for read sketches")
+      ("cluster-sketch", po::value<int>()->default_value(DefaultClusterSketchSize), "number of MinHash values in a read sketch")
+      ("cluster-bands", po::value<int>()->default_value(DefaultClusterBands), "number of LSH bands the sketch is cut into")
+      ("cluster-max-edit-rate", po::value<double>()->default_value(DefaultClusterMaxEditRate), "max edits per base between reads of the same strand")
+      ("anchor", "for Viterbi decoding, cut reads at control words and decode the segments in parallel")
+      ("anchor-seed", po::value<int>()->default_value(DefaultAnchorSeedLen), "length of exact seeds used to find control words in reads")
+      ("anchor-edits", po::value<int>()->default_value(DefaultAnchorMaxEdits), "max edits in a control word used as an anchor")
+      ("anchor-min-segment", po::value<int>()->default_value(DefaultAnchorMinSegmentLen), "min length of segments between anchors")
+      ("auto-orient", "for Viterbi decoding, detect reverse-complemented reads (or, with --joint, clusters) by k-mer voting and decode them in the code's orientation")
+      ("orient-min-votes", po::value<int>()->default_value(DefaultOrientMinVotes), "min winning margin of k-mer votes to decide a read's orientation; closer reads are decoded both ways")
+      ("joint", "for Viterbi decoding, decode all the reads as copies of one strand, to a single sequence (or, if they have cluster=N comments, each cluster)")
+      ("joint-iterations", po::value<int>()->default_value(DefaultJointMaxIterations), "max rounds of consensus refinement for --joint")
+      ("joint-band", po::value<int>()->default_value(DefaultJointBand), "min alignment band for --joint")
+      ("decode-cache", po::value<string>(), "for Viterbi decoding, keep decoded reads in this file, and reuse them when decoding the same machine & error model")
       ("raw,r", "strip headers from FASTA output; just print raw sequence")
       ("error-sub-prob", po::value<double>()->default_value(.01), "substitution probability for error model")
       ("error-iv-ratio", po::value<double>()->default_value(10), "transition/transversion ratio for error model")
@@ -76,6 +207,11 @@ int main (int argc, char** argv) {
       ("fit-error,f", po::value<string>(), "train error model on Stockholm database of pairwise alignments and print to stdout")
       ("error-counts", po::value<string>(), "estimate posterior expected counts of various different types of error from Stockholm database")
       ("strict-guides", "treat alignments in Stockholm database as strict truth, not just hints")
+      ("simulate-reads", po::value<string>(), "simulate reads of sequences in FASTA file, with errors drawn from the error model, and print them to stdout")
+      ("simulate-copies", po::value<int>()->default_value(DefaultSimulateCopies), "number of reads to simulate per sequence")
+      ("simulate-seed", po::value<unsigned long long>()->default_value(DefaultSimulateSeed), "random number seed for --simulate-reads")
+      ("simulate-alignments", po::value<string>(), "save the true alignment of each simulated read to this Stockholm file")
+      ("metrics-json", po::value<string>(), "record counters, phase timings & histograms, and write them as JSON to this file ('-' for stdout) on exit")
       ("verbose,v", po::value<int>()->default_value(2), "verbosity level")
       ("log", po::value<vector<string> >(), "log everything in this function")
       ("nocolor", "log in monochrome")
@@ -92,6 +228,9 @@ int main (int argc, char** argv) {
     }
 
     logger.parseLogArgs (vm);
+
+    // written when main() returns, after all other output
+    const MetricsWriter metricsWriter (vm.count("metrics-json") ? vm.at("metrics-json").as<string>() : string());
     
     const Pos len = vm.at("length").as<int>();
     Assert (len <= 31, "Maximum context is 31 bases");
@@ -111,6 +250,10 @@ int main (int argc, char** argv) {
     builder.controlWordAtStart = !vm.count("no-start");
     builder.controlWordAtEnd = !vm.count("no-end");
     builder.buildDelayedMachine = vm.count("delay");
+    if (vm.count("threads")) {
+      Require (vm.at("threads").as<int>() > 0, "--threads must be at least 1");
+      builder.nThreads = vm.at("threads").as<int>();
+    }
 
     MutatorParams mut;
     if (vm.count("error-file")) {
@@ -145,17 +288,123 @@ int main (int argc, char** argv) {
       const MutatorCounts counts = expectedCounts (mut, db, ll, strictAlignments);
       counts.writeJSON (cout);
 
+    } else if (vm.count("simulate-reads")) {
+      ReadSimulator simulator (mut);
+      simulator.seed = vm.at("simulate-seed").as<unsigned long long>();
+      simulator.nThreads = builder.nThreads;
+      const vguard<SimulatedRead> sims = simulator.simulate (readFastSeqs (vm.at("simulate-reads").as<string>().c_str()),
+							     vm.at("simulate-copies").as<int>());
+      for (const auto& sim: sims)
+	if (rawSeqOutput)
+	  cout << sim.read.seq << endl;
+	else
+	  sim.read.writeFasta (cout);
+      if (vm.count("simulate-alignments")) {
+	const string filename = vm.at("simulate-alignments").as<string>();
+	ofstream out (filename);
+	Require (out, "Can't write to %s", filename.c_str());
+	for (const auto& sim: sims)
+	  sim.alignment().write (out);
+      }
+
+    } else if (vm.count("print-periodic")) {
+      periodicBuilder(vm).makeMachine().writeJSON (cout);
+
+    } else if (vm.count("print-mixradar")) {
+      Require (vm.count("mixradar"), "--print-mixradar requires --mixradar");
+      MixRadarBuilder mixRadar (vm.at("mixradar").as<int>());
+      mixRadar.eofProb = vm.at("mixradar-eof-prob").as<double>();
+      mixRadar.makeMachine().writeJSON (cout);
+
+    } else if (vm.count("cluster-reads")) {
+      ReadClusterer clusterer;
+      clusterer.kmerLen = vm.at("cluster-kmer").as<int>();
+      clusterer.sketchSize = vm.at("cluster-sketch").as<int>();
+      clusterer.nBands = vm.at("cluster-bands").as<int>();
+      clusterer.maxEditRate = vm.at("cluster-max-edit-rate").as<double>();
+      clusterer.nThreads = builder.nThreads;
+      const vguard<FastSeq> reads = readFastSeqs (vm.at("cluster-reads").as<string>().c_str());
+      writeFastaSeqs (cout, clusteredFastSeqs (reads, clusterer.cluster (reads)));
+
+    } else if (vm.count("arithmetic")) {
+      Require (!vm.count("load-machine") && !vm.count("compose-machine") && !vm.count("save-machine") && !vm.count("implicit"), "--arithmetic can't be used to load, compose or save machines, or with --implicit");
+      Require (!builder.buildDelayedMachine, "--arithmetic doesn't support delayed machines");
+      if (!vm["controls"].defaulted() && builder.nControlWords > 0)
+	Warn ("Arithmetic code has no control words");
+      builder.nControlWords = 0;
+      builder.controlWordAtStart = builder.controlWordAtEnd = false;
+      const ArithmeticCode code (builder);
+
+      if (vm.count("encode-file") || vm.count("encode-string")) {
+	const bool encodeFile = vm.count("encode-file");
+	string bytes;
+	if (encodeFile) {
+	  ifstream infile (vm.at("encode-file").as<string>(), std::ios::binary);
+	  if (!infile)
+	    throw runtime_error ("Binary file not found");
+	  bytes = string (istreambuf_iterator<char>(infile), istreambuf_iterator<char>());
+	} else
+	  bytes = vm.at("encode-string").as<string>();
+	string seq = code.encodeBytes (bytes);
+	FastaWriter writer (cout, rawSeqOutput ? NULL : (encodeFile ? vm.at("encode-file").as<string>().c_str() : "ASCII_string"));
+	writer.write (&seq[0], seq.size());
+
+      } else if (vm.count("decode-file")) {
+	for (const auto& fs: readFastSeqs (vm.at("decode-file").as<string>().c_str()))
+	  cout << code.decodeBytes (fs.seq);
+
+      } else if (vm.count("decode-string"))
+	cout << code.decodeBytes (vm.at("decode-string").as<string>());
+
+      else if (vm.count("decode-viterbi")) {
+	runViterbi (vm, rawSeqOutput, machineDescription (code.viterbiMachine()), string("arithmetic\n") + mut.asJSON(),
+		    [&] (const vguard<FastSeq>& reads) { return decodeFastSeqs (reads, code, mut); });
+
+      } else if (vm.count("rate"))
+	cout << "Capacity: " << code.capacity() << " bits/base" << endl;
+
+      else
+	Fail ("--arithmetic supports encoding, decoding & --rate only");
+
+    } else if (vm.count("implicit")) {
+      Require (!vm.count("load-machine") && !vm.count("compose-machine") && !vm.count("save-machine"), "--implicit can't be used to load, compose or save machines");
+      Require (!builder.buildDelayedMachine && builder.keepDegenerates && builder.sourceMotif.empty(), "--implicit doesn't support delayed machines, degenerate transition elimination or source motifs");
+      if (!vm["controls"].defaulted() && builder.nControlWords > 0)
+	Warn ("Implicit machine has no control words");
+      const ImplicitMachine implicit (builder);
+
+      if (vm.count("decode-viterbi")) {
+	const int beamWidth = vm.at("beam-width").as<int>();
+	runViterbi (vm, rawSeqOutput, string(), string(),
+		    [&] (const vguard<FastSeq>& reads) { return decodeFastSeqs (reads, implicit, mut, beamWidth); });
+      } else
+	Require (runCodec (implicit, vm, rawSeqOutput), "--implicit supports encoding & decoding only");
+
     } else {
       // build, or load, transducer
       const bool loadMachine = vm.count("load-machine");
-      Machine machine = loadMachine
-	? Machine::fromFile(vm.at("load-machine").as<string>().c_str())
-	: builder.makeMachine();
+      const bool useCompact = vm.count("compact");
+      const bool preCompose = vm.count("mixradar") || vm.count("compose-machine") || ((vm.count("sync") || vm.count("watermark")) && !vm.count("periodic"));
+      const bool buildCompact = useCompact && !loadMachine && !preCompose;  // build straight into the compact layout
+      CompactMachine compact;
+      Machine machine;
+      if (loadMachine)
+	machine = Machine::fromFile(vm.at("load-machine").as<string>().c_str());
+      else if (buildCompact)
+	compact = builder.makeCompactMachine();
+      else
+	machine = builder.makeMachine();
 
       if (!loadMachine && vm.count("print-controls"))
 	cout << "Control words: " << join(builder.controlWordString) << endl;
 
       // pre-compose transducers
+      if (vm.count("mixradar")) {
+	MixRadarBuilder mixRadar (vm.at("mixradar").as<int>());
+	mixRadar.eofProb = vm.at("mixradar-eof-prob").as<double>();
+	LogThisAt(3,"Pre-composing with " << mixRadar.blockLen << "-bit mixed-radix machine" << endl);
+	machine = Machine::compose (mixRadar.makeMachine(), machine);
+      }
       if (vm.count("compose-machine")) {
 	const vector<string> comps = vm.at("compose-machine").as<vector<string> >();
 	for (auto iter = comps.rbegin(); iter != comps.rend(); ++iter) {
@@ -163,81 +412,110 @@ int main (int argc, char** argv) {
 	  machine = Machine::compose (Machine::fromFile((*iter).c_str()), machine);
 	}
       }
+      const bool periodic = vm.count("periodic");
+      if ((vm.count("sync") || vm.count("watermark")) && !periodic) {
+	LogThisAt(3,"Pre-composing with " << (vm.count("sync") ? "sync" : "watermark") << " machine" << endl);
+	machine = Machine::compose (periodicBuilder(vm).makeMachine(), machine);
+      }
+      Require (!periodic || !(vm.count("compact") || vm.count("save-machine")), "--periodic machines can't be compacted or saved");
+
+      // switch to compact layout
+      if (useCompact && !buildCompact) {
+	compact = CompactMachine (machine);
+	machine = Machine();
+      }
 
       // save transducer
       if (vm.count("save-machine")) {
 	const string savefile = vm.at("save-machine").as<string>();
-	if (savefile == "-")
-	  machine.writeJSON (cout);
-	else {
+	if (savefile == "-") {
+	  if (useCompact)
+	    compact.writeJSON (cout);
+	  else
+	    machine.writeJSON (cout);
+	} else {
 	  ofstream out (savefile);
-	  machine.writeJSON (out);
+	  if (useCompact)
+	    compact.writeJSON (out);
+	  else
+	    machine.writeJSON (out);
 	}
       }
 
       // encoding or decoding?
-      if (vm.count("encode-file")) {
-	const string filename = vm.at("encode-file").as<string>();
-	ifstream infile (filename, std::ios::binary);
-	if (!infile)
-	  throw runtime_error ("Binary file not found");
-	FastaWriter writer (cout, rawSeqOutput ? NULL : filename.c_str());
-	Encoder<FastaWriter> encoder (machine, writer);
-	encoder.encodeStream (infile);
-	
-      } else if (vm.count("decode-file")) {
-	const vguard<FastSeq> fastSeqs = readFastSeqs (vm.at("decode-file").as<string>().c_str());
-	BinaryWriter writer (cout);
-	Decoder<BinaryWriter> decoder (machine, writer);
-	for (auto& fs: fastSeqs)
-	  decoder.decodeString (fs.seq);
-
-      } else if (vm.count("encode-string")) {
-	FastaWriter writer (cout, rawSeqOutput ? NULL : "ASCII_string");
-	Encoder<FastaWriter> encoder (machine, writer);
-	encoder.encodeString (vm.at("encode-string").as<string>());
-      
-      } else if (vm.count("decode-string")) {
-	BinaryWriter writer (cout);
-	Decoder<BinaryWriter> decoder (machine, writer);
-	decoder.decodeString (vm.at("decode-string").as<string>());
-
-      } else if (vm.count("encode-bits")) {
-	FastaWriter writer (cout, rawSeqOutput ? NULL : "bit_string");
-	Encoder<FastaWriter> encoder (machine, writer);
-	encoder.encodeSymbolString (vm.at("encode-bits").as<string>());
-      
-      } else if (vm.count("decode-bits")) {
-	Decoder<ostream> decoder (machine, cout);
-	decoder.decodeString (vm.at("decode-bits").as<string>());
-	decoder.close();
+      if (periodic) {
+	const PeriodicMachine periodicMachine (periodicBuilder(vm).makeMachine(), machine);
+	if (vm.count("decode-viterbi")) {
+	  const int beamWidth = vm.at("beam-width").as<int>();
+	  runViterbi (vm, rawSeqOutput, machineDescription (periodicMachine.outer) + machineDescription (periodicMachine.inner),
+		      string("beam-width ") + to_string(beamWidth) + "\n" + mut.asJSON(),
+		      [&] (const vguard<FastSeq>& reads) { return decodeFastSeqs (reads, periodicMachine, mut, beamWidth); });
+	} else
+	  Require (runCodec (periodicMachine, vm, rawSeqOutput), "--periodic supports encoding & decoding only");
 
-	cout << endl;
+      } else if (!(useCompact ? runCodec (compact, vm, rawSeqOutput) : runCodec (machine, vm, rawSeqOutput))) {
 
-      } else if (vm.count("decode-viterbi")) {
-	const auto decoded = decodeFastSeqs (vm.at("decode-viterbi").as<string>().c_str(), machine, mut);
-	if (rawSeqOutput)
-	  for (const auto& fs: decoded)
-	    cout << fs.seq << endl;
-	else
-	  writeFastaSeqs (cout, decoded);
+	// remaining actions use the full layout
+	if (useCompact && (vm.count("decode-viterbi") || vm.count("rate") || !vm.count("save-machine")))
+	  machine = compact.expand();
+
+	if (vm.count("decode-viterbi") && vm.count("joint")) {
+	  Require (!vm.count("anchor") && !vm.count("decode-cache"), "--joint can't be combined with --anchor or --decode-cache");
+	  JointDecoder joint (machine, mut);
+	  joint.maxIterations = vm.at("joint-iterations").as<int>();
+	  joint.band = vm.at("joint-band").as<int>();
+	  Require (joint.maxIterations > 0 && joint.band >= 0, "--joint-iterations must be positive, and --joint-band can't be negative");
+	  OrientationClassifier classifier (machine);
+	  const vguard<FastSeq> decoded = joint.decodeClusters (readFastSeqs (vm.at("decode-viterbi").as<string>().c_str()), builder.nThreads,
+								vm.count("auto-orient") ? &classifier : NULL);
+	  if (rawSeqOutput)
+	    for (const auto& fs: decoded)
+	      cout << fs.seq << endl;
+	  else
+	    writeFastaSeqs (cout, decoded);
+
+	} else if (vm.count("decode-viterbi")) {
+	  const bool anchored = vm.count("anchor"), autoOrient = vm.count("auto-orient");
+	  ControlWordAnchors anchors (machine);
+	  OrientationClassifier classifier (machine);
+	  string params;
+	  if (anchored) {
+	    anchors.seedLen = vm.at("anchor-seed").as<int>();
+	    anchors.maxEdits = vm.at("anchor-edits").as<int>();
+	    anchors.minSegmentLen = vm.at("anchor-min-segment").as<int>();
+	    Require (anchors.seedLen > 0, "--anchor-seed must be positive");
+	    params += string("anchor ") + to_string(anchors.seedLen) + " " + to_string(anchors.maxEdits) + " " + to_string(anchors.minSegmentLen) + "\n";
+	  }
+	  if (autoOrient) {
+	    classifier.minVotes = vm.at("orient-min-votes").as<int>();
+	    Require (classifier.minVotes > 0, "--orient-min-votes must be positive");
+	    params += string("auto-orient ") + to_string(classifier.minVotes) + "\n";
+	  }
+	  runViterbi (vm, rawSeqOutput, machineDescription (machine), params + mut.asJSON(),
+		      [&] (const vguard<FastSeq>& reads) {
+			if (autoOrient)
+			  return decodeFastSeqs (reads, classifier, mut, anchored ? &anchors : NULL, builder.nThreads);
+			return anchored ? decodeFastSeqs (reads, anchors, mut, builder.nThreads) : decodeFastSeqs (reads, machine, mut);
+		      });
 	
-      } else if (vm.count("rate")) {
-	// Output statistics
-	const auto charBases = machine.expectedBasesPerInputSymbol("01$");
-	vguard<string> cbstr;
-	for (const auto& cb: charBases)
-	  cbstr.push_back (Machine::charToString(cb.first) + ": " + to_string(cb.second));
-	cout << "Expected bases/symbol: { " << join(cbstr,", ") << " }" << endl;
-
-      } else {
-	// Output the transducer
-	if (vm.count("dot"))
-	  machine.writeDot (cout);
-	else if (vm.count("token-info"))
-	  cout << machine.inputDescriptionTable();
-	else if (!vm.count("save-machine"))
-	  machine.write (cout);
+	} else if (vm.count("rate")) {
+	  // Output statistics
+	  const string symbols = string("01") + MachineEOF + machine.inputAlphabet (MachineControlInputFlag);
+	  const auto charBases = machine.expectedBasesPerInputSymbol (symbols.c_str(), builder.nThreads);
+	  vguard<string> cbstr;
+	  for (const auto& cb: charBases)
+	    cbstr.push_back (Machine::charToString(cb.first) + ": " + to_string(cb.second));
+	  cout << "Expected bases/symbol: { " << join(cbstr,", ") << " }" << endl;
+
+	} else {
+	  // Output the transducer
+	  if (vm.count("dot"))
+	    machine.writeDot (cout);
+	  else if (vm.count("token-info"))
+	    cout << machine.inputDescriptionTable();
+	  else if (!vm.count("save-machine"))
+	    machine.write (cout);
+	}
       }
     }
 
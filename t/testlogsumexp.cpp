@@ -0,0 +1,92 @@
+#include <iostream>
+#include <random>
+#include "../src/logsumexp.h"
+#include "../src/vguard.h"
+
+#define TestOK(EXPR) do { if (!(EXPR)) { cout << "Failed: "  #EXPR "\n"; ok = false; } } while (false)
+
+// reference implementations (library exp & log) for the approximations
+double refLogSumExp (const double* x, size_t n) {
+  double max = -numeric_limits<double>::infinity();
+  for (size_t i = 0; i < n; ++i)
+    max = x[i] > max ? x[i] : max;
+  if (std::isinf(max))
+    return max;
+  double sum = 0;
+  for (size_t i = 0; i < n; ++i)
+    sum += exp (x[i] - max);
+  return max + log (sum);
+}
+
+// log_sum_exp_unary is zero beyond the end of its table, so it can be off by up to log(1+exp(-LOG_SUM_EXP_LOOKUP_MAX))
+const double UnaryTolerance = 2e-7;
+const double BatchTolerance = 1e-11;
+
+bool close (double x, double y, double tol) {
+  return x == y || abs (x - y) <= tol * max (1., abs (y));
+}
+
+int main (int argc, char** argv) {
+  bool ok = true;
+  const double inf = numeric_limits<double>::infinity();
+
+  double maxUnaryErr = 0;
+  for (double x = 0; x < 20; x += .00037)
+    maxUnaryErr = max (maxUnaryErr, abs (log_sum_exp_unary(x) - log_sum_exp_unary_slow(x)));
+  TestOK (maxUnaryErr < UnaryTolerance);
+  TestOK (log_sum_exp_unary(0) == log(2.));
+  TestOK (log_sum_exp_unary(inf) == 0);
+
+  double maxExpErr = 0, maxLog1pErr = 0;
+  for (double x = -700; x <= 0; x += .0123)
+    maxExpErr = max (maxExpErr, abs (exp_nonpositive(x) / exp(x) - 1));
+  for (double y = 0; y <= 1; y += .0001)
+    maxLog1pErr = max (maxLog1pErr, abs (log1p_unit(y) - log1p(y)));
+  TestOK (maxExpErr < BatchTolerance);
+  TestOK (maxLog1pErr < BatchTolerance);
+  TestOK (close (exp_nonpositive(0), 1, BatchTolerance));
+  TestOK (exp_nonpositive(-inf) < 1e-300);
+
+  TestOK (log_sum_exp(-inf,-inf) == -inf);
+  TestOK (log_sum_exp_branchless(-inf,-inf) == -inf);
+  TestOK (log_sum_exp_branchless(-inf,-3) == -3);
+  TestOK (log_sum_exp_branchless(inf,-3) == inf);
+  TestOK (close (log_sum_exp_branchless(-2,-2), -2 + log(2.), BatchTolerance));
+  TestOK (log_sum_exp((const double*) NULL, 0) == -inf);
+  TestOK (log_sum_exp(-inf,-inf,-inf) == -inf);
+  TestOK (log_sum_exp(-inf,inf,-inf,0) == inf);
+
+  mt19937 gen (1);
+  uniform_real_distribution<double> logProb (-30, 0);
+  const size_t maxLen = 19;
+  for (size_t n = 0; n <= maxLen; ++n)
+    for (int trial = 0; trial < 100; ++trial) {
+      vguard<double> x (n), y (n), xy (n), acc (n);
+      for (size_t i = 0; i < n; ++i) {
+	x[i] = trial % 5 == 0 && i % 3 == 0 ? -inf : logProb(gen);
+	y[i] = trial % 7 == 0 && i % 2 == 0 ? -inf : logProb(gen);
+      }
+      // short sums are folded pairwise through the table, so each step can be off by up to UnaryTolerance
+      const double sumTolerance = n >= LOG_SUM_EXP_MIN_VECTOR_TERMS ? BatchTolerance : UnaryTolerance * n;
+      TestOK (close (log_sum_exp (x.data(), n), refLogSumExp (x.data(), n), sumTolerance));
+      log_sum_exp (x.data(), y.data(), xy.data(), n);
+      acc = x;
+      log_accum_exp (acc.data(), y.data(), n);
+      for (size_t i = 0; i < n; ++i) {
+	const double xyi[] = { x[i], y[i] };
+	const double ref = refLogSumExp (xyi, 2);
+	TestOK (close (log_sum_exp_branchless (x[i], y[i]), ref, BatchTolerance));
+	TestOK (close (log_sum_exp (x[i], y[i]), ref, UnaryTolerance));
+	TestOK (close (xy[i], ref, UnaryTolerance));
+	TestOK (acc[i] == xy[i]);
+      }
+      if (n >= 5) {
+	TestOK (close (log_sum_exp (x[0], x[1], x[2]), refLogSumExp (x.data(), 3), 2 * UnaryTolerance));
+	TestOK (close (log_sum_exp (x[0], x[1], x[2], x[3]), refLogSumExp (x.data(), 4), 3 * UnaryTolerance));
+	TestOK (close (log_sum_exp (x[0], x[1], x[2], x[3], x[4]), refLogSumExp (x.data(), 5), 4 * UnaryTolerance));
+      }
+    }
+
+  cout << (ok ? "ok: log-space arithmetic works" : "not ok: log-space arithmetic broken") << endl;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
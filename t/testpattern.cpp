@@ -3,6 +3,40 @@
 
 #define TestOK(EXPR) do { if (!(EXPR)) { cout << "Failed: "  #EXPR "\n"; ok = false; } } while (false)
 
+// reference implementations (base-by-base loops) for the word-level kernels
+Kmer refRevComp (Kmer kmer, Pos len) {
+  Kmer rc = 0;
+  for (Pos i = 1; i <= len; ++i)
+    rc = (rc << 2) | complementBase (getBase(kmer,i));
+  return rc;
+}
+
+bool refTandemRepeat (Kmer seq, Pos len, Pos maxRepeatLen) {
+  for (Pos repeatLen = 1; repeatLen <= maxRepeatLen; ++repeatLen)
+    for (Pos i = len - 2*repeatLen + 1; i >= 1; --i)
+      if (kmerSub (seq, i, repeatLen) == kmerSub (seq, i + repeatLen, repeatLen))
+	return true;
+  return false;
+}
+
+bool refLocalInvertedRepeat (Kmer seq, Pos len, Pos minRepeatLen, Pos maxRepeatLen) {
+  for (Pos repeatLen = minRepeatLen; repeatLen <= maxRepeatLen; ++repeatLen)
+    for (Pos i = len - 2*repeatLen + 1; i >= 1; --i)
+      if (refRevComp (kmerSub (seq, i, repeatLen), repeatLen) == kmerSub (seq, i + repeatLen, repeatLen))
+	return true;
+  return false;
+}
+
+bool refNonlocalInvertedRepeat (Kmer seq, Pos len, Pos repeatLen, Pos minSeparation) {
+  if (repeatLen <= 0)
+    return false;
+  for (Pos i = len - 2*repeatLen - minSeparation + 1; i >= 1; --i)
+    for (Pos j = len - repeatLen + 1; j >= i + repeatLen + minSeparation; --j)
+      if (refRevComp (kmerSub (seq, i, repeatLen), repeatLen) == kmerSub (seq, j, repeatLen))
+	return true;
+  return false;
+}
+
 int main (int argc, char** argv) {
   bool ok = true;
 
@@ -19,6 +53,59 @@ int main (int argc, char** argv) {
   TestOK (!hasExactNonlocalInvertedRepeat (stringToKmer("ACGTCGT"),7,3,2));
   TestOK (hasExactNonlocalInvertedRepeat (stringToKmer("ACGTTCGT"),8,3,2));
 
+  TestOK (hasExactTandemRepeatAtEnd(stringToKmer("ACGACG"),6,3));
+  TestOK (!hasExactTandemRepeatAtEnd(stringToKmer("ACGACGT"),7,3));
+  TestOK (hasExactLocalInvertedRepeatAtEnd(stringToKmer("ACGCGT"),6,3,4));
+  TestOK (!hasExactLocalInvertedRepeatAtEnd(stringToKmer("ACGCGTA"),7,3,4));
+  TestOK (hasExactNonlocalInvertedRepeatAtEnd (stringToKmer("ACGTTCGT"),8,3,2));
+  TestOK (!hasExactNonlocalInvertedRepeatAtEnd (stringToKmer("ACGTTCGTA"),9,3,2));
+
+  // a kmer has a repeat iff one of its prefixes ends with one
+  for (Pos len = 1; len <= 8; ++len)
+    for (Kmer kmer = 0; kmer <= kmerMask(len); ++kmer) {
+      bool tandem = false, local = false, nonlocal = false;
+      for (Pos prefixLen = 1; prefixLen <= len; ++prefixLen) {
+	const Kmer prefix = kmer >> ((len - prefixLen) << 1);
+	tandem = tandem || hasExactTandemRepeatAtEnd(prefix,prefixLen,len/2);
+	local = local || hasExactLocalInvertedRepeatAtEnd(prefix,prefixLen,2,len/2);
+	nonlocal = nonlocal || hasExactNonlocalInvertedRepeatAtEnd(prefix,prefixLen,3,2);
+      }
+      TestOK (tandem == hasExactTandemRepeat(kmer,len,len/2));
+      TestOK (local == hasExactLocalInvertedRepeat(kmer,len,2,len/2));
+      TestOK (nonlocal == hasExactNonlocalInvertedRepeat(kmer,len,3,2));
+    }
+
+  // word-level kernels agree with the reference loops
+  for (Pos len = 1; len <= 31; ++len)
+    for (Kmer kmer: { (Kmer) 0, (Kmer) 0x123456789abcdefULL, (Kmer) 0xfedcba987654321ULL, kmerMask(len) })
+      TestOK (kmerRevComp(kmer & kmerMask(len),len) == refRevComp(kmer,len));
+  for (Pos len = 1; len <= 9; ++len)
+    for (Kmer kmer = 0; kmer <= kmerMask(len); ++kmer) {
+      for (Pos maxRepeatLen = 1; maxRepeatLen <= len/2 + 1; ++maxRepeatLen) {
+	TestOK (hasExactTandemRepeat(kmer,len,maxRepeatLen) == refTandemRepeat(kmer,len,maxRepeatLen));
+	for (Pos minRepeatLen = 1; minRepeatLen <= maxRepeatLen; ++minRepeatLen)
+	  TestOK (hasExactLocalInvertedRepeat(kmer,len,minRepeatLen,maxRepeatLen) == refLocalInvertedRepeat(kmer,len,minRepeatLen,maxRepeatLen));
+      }
+      for (Pos repeatLen = 1; repeatLen <= 4; ++repeatLen)
+	for (Pos minSeparation = 0; minSeparation <= 3; ++minSeparation)
+	  TestOK (hasExactNonlocalInvertedRepeat(kmer,len,repeatLen,minSeparation) == refNonlocalInvertedRepeat(kmer,len,repeatLen,minSeparation));
+    }
+
+  // batched end tests agree with the one-at-a-time versions
+  for (Pos len = 1; len <= 9; ++len)
+    for (Kmer prefix = 0; prefix <= kmerMask(len-1); ++prefix) {
+      const Kmer ext[4] = { prefix << 2, (prefix << 2) | 1, (prefix << 2) | 2, (prefix << 2) | 3 };
+      bool tandem[4], local[4], nonlocal[4];
+      hasExactTandemRepeatAtEnd<4>(ext,len,len/2,tandem);
+      hasExactLocalInvertedRepeatAtEnd<4>(ext,len,2,len/2,local);
+      hasExactNonlocalInvertedRepeatAtEnd<4>(ext,len,3,2,nonlocal);
+      for (size_t n = 0; n < 4; ++n) {
+	TestOK (tandem[n] == hasExactTandemRepeatAtEnd(ext[n],len,len/2));
+	TestOK (local[n] == hasExactLocalInvertedRepeatAtEnd(ext[n],len,2,len/2));
+	TestOK (nonlocal[n] == hasExactNonlocalInvertedRepeatAtEnd(ext[n],len,3,2));
+      }
+    }
+
   cout << (ok ? "ok: pattern recognition works" : "not ok: pattern recognition broken. Email Hubertus.Bigend@BlueAnt.com") << endl;
 
   return EXIT_SUCCESS;